@@ -0,0 +1,503 @@
+/*
+Rem benchmark harness
+
+Builds the editor without main() and times the row primitives directly, so it
+runs without a TTY. Run with: make bench
+
+Every timing is the best of BENCH_REPEAT runs and has a key (its name and
+parameters). make bench compares them with bench/baseline.txt and fails if
+any got slower than its baseline by more than the threshold: BENCH_THRESHOLD
+times, or $REM_BENCH_THRESHOLD. A busy machine can slow any one timing down,
+so if some are over, the whole suite runs again and only those still over
+with the better of their two timings count. Baselines only mean something on
+the machine they were taken on, so take them again with make bench-baseline
+(which runs ./builds/bench --save bench/baseline.txt) before comparing
+changes.
+*/
+
+#define REM_NO_MAIN
+#include "../src/rem.c"
+
+#define BENCH_REPEAT 5
+#define BENCH_THRESHOLD 2.0
+#define BENCH_MAX 512  // Results and baseline entries
+
+struct benchResult {
+    char key[64];
+    double ns;
+};
+
+static struct benchResult benchResults[BENCH_MAX];
+static int benchNresults;
+static struct benchResult benchBaseline[BENCH_MAX];
+static int benchNbaseline;
+static double benchThreshold = BENCH_THRESHOLD;
+static int benchOver;     // Results over the threshold in this pass
+static int benchConfirm;  // Second pass: results keep the better of their two timings
+
+static double benchNow() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Reads "key ns" lines. A missing file just means there's nothing to compare with.
+static void benchLoadBaseline(const char *path) {
+    FILE *f = fopen(path, "r");
+    char line[128];
+
+    if (f == NULL) {
+        printf("No baseline in %s (make bench-baseline writes one)\n", path);
+        return;
+    }
+
+    while (fgets(line, sizeof(line), f) && benchNbaseline < BENCH_MAX) {
+        struct benchResult *b = &benchBaseline[benchNbaseline];
+
+        if (line[0] != '#' && sscanf(line, "%63s %lf", b->key, &b->ns) == 2) { benchNbaseline++; }
+    }
+
+    fclose(f);
+}
+
+static void benchSave(const char *path) {
+    FILE *f = fopen(path, "w");
+
+    if (f == NULL) {
+        perror(path);
+        exit(1);
+    }
+
+    fprintf(f, "# ns per operation, best of %d (make bench-baseline)\n", BENCH_REPEAT);
+
+    for (int i = 0; i < benchNresults; i++) { fprintf(f, "%s %.1f\n", benchResults[i].key, benchResults[i].ns); }
+
+    fclose(f);
+    printf("Baseline written to %s\n", path);
+}
+
+// Records a result and ends its line with how it compares to the baseline
+static void benchCheck(const char *key, double ns) {
+    int r;
+
+    for (r = 0; r < benchNresults && strcmp(benchResults[r].key, key); r++) {}
+
+    if (r == benchNresults && r < BENCH_MAX) {
+        snprintf(benchResults[r].key, sizeof(benchResults[0].key), "%s", key);
+        benchResults[benchNresults++].ns = ns;
+    } else if (r < benchNresults && (!benchConfirm || ns < benchResults[r].ns)) {
+        benchResults[r].ns = ns;
+    }
+
+    if (r < benchNresults) { ns = benchResults[r].ns; }
+
+    for (int i = 0; i < benchNbaseline; i++) {
+        if (strcmp(benchBaseline[i].key, key)) { continue; }
+
+        double ratio = ns / benchBaseline[i].ns;
+
+        if (ratio > benchThreshold) {
+            printf("  x%.2f  %s (baseline %.1f)\n", ratio, benchConfirm ? "REGRESSION" : "slower?", benchBaseline[i].ns);
+            benchOver++;
+        } else {
+            printf("  x%.2f\n", ratio);
+        }
+
+        return;
+    }
+
+    printf("\n");
+}
+
+// Fills a line of len bytes with a tab every tab_every bytes (0 for no tabs)
+static void benchLine(char *buf, int len, int tab_every) {
+    for (int i = 0; i < len; i++) {
+        buf[i] = "abcdefgh ij(kl);"[i % 16];
+
+        if (tab_every && i % tab_every == 0) { buf[i] = '\t'; }
+    }
+}
+
+// Fills a line of len bytes with C: keywords, numbers, a string and a comment
+static void benchCodeLine(char *buf, int len) {
+    static const char code[] = "\tif (count < 42) { return total + 0.5; } printf(\"%d\\n\", x); // done ";
+
+    for (int i = 0; i < len; i++) { buf[i] = code[i % (sizeof(code) - 1)]; }
+}
+
+// Per-line throughput of editorUpdateRow (tab expansion, no syntax)
+static void benchUpdateRow(int len, int tab_every) {
+    erow row;
+    memset(&row, 0, sizeof(row));
+
+    row.chars = malloc(len + 1);
+    row.size = len;
+    benchLine(row.chars, len, tab_every);
+
+    const char *tabs = tab_every ? (tab_every == 4 ? "dense" : "sparse") : "none";
+    int iters = 2000000 / BENCH_REPEAT / (len / 16 + 1);
+    double secs = 1e9;
+
+    for (int r = 0; r < BENCH_REPEAT; r++) {
+        double start = benchNow();
+
+        for (int i = 0; i < iters; i++) {
+            editorUpdateRow(&row);
+        }
+
+        double t = benchNow() - start;
+        if (t < secs) { secs = t; }
+    }
+
+    char key[64];
+    snprintf(key, sizeof(key), "%s/editorUpdateRow/len=%d/tabs=%s", remSimdLevel, len, tabs);
+
+    printf("  editorUpdateRow  len=%-5d tabs=%-7s %8.1f ns/line %8.1f MB/s", len, tabs,
+           secs * 1e9 / iters, (double) len * iters / secs / 1e6);
+    benchCheck(key, secs * 1e9 / iters);
+
+    editorFreeRow(&row);
+}
+
+// Control byte detection as done by editorDrawRows for each visible line
+static void benchFindCtrl(int len) {
+    char *buf = malloc(len);
+    benchLine(buf, len, 0);
+
+    int iters = 4000000 / BENCH_REPEAT / (len / 16 + 1);
+    long found = 0;
+    double secs = 1e9;
+
+    for (int r = 0; r < BENCH_REPEAT; r++) {
+        double start = benchNow();
+
+        for (int i = 0; i < iters; i++) {
+            found += remFindCtrl(buf, len);
+        }
+
+        double t = benchNow() - start;
+        if (t < secs) { secs = t; }
+    }
+
+    char key[64];
+    snprintf(key, sizeof(key), "%s/remFindCtrl/len=%d", remSimdLevel, len);
+
+    printf("  remFindCtrl      len=%-5d              %8.1f ns/line %8.1f MB/s (%ld)", len,
+           secs * 1e9 / iters, (double) len * iters / secs / 1e6, found / iters / BENCH_REPEAT);
+    benchCheck(key, secs * 1e9 / iters);
+
+    free(buf);
+}
+
+// Substring search as used by search and replace (no match, so the whole line is scanned)
+static void benchFindStr(int len) {
+    char *buf = malloc(len);
+    benchLine(buf, len, 0);
+
+    int iters = 4000000 / BENCH_REPEAT / (len / 16 + 1);
+    long found = 0;
+    double secs = 1e9;
+
+    for (int r = 0; r < BENCH_REPEAT; r++) {
+        double start = benchNow();
+
+        for (int i = 0; i < iters; i++) {
+            found += remFindStr(buf, len, "(kl)x", 5);
+        }
+
+        double t = benchNow() - start;
+        if (t < secs) { secs = t; }
+    }
+
+    char key[64];
+    snprintf(key, sizeof(key), "%s/remFindStr/len=%d", remSimdLevel, len);
+
+    printf("  remFindStr       len=%-5d              %8.1f ns/line %8.1f MB/s (%ld)", len,
+           secs * 1e9 / iters, (double) len * iters / secs / 1e6, found / iters / BENCH_REPEAT);
+    benchCheck(key, secs * 1e9 / iters);
+
+    free(buf);
+}
+
+/*
+Buffer benchmarks
+
+These run on the editor's own buffer: nrows rows of len bytes of C, all
+highlighted as if they'd been drawn, the way an open file is once it has been
+scrolled through.
+*/
+
+static void benchBuffer(int nrows, int len) {
+    char *buf = malloc(len + 1);
+
+    editorDelRows(0, EC.numrows);
+    EC.hl_valid = 0;
+    benchCodeLine(buf, len);
+
+    for (int r = 0; r < nrows; r++) { editorInsertRow(EC.numrows, buf, len); }
+    for (int r = 0; r < nrows; r++) { editorPrepareRow(&EC.row[r]); }
+
+    EC.dirty = 0;
+    free(buf);
+}
+
+// Prints and checks one buffer result: ns per operation, with the bytes it went through if any
+static void benchReport(const char *name, int nrows, int len, double ns, double bytes) {
+    char key[64];
+    snprintf(key, sizeof(key), "%s/rows=%d/len=%d", name, nrows, len);
+
+    printf("  %-26s rows=%-7d len=%-5d %10.1f ns/op", name, nrows, len, ns);
+
+    if (bytes) {
+        printf(" %8.1f MB/s", bytes / ns * 1e3);
+    } else {
+        printf("             ");
+    }
+
+    benchCheck(key, ns);
+}
+
+// Inserting rows in the middle of the buffer, then deleting them again
+static void benchInsertDelete(int nrows, int len) {
+    int ops = 200;
+    char *buf = malloc(len + 1);
+    double ins = 1e9, del = 1e9;
+
+    benchCodeLine(buf, len);
+
+    for (int r = 0; r < BENCH_REPEAT; r++) {
+        double start = benchNow();
+
+        for (int i = 0; i < ops; i++) { editorInsertRow(nrows / 2, buf, len); }
+
+        double t = benchNow() - start;
+        if (t < ins) { ins = t; }
+
+        start = benchNow();
+
+        for (int i = 0; i < ops; i++) { editorDelRow(nrows / 2); }
+
+        t = benchNow() - start;
+        if (t < del) { del = t; }
+    }
+
+    benchReport("editorInsertRow", nrows, len, ins * 1e9 / ops, 0);
+    benchReport("editorDelRow", nrows, len, del * 1e9 / ops, 0);
+    free(buf);
+}
+
+/*
+Highlighting a row in the middle of the buffer: first an edit that keeps the
+comment state (only the row is lexed again), then one that opens and closes a
+comment on the first row, which carries into every row below.
+*/
+static void benchUpdateSyntax(int nrows, int len) {
+    int ops = 20000 / (len / 16 + 1);
+    double row = 1e9, cascade = 1e9;
+    erow *mid = &EC.row[nrows / 2];
+    erow *first = &EC.row[0];
+    char saved[2] = {first->render[0], first->render[1]};
+
+    for (int r = 0; r < BENCH_REPEAT; r++) {
+        double start = benchNow();
+
+        for (int i = 0; i < ops; i++) { editorUpdateSyntax(mid); }
+
+        double t = benchNow() - start;
+        if (t < row) { row = t; }
+
+        // Only twice per run: each one goes through the whole buffer
+        // (rows are highlighted from their render, so that's what's edited)
+        start = benchNow();
+
+        first->render[0] = '/';
+        first->render[1] = '*';
+        editorUpdateSyntax(first);
+        first->render[0] = saved[0];
+        first->render[1] = saved[1];
+        editorUpdateSyntax(first);
+
+        t = benchNow() - start;
+        if (t < cascade) { cascade = t; }
+    }
+
+    benchReport("editorUpdateSyntax", nrows, len, row * 1e9 / ops, len);
+    benchReport("editorUpdateSyntax/cascade", nrows, len, cascade * 1e9 / 2, (double) nrows * len);
+}
+
+// Cursor position to screen column at the end of a row (tabs, then with multi-byte characters)
+static void benchXposToRx(int nrows, int len) {
+    int ops = 2000000 / (len / 16 + 1);
+    double ascii = 1e9, utf8 = 1e9;
+    erow *row = &EC.row[nrows / 2];
+    erow *wide = &EC.row[nrows / 2 + 1];
+    long total = 0;
+
+    // "é" in place of two bytes on a second row gives it a column table
+    editorRowOwn(wide);
+    wide->chars[1] = (char) 0xc3;
+    wide->chars[2] = (char) 0xa9;
+    editorUpdateRow(wide);
+
+    for (int r = 0; r < BENCH_REPEAT; r++) {
+        double start = benchNow();
+
+        for (int i = 0; i < ops; i++) { total += editorRowXposToRx(row, row->size); }
+
+        double t = benchNow() - start;
+        if (t < ascii) { ascii = t; }
+
+        start = benchNow();
+
+        for (int i = 0; i < ops; i++) { total += editorRowXposToRx(wide, wide->size); }
+
+        t = benchNow() - start;
+        if (t < utf8) { utf8 = t; }
+    }
+
+    // Keeps the loops from being optimized away
+    if (total == 0) { printf("  (no columns)\n"); }
+
+    benchReport("editorRowXposToRx", nrows, len, ascii * 1e9 / ops, len);
+    benchReport("editorRowXposToRx/utf8", nrows, len, utf8 * 1e9 / ops, len);
+}
+
+// Screen column back to cursor position near the end of a long row with a multi-byte character (every vertical move does this)
+static void benchRxToXpos(int len) {
+    int ops = 2000000 / (len / 16 + 1);
+    double secs = 1e9;
+    char *buf = malloc(len);
+    long total = 0;
+
+    benchLine(buf, len, 0);
+    buf[1] = (char) 0xc3;
+    buf[2] = (char) 0xa9;
+    editorInsertRow(EC.numrows, buf, len);
+    free(buf);
+
+    erow *row = &EC.row[EC.numrows - 1];
+    int rx = editorRowXposToRx(row, row->size) - 1;
+
+    for (int r = 0; r < BENCH_REPEAT; r++) {
+        double start = benchNow();
+
+        for (int i = 0; i < ops; i++) { total += editorRowRxToXpos(row, rx - (i & 7)); }
+
+        double t = benchNow() - start;
+        if (t < secs) { secs = t; }
+    }
+
+    // Keeps the loop from being optimized away
+    if (total == 0) { printf("  (no positions)\n"); }
+
+    benchReport("editorRowRxToXpos/utf8", 1, len, secs * 1e9 / ops, 0);
+}
+
+// The save path: measuring the buffer and writing it out (to /dev/null), per row
+static void benchWriteRows(int nrows, int len) {
+    int fd = open("/dev/null", O_WRONLY);
+    double measure = 1e9, write = 1e9;
+    size_t total = 0;
+
+    for (int r = 0; r < BENCH_REPEAT; r++) {
+        double start = benchNow();
+
+        total += editorRowsLength();
+
+        double t = benchNow() - start;
+        if (t < measure) { measure = t; }
+
+        start = benchNow();
+
+        if (editorWriteRows(fd) == -1) { perror("/dev/null"); }
+
+        t = benchNow() - start;
+        if (t < write) { write = t; }
+    }
+
+    close(fd);
+
+    if (total == 0) { printf("  (empty buffer)\n"); }
+
+    benchReport("editorRowsLength", nrows, len, measure * 1e9 / nrows, 0);
+    benchReport("editorWriteRows", nrows, len, write * 1e9 / nrows, len + 1);
+}
+
+static void benchAll() {
+    const char *levels[] = {"scalar", "sse2", "avx2"};
+    int lens[] = {16, 80, 256, 4096};
+    int row_lens[] = {16, 80, 256};
+    int row_counts[] = {1000, 100000};
+
+    for (unsigned int l = 0; l < sizeof(levels) / sizeof(levels[0]); l++) {
+        if (!simdSelect(levels[l])) { continue; }
+
+        printf("[%s]\n", remSimdLevel);
+
+        for (unsigned int n = 0; n < sizeof(lens) / sizeof(lens[0]); n++) {
+            benchUpdateRow(lens[n], 0);
+            benchUpdateRow(lens[n], 64);
+            benchUpdateRow(lens[n], 4);
+            benchFindCtrl(lens[n]);
+            benchFindStr(lens[n]);
+        }
+    }
+
+    // The buffer benchmarks run as the editor would, with the best kernels and C highlighting
+    simdInit();
+    EC.filename = "bench.c";
+    editorSetSyntaxHl();
+
+    printf("[buffer, %s]\n", remSimdLevel);
+
+    for (unsigned int c = 0; c < sizeof(row_counts) / sizeof(row_counts[0]); c++) {
+        for (unsigned int n = 0; n < sizeof(row_lens) / sizeof(row_lens[0]); n++) {
+            benchBuffer(row_counts[c], row_lens[n]);
+            benchInsertDelete(row_counts[c], row_lens[n]);
+            benchUpdateSyntax(row_counts[c], row_lens[n]);
+            benchXposToRx(row_counts[c], row_lens[n]);
+            benchWriteRows(row_counts[c], row_lens[n]);
+        }
+    }
+
+    benchRxToXpos(4096);
+
+    editorDelRows(0, EC.numrows);
+    EC.hl_valid = 0;
+}
+
+int main(int argc, char *argv[]) {
+    const char *save = NULL;
+
+    for (int a = 1; a + 1 < argc; a += 2) {
+        if (!strcmp(argv[a], "--baseline")) { benchLoadBaseline(argv[a + 1]); }
+        if (!strcmp(argv[a], "--save")) { save = argv[a + 1]; }
+    }
+
+    char *threshold = getenv("REM_BENCH_THRESHOLD");
+
+    if (threshold && atof(threshold) > 0) { benchThreshold = atof(threshold); }
+
+    EC.batch = 1;
+    initEditor();
+    syntaxLoadAll();
+
+    benchAll();
+
+    if (benchOver) {
+        printf("%d over x%.2f of the baseline, running again to confirm\n", benchOver, benchThreshold);
+
+        benchOver = 0;
+        benchConfirm = 1;
+        benchAll();
+    }
+
+    if (save) { benchSave(save); }
+
+    if (benchOver) {
+        printf("%d regression%s over x%.2f of the baseline\n", benchOver, benchOver == 1 ? "" : "s", benchThreshold);
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,401 @@
+/*
+Highlighter differential check
+
+Compares the highlighting rem produces against a reference highlighter on
+generated C and Python text, so a faster highlighter can't quietly change
+what's drawn. The reference is the original character-by-character
+highlighter rem had before the table-driven lexer: slow, but each rule is
+spelled out. Checked against it:
+
+    lexerRun       the DFA lexer, row by row
+    lexerRunState  the state-only pass used for rows that aren't drawn
+    editor         the editor's own paths: rows highlighted as they're drawn,
+                   then random edits (single rows, batches through
+                   editorUpdateRows, inserted and deleted rows)
+
+Every syntax definition for C and Python is checked (the built-in ones and
+those in syntax/). Runs without a TTY: make hlcheck, or ./builds/hlcheck
+[seed] [lines]. The first mismatch is printed with its row and column and
+the run fails.
+*/
+
+#define REM_NO_MAIN
+#include "../src/rem.c"
+
+static uint64_t checkSeed;
+
+static uint32_t checkRand() {
+    checkSeed ^= checkSeed << 13;
+    checkSeed ^= checkSeed >> 7;
+    checkSeed ^= checkSeed << 17;
+    return (uint32_t) (checkSeed >> 16);
+}
+
+static int checkIsKeyword(char **list, const char *s, int len) {
+    for (int k = 0; list && list[k]; k++) {
+        if ((int) strlen(list[k]) == len && !memcmp(list[k], s, len)) { return 1; }
+    }
+
+    return 0;
+}
+
+static int checkIsQuote(struct editorSyntax *syn, int c) {
+    return c != '\0' && strchr(syn->quotes ? syn->quotes : "\"'", c) != NULL;
+}
+
+/*
+Reference highlighter: highlights len bytes of s into hl, starting inside a
+multi-line comment if in_comment is set, and returns whether the row ends
+inside one. Keywords are matched where a word starts and must be followed by
+a separator (or the end of the row).
+*/
+static int refHighlight(struct editorSyntax *syn, const char *s, int len, unsigned char *hl, int in_comment) {
+    memset(hl, SYNTAX_HL_DEFAULT, len);
+
+    const char *scs = syn->singleline_comment_s;
+    const char *mcs = syn->multiline_comment_s;
+    const char *mce = syn->multiline_comment_e;
+
+    int scs_len = scs ? strlen(scs) : 0;
+    int mcs_len = mcs ? strlen(mcs) : 0;
+    int mce_len = mce ? strlen(mce) : 0;
+
+    if (mcs_len == 0 || mce_len == 0) {
+        mcs_len = mce_len = 0;
+        in_comment = 0;
+    }
+
+    int prev_seperator = 1;
+    int in_str = 0;
+    int i = 0;
+
+    while (i < len) {
+        unsigned char c = s[i];
+        unsigned char prev_hl = (i > 0) ? hl[i - 1] : SYNTAX_HL_DEFAULT;
+
+        if (scs_len && !in_str && !in_comment && i + scs_len <= len && !memcmp(&s[i], scs, scs_len)) {
+            memset(&hl[i], SYNTAX_HL_COMMENT, len - i);
+            break;
+        }
+
+        if (mcs_len && !in_str) {
+            if (in_comment) {
+                hl[i] = SYNTAX_HL_MULTI_COMMENT;
+
+                if (i + mce_len <= len && !memcmp(&s[i], mce, mce_len)) {
+                    memset(&hl[i], SYNTAX_HL_MULTI_COMMENT, mce_len);
+                    i += mce_len;
+                    in_comment = 0;
+                    prev_seperator = 1;
+                } else {
+                    i++;
+                }
+
+                continue;
+            } else if (i + mcs_len <= len && !memcmp(&s[i], mcs, mcs_len)) {
+                memset(&hl[i], SYNTAX_HL_MULTI_COMMENT, mcs_len);
+                i += mcs_len;
+                in_comment = 1;
+                continue;
+            }
+        }
+
+        if (syn->flags & HL_STRINGS) {
+            if (in_str) {
+                hl[i] = SYNTAX_HL_STR;
+
+                if (c == '\\' && i + 1 < len) {
+                    hl[i + 1] = SYNTAX_HL_STR;
+                    i += 2;
+                    continue;
+                }
+
+                if (c == in_str) { in_str = 0; }
+
+                i++;
+                prev_seperator = 1;
+                continue;
+            } else if (checkIsQuote(syn, c)) {
+                in_str = c;
+                hl[i] = SYNTAX_HL_STR;
+                i++;
+                continue;
+            }
+        }
+
+        if (syn->flags & HL_NUMBERS) {
+            if ((isdigit(c) && (prev_seperator || prev_hl == SYNTAX_HL_NUM)) || (c == '.' && prev_hl == SYNTAX_HL_NUM)) {
+                hl[i] = SYNTAX_HL_NUM;
+                i++;
+                prev_seperator = 0;
+                continue;
+            }
+        }
+
+        if (prev_seperator) {
+            // The word runs up to the next separator (which may be the end of the row)
+            int end = i;
+
+            while (end < len && !is_seperator((unsigned char) s[end])) { end++; }
+
+            int kind = checkIsKeyword(syn->keywords, &s[i], end - i) ? SYNTAX_HL_KEYWORD1 :
+                       checkIsKeyword(syn->keywords2, &s[i], end - i) ? SYNTAX_HL_KEYWORD2 : 0;
+
+            if (kind) {
+                memset(&hl[i], kind, end - i);
+                i = end;
+                prev_seperator = 0;
+                continue;
+            }
+        }
+
+        prev_seperator = is_seperator(c);
+        i++;
+    }
+
+    return in_comment;
+}
+
+// Pieces lines are made of: keywords, near misses, numbers, strings, comment delimiters, tabs and UTF-8
+static const char *checkPieces[] = {
+    "int", "intx", "in", "if", "for", "fork", "def", "None", "True", "False", "false", "self", "print", "printf",
+    "return", "__init__", "NULL", "x", "count_2", "é", "名前", "0", "42", "3.14", "1.2.3", "0x1f", "7.", "x1",
+    "\"", "'", "\"str\"", "'c'", "\"a\\\"b\"", "'\\''", "\\", "\"unterminated", "`",
+    "//", "/*", "*/", "/", "*", "#", "# note", "/* c */", "*/x", "/**/", "///",
+    " ", " ", " ", "\t", "(", ")", "[", "];", ",", ".", "+", "-", "=", "<", ">", "~", "%", ";", "{", "}", ":", "!",
+};
+
+#define CHECK_PIECES (sizeof(checkPieces) / sizeof(checkPieces[0]))
+
+static int checkLine(char *buf, int max) {
+    int len = 0;
+    int pieces = checkRand() % 16;
+
+    // Some rows are long, with the same tokens
+    if (checkRand() % 64 == 0) { pieces *= 40; }
+
+    for (int p = 0; p < pieces; p++) {
+        const char *piece = checkPieces[checkRand() % CHECK_PIECES];
+        int n = strlen(piece);
+
+        if (len + n > max) { break; }
+
+        memcpy(buf + len, piece, n);
+        len += n;
+    }
+
+    return len;
+}
+
+static const char *checkClasses = ".cmkKsnq";
+
+static void checkShowHl(const char *label, const unsigned char *hl, int len) {
+    printf("    %-9s ", label);
+
+    for (int i = 0; i < len; i++) { putchar(hl[i] < 8 ? checkClasses[hl[i]] : '?'); }
+
+    putchar('\n');
+}
+
+// Prints the first difference between expected and actual highlighting of a row. Returns 1 if they differ.
+static int checkRow(const char *what, struct editorSyntax *syn, int row, const char *s, int len,
+                    const unsigned char *want, const unsigned char *got, int want_state, int got_state) {
+    int col = 0;
+
+    while (col < len && want[col] == got[col]) { col++; }
+
+    if (col == len && want_state == got_state) { return 0; }
+
+    printf("MISMATCH %s (%s): row %d, ", what, syn->filetype, row);
+
+    if (col < len) {
+        printf("column %d\n", col);
+    } else {
+        printf("ends %s a multi-line comment (reference: %s)\n", got_state ? "in" : "out of", want_state ? "in" : "out of");
+    }
+
+    printf("    %-9s %.*s\n", "text", len, s);
+    checkShowHl("reference", want, len);
+    checkShowHl("got", got, len);
+    printf("    (classes: %s = default comment multi-comment keyword1 keyword2 string number match)\n", checkClasses);
+
+    return 1;
+}
+
+// The lexer alone, on lines passed straight to it
+static int checkLexer(struct editorSyntax *syn, int lines) {
+    char *buf = malloc(1 << 16);
+    unsigned char *want = malloc(1 << 16);
+    unsigned char *got = malloc(1 << 16);
+    int state = 0, failed = 0;
+    int multi = syn->multiline_comment_s && syn->multiline_comment_s[0] && syn->multiline_comment_e && syn->multiline_comment_e[0];
+
+    for (int r = 0; r < lines && !failed; r++) {
+        int len = checkLine(buf, 1 << 16);
+
+        // Now and then the row starts in a comment regardless of the row above
+        if (multi && checkRand() % 16 == 0) { state = checkRand() & 1; }
+
+        int want_state = refHighlight(syn, buf, len, want, state);
+        int got_state = lexerRun(syn->lexer, buf, len, got, state);
+
+        failed = checkRow("lexerRun", syn, r, buf, len, want, got, want_state, got_state);
+
+        if (!failed) {
+            got_state = lexerRunState(syn->lexer, buf, len, state);
+            failed = checkRow("lexerRunState", syn, r, buf, len, want, want, want_state, got_state);
+        }
+
+        state = want_state;
+    }
+
+    free(buf);
+    free(want);
+    free(got);
+
+    return failed;
+}
+
+// Compares every row of the buffer with the reference, drawing rows that haven't been yet
+static int checkBuffer(struct editorSyntax *syn, const char *when) {
+    static unsigned char *want = NULL;
+    static int cap = 0;
+    int state = 0;
+
+    for (int r = 0; r < EC.numrows; r++) {
+        erow *row = &EC.row[r];
+
+        editorPrepareRow(row);
+
+        if (row->rsize > cap) {
+            cap = row->rsize * 2;
+            want = realloc(want, cap);
+        }
+
+        state = refHighlight(syn, row->render, row->rsize, want, state);
+
+        if (checkRow(when, syn, r, row->render, row->rsize, want, row->syntax_hl, state, row->multi_syntax_hl)) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static void checkClearBuffer() {
+    editorDelRows(0, EC.numrows);
+    EC.hl_valid = 0;
+    EC.dirty = 0;
+}
+
+// The editor's paths: a buffer highlighted as it's drawn, then edited at random
+static int checkEditor(struct editorSyntax *syn, int lines) {
+    char *buf = malloc(1 << 16);
+
+    checkClearBuffer();
+    EC.syntax = syn;
+
+    for (int r = 0; r < lines; r++) {
+        int len = checkLine(buf, 1 << 16);
+        editorInsertRow(EC.numrows, buf, len);
+    }
+
+    int failed = checkBuffer(syn, "editor (first draw)");
+    int edits = lines / 4;
+
+    for (int e = 0; e < edits && !failed; e++) {
+        int at = checkRand() % EC.numrows;
+        erow *row = &EC.row[at];
+        const char *piece = checkPieces[checkRand() % CHECK_PIECES];
+
+        switch (checkRand() % 6) {
+            case 0:
+                editorRowInsertChar(row, checkRand() % (row->size + 1), piece[0]);
+                break;
+            case 1:
+                if (row->size) { editorRowDelChar(row, checkRand() % row->size); }
+                break;
+            case 2:
+                editorInsertRow(at, buf, checkLine(buf, 1 << 16));
+                break;
+            case 3:
+                if (EC.numrows > 1) { editorDelRow(at); }
+                break;
+            case 4:
+                {
+                    // A few rows edited together, as with several cursors
+                    int rows[8];
+                    int n = 0;
+
+                    for (int r = at; r < EC.numrows && n < 8; r += 1 + checkRand() % 3) {
+                        editorRowInsertByte(&EC.row[r], checkRand() % (EC.row[r].size + 1), piece[0]);
+                        rows[n++] = r;
+                    }
+
+                    editorUpdateRows(rows, n);
+                    break;
+                }
+            case 5:
+                // Rows far from the view lose their highlighting, and are lexed state-only until drawn again
+                for (int r = at; r < EC.numrows && r < at + 64; r++) { editorColdRow(&EC.row[r]); }
+                break;
+        }
+
+        if (e % 64 == 63 || e == edits - 1) { failed = checkBuffer(syn, "editor (after edits)"); }
+    }
+
+    checkClearBuffer();
+    EC.syntax = NULL;
+    free(buf);
+
+    return failed;
+}
+
+int main(int argc, char *argv[]) {
+    uint64_t seed = (argc > 1) ? strtoull(argv[1], NULL, 0) : 0x5eed;
+    int lines = (argc > 2) ? atoi(argv[2]) : 20000;
+    struct editorSyntax *defs[8];
+    int ndefs = 0;
+
+    EC.batch = 1;
+    initEditor();
+
+    // The built-in definitions, then the ones loaded from files (which replace them in SyntaxTable)
+    for (unsigned int e = 0; e < SYNTAXDB_ENTRIES; e++) { defs[ndefs++] = &SyntaxDB[e]; }
+
+    syntaxLoadAll();
+
+    for (int e = 0; e < SyntaxTableLen && ndefs < 8; e++) {
+        struct editorSyntax *s = SyntaxTable[e];
+
+        if (!syntaxIsBuiltin(s) && (!strcmp(s->filetype, "c") || !strcmp(s->filetype, "py"))) { defs[ndefs++] = s; }
+    }
+
+    int failed = 0;
+
+    for (int d = 0; d < ndefs && !failed; d++) {
+        struct editorSyntax *syn = defs[d];
+
+        if (syn->lexer == NULL) { syn->lexer = lexerCompile(syn); }
+
+        if (syn->lexer == NULL) {
+            printf("%s: the lexer can't represent this definition\n", syn->filetype);
+            failed = 1;
+            break;
+        }
+
+        checkSeed = seed * 2 + 1 + d;
+
+        printf("%-2s (%s, %d states): ", syn->filetype, syntaxIsBuiltin(syn) ? "built in" : "file", syn->lexer->nstates);
+        fflush(stdout);
+
+        failed = checkLexer(syn, lines);
+
+        if (!failed) { failed = checkEditor(syn, lines / 4); }
+        if (!failed) { printf("%d lines match\n", lines + lines / 4); }
+    }
+
+    if (failed) { printf("Differential check failed (seed %llu)\n", (unsigned long long) seed); }
+
+    return failed;
+}
@@ -12,24 +12,68 @@
 #include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
 #include <sys/types.h>
+#include <sys/wait.h>
 #include <termios.h>
 #include <time.h>
 #include <unistd.h>
 
+#include "utils/simd.h"
+#include "utils/parallel.h"
+#include "utils/fenwick.h"
+#include "utils/utf8.h"
 #include "utils/syntax_hl.h"
+#include "utils/lexer.h"
+#include "utils/syntax_load.h"
+#include "utils/brackets.h"
+#include "utils/folds.h"
+#include "utils/words.h"
+#include "utils/memstat.h"
+#include "utils/lz.h"
+#include "utils/hexview.h"
+#include "utils/grep.h"
+#include "utils/linecache.h"
+#include "utils/inflate.h"
+#include "utils/unzstd.h"
+#include "utils/zipstream.h"
+#include "utils/journal.h"
 #include "utils/bindings.h"
+#include "utils/script.h"
+#include "utils/server.h"
 
 #define CTRL_KEY(k) ((k) & 0x1f)
 #define VERSION "1.2.37"
 #define TAB_STOP 4
 #define QUIT_TIMES 1
 #define DEFAULT_MSG "^X: Exit | ^S: Save | ^Q: Query"
+#define FRAME_MAX_MS 250
+#define UNDO_LEVELS 100
+#define MEMORY_BUDGET_MB 256  // Default for $REM_MEMORY_BUDGET (at most half the cgroup's memory limit)
+#define MEMORY_DUMP "rem-memory.txt"  // Where ^T ^T writes the breakdown by default
+#define PACK_BLOCK 65536       // Bytes of row text packed together
+#define PACK_MARGIN 4096       // Rows either side of the view that are never packed
+#define SAVE_CHUNK (1 << 20)   // Bytes buffered between writes when saving
+#define SAVE_PATCH_SHARE 4     // Saves patch the file in place while at most 1/4 of it changed
+#define WORDS_SCAN_ROWS 16384  // Rows the background scan indexes words of at a time
+#define COMPLETE_MAX 16        // Completions ^N cycles through
+#define ZIP_POLL_MS 50         // How often rows are taken from a compressed file while it's decompressed
+#define SERVER_BUFFERS 8       // Files a server keeps open (the least recently attached one is closed)
+
+// A run of render bytes drawn in one color (-1 is the terminal default)
+struct hlspan {
+    int start;
+    int len;
+    int color;
+};
 
 typedef struct erow {
     int idx;
@@ -39,8 +83,82 @@ typedef struct erow {
     char *render;
     unsigned char *syntax_hl;
     int multi_syntax_hl;
+    int packed; // Packed block holding the text + 1 (chars is NULL meanwhile), 0 if it isn't packed
+    struct hlspan *spans;
+    int nspans;
+    int packoff; // Where the text starts in its block
+    int *cols;  // Display column of each render byte (+ one past the end), NULL for ASCII rows
+    int *xcols; // Display column of each byte of chars (+ one past the end), built with cols
+    int rcols;  // Display width of the row
+    int bsum;   // Bracket depth change over the row
+    int bmin;   // Lowest bracket depth in the row relative to its start, or BRACKET_UNKNOWN
+    int vlines; // Screen lines the row takes with soft wrap on, 0 until worked out
+    uint32_t *words; // Ids of the words indexed from the row (see utils/words.h), NULL until it's indexed
 } erow;
 
+// Edits recorded in the swap file
+enum editorJournalOp {
+    JOURNAL_INSERT = 1,  // Bytes typed at row, col
+    JOURNAL_NEWLINE,     // Enter at row, col
+    JOURNAL_DELETE,      // Backspace at row, col
+    JOURNAL_REPLACE,     // Replace all: col bytes of query, then the replacement
+    JOURNAL_UNDO,
+    JOURNAL_MULTI,       // One key at every cursor: col is the key, data the cursors (primary first)
+    JOURNAL_CUT,         // Text from row, col to the row and col in data removed
+    JOURNAL_PASTE        // Lines (joined by '\n') pasted at row, col
+};
+
+// Rows [at, at + old_n) were replaced by new_n rows; the old rows are kept from lines[line]
+struct undoStep {
+    int at;
+    int old_n;
+    int new_n;
+    int line;
+};
+
+struct undoLine {
+    char *chars;
+    int size;
+};
+
+// Everything one undo (^Z) reverts
+struct undoBatch {
+    struct undoStep *steps;
+    int nsteps, capsteps;
+    struct undoLine *lines;
+    int nlines, caplines;
+    int xpos, ypos;  // Cursor before the batch
+    int typing;      // Further typing in rows the batch covers merges into it
+    int multi;       // Keys typed at the same cursors merge into it
+};
+
+struct editorCursor {
+    int xpos, ypos;
+};
+
+// Immutable text rows and the clipboard can share (freed with its last reference)
+struct textBlock {
+    char *data;
+    size_t len;
+    int refs;
+};
+
+// LZ compressed text of rows far from the view, or a compressed file's rows (freed with the last of them)
+struct packBlock {
+    char *data;     // For a compressed file's rows: their text, NULL once it's dropped
+    int zlen;       // Bytes data takes
+    int len;
+    int rows;
+    int64_t zoff;   // Where a compressed file's rows start in it decompressed, -1 for LZ blocks
+};
+
+// Holds the last block unpacked, so its neighbouring rows don't decompress it again
+struct packCache {
+    int block;  // -1 if empty
+    char *text;
+    int cap;
+};
+
 struct editorConfig {
     int xpos, ypos;
     int rx;
@@ -56,18 +174,109 @@ struct editorConfig {
     time_t statusmsg_time;
     struct editorSyntax *syntax;
     struct termios prev_terminal_state;
+    uint64_t *shadow;  // Hash of each screen line as last sent to the terminal
+    int shadow_rows;
+    int frame_ms;      // Minimum time between frames, grows when output backs up
+    struct undoBatch *undo;
+    int nundo;
+    char *text;        // Mapped file contents unedited rows point into
+    size_t textlen;
+    int text_mapped;
+    int text_layout;   // Rows still sit where they are in the file on disk
+    int hl_valid;      // Rows before this one have an up to date multi_syntax_hl
+    struct stat file_st;
+    uint64_t file_fingerprint;
+    int cache_pending; // Write the line cache once every row's state is known
+    struct journal *journal;
+    int journal_off;   // Don't record edits (while replaying, or after the swap file failed)
+    struct fenwick lineidx;  // Byte length of each row plus its newline, built on first use
+    int lineidx_valid;
+    struct editorCursor *cursors;  // Cursors besides xpos/ypos, by row (at most one per row)
+    int ncursors;
+    int cursor_rx;     // Display column new cursors are added at
+    int sel_active;    // The selection runs from sel_x/sel_y to the cursor
+    int sel_x, sel_y;
+    struct undoLine *clip;  // Clipboard lines, all pointing into shared text
+    int nclip;
+    struct textBlock *blocks;  // Sorted by address
+    int nblocks;
+    struct bracketIndex brackets;  // Built on first use
+    int brackets_valid;
+    int brackets_scan; // Rows before this one have been summarised in the background
+    int lex_parallel;  // Rows are being lexed by worker threads
+    struct foldTree folds;  // Closed folds; rowoff counts visual rows, skipping what they hide
+    int wrap;          // Soft wrap: long rows continue on the next screen lines
+    int wrap_cols;     // Width the rows' vlines were worked out for
+    struct fenwick wrapidx;  // Screen lines of each row (0 inside closed folds), built on first use
+    int wrapidx_valid;
+    volatile sig_atomic_t resized;  // Set by SIGWINCH, handled before the next frame
+    struct packBlock *packs;  // By id; rows hold id + 1
+    int npacks;
+    int *pack_spare;   // Ids of freed blocks
+    int nspare;
+    struct packCache pack_cache;
+    size_t packed_bytes;
+    size_t mem_budget; // Heap to keep to before evicting derived data and packing cold rows
+    size_t mem_rows;   // What that came to when last measured
+    size_t mem_grown;  // Roughly how much has been made resident since
+    int trim_phase;    // 0: idle, 1: measuring, 2: dropping derived data, 3: packing
+    int trim_row, trim_lo, trim_hi;
+    long long trim_total;
+    int batch;         // Headless: keys come from batch_keys and nothing is drawn
+    int *batch_keys;
+    int batch_len, batch_pos;
+    int hex;           // Binary file shown read-only in hex, straight from text (there are no rows)
+    size_t hex_cur;    // Byte the cursor is on
+    size_t hex_top;    // Line shown at the top of the screen
+    struct grepSearch *grep;  // Last project search
+    int grep_view;     // Its hits are shown instead of the file
+    int grep_sel, grep_top;
+    int grep_drawn;    // Hits (times 2, plus 1 once done) when the list was last drawn
+    struct wordIndex words;  // Words of the rows before words_scan, for completion
+    int words_scan;    // Rows before this one have been indexed in the background
+    char complete_words[COMPLETE_MAX][WORDS_MAX_LEN + 1];  // Candidates the last ^N found
+    int complete_n, complete_at;  // How many, and the one inserted
+    int complete_row, complete_x; // Where the cursor was left after inserting it
+    int complete_prefix, complete_len;  // Bytes typed before it, and bytes it added
+    int words_off;     // The word index was dropped to stay within the memory budget
+    size_t frame_bytes;  // Buffers the last frame was built in
+    int mem_shown;     // The memory summary is in the status bar (^T again dumps it)
+    struct zipStream *zip;  // The file is compressed: shown read-only, rows packed in blocks of what it decompresses to
+    int zip_done;      // 1 once every row is in, -1 if the data turned out damaged
+    int zip_shown;     // Progress (percent) when the status bar was last drawn
 };
 
 struct editorConfig EC;
 
+// The client a server draws for (see Server mode). Not part of EC, which is swapped for each file.
+struct serverSession {
+    int attached;      // fd 0 and 1 are the client's socket
+    int detached;      // The client quit or hung up: the session ends
+    int rows, cols;    // The client's terminal size
+    struct editorConfig *bufs[SERVER_BUFFERS - 1];  // Files kept open besides EC, least recently attached first
+    int nbufs;
+};
+
+struct serverSession SS;
+
 void editorSetStatusMessage(const char *fmt, ...);
 void editorRefreshScreen();
-char *editorPrompt(char *prompt, void (*callback)(char *, int));
+void editorOnResize(int sig);
+void editorPrepareRow(erow *row);
+void editorRowUnpack(erow *row);
+const char *editorRowText(erow *row, struct packCache *c);
+int editorStepRow(int at, int dir);
+void editorJumpRow(int at);
+void editorInvalidateScreen();
+char *editorPrompt(char *prompt, void (*callback)(char *, int), int allow_empty);
+void editorDetach();
 
 // Destroys processes once they're complete or enter an error state
 void destroy(const char *e) {
-    write(STDOUT_FILENO, "\x1b[2J", 4);
-    write(STDOUT_FILENO, "\x1b[H", 3);
+    if (!EC.batch) {
+        write(STDOUT_FILENO, "\x1b[2J", 4);
+        write(STDOUT_FILENO, "\x1b[H", 3);
+    }
 
     perror(e);
     exit(1);
@@ -103,34 +312,111 @@ void enableRawMode() {
     }
 }
 
+// Reads a byte of input like read() on the raw terminal: 0 if none came within a tenth of a second
+static int editorReadByte(void *c) {
+    if (!SS.attached) { return read(STDIN_FILENO, c, 1); }
+
+    // A socket has no VTIME, so wait the same tenth of a second for it
+    struct pollfd fd = {STDIN_FILENO, POLLIN, 0};
+
+    if (poll(&fd, 1, 100) <= 0) { return 0; }
+
+    int n = read(STDIN_FILENO, c, 1);
+
+    if (n <= 0) { SS.detached = 1; }
+
+    return n > 0 ? n : 0;
+}
+
+// Reads the rest of a client's size report (ESC [ 8 ; rows ; cols t). Returns ^L, which only redraws.
+static int editorReadSizeReport() {
+    int size[2] = {0, 0}, k = 0;
+    char c;
+
+    while (editorReadByte(&c) == 1 && c != 't') {
+        if (c == ';' && k == 0) {
+            k = 1;
+        } else if (c >= '0' && c <= '9' && size[k] < 100000) {
+            size[k] = size[k] * 10 + c - '0';
+        } else {
+            break;
+        }
+    }
+
+    if (size[0] > 0 && size[1] > 0) {
+        SS.rows = size[0];
+        SS.cols = size[1];
+        EC.resized = 1;
+    }
+
+    return CTRL_KEY('l');
+}
+
 int editorReadKey() {
     int key_read;
-    char i; // i = User input
+    unsigned char i; // i = User input
+
+    if (EC.batch) {
+        // Past the end of the script, Esc backs out of any prompt left open
+        return EC.batch_pos < EC.batch_len ? EC.batch_keys[EC.batch_pos++] : '\x1b';
+    }
+
+    // Likewise once a client has hung up, until the session ends
+    if (SS.detached) { return '\x1b'; }
 
-    while ((key_read = read(STDIN_FILENO, &i, 1)) != 1) {
+    while ((key_read = editorReadByte(&i)) != 1) {
         if (key_read == -1 && errno == EAGAIN) {
             destroy("read");
         }
+
+        if (SS.detached) { return '\x1b'; }
+
+        // Resized while waiting (in a prompt): redraw without waiting for the key
+        if (EC.resized) { editorRefreshScreen(); }
     }
 
     if (i == '\x1b') {
         char seq[3];
 
-        if (read(STDIN_FILENO, &seq[0], 1) != 1) {
+        if (editorReadByte(&seq[0]) != 1) {
             return '\x1b';
         }
 
-        if (read(STDIN_FILENO, &seq[1], 1) != 1) {
+        if (editorReadByte(&seq[1]) != 1) {
             return '\x1b';
         }
 
         if (seq[0] == '[') {
             if (seq[1] >= '0' && seq[1] <= '9') { 
-                if (read(STDIN_FILENO, &seq[2], 1) != 1) {
+                if (editorReadByte(&seq[2]) != 1) {
                     return '\x1b';
                 }
 
-                if (seq[2] == '$') {
+                if (SS.attached && seq[1] == '8' && seq[2] == ';') { return editorReadSizeReport(); }
+
+                // Keys with modifiers: ESC [ 1 ; <modifier> <key> (2 is Shift)
+                if (seq[2] == ';') {
+                    if (editorReadByte(&seq[0]) != 1 || editorReadByte(&seq[2]) != 1) {
+                        return '\x1b';
+                    }
+
+                    if (seq[2] == 'H') { return FILE_START; }
+                    if (seq[2] == 'F') { return FILE_END; }
+
+                    if (seq[0] == '2') {
+                        switch (seq[2]) {
+                            case 'A': return SELECT_UP;
+                            case 'B': return SELECT_DOWN;
+                            case 'C': return SELECT_RIGHT;
+                            case 'D': return SELECT_LEFT;
+                        }
+                    }
+
+                    if (seq[2] == 'A') { return ADD_CURSOR_UP; }
+                    if (seq[2] == 'B') { return ADD_CURSOR_DOWN; }
+                }
+
+                if (seq[2] == '~' || seq[2] == '$') {
                     switch (seq[1]) {
                         case '1': return HOME_KEY;
                         case '3': return DEL_KEY;
@@ -196,6 +482,13 @@ int getCursorPos(int *rows, int *cols) {
 int getWindowSize(int *rows, int *cols) {
     struct winsize w;
 
+    // A client's terminal is at the other end of a socket: it reports its size
+    if (SS.attached) {
+        *rows = SS.rows;
+        *cols = SS.cols;
+        return 0;
+    }
+
     if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &w) == -1 || w.ws_col == 0) {
         if (write(STDOUT_FILENO, "\x1b[999C\x1b[999B", 12) != 12) { return -1; }
         return getCursorPos(rows, cols);
@@ -206,169 +499,212 @@ int getWindowSize(int *rows, int *cols) {
     }
 }
 
-int is_seperator(int c) {
-    return isspace(c) || c == '\0' || strchr(",.()+-/*=~%<>[];", c) != NULL;
+static int editorSpanColor(int syntax_hl) {
+    return (syntax_hl == SYNTAX_HL_DEFAULT) ? -1 : editorSyntaxToColor(syntax_hl);
 }
 
-void editorUpdateSyntax(erow *row) {
+// Collapses syntax_hl into runs of equal color for editorDrawRow
+void editorUpdateSpans(erow *row) {
+    int n = 0;
+    int prev = -2;
+
+    for (int i = 0; i < row->rsize; i++) {
+        int color = editorSpanColor(row->syntax_hl[i]);
+
+        if (color != prev) {
+            n++;
+            prev = color;
+        }
+    }
+
+    free(row->spans);
+    row->spans = malloc(sizeof(struct hlspan) * (n ? n : 1));
+    row->nspans = 0;
+    prev = -2;
+
+    for (int i = 0; i < row->rsize; i++) {
+        int color = editorSpanColor(row->syntax_hl[i]);
+
+        if (color != prev) {
+            row->spans[row->nspans].start = i;
+            row->spans[row->nspans].len = 0;
+            row->spans[row->nspans].color = color;
+            row->nspans++;
+            prev = color;
+        }
+
+        row->spans[row->nspans - 1].len++;
+    }
+}
+
+// Tells the bracket index a row's summary changed (worker threads leave that to their caller)
+static void editorBracketsNote(erow *row) {
+    if (EC.brackets_valid && !EC.lex_parallel) { bracketTouch(&EC.brackets, row->idx / BRACKET_BLOCK); }
+}
+
+// Highlights one row starting in state in_comment. Returns the state it ends in.
+static int editorLexRow(erow *row, int in_comment) {
     row->syntax_hl = realloc(row->syntax_hl, row->rsize);
-    memset(row->syntax_hl, SYNTAX_HL_DEFAULT, row->rsize);
 
-    if (EC.syntax == NULL) { return; }
+    if (EC.syntax == NULL) {
+        memset(row->syntax_hl, SYNTAX_HL_DEFAULT, row->rsize);
+        in_comment = 0;
+    } else {
+        in_comment = lexerRun(EC.syntax->lexer, row->render, row->rsize, row->syntax_hl, in_comment);
+    }
 
-    char **keywords = EC.syntax->keywords;
+    editorUpdateSpans(row);
+    bracketScan(row->render, row->syntax_hl, row->rsize, &row->bsum, &row->bmin);
+    editorBracketsNote(row);
 
-    char *scs = EC.syntax->singleline_comment_s;
-    char *mcs = EC.syntax->multiline_comment_s;
-    char *mce = EC.syntax->multiline_comment_e;
+    return in_comment;
+}
 
-    int scs_len = scs ? strlen(scs) : 0;
-    int mcs_len = mcs ? strlen(mcs) : 0;
-    int mce_len = mce ? strlen(mce) : 0;
+// Lexes a row that has been drawn, or just tracks the state of one that hasn't
+static int editorRowLex(erow *row, int in_comment) {
+    if (row->render) { return editorLexRow(row, in_comment); }
 
-    int prev_seperator = 1;
-    int in_str = 0;
-    int in_comment = (row->idx > 0 && EC.row[row->idx - 1].multi_syntax_hl);
-    
-    int i = 0;
+    // Its brackets are counted again when the index needs them
+    row->bmin = BRACKET_UNKNOWN;
+    editorBracketsNote(row);
 
-    while (i < row->rsize) {
-        char c = row->render[i];
-        unsigned char prev_syntax_hl = (i > 0) ? row->syntax_hl[i - 1] : SYNTAX_HL_DEFAULT;
+    if (EC.syntax == NULL) { return 0; }
 
-        if (scs_len && !in_str && !in_comment) {
-            if (!strncmp(&row->render[i], scs, scs_len)) {
-                memset(&row->syntax_hl[i], SYNTAX_HL_COMMENT, row->rsize - i);
-                break;
-            }
-        }
+    // Tabs only differ from their expansion in width, so the raw text ends in the same state
+    // (rows lexed by worker threads have just been edited, so they're never packed)
+    return lexerRunState(EC.syntax->lexer, editorRowText(row, &EC.pack_cache), row->size, in_comment);
+}
 
-        if (mcs_len && mce_len && !in_str) {
-            if (in_comment) {
-                row->syntax_hl[i] = SYNTAX_HL_MULTI_COMMENT;
+// Works out multi_syntax_hl for every row up to and including row to
+void editorHlAdvance(int to) {
+    while (EC.hl_valid <= to && EC.hl_valid < EC.numrows) {
+        erow *row = &EC.row[EC.hl_valid];
 
-                if (!strncmp(&row->render[i], mce, mce_len)) {
-                    memset(&row->syntax_hl[i], SYNTAX_HL_MULTI_COMMENT, mce_len);
+        row->multi_syntax_hl = editorRowLex(row, EC.hl_valid > 0 && EC.row[EC.hl_valid - 1].multi_syntax_hl);
+        EC.hl_valid++;
+    }
+}
 
-                    i += mce_len;
-                    in_comment = 0;
-                    prev_seperator = 1;
-                    continue;
-                } else {
-                    i++;
-                    continue;
-                }
-            } else if (!strncmp(&row->render[i], mcs, mcs_len)) {
-                memset(&row->syntax_hl[i], SYNTAX_HL_MULTI_COMMENT, mcs_len);
+// Counts a row's words: from its highlighting if it's been drawn, otherwise by lexing its text
+static uint32_t *editorWordsLine(erow *row) {
+    static unsigned char *hl = NULL;
+    static int cap = 0;
 
-                i += mcs_len;
-                in_comment = 1;
-                continue;
-            }
-        }
+    // Render only differs from the text in its tabs, which aren't part of any word
+    if (row->render && row->syntax_hl) { return wordsAddLine(&EC.words, row->render, row->syntax_hl, row->rsize); }
 
-        if (EC.syntax->flags & HL_STRINGS) {
-            if (in_str) {
-                row->syntax_hl[i] = SYNTAX_HL_STR;
+    const char *chars = editorRowText(row, &EC.pack_cache);
 
-                if (c == '\\' && i + 1 < row->rsize) {
-                    row->syntax_hl[i + 1] = SYNTAX_HL_STR;
-                    i += 2;
-                    continue;
-                }
+    if (EC.syntax == NULL) { return wordsAddLine(&EC.words, chars, NULL, row->size); }
 
-                if (c == in_str) {
-                    in_str = 0;
-                }
+    if (row->size > cap) {
+        cap = row->size * 2;
+        hl = realloc(hl, cap);
+    }
 
-                i++;
-                prev_seperator = 1;
-                continue;
-            } else {
-                if (c == '"' || c == '\'') {
-                    in_str = c;
-                    row->syntax_hl[i] = SYNTAX_HL_STR;
-                    i++;
-                    continue;
-                }
-            }
-        }
+    lexerRun(EC.syntax->lexer, chars, row->size, hl, row->idx > 0 && EC.row[row->idx - 1].multi_syntax_hl);
 
-        if (EC.syntax->flags & HL_NUMBERS) {
-            if ((isdigit(c) && (prev_seperator || prev_syntax_hl == SYNTAX_HL_NUM)) || (c == '.' && prev_syntax_hl == SYNTAX_HL_NUM)) {
-                row->syntax_hl[i] = SYNTAX_HL_NUM;
-                i++;
-                prev_seperator = 0;
-                continue;
-            }
-        }
+    return wordsAddLine(&EC.words, chars, hl, row->size);
+}
 
-        if (prev_seperator) {
-            int k;
-
-            for (k = 0; keywords[k]; k++) {
-                int key_len = strlen(keywords[k]);
-                
-                // Add new lines for extra keywords
-                int kw2 = keywords[k][key_len - 1] == '2';
-                // int kw3 = keywords[k][key_len - 1] == '3';
-
-                // Add new lines for extra keywords
-                if (kw2) { key_len--; }
-                // if (kw3) { key_len--; }
-
-                if (!strncmp(&row->render[i], keywords[k], key_len) && is_seperator(row->render[i + key_len])) {
-                    
-                    // Add new lines for extra keywords
-                    memset(&row->syntax_hl[i], kw2 ? SYNTAX_HL_KEYWORD2 : SYNTAX_HL_KEYWORD1, key_len);
-                    // memset(&row->syntax_hl[i], kw3 ? SYNTAX_HL_KEYWORD3 : SYNTAX_HL_KEYWORD1, key_len);
-                    
-                    i += key_len;
-                    break;
-                }
-            }
+// Indexes a row's words again after it changed (rows the background scan hasn't reached are left to it)
+static void editorWordsRow(erow *row) {
+    if (row->idx >= EC.words_scan) { return; }
 
-            if (keywords[k] != NULL) {
-                prev_seperator = 0;
-                continue;
-            }
-        }
+    wordsDropLine(&EC.words, row->words);
+    row->words = editorWordsLine(row);
+}
 
-        prev_seperator = is_seperator(c);
-        i++;
+// Forgets every row's words, for the background scan to index them again
+static void editorWordsReset() {
+    for (int i = 0; i < EC.words_scan; i++) {
+        wordsDropLine(&EC.words, EC.row[i].words);
+        EC.row[i].words = NULL;
     }
 
-    int data_updated = (row->multi_syntax_hl != in_comment);
-    row->multi_syntax_hl = in_comment;
+    wordsFree(&EC.words);
+    EC.words_scan = 0;
+}
+
+void editorUpdateSyntax(erow *row) {
+    while (1) {
+        int in_comment = (row->idx > 0 && EC.row[row->idx - 1].multi_syntax_hl);
+        in_comment = editorRowLex(row, in_comment);
+
+        int data_updated = (row->multi_syntax_hl != in_comment);
+        row->multi_syntax_hl = in_comment;
+        editorWordsRow(row);
+
+        // A multi-line comment opened or closed, so the next row changes too
+        // (rows past hl_valid aren't known yet and are worked out when needed)
+        if (!data_updated || row->idx + 1 >= EC.hl_valid) { return; }
 
-    if (data_updated && row->idx + 1 < EC.numrows) {
-        editorUpdateSyntax(&EC.row[row->idx + 1]);
+        row = &EC.row[row->idx + 1];
     }
 }
 
+// Drops a row's render and highlighting; they're rebuilt from chars when next needed
+static void editorColdRow(erow *row) {
+    free(row->render);
+    free(row->syntax_hl);
+    free(row->spans);
+    free(row->cols);
+    free(row->xcols);
+    row->render = NULL;
+    row->syntax_hl = NULL;
+    row->spans = NULL;
+    row->cols = NULL;
+    row->xcols = NULL;
+    row->nspans = 0;
+    row->rsize = 0;
+    row->rcols = 0;
+}
+
 void editorSetSyntaxHl() {
     EC.syntax = NULL;
+    EC.brackets_valid = 0;
+    EC.brackets_scan = 0;
+
+    // Which words count depends on the syntax
+    editorWordsReset();
 
     if (EC.filename == NULL) { return; }
 
-    char *ext = strchr(EC.filename, '.');
+    // Compressed files are highlighted as what they hold (main.c.gz as C)
+    char name[4096];
+    char *ext = strrchr(EC.filename, '.');
+
+    snprintf(name, sizeof(name), "%s", EC.filename);
 
-    for (unsigned int e = 0; e < SYNTAXDB_ENTRIES; e++) {
-        struct editorSyntax *s = &SyntaxDB[e];
+    if (ext && (!strcmp(ext, ".gz") || !strcmp(ext, ".zst"))) { name[ext - EC.filename] = '\0'; }
+
+    ext = strrchr(name, '.');
+
+    for (int e = 0; e < SyntaxTableLen; e++) {
+        struct editorSyntax *s = SyntaxTable[e];
         unsigned int i = 0;
 
         while (s->filematch[i]) {
             int is_ext = (s->filematch[i][0] == '.');
 
-            if ((is_ext && ext && !strcmp(ext, s->filematch[i])) || (!is_ext && strstr(EC.filename, s->filematch[i]))) {
-                EC.syntax = s;
+            if ((is_ext && ext && !strcmp(ext, s->filematch[i])) || (!is_ext && strstr(name, s->filematch[i]))) {
+                if (s->lexer == NULL) {
+                    s->lexer = lexerCompile(s);
+                }
 
-                int frow;
+                // Definitions the lexer can't represent are left unhighlighted
+                if (s->lexer == NULL) { return; }
 
-                for (frow = 0; frow < EC.numrows; frow++) {
-                    editorUpdateSyntax(&EC.row[frow]);
+                EC.syntax = s;
+
+                // Rows are highlighted again as they're drawn
+                for (int frow = 0; frow < EC.numrows; frow++) {
+                    editorColdRow(&EC.row[frow]);
+                    EC.row[frow].bmin = BRACKET_UNKNOWN;
                 }
 
+                EC.hl_valid = 0;
+
                 return;
             }
 
@@ -377,8 +713,33 @@ void editorSetSyntaxHl() {
     }
 }
 
-// Converts x-position to render index position
+// Display column of x-position xpos in a row's text with multi-byte characters
+static int editorRowColAt(const char *chars, int size, int xpos) {
+    int col = 0;
+    int u = 0;
+
+    while (u < xpos && u < size) {
+        int cp;
+        int n = utf8Decode(&chars[u], size - u, &cp);
+
+        if (cp == '\t') {
+            col += TAB_STOP - (col % TAB_STOP);
+        } else {
+            col += ((unsigned char) chars[u] < 0x80) ? 1 : utf8Width(cp);
+        }
+
+        u += n;
+    }
+
+    return col;
+}
+
+// Converts x-position to display column
 int editorRowXposToRx(erow *row, int xpos) {
+    editorPrepareRow(row);
+
+    if (row->xcols) { return row->xcols[xpos < row->size ? xpos : row->size]; }
+
     int rx = 0;
     int u;
 
@@ -395,6 +756,27 @@ int editorRowRxToXpos(erow *row, int rx) {
     int cur_rx = 0;
     int xpos;
 
+    editorPrepareRow(row);
+
+    if (row->xcols) {
+        // The first byte past column rx starts the character after the one covering it
+        int lo = 0, hi = row->size + 1;
+
+        while (lo < hi) {
+            int mid = (lo + hi) / 2;
+
+            if (row->xcols[mid] <= rx) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+
+        if (lo > row->size) { return row->size; }
+
+        return lo > 0 ? utf8Prev(row->chars, row->size, lo) : 0;
+    }
+
     for (xpos = 0; xpos < row->size; xpos++) {
         if (row->chars[xpos] == '\t') {
             cur_rx += (TAB_STOP - 1) - (cur_rx % TAB_STOP);
@@ -409,469 +791,4229 @@ int editorRowRxToXpos(erow *row, int rx) {
     return xpos;
 }
 
-void editorUpdateRow(erow *row) {
-    int tabs = 0;
-    int u;
+// Converts a render byte offset to its display column
+int editorRowRenderToRx(erow *row, int roff) {
+    return row->cols ? row->cols[roff] : roff;
+}
 
-    for (u = 0; u < row->size; u++) {
-        if (row->chars[u] == '\t') {
-            tabs++;
+// First render byte at or after display column rx
+int editorRowRxToRender(erow *row, int rx) {
+    if (row->cols == NULL) { return rx < row->rsize ? rx : row->rsize; }
+
+    int lo = 0, hi = row->rsize;
+
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+
+        if (row->cols[mid] < rx) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
         }
     }
 
+    return lo;
+}
+
+// Builds render and the column table for a row with multi-byte characters
+static void editorUpdateRowUtf8(erow *row, int tabs) {
+    int cap = row->size + tabs*(TAB_STOP - 1);
+
     free(row->render);
-    row->render = malloc(row->size + tabs*(TAB_STOP - 1) + 1);
+    free(row->cols);
+    free(row->xcols);
+    row->render = malloc(cap + 1);
+    row->cols = malloc(sizeof(int) * (cap + 1));
+    row->xcols = malloc(sizeof(int) * (row->size + 1));
 
+    int col = 0;
     int eur = 0;
+    int u = 0;
+
+    while (u < row->size) {
+        row->xcols[u] = col;
 
-    for (u = 0; u < row->size; u++) {
         if (row->chars[u] == '\t') {
-            row->render[eur++] = ' ';
+            do {
+                row->render[eur] = ' ';
+                row->cols[eur++] = col++;
+            } while (col % TAB_STOP != 0);
 
-            while (eur % TAB_STOP != 0) {
-                row->render[eur++] = ' ';
-            }
-        } else {
-            row->render[eur++] = row->chars[u];
+            u++;
+            continue;
+        }
+
+        int cp;
+        int n = utf8Decode(&row->chars[u], row->size - u, &cp);
+        int w = ((unsigned char) row->chars[u] < 0x80) ? 1 : utf8Width(cp);
+
+        // Zero width marks share the column of the character they modify
+        int start = (w == 0 && eur > 0) ? row->cols[eur - 1] : col;
+
+        for (int k = 0; k < n; k++) {
+            row->render[eur] = row->chars[u + k];
+            row->cols[eur++] = start;
+            row->xcols[u + k] = col;
         }
+
+        col += w;
+        u += n;
     }
 
     row->render[eur] = '\0';
+    row->cols[eur] = col;
+    row->xcols[row->size] = col;
     row->rsize = eur;
-
-    editorUpdateSyntax(row);
+    row->rcols = col;
 }
 
-void editorInsertRow(int at, char *s, size_t len) {
-    if (at < 0 || at > EC.numrows) { return; }
-    
-    EC.row = realloc(EC.row, sizeof(erow) * (EC.numrows + 1));
-    memmove(&EC.row[at + 1], &EC.row[at], sizeof(erow) * (EC.numrows - at));
+// Rebuilds render (and the column table) from chars
+void editorUpdateRender(erow *row) {
+    int tabs = remCountByte(row->chars, row->size, '\t');
 
-    for (int a = at + 1; a <= EC.numrows; a++) {
-        EC.row[a].idx++;
+    if (remFindNonAscii(row->chars, row->size) < row->size) {
+        editorUpdateRowUtf8(row, tabs);
+        return;
     }
-    
-    EC.row[at].idx = at;
-    EC.row[at].size = len;
-    EC.row[at].chars = malloc(len + 1);
-    
-    memcpy(EC.row[at].chars, s, len);
-    
-    EC.row[at].chars[len] = '\0';
-    EC.row[at].rsize = 0;
-    EC.row[at].render = NULL;
-    EC.row[at].syntax_hl = NULL;
-    EC.row[at].multi_syntax_hl = 0;
 
-    editorUpdateRow(&EC.row[at]);
+    free(row->cols);
+    free(row->xcols);
+    row->cols = NULL;
+    row->xcols = NULL;
+    free(row->render);
+    row->render = malloc(row->size + tabs*(TAB_STOP - 1) + 1);
 
-    EC.numrows++;
-    EC.dirty++;
-}
+    int eur = 0;
 
-void editorFreeRow(erow *row) {
-    free(row->render);
-    free(row->chars);
-    free(row->syntax_hl);
-}
+    if (tabs == 0) {
+        memcpy(row->render, row->chars, row->size);
+        eur = row->size;
+    } else if (tabs > row->size / 16) {
+        // Runs are too short for memchr/memcpy to pay off
+        for (int u = 0; u < row->size; u++) {
+            if (row->chars[u] == '\t') {
+                row->render[eur++] = ' ';
 
-void editorDelRow(int at) {
-    if (at < 0 || at >= EC.numrows) { return; }
+                while (eur % TAB_STOP != 0) {
+                    row->render[eur++] = ' ';
+                }
+            } else {
+                row->render[eur++] = row->chars[u];
+            }
+        }
+    } else {
+        char *p = row->chars;
+        char *end = row->chars + row->size;
+
+        // Copy each run between tabs in one move, then expand the tab
+        while (p < end) {
+            char *tab = memchr(p, '\t', end - p);
+            int run = (tab ? tab : end) - p;
+
+            memcpy(&row->render[eur], p, run);
+            eur += run;
+            p += run;
 
-    editorFreeRow(&EC.row[at]);
-    memmove(&EC.row[at], &EC.row[at + 1], sizeof(erow) * (EC.numrows - at - 1));
+            if (tab) {
+                int pad = TAB_STOP - (eur % TAB_STOP);
 
-    for (int a = at; a < EC.numrows - 1; a++) {
-        EC.row[a].idx--;
+                memset(&row->render[eur], ' ', pad);
+                eur += pad;
+                p++;
+            }
+        }
     }
 
-    EC.numrows--;
-    EC.dirty++;
+    row->render[eur] = '\0';
+    row->rsize = eur;
+    row->rcols = eur;
 }
 
-// Inserts a single character into the editor row
-void editorRowInsertChar(erow *row, int at, int c) {
-    if (at < 0 || at > row->size) {
-        at = row->size;
-    }
+// Builds the line offset index if rows were inserted or deleted since it was last used
+static void editorLineIndexBuild() {
+    if (EC.lineidx_valid) { return; }
 
-    row->chars = realloc(row->chars, row->size + 2);
-    memmove(&row->chars[at + 1], &row->chars[at], row->size - at + 1);
-    row->size++;
-    row->chars[at] = c;
+    fenwickReset(&EC.lineidx, EC.numrows);
 
-    editorUpdateRow(row);
-    EC.dirty++;
+    for (int i = 0; i < EC.numrows; i++) {
+        EC.lineidx.tree[i + 1] = EC.row[i].size + 1;
+    }
+
+    fenwickBuild(&EC.lineidx);
+    EC.lineidx_valid = 1;
 }
 
-void editorRowAppendStr(erow *row, char *s, size_t len) {
-    row->chars = realloc(row->chars, row->size + len + 1);
-    memcpy(&row->chars[row->size], s, len);
-    row->size += len;
-    row->chars[row->size] = '\0';
-    editorUpdateRow(row);
-    EC.dirty++;
+// Keeps the index in step with a row whose size changed
+static void editorLineIndexUpdate(erow *row) {
+    if (!EC.lineidx_valid) { return; }
+
+    int64_t old = fenwickPrefix(&EC.lineidx, row->idx + 1) - fenwickPrefix(&EC.lineidx, row->idx);
+
+    fenwickAdd(&EC.lineidx, row->idx, row->size + 1 - old);
 }
 
-void editorInsertNewLine() {
-    if (EC.xpos == 0) {
-        editorInsertRow(EC.ypos, "", 0);
-    } else {
-        erow *row = &EC.row[EC.ypos];
-        editorInsertRow(EC.ypos + 1, &row->chars[EC.xpos], row->size - EC.xpos);
-        row = &EC.row[EC.ypos];
-        row->size = EC.xpos;
-        row->chars[row->size] = '\0';
-        editorUpdateRow(row);
+/*
+Soft wrap
+
+With wrap on (^W), a row takes one screen line per screen width of text
+(a cursor after the last character of a full line stays on it). Each row caches that
+count in vlines, and a Fenwick tree over the counts (rows in closed folds
+count 0) turns screen lines into rows and back in O(log n). An edit only
+recounts its own rows; rows inserted or deleted rebuild the tree from the
+cached counts, and a new screen width recounts every row.
+*/
+
+// Display width of a row, from its text (read through c if it's packed) if it hasn't been rendered
+static int editorRowWidth(erow *row, struct packCache *c) {
+    if (row->render) { return row->cols ? row->rcols : row->rsize; }
+
+    const char *chars = editorRowText(row, c);
+
+    if (remFindNonAscii(chars, row->size) < row->size) { return editorRowColAt(chars, row->size, row->size); }
+
+    // ASCII is one column a byte, apart from tabs
+    if (remCountByte(chars, row->size, '\t') == 0) { return row->size; }
+
+    int col = 0;
+
+    for (int i = 0; i < row->size; i++) {
+        col += (chars[i] == '\t') ? TAB_STOP - (col % TAB_STOP) : 1;
     }
 
-    EC.ypos++;
-    EC.xpos = 0;
+    return col;
 }
 
-void editorRowDelChar(erow *row, int at) {
-    if (at < 0 || at >= row->size) { return; }
+static int editorRowVlines(erow *row, struct packCache *c) {
+    int width = editorRowWidth(row, c);
 
-    memmove(&row->chars[at], &row->chars[at + 1], row->size - at);
-    row->size--;
-    
-    editorUpdateRow(row);
-    EC.dirty++;
+    return width ? (width + EC.wrap_cols - 1) / EC.wrap_cols : 1;
 }
 
-void editorInsertChar(int c) {
-    if (EC.ypos == EC.numrows) {
-        editorInsertRow(EC.numrows, "", 0);
+// Counts the rows that need it and fills in their leaves of the index
+static void editorWrapWorker(void *ctx, int start, int end) {
+    struct packCache c = {-1, NULL, 0};
+
+    (void) ctx;
+
+    for (int i = start; i < end; i++) {
+        if (EC.row[i].vlines == 0) { EC.row[i].vlines = editorRowVlines(&EC.row[i], &c); }
+
+        EC.wrapidx.tree[i + 1] = EC.row[i].vlines;
     }
 
-    editorRowInsertChar(&EC.row[EC.ypos], EC.xpos, c);
-    EC.xpos++;
+    free(c.text);
 }
 
-// Deletes the character when a backspace is detected
-void editorDelChar() {
-    if (EC.ypos == EC.numrows) { return; }
-    if (EC.xpos == 0 && EC.ypos == 0) { return; }
+// Builds the screen line index if it's out of date, counting the rows that need it in parallel
+static void editorWrapBuild() {
+    if (EC.wrapidx_valid && EC.wrap_cols == EC.screencols) { return; }
 
-    erow *row = &EC.row[EC.ypos];
+    if (EC.wrap_cols != EC.screencols) {
+        for (int i = 0; i < EC.numrows; i++) { EC.row[i].vlines = 0; }
 
-    if (EC.xpos > 0) {
-        editorRowDelChar(row, EC.xpos - 1);
-        EC.xpos--;
-    } else {
-        EC.xpos = EC.row[EC.ypos - 1].size;
-        editorRowAppendStr(&EC.row[EC.ypos - 1], row->chars, row->size);
-        editorDelRow(EC.ypos);
-        EC.ypos--;
+        EC.wrap_cols = EC.screencols;
+    }
+
+    fenwickReset(&EC.wrapidx, EC.numrows);
+    parallelFor(EC.numrows, 4096, editorWrapWorker, NULL);
+
+    for (int k = 0; k < EC.folds.nroots; k++) {
+        struct fold *f = foldRoot(&EC.folds, k);
+
+        for (int i = f->start + 1; i <= f->end && i < EC.numrows; i++) { EC.wrapidx.tree[i + 1] = 0; }
     }
+
+    fenwickBuild(&EC.wrapidx);
+    EC.wrapidx_valid = 1;
 }
 
-char *editorRowsToString(int *buflen) {
-    int totlen = 0;
-    int j;
+// Recounts the screen lines of a row whose text changed
+static void editorWrapUpdate(erow *row) {
+    if (!EC.wrap || !EC.wrapidx_valid || EC.wrap_cols != EC.screencols) {
+        row->vlines = 0;
+        return;
+    }
+
+    int old = row->vlines;
 
-    for (j = 0; j < EC.numrows; j++) {
-        totlen += EC.row[j].size + 1;
+    row->vlines = editorRowVlines(row, &EC.pack_cache);
+
+    if (row->vlines != old && foldHiding(&EC.folds, row->idx) == -1) {
+        fenwickAdd(&EC.wrapidx, row->idx, row->vlines - old);
     }
-    *buflen = totlen;
+}
+
+// First screen line (counted from the top of the file) of row at; rows in a closed fold map to its first row
+int editorVisualRow(int at) {
+    if (!EC.wrap) { return foldToVisual(&EC.folds, at); }
+
+    editorWrapBuild();
+
+    int k = foldHiding(&EC.folds, at);
+
+    if (k != -1) { at = foldRoot(&EC.folds, k)->start; }
 
-    char *buf = malloc(totlen);
-    char *p = buf;
+    return fenwickPrefix(&EC.wrapidx, at);
+}
+
+// Row shown on screen line v, and in *sub which of its lines that is (past the end is numrows)
+int editorFileRow(int v, int *sub) {
+    *sub = 0;
+
+    if (!EC.wrap) { return foldToFile(&EC.folds, v); }
+    if (v < 0) { return v; }
+
+    editorWrapBuild();
+
+    int at = fenwickFind(&EC.wrapidx, v);
+
+    if (at < EC.numrows) { *sub = v - fenwickPrefix(&EC.wrapidx, at); }
+
+    return at;
+}
+
+// Which of row at's screen lines display column rx is shown on (the index must be built)
+static int editorWrapLine(int at, int rx) {
+    if (at >= EC.numrows) { return 0; }
+
+    int line = rx / EC.wrap_cols;
+
+    return line < EC.row[at].vlines ? line : EC.row[at].vlines - 1;
+}
+
+// Screen line of the cursor, counted from the top of the file
+static int editorCursorLine() {
+    int v = editorVisualRow(EC.ypos);
+
+    if (EC.wrap) { v += editorWrapLine(EC.ypos, EC.rx); }
+
+    return v;
+}
 
-    for (j =0; j < EC.numrows; j++) {
-        memcpy(p, EC.row[j].chars, EC.row[j].size);
-        p += EC.row[j].size;
-        *p = '\n';
-        p++;
+// Moves the cursor dir screen lines with wrap on, keeping its column on the screen
+static void editorWrapMove(int dir, int rx) {
+    int v = editorVisualRow(EC.ypos);
+    int line = editorWrapLine(EC.ypos, rx);
+    int col = rx - line * EC.wrap_cols;
+    int sub;
+
+    v += line + dir;
+
+    if (v < 0) { return; }
+
+    int at = editorFileRow(v, &sub);
+
+    if (at >= EC.numrows) {
+        EC.ypos = EC.numrows;
+        EC.xpos = 0;
+        return;
     }
 
-    return buf;
+    EC.ypos = at;
+    EC.xpos = editorRowRxToXpos(&EC.row[at], sub * EC.wrap_cols + col);
 }
 
-void editorOpen(char *filename) {
-    free(EC.filename);
-    EC.filename = strdup(filename);
+void editorUpdateRow(erow *row) {
+    editorLineIndexUpdate(row);
+    editorHlAdvance(row->idx - 1);
+    editorUpdateRender(row);
+    editorWrapUpdate(row);
+    editorUpdateSyntax(row);
 
-    editorSetSyntaxHl();
+    if (EC.hl_valid == row->idx) { EC.hl_valid++; }
+}
 
-    FILE *filepath = fopen(filename, "r");
+// Builds render and highlighting for a row that hasn't been drawn yet
+void editorPrepareRow(erow *row) {
+    if (row->render) { return; }
 
-    if (!filepath) {
-        destroy("fopen");
+    editorRowUnpack(row);
+    editorHlAdvance(row->idx - 1);
+    editorUpdateRender(row);
+    row->multi_syntax_hl = editorLexRow(row, row->idx > 0 && EC.row[row->idx - 1].multi_syntax_hl);
+
+    if (EC.hl_valid == row->idx) { EC.hl_valid++; }
+
+    // Roughly what the render, highlighting and spans take
+    EC.mem_grown += (size_t) row->rsize * (row->cols ? 3 + 2 * sizeof(int) : 3);
+}
+
+struct rowUpdateJob {
+    const int *rows;
+    int *in;
+    int *out;
+};
+
+static void editorUpdateRowsWorker(void *ctx, int start, int end) {
+    struct rowUpdateJob *job = ctx;
+
+    for (int k = start; k < end && job->rows[k] < EC.hl_valid; k++) {
+        erow *row = &EC.row[job->rows[k]];
+
+        // Rows nobody has drawn yet stay that way
+        if (row->render) { editorUpdateRender(row); }
+
+        row->multi_syntax_hl = editorRowLex(row, job->in[k]);
     }
+}
 
-    char *line = NULL;
-    size_t linecap = 0;
-    ssize_t line_len;
+/*
+Updates many rows at once (rows must be ascending). Each row is rebuilt and
+highlighted in parallel from the state the row above had before the update,
+then one pass in file order fixes up rows whose start state changed and
+carries new comment states into the untouched rows below. Rows past
+hl_valid are left for editorHlAdvance.
+*/
+void editorUpdateRows(const int *rows, int n) {
+    if (n == 0) { return; }
+
+    struct rowUpdateJob job = {rows, malloc(sizeof(int) * n), malloc(sizeof(int) * n)};
+
+    for (int k = 0; k < n; k++) {
+        editorLineIndexUpdate(&EC.row[rows[k]]);
+        EC.mem_grown += EC.row[rows[k]].size + 1;
+        job.in[k] = (rows[k] > 0 && EC.row[rows[k] - 1].multi_syntax_hl);
+        job.out[k] = EC.row[rows[k]].multi_syntax_hl;
+    }
 
-    while ((line_len = getline(&line, &linecap, filepath)) != -1) {
-        while (line_len > 0 && (line[line_len - 1] == '\n' ||
-                                line[line_len - 1] == '\r')) {
-            line_len--;
+    EC.lex_parallel = 1;
+    parallelFor(n, 1024, editorUpdateRowsWorker, &job);
+    EC.lex_parallel = 0;
+
+    for (int k = 0; k < n && rows[k] < EC.hl_valid; k++) { editorBracketsNote(&EC.row[rows[k]]); }
+    for (int k = 0; k < n; k++) { editorWrapUpdate(&EC.row[rows[k]]); }
+
+    for (int k = 0; k < n && rows[k] < EC.hl_valid; k++) {
+        erow *row = &EC.row[rows[k]];
+        int in_comment = (row->idx > 0 && EC.row[row->idx - 1].multi_syntax_hl);
+
+        if (in_comment != job.in[k]) {
+            row->multi_syntax_hl = editorRowLex(row, in_comment);
         }
 
-        editorInsertRow(EC.numrows, line, line_len);
+        int next_touched = (k + 1 < n && rows[k + 1] == row->idx + 1);
+
+        if (row->multi_syntax_hl != job.out[k] && !next_touched && row->idx + 1 < EC.hl_valid) {
+            editorUpdateSyntax(&EC.row[row->idx + 1]);
+        }
     }
 
-    free(line);
-    fclose(filepath);
-    EC.dirty = 0;
+    for (int k = 0; k < n; k++) { editorWordsRow(&EC.row[rows[k]]); }
+
+    free(job.in);
+    free(job.out);
 }
 
-void editorSave() {
-    // Checks if the file is a new file. Prompts for a new filename.
-    if (EC.filename == NULL) {
-        EC.filename = editorPrompt("Save file as (ESC to cancel): %s", NULL);
+// Sets up a row that hasn't been rendered or highlighted yet
+static void editorInitRow(erow *row, int idx, char *chars, int size) {
+    row->idx = idx;
+    row->size = size;
+    row->chars = chars;
+    row->rsize = 0;
+    row->render = NULL;
+    row->syntax_hl = NULL;
+    row->multi_syntax_hl = 0;
+    row->spans = NULL;
+    row->nspans = 0;
+    row->cols = NULL;
+    row->xcols = NULL;
+    row->rcols = 0;
+    row->bsum = 0;
+    row->bmin = BRACKET_UNKNOWN;
+    row->vlines = 0;
+    row->packed = 0;
+    row->packoff = 0;
+    row->words = NULL;
+}
 
-        if (EC.filename == NULL) {
-            editorSetStatusMessage("%s | Status: Save Aborted | v%s", DEFAULT_MSG, VERSION);
-            return;
+static int editorInText(const char *p) {
+    return EC.text && p >= EC.text && p < EC.text + EC.textlen;
+}
+
+// Index of the first block that starts after p (blocks are kept sorted by address)
+static int editorTextBlockAfter(const char *p) {
+    int lo = 0, hi = EC.nblocks;
+
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+
+        if ((uintptr_t) EC.blocks[mid].data <= (uintptr_t) p) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
         }
+    }
 
-        editorSetSyntaxHl();
+    return lo;
+}
+
+static struct textBlock *editorTextBlock(const char *p) {
+    int at = editorTextBlockAfter(p);
+
+    if (at == 0) { return NULL; }
+
+    // Only the block starting last before p can hold it
+    struct textBlock *b = &EC.blocks[at - 1];
+
+    return ((uintptr_t) p < (uintptr_t) b->data + b->len) ? b : NULL;
+}
+
+// Makes a malloc'd buffer shared text with refs references to it
+static void editorAdoptBlock(char *data, size_t len, int refs) {
+    EC.blocks = realloc(EC.blocks, sizeof(struct textBlock) * (EC.nblocks + 1));
+
+    int at = editorTextBlockAfter(data);
+
+    memmove(&EC.blocks[at + 1], &EC.blocks[at], sizeof(struct textBlock) * (EC.nblocks - at));
+    EC.nblocks++;
+
+    struct textBlock *b = &EC.blocks[at];
+    b->data = data;
+    b->len = len;
+    b->refs = refs;
+
+    EC.mem_grown += len;
+}
+
+// Rows from a file point into EC.text until they are edited, pasted rows into a block
+int editorTextShared(const char *p) {
+    return editorInText(p) || (EC.nblocks && editorTextBlock(p));
+}
+
+// Takes another reference to shared text
+void editorTextRef(const char *p) {
+    struct textBlock *b = EC.nblocks ? editorTextBlock(p) : NULL;
+
+    if (b) { b->refs++; }
+}
+
+void editorFreeText(char *p) {
+    if (editorInText(p)) { return; }
+
+    struct textBlock *b = EC.nblocks ? editorTextBlock(p) : NULL;
+
+    if (b == NULL) {
+        free(p);
+    } else if (--b->refs == 0) {
+        free(b->data);
+        memmove(b, b + 1, sizeof(struct textBlock) * (&EC.blocks[--EC.nblocks] - b));
     }
+}
 
-    // If the file doesn't exist we do the following:
-    int len;
-    char *buf = editorRowsToString(&len);
-    int fo = open(EC.filename, O_RDWR | O_CREAT, 0644); // Create a new file (O_CREAT), open the file for R & W (O_RDWR). Default permissions set to 644 (Owner: RW, Everyone Else: R)
+// Gives a row its own copy of its text before it's modified
+void editorRowOwn(erow *row) {
+    editorRowUnpack(row);
 
-    if (fo != -1) {
-        // Sets the file length - Safer than O_TRUNC (We can't be losing any data!)
-        if (ftruncate(fo, len) != -1) {
-            // Writes to the file
-            if (write(fo, buf, len) == len) {
-                close(fo);
-                free(buf); // Frees memory
-                EC.dirty = 0;
-                editorSetStatusMessage("%s | Status: %d bytes written to disk | v%s", DEFAULT_MSG, len, VERSION); // Displays number of bytes written to disk
-                return;
-            }
+    if (!editorTextShared(row->chars)) { return; }
+
+    char *chars = malloc(row->size + 1);
+
+    memcpy(chars, row->chars, row->size);
+    chars[row->size] = '\0';
+    editorFreeText(row->chars);
+    row->chars = chars;
+    EC.mem_grown += row->size + 1;
+}
+
+/*
+Packed rows
+
+Rows far from the view have their render and highlighting dropped, and if
+their text is on the heap (edited, pasted, read from a pipe or copied out of
+the file on save) runs of them are LZ compressed into blocks of about
+PACK_BLOCK bytes. A packed row's chars is NULL: its text is read through
+editorRowText(), which decompresses the block into a cache (the next rows
+usually come from the same block), and a row that's drawn or edited gets its
+own copy back with editorRowUnpack(). Rows still in the mapped file are only
+cooled, the page cache already holds their text. A compressed file's rows
+are packed from the start, in blocks holding their text as it was
+decompressed; packing those just drops the text, which is decompressed
+again from the file when it's next read.
+*/
+
+// Text of a row, decompressing its block into c if it's packed (rows that aren't leave c alone)
+const char *editorRowText(erow *row, struct packCache *c) {
+    if (!row->packed) { return row->chars; }
+
+    int id = row->packed - 1;
+    struct packBlock *b = &EC.packs[id];
+
+    // A compressed file's block is only decompressed again once its text was dropped
+    if (b->zoff >= 0 && b->data) { return b->data + row->packoff; }
+
+    if (c->block != id) {
+        if (b->len + 1 > c->cap) {
+            c->cap = b->len + 1;
+            c->text = realloc(c->text, c->cap);
         }
-        close(fo);
+
+        if (b->zoff >= 0) {
+            if (zipStreamRead(EC.zip, b->zoff, b->len, c->text) == -1) { destroy("zipStreamRead"); }
+        } else if (lzDecompress(b->data, b->zlen, c->text, b->len) != b->len) {
+            destroy("lzDecompress");
+        }
+
+        c->block = id;
     }
 
-    free(buf); // Frees memory
-    editorSetStatusMessage("%s | Status: Unable to save file: %s | v%s", DEFAULT_MSG, strerror(errno), VERSION); // Notifies of an error is unable to save file
+    return c->text + row->packoff;
 }
 
-// Incremental search function
-void editorSearchCallback(char *query, int key) {
-    static int last_match = -1;
-    static int direction = 1;
-    static int save_syn_line;
-    static char *save_syn_hl = NULL;
+// Drops a packed row's hold on its block, freeing the block after its last row
+static void editorPackRelease(erow *row) {
+    int id = row->packed - 1;
+    struct packBlock *b = &EC.packs[id];
 
-    if (save_syn_hl) {
-        memcpy(EC.row[save_syn_line].syntax_hl, save_syn_hl, EC.row[save_syn_line].rsize);
-        free(save_syn_hl);
-        save_syn_hl = NULL;
-    }
+    row->packed = 0;
 
-    if (key == '\r' || key == '\x1b') {
-        last_match = -1;
-        direction = 1;
-        return;
-    } else if (key == ARROW_RIGHT || key == ARROW_DOWN) {
-        direction = 1;
-    } else if (key == ARROW_LEFT || key == ARROW_UP) {
-        direction = -1;
+    if (--b->rows > 0) { return; }
+
+    EC.packed_bytes -= b->zlen;
+    free(b->data);
+    b->data = NULL;
+
+    EC.pack_spare = realloc(EC.pack_spare, sizeof(int) * (EC.nspare + 1));
+    EC.pack_spare[EC.nspare++] = id;
+
+    if (EC.pack_cache.block == id) { EC.pack_cache.block = -1; }
+}
+
+// Gives a packed row its own copy of its text again
+void editorRowUnpack(erow *row) {
+    if (!row->packed) { return; }
+
+    const char *text = editorRowText(row, &EC.pack_cache);
+    char *chars = malloc(row->size + 1);
+
+    memcpy(chars, text, row->size);
+    chars[row->size] = '\0';
+    editorPackRelease(row);
+    row->chars = chars;
+    EC.mem_grown += row->size + 1;
+}
+
+// Lets go of a row's text, wherever it's kept
+static void editorRowFreeText(erow *row) {
+    if (row->packed) {
+        editorPackRelease(row);
     } else {
-        last_match = -1;
-        direction = 1;
+        editorFreeText(row->chars);
     }
+}
 
-    if (last_match == -1) { direction = 1; }
-    
-    int current_pos = last_match;
-    int q;
+// Adds what a row holds on the heap outside the row array (render and highlighting, and text it owns) to use
+static void editorRowUse(erow *row, size_t *use) {
+    use[MEM_HL] += row->nspans * sizeof(struct hlspan);
 
-    for (q = 0; q < EC.numrows; q++) {
-        current_pos += direction;
+    if (row->render) { use[MEM_RENDER] += row->rsize + 1; }
+    if (row->syntax_hl) { use[MEM_HL] += row->rsize; }
+    if (row->cols) { use[MEM_RENDER] += (row->rsize + row->size + 2) * sizeof(int); }
+    if (!row->packed && !editorTextShared(row->chars)) { use[MEM_TEXT] += row->size + 1; }
+}
 
-        if (current_pos == -1) {
-            current_pos = EC.numrows - 1;
-        } else if (current_pos == EC.numrows) {
-            current_pos = 0;
-        }
+static size_t editorRowHeap(erow *row) {
+    size_t use[MEM_KINDS] = {0};
 
-        erow *row = &EC.row[current_pos];
+    editorRowUse(row, use);
 
-        char *match = strstr(row->render, query);
+    return use[MEM_TEXT] + use[MEM_RENDER] + use[MEM_HL];
+}
 
-        if (match) {
-            last_match = current_pos;
-            EC.ypos = current_pos;
-            EC.xpos = editorRowRxToXpos(row, match - row->render);
-            EC.xpos = match - row->render;
-            EC.rowoff = EC.numrows;
+// Heap held by shared text and packed blocks
+static size_t editorBlocksHeap() {
+    size_t n = EC.packed_bytes;
 
-            save_syn_line = current_pos;
-            save_syn_hl = malloc(row->rsize);
-            
-            memcpy(save_syn_hl, row->syntax_hl, row->rsize);
-            memset(&row->syntax_hl[match - row->render], SYNTAX_HL_QUERY, strlen(query));
-            
-            break;
-        }
+    for (int b = 0; b < EC.nblocks; b++) { n += EC.blocks[b].len; }
+
+    return n;
+}
+
+static size_t editorLinesHeap(const struct undoLine *lines, int n) {
+    size_t bytes = 0;
+
+    for (int l = 0; l < n; l++) {
+        if (lines[l].chars && !editorTextShared(lines[l].chars)) { bytes += lines[l].size + 1; }
     }
+
+    return bytes;
 }
 
-// Searches each row for query
-void editorSearch() {
-    int s_xpos = EC.xpos; // Saves x position
-    int s_ypos = EC.ypos; // Saves y position
-    int s_coloff = EC.coloff; // Saves column position
-    int s_rowoff = EC.rowoff; // Saves row position
+/*
+Adds up what the editor holds on the heap by kind. The rows themselves take
+a pass over every row, so with_rows can leave them out (along with the row
+array) when they're counted some other way.
+*/
+static void editorMemUse(size_t *use, int with_rows) {
+    memset(use, 0, sizeof(size_t) * MEM_KINDS);
 
-    char *query = editorPrompt("Query (ESC to cancel): %s (Search using Arrows/Enter)", editorSearchCallback);
+    if (with_rows) {
+        use[MEM_ROWS] = sizeof(erow) * EC.numrows;
 
-    if (query) {
-        free(query);
-    } else {
-        // Returns user to their original mouse position after search
-        EC.xpos = s_xpos;
-        EC.ypos = s_ypos;
-        EC.coloff = s_coloff;
-        EC.rowoff = s_rowoff;
+        for (int i = 0; i < EC.numrows; i++) { editorRowUse(&EC.row[i], use); }
+    }
+
+    use[MEM_ROWS] += sizeof(struct editorCursor) * EC.ncursors;
+
+    for (int b = 0; b < EC.nblocks; b++) { use[MEM_TEXT] += EC.blocks[b].len; }
+
+    use[MEM_TEXT] += sizeof(struct textBlock) * EC.nblocks;
+    use[MEM_PACKED] = EC.packed_bytes + sizeof(struct packBlock) * EC.npacks + sizeof(int) * EC.nspare;
+
+    for (int u = 0; u < EC.nundo; u++) {
+        struct undoBatch *b = &EC.undo[u];
+
+        use[MEM_UNDO] += sizeof(struct undoStep) * b->capsteps + sizeof(struct undoLine) * b->caplines;
+        use[MEM_UNDO] += editorLinesHeap(b->lines, b->nlines);
+    }
+
+    use[MEM_UNDO] += sizeof(struct undoBatch) * EC.nundo;
+    use[MEM_CLIP] = sizeof(struct undoLine) * EC.nclip + editorLinesHeap(EC.clip, EC.nclip);
+    use[MEM_WORDS] = wordsHeap(&EC.words);
+
+    use[MEM_INDEXES] = sizeof(int64_t) * ((EC.lineidx.tree ? EC.lineidx.n + 1 : 0) + (EC.wrapidx.tree ? EC.wrapidx.n + 1 : 0));
+    use[MEM_INDEXES] += sizeof(struct fold) * EC.folds.cap + sizeof(int) * 2 * (EC.folds.n + 1);
+
+    if (EC.brackets.tree) {
+        use[MEM_INDEXES] += sizeof(struct bracketNode) * 2 * EC.brackets.size + (1 + sizeof(int)) * EC.brackets.nblocks;
+    }
+
+    use[MEM_INDEXES] += zipHeap(EC.zip);
+    use[MEM_SEARCH] = grepHeap(EC.grep);
+    use[MEM_FRAME] = EC.frame_bytes + sizeof(uint64_t) * EC.shadow_rows;
+    use[MEM_CACHE] = EC.pack_cache.cap + journalHeap(EC.journal);
+}
+
+// Rows [start, end) packed into one block
+struct packJob {
+    int start, end;
+    int len;
+    char *text;
+    char *data;
+    int zlen;
+};
+
+static void editorPackWorker(void *ctx, int start, int end) {
+    struct packJob *jobs = ctx;
+
+    for (int k = start; k < end; k++) {
+        jobs[k].data = malloc(LZ_BOUND(jobs[k].len));
+        jobs[k].zlen = lzCompress(jobs[k].text, jobs[k].len, jobs[k].data);
+        jobs[k].data = realloc(jobs[k].data, jobs[k].zlen);
     }
 }
 
-struct abuf {
-    char *b;
-    int len;
-};
+// Id for a new block (a freed one if there is one)
+static int editorPackAlloc() {
+    if (EC.nspare) { return EC.pack_spare[--EC.nspare]; }
+
+    EC.packs = realloc(EC.packs, sizeof(struct packBlock) * (EC.npacks + 1));
+
+    return EC.npacks++;
+}
+
+static int editorPackNew(struct packJob *job) {
+    int id = editorPackAlloc();
+
+    struct packBlock *b = &EC.packs[id];
+    b->data = job->data;
+    b->zlen = job->zlen;
+    b->len = job->len;
+    b->rows = job->end - job->start;
+    b->zoff = -1;
+
+    EC.packed_bytes += job->zlen;
+
+    return id;
+}
+
+/*
+Cools rows [from, to) and packs the ones whose text is on the heap, the
+blocks being compressed in parallel (a compressed file's blocks just let go
+of their text). Returns how many bytes that freed.
+*/
+static long long editorPackRows(int from, int to) {
+    long long before = editorBlocksHeap();
+    struct packJob *jobs = NULL;
+    int njobs = 0;
+
+    for (int i = from; i < to; i++) {
+        erow *row = &EC.row[i];
+
+        before += editorRowHeap(row);
+        editorColdRow(row);
+
+        // A compressed file's block can be decompressed again, so its text goes (with its first row)
+        struct packBlock *b = row->packed ? &EC.packs[row->packed - 1] : NULL;
+
+        if (b && b->zoff >= 0 && b->data && row->packoff == 0) {
+            EC.packed_bytes -= b->zlen;
+            free(b->data);
+            b->data = NULL;
+            b->zlen = 0;
+        }
+    }
+
+    for (int i = from; i < to; ) {
+        if (EC.row[i].packed || editorInText(EC.row[i].chars)) {
+            i++;
+            continue;
+        }
+
+        int start = i;
+        int len = 0;
+
+        while (i < to && !EC.row[i].packed && !editorInText(EC.row[i].chars) &&
+               (i == start || len + EC.row[i].size <= PACK_BLOCK)) {
+            len += EC.row[i++].size;
+        }
+
+        jobs = realloc(jobs, sizeof(struct packJob) * (njobs + 1));
+        jobs[njobs].start = start;
+        jobs[njobs].end = i;
+        jobs[njobs].len = len;
+        jobs[njobs].text = malloc(len ? len : 1);
+
+        for (int r = start, off = 0; r < i; r++) {
+            memcpy(jobs[njobs].text + off, EC.row[r].chars, EC.row[r].size);
+            off += EC.row[r].size;
+        }
+
+        njobs++;
+    }
+
+    parallelFor(njobs, 1, editorPackWorker, jobs);
+
+    for (int k = 0; k < njobs; k++) {
+        int id = editorPackNew(&jobs[k]);
+
+        for (int r = jobs[k].start, off = 0; r < jobs[k].end; r++) {
+            erow *row = &EC.row[r];
+
+            editorFreeText(row->chars);
+            row->chars = NULL;
+            row->packed = id + 1;
+            row->packoff = off;
+            off += row->size;
+        }
+
+        free(jobs[k].text);
+    }
+
+    free(jobs);
+
+    return before - (long long) editorBlocksHeap();
+}
+
+void editorInsertRow(int at, char *s, size_t len) {
+    if (at < 0 || at > EC.numrows) { return; }
+    
+    EC.row = realloc(EC.row, sizeof(erow) * (EC.numrows + 1));
+    memmove(&EC.row[at + 1], &EC.row[at], sizeof(erow) * (EC.numrows - at));
+
+    for (int a = at + 1; a <= EC.numrows; a++) {
+        EC.row[a].idx++;
+    }
+    
+    editorInitRow(&EC.row[at], at, malloc(len + 1), len);
+    memcpy(EC.row[at].chars, s, len);
+    EC.row[at].chars[len] = '\0';
+    EC.mem_grown += len + 1;
+
+    EC.numrows++;
+    EC.dirty++;
+    EC.lineidx_valid = 0;
+    EC.wrapidx_valid = 0;
+    EC.brackets_valid = 0;
+    foldInsertRows(&EC.folds, at, 1);
+
+    if (at < EC.words_scan) { EC.words_scan++; }
+
+    // Rows past hl_valid are highlighted when they're reached
+    if (at < EC.hl_valid) {
+        EC.row[at].multi_syntax_hl = (at > 0 && EC.row[at - 1].multi_syntax_hl);
+        EC.hl_valid++;
+        editorUpdateRow(&EC.row[at]);
+    }
+}
+
+void editorFreeRow(erow *row) {
+    free(row->render);
+    editorRowFreeText(row);
+    free(row->syntax_hl);
+    free(row->spans);
+    free(row->cols);
+    free(row->xcols);
+}
+
+// Removes rows [at, at + n) with one move of the row array
+void editorDelRows(int at, int n) {
+    if (at < 0 || n <= 0 || at + n > EC.numrows) { return; }
+
+    for (int k = 0; k < n; k++) {
+        wordsDropLine(&EC.words, EC.row[at + k].words);
+        editorFreeRow(&EC.row[at + k]);
+    }
+
+    memmove(&EC.row[at], &EC.row[at + n], sizeof(erow) * (EC.numrows - at - n));
+
+    if (at < EC.hl_valid) { EC.hl_valid = (EC.hl_valid > at + n) ? EC.hl_valid - n : at; }
+    if (at < EC.words_scan) { EC.words_scan = (EC.words_scan > at + n) ? EC.words_scan - n : at; }
+
+    EC.lineidx_valid = 0;
+    EC.wrapidx_valid = 0;
+    EC.brackets_valid = 0;
+    EC.numrows -= n;
+    foldDeleteRows(&EC.folds, at, n);
+
+    for (int a = at; a < EC.numrows; a++) {
+        EC.row[a].idx = a;
+    }
+
+    EC.dirty++;
+
+    // The row that moved up now follows different text
+    if (at < EC.hl_valid) { editorUpdateSyntax(&EC.row[at]); }
+}
+
+void editorDelRow(int at) {
+    editorDelRows(at, 1);
+}
+
+/*
+Inserts n rows at at with one move of the row array, taking over the lines'
+buffers. The new rows start cold, so only their comment states are worked
+out here.
+*/
+void editorInsertRows(int at, const struct undoLine *lines, int n) {
+    if (at < 0 || at > EC.numrows || n <= 0) { return; }
+
+    EC.row = realloc(EC.row, sizeof(erow) * (EC.numrows + n));
+    memmove(&EC.row[at + n], &EC.row[at], sizeof(erow) * (EC.numrows - at));
+
+    for (int k = 0; k < n; k++) {
+        editorInitRow(&EC.row[at + k], at + k, lines[k].chars, lines[k].size);
+        EC.mem_grown += lines[k].size + 1;
+    }
+
+    EC.numrows += n;
+
+    for (int a = at + n; a < EC.numrows; a++) {
+        EC.row[a].idx = a;
+    }
+
+    EC.dirty++;
+    EC.lineidx_valid = 0;
+    EC.wrapidx_valid = 0;
+    EC.brackets_valid = 0;
+    foldInsertRows(&EC.folds, at, n);
+
+    if (at < EC.hl_valid) {
+        int in_comment = (at > 0 && EC.row[at - 1].multi_syntax_hl);
+
+        for (int k = 0; k < n; k++) {
+            in_comment = editorRowLex(&EC.row[at + k], in_comment);
+            EC.row[at + k].multi_syntax_hl = in_comment;
+        }
+
+        if (at < EC.words_scan) {
+            EC.words_scan += n;
+
+            for (int k = 0; k < n; k++) { EC.row[at + k].words = editorWordsLine(&EC.row[at + k]); }
+        }
+
+        EC.hl_valid += n;
+
+        if (at + n < EC.hl_valid) { editorUpdateSyntax(&EC.row[at + n]); }
+    }
+}
+
+// Records an edit in the swap file, starting one for the file on disk if needed
+void editorJournal(int op, int row, int col, const char *data, int len, int merge) {
+    if (EC.journal_off || EC.filename == NULL) { return; }
+
+    if (EC.journal == NULL) {
+        int fd = open(EC.filename, O_RDONLY);
+
+        if (fd == -1) { return; }
+
+        EC.journal = journalCreate(EC.filename, &EC.file_st, lineCacheFingerprint(fd, EC.file_st.st_size));
+        close(fd);
+    }
+
+    if (EC.journal == NULL || __atomic_load_n(&EC.journal->failed, __ATOMIC_RELAXED)) {
+        journalClose(EC.journal, 0);
+        EC.journal = NULL;
+        EC.journal_off = 1;
+        editorSetStatusMessage("%s | Status: Swap file unavailable, edits aren't journaled | v%s", DEFAULT_MSG, VERSION);
+        return;
+    }
+
+    journalAppend(EC.journal, op, row, col, data, len, merge);
+}
+
+static void editorUndoFreeBatch(struct undoBatch *b) {
+    for (int l = 0; l < b->nlines; l++) { editorFreeText(b->lines[l].chars); }
+
+    free(b->steps);
+    free(b->lines);
+}
+
+// Starts a new undo batch, dropping the oldest one when the history is full
+struct undoBatch *editorUndoBegin(int typing) {
+    if (EC.nundo == UNDO_LEVELS) {
+        editorUndoFreeBatch(&EC.undo[0]);
+        memmove(&EC.undo[0], &EC.undo[1], sizeof(struct undoBatch) * (UNDO_LEVELS - 1));
+        EC.nundo--;
+    }
+
+    EC.undo = realloc(EC.undo, sizeof(struct undoBatch) * (EC.nundo + 1));
+
+    struct undoBatch *b = &EC.undo[EC.nundo++];
+    memset(b, 0, sizeof(*b));
+    b->xpos = EC.xpos;
+    b->ypos = EC.ypos;
+    b->typing = typing;
+
+    return b;
+}
+
+// Makes room for nsteps more steps saving nlines more rows
+void editorUndoReserve(struct undoBatch *b, int nsteps, int nlines) {
+    if (b->nsteps + nsteps > b->capsteps) {
+        b->capsteps = (b->nsteps + nsteps) * 2;
+        b->steps = realloc(b->steps, sizeof(struct undoStep) * b->capsteps);
+    }
+
+    if (b->nlines + nlines > b->caplines) {
+        b->caplines = (b->nlines + nlines) * 2;
+        b->lines = realloc(b->lines, sizeof(struct undoLine) * b->caplines);
+    }
+}
+
+/*
+Adds a step to b. The old rows are copied unless lines is given, in which
+case the batch takes ownership of those buffers instead.
+*/
+void editorUndoAddStep(struct undoBatch *b, int at, int old_n, int new_n, struct undoLine *lines) {
+    editorUndoReserve(b, 1, old_n);
+
+    b->steps[b->nsteps].at = at;
+    b->steps[b->nsteps].old_n = old_n;
+    b->steps[b->nsteps].new_n = new_n;
+    b->steps[b->nsteps].line = b->nlines;
+    b->nsteps++;
+
+    for (int k = 0; k < old_n; k++) {
+        struct undoLine *l = &b->lines[b->nlines++];
+
+        if (lines) {
+            *l = lines[k];
+        } else {
+            l->size = EC.row[at + k].size;
+            l->chars = malloc(l->size + 1);
+            memcpy(l->chars, editorRowText(&EC.row[at + k], &EC.pack_cache), l->size);
+            l->chars[l->size] = '\0';
+            EC.mem_grown += l->size + 1;
+        }
+    }
+}
+
+// Saves rows [at, at + old_n) before an edit turns them into new_n rows
+void editorUndoRecord(int at, int old_n, int new_n) {
+    struct undoBatch *b = EC.nundo ? &EC.undo[EC.nundo - 1] : NULL;
+
+    // Typing into a row the last step already saved needs no new snapshot
+    if (b && b->typing && old_n == 1 && new_n == 1) {
+        struct undoStep *s = &b->steps[b->nsteps - 1];
+
+        if (at >= s->at && at < s->at + s->new_n) { return; }
+    }
+
+    editorUndoAddStep(editorUndoBegin(1), at, old_n, new_n, NULL);
+}
+
+static int editorCompareInt(const void *a, const void *b) {
+    return *(const int *) a - *(const int *) b;
+}
+
+// Rehighlights rows whose text was swapped back in place
+static void editorUndoFlush(int *rows, int *n) {
+    qsort(rows, *n, sizeof(int), editorCompareInt);
+    editorUpdateRows(rows, *n);
+    *n = 0;
+}
+
+// Reverts the last batch of edits
+void editorUndo() {
+    if (EC.nundo == 0) {
+        editorSetStatusMessage("%s | Status: Nothing to undo | v%s", DEFAULT_MSG, VERSION);
+        return;
+    }
+
+    editorJournal(JOURNAL_UNDO, 0, 0, NULL, 0, 0);
+
+    struct undoBatch *b = &EC.undo[--EC.nundo];
+    int *rows = malloc(sizeof(int) * (b->nlines ? b->nlines : 1));
+    int nrows = 0;
+
+    for (int s = b->nsteps - 1; s >= 0; s--) {
+        struct undoStep *step = &b->steps[s];
+        struct undoLine *lines = &b->lines[step->line];
+
+        if (step->old_n == step->new_n) {
+            for (int k = 0; k < step->old_n; k++) {
+                erow *row = &EC.row[step->at + k];
+
+                editorRowFreeText(row);
+                row->chars = lines[k].chars;
+                row->size = lines[k].size;
+                lines[k].chars = NULL;
+                rows[nrows++] = row->idx;
+            }
+
+            continue;
+        }
+
+        // Rows are about to shift, so settle the swapped ones first
+        editorUndoFlush(rows, &nrows);
+
+        editorDelRows(step->at, step->new_n);
+        editorInsertRows(step->at, lines, step->old_n);
+
+        for (int k = 0; k < step->old_n; k++) { lines[k].chars = NULL; }
+    }
+
+    editorUndoFlush(rows, &nrows);
+    free(rows);
+
+    EC.ypos = b->ypos < EC.numrows ? b->ypos : EC.numrows;
+    EC.xpos = (EC.ypos < EC.numrows && b->xpos <= EC.row[EC.ypos].size) ? b->xpos : 0;
+    EC.dirty++;
+
+    editorUndoFreeBatch(b);
+}
+
+// Inserts a byte into a row's text without rebuilding the row
+static void editorRowInsertByte(erow *row, int at, int c) {
+    editorRowOwn(row);
+    row->chars = realloc(row->chars, row->size + 2);
+    memmove(&row->chars[at + 1], &row->chars[at], row->size - at + 1);
+    row->size++;
+    row->chars[at] = c;
+}
+
+// Inserts a single character into the editor row
+void editorRowInsertChar(erow *row, int at, int c) {
+    if (at < 0 || at > row->size) {
+        at = row->size;
+    }
+
+    editorRowInsertByte(row, at, c);
+    editorUpdateRow(row);
+    EC.dirty++;
+}
+
+void editorRowAppendStr(erow *row, char *s, size_t len) {
+    editorRowOwn(row);
+    row->chars = realloc(row->chars, row->size + len + 1);
+    memcpy(&row->chars[row->size], s, len);
+    row->size += len;
+    row->chars[row->size] = '\0';
+    editorUpdateRow(row);
+    EC.dirty++;
+}
+
+void editorInsertNewLine() {
+    editorJournal(JOURNAL_NEWLINE, EC.ypos, EC.xpos, NULL, 0, 0);
+
+    if (EC.xpos == 0) {
+        editorUndoRecord(EC.ypos, 0, 1);
+        editorInsertRow(EC.ypos, "", 0);
+    } else {
+        editorUndoRecord(EC.ypos, 1, 2);
+        erow *row = &EC.row[EC.ypos];
+        editorInsertRow(EC.ypos + 1, &row->chars[EC.xpos], row->size - EC.xpos);
+        row = &EC.row[EC.ypos];
+        editorRowOwn(row);
+        row->size = EC.xpos;
+        row->chars[row->size] = '\0';
+        editorUpdateRow(row);
+    }
+
+    EC.ypos++;
+    EC.xpos = 0;
+}
+
+// Removes the character starting at byte at from a row's text without rebuilding the row
+static void editorRowCutChar(erow *row, int at) {
+    int n = utf8Next(row->chars, row->size, at) - at;
+
+    editorRowOwn(row);
+    memmove(&row->chars[at], &row->chars[at + n], row->size - at - n + 1);
+    row->size -= n;
+}
+
+// Deletes the whole character (including any combining marks) starting at byte at
+void editorRowDelChar(erow *row, int at) {
+    if (at < 0 || at >= row->size) { return; }
+
+    editorRowCutChar(row, at);
+    editorUpdateRow(row);
+    EC.dirty++;
+}
+
+void editorInsertChar(int c) {
+    char ch = c;
+
+    editorJournal(JOURNAL_INSERT, EC.ypos, EC.xpos, &ch, 1, 1);
+
+    if (EC.ypos == EC.numrows) {
+        editorUndoRecord(EC.numrows, 0, 1);
+        editorInsertRow(EC.numrows, "", 0);
+    } else {
+        editorUndoRecord(EC.ypos, 1, 1);
+    }
+
+    editorRowInsertChar(&EC.row[EC.ypos], EC.xpos, c);
+    EC.xpos++;
+}
+
+// Deletes the character when a backspace is detected
+void editorDelChar() {
+    if (EC.ypos == EC.numrows) { return; }
+    if (EC.xpos == 0 && EC.ypos == 0) { return; }
+
+    editorJournal(JOURNAL_DELETE, EC.ypos, EC.xpos, NULL, 0, 0);
+
+    erow *row = &EC.row[EC.ypos];
+
+    if (EC.xpos > 0) {
+        int prev = utf8Prev(row->chars, row->size, EC.xpos);
+        editorUndoRecord(EC.ypos, 1, 1);
+        editorRowDelChar(row, prev);
+        EC.xpos = prev;
+    } else {
+        editorUndoRecord(EC.ypos - 1, 2, 1);
+        EC.xpos = EC.row[EC.ypos - 1].size;
+        editorRowAppendStr(&EC.row[EC.ypos - 1], row->chars, row->size);
+        editorDelRow(EC.ypos);
+        EC.ypos--;
+    }
+}
+
+/*
+Multi-cursor editing
+
+Ctrl+Up/Down stack extra cursors in a column above or below the others. A
+key typed while there are extra cursors is applied at every cursor as one
+batch: each row's text is edited, then all of them are rebuilt and
+highlighted together by editorUpdateRows, and the screen is drawn once.
+Backspace and Delete don't join lines here; keys that move between rows or
+change them clear the extra cursors first.
+*/
+
+void editorClearCursors() {
+    EC.ncursors = 0;
+}
+
+// Adds a cursor on the row above the topmost (dir < 0) or below the bottommost one, and moves there
+void editorAddCursor(int dir) {
+    if (EC.ypos >= EC.numrows) { return; }
+
+    if (EC.ncursors == 0) { EC.cursor_rx = editorRowXposToRx(&EC.row[EC.ypos], EC.xpos); }
+
+    int top = EC.ypos, bottom = EC.ypos;
+
+    if (EC.ncursors && EC.cursors[0].ypos < top) { top = EC.cursors[0].ypos; }
+    if (EC.ncursors && EC.cursors[EC.ncursors - 1].ypos > bottom) { bottom = EC.cursors[EC.ncursors - 1].ypos; }
+
+    int at = (dir < 0) ? (top > 0 ? editorStepRow(top, -1) : -1) : editorStepRow(bottom, 1);
+
+    if (at < 0 || at >= EC.numrows) { return; }
+
+    // The current cursor stays behind as an extra one; the new one becomes current
+    int k = 0;
+
+    while (k < EC.ncursors && EC.cursors[k].ypos < EC.ypos) { k++; }
+
+    EC.cursors = realloc(EC.cursors, sizeof(struct editorCursor) * (EC.ncursors + 1));
+    memmove(&EC.cursors[k + 1], &EC.cursors[k], sizeof(struct editorCursor) * (EC.ncursors - k));
+    EC.cursors[k].xpos = EC.xpos;
+    EC.cursors[k].ypos = EC.ypos;
+    EC.ncursors++;
+
+    EC.ypos = at;
+    EC.xpos = editorRowRxToXpos(&EC.row[at], EC.cursor_rx);
+}
+
+// Rows of all cursors in ascending order, with where each one's xpos lives. Returns how many.
+static int editorCursorRows(int *rows, int **xs) {
+    int n = 0;
+    int placed = (EC.ypos >= EC.numrows);
+
+    for (int k = 0; k <= EC.ncursors; k++) {
+        if (!placed && (k == EC.ncursors || EC.ypos < EC.cursors[k].ypos)) {
+            rows[n] = EC.ypos;
+            xs[n++] = &EC.xpos;
+            placed = 1;
+        }
+
+        if (k < EC.ncursors) {
+            rows[n] = EC.cursors[k].ypos;
+            xs[n++] = &EC.cursors[k].xpos;
+        }
+    }
+
+    return n;
+}
+
+// Types key at every cursor (a byte, BACKSPACE or DEL_KEY)
+void editorMultiEdit(int key) {
+    int total = EC.ncursors + 1;
+    struct editorCursor *all = malloc(sizeof(struct editorCursor) * total);
+    int *rows = malloc(sizeof(int) * total);
+    int **xs = malloc(sizeof(int *) * total);
+
+    all[0].xpos = EC.xpos;
+    all[0].ypos = EC.ypos;
+    memcpy(&all[1], EC.cursors, sizeof(struct editorCursor) * EC.ncursors);
+    editorJournal(JOURNAL_MULTI, 0, key, (const char *) all, sizeof(struct editorCursor) * total, 0);
+    free(all);
+
+    int n = editorCursorRows(rows, xs);
+
+    // More keys at the same cursors go into the batch the first one started
+    struct undoBatch *b = EC.nundo ? &EC.undo[EC.nundo - 1] : NULL;
+    int merge = b && b->multi && b->nsteps == n;
+
+    for (int k = 0; merge && k < n; k++) { merge = (b->steps[k].at == rows[k]); }
+
+    if (!merge) {
+        b = editorUndoBegin(0);
+        b->multi = 1;
+        editorUndoReserve(b, n, n);
+
+        for (int k = 0; k < n; k++) { editorUndoAddStep(b, rows[k], 1, 1, NULL); }
+    }
+
+    for (int k = 0; k < n; k++) {
+        erow *row = &EC.row[rows[k]];
+        int x = *xs[k];
+
+        if (key == BACKSPACE || key == CTRL_KEY('h')) {
+            if (x > 0) {
+                *xs[k] = utf8Prev(row->chars, row->size, x);
+                editorRowCutChar(row, *xs[k]);
+            }
+        } else if (key == DEL_KEY) {
+            if (x < row->size) { editorRowCutChar(row, x); }
+        } else {
+            editorRowInsertByte(row, x, key);
+            (*xs[k])++;
+        }
+    }
+
+    editorUpdateRows(rows, n);
+    EC.dirty++;
+
+    free(rows);
+    free(xs);
+}
+
+static int editorCursorStep(erow *row, int xpos, int key) {
+    if (row == NULL) { return 0; }
+
+    switch (key) {
+        case ARROW_LEFT: return xpos > 0 ? utf8Prev(row->chars, row->size, xpos) : 0;
+        case ARROW_RIGHT: return xpos < row->size ? utf8Next(row->chars, row->size, xpos) : xpos;
+        case HOME_KEY: return 0;
+        case END_KEY: return row->size;
+    }
+
+    return xpos;
+}
+
+/*
+Handles a key while there are extra cursors. Returns 0 if it's left to the
+normal handling (having cleared the extra cursors if the key would move or
+edit across rows).
+*/
+int editorMultiKey(int key) {
+    switch (key) {
+        case ARROW_LEFT:
+        case ARROW_RIGHT:
+        case HOME_KEY:
+        case END_KEY:
+            EC.xpos = editorCursorStep(EC.ypos < EC.numrows ? &EC.row[EC.ypos] : NULL, EC.xpos, key);
+
+            for (int k = 0; k < EC.ncursors; k++) {
+                struct editorCursor *c = &EC.cursors[k];
+                c->xpos = editorCursorStep(&EC.row[c->ypos], c->xpos, key);
+            }
+
+            return 1;
+        case '\x1b':
+            editorClearCursors();
+            return 1;
+        case CTRL_KEY('x'):
+        case CTRL_KEY('s'):
+        case CTRL_KEY('l'):
+        case CTRL_KEY('c'):
+        case CTRL_KEY('w'):
+        case CTRL_KEY('p'):
+        case CTRL_KEY('t'):
+        case ADD_CURSOR_UP:
+        case ADD_CURSOR_DOWN:
+            return 0;
+        case '\r':
+        case CTRL_KEY('q'):
+        case CTRL_KEY('r'):
+        case CTRL_KEY('z'):
+        case CTRL_KEY('g'):
+        case CTRL_KEY(']'):
+        case CTRL_KEY('e'):
+        case CTRL_KEY('f'):
+        case CTRL_KEY('n'):
+        case ARROW_UP:
+        case ARROW_DOWN:
+        case PAGE_UP:
+        case PAGE_DOWN:
+        case FILE_START:
+        case FILE_END:
+        case CTRL_KEY('b'):
+        case CTRL_KEY('k'):
+        case CTRL_KEY('v'):
+        case SELECT_UP:
+        case SELECT_DOWN:
+        case SELECT_LEFT:
+        case SELECT_RIGHT:
+            editorClearCursors();
+            return 0;
+        default:
+            editorMultiEdit(key);
+            return 1;
+    }
+}
+
+// Extra cursor on row at, or NULL
+struct editorCursor *editorCursorAt(int at) {
+    int lo = 0, hi = EC.ncursors;
+
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+
+        if (EC.cursors[mid].ypos < at) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return (lo < EC.ncursors && EC.cursors[lo].ypos == at) ? &EC.cursors[lo] : NULL;
+}
+
+/*
+Selection and clipboard
+
+^B (or Shift+arrows) starts a selection at the cursor. The clipboard keeps
+lines pointing into shared text: lines the file or an earlier paste
+already hold are referenced, and only edited lines are copied, into one
+block. Pasting points the whole lines in the middle at that same text and
+inserts them with one move of the row array; cutting moves the removed
+rows into the undo history instead of copying them.
+*/
+
+void editorClearSelection() {
+    EC.sel_active = 0;
+}
+
+// The selection in order. Returns 0 if there's nothing selected.
+int editorSelection(int *y0, int *x0, int *y1, int *x1) {
+    if (!EC.sel_active || EC.numrows == 0) { return 0; }
+
+    int ay = EC.sel_y, ax = EC.sel_x, by = EC.ypos, bx = EC.xpos;
+
+    // The empty line past the end stands for the end of the last row
+    if (ay >= EC.numrows) { ay = EC.numrows - 1; ax = EC.row[ay].size; }
+    if (by >= EC.numrows) { by = EC.numrows - 1; bx = EC.row[by].size; }
+
+    if (ay > by || (ay == by && ax > bx)) {
+        int t = ay; ay = by; by = t;
+        t = ax; ax = bx; bx = t;
+    }
+
+    *y0 = ay;
+    *x0 = ax;
+    *y1 = by;
+    *x1 = bx;
+
+    return ay != by || ax != bx;
+}
+
+static void editorFreeClip() {
+    for (int l = 0; l < EC.nclip; l++) { editorFreeText(EC.clip[l].chars); }
+
+    free(EC.clip);
+    EC.clip = NULL;
+    EC.nclip = 0;
+}
+
+// Copies the selection to the clipboard
+void editorCopy() {
+    int y0, x0, y1, x1;
+
+    if (!editorSelection(&y0, &x0, &y1, &x1)) { return; }
+
+    editorFreeClip();
+    EC.nclip = y1 - y0 + 1;
+
+    // The clipboard shares the rows' text
+    for (int y = y0; y <= y1; y++) { editorRowUnpack(&EC.row[y]); }
+    EC.clip = malloc(sizeof(struct undoLine) * EC.nclip);
+
+    size_t copy_len = 0;
+    int ncopy = 0;
+
+    for (int l = 0; l < EC.nclip; l++) {
+        erow *row = &EC.row[y0 + l];
+        int start = (l == 0) ? x0 : 0;
+
+        EC.clip[l].chars = row->chars + start;
+        EC.clip[l].size = ((l == EC.nclip - 1) ? x1 : row->size) - start;
+
+        // Empty lines go into the block too, so no line points just past the end of some text
+        if (!editorTextShared(row->chars) || EC.clip[l].size == 0) {
+            copy_len += EC.clip[l].size + 1;
+            ncopy++;
+        } else {
+            editorTextRef(EC.clip[l].chars);
+        }
+    }
+
+    if (ncopy) {
+        char *p = malloc(copy_len);
+        char *block = p;
+        int *copy = malloc(sizeof(int) * ncopy);
+        int c = 0;
+
+        for (int l = 0; l < EC.nclip; l++) {
+            if (!editorTextShared(EC.clip[l].chars) || EC.clip[l].size == 0) { copy[c++] = l; }
+        }
+
+        for (c = 0; c < ncopy; c++) {
+            struct undoLine *line = &EC.clip[copy[c]];
+
+            memcpy(p, line->chars, line->size);
+            p[line->size] = '\n';
+            line->chars = p;
+            p += line->size + 1;
+        }
+
+        editorAdoptBlock(block, copy_len, ncopy);
+        free(copy);
+    }
+
+    editorSetStatusMessage("%s | Status: Copied %d lines | v%s", DEFAULT_MSG, EC.nclip, VERSION);
+}
+
+// Removes the text from y0, x0 up to y1, x1 as one undo step
+void editorDeleteRange(int y0, int x0, int y1, int x1) {
+    int32_t end[2] = {y1, x1};
+    int n = y1 - y0 + 1;
+
+    editorJournal(JOURNAL_CUT, y0, x0, (const char *) end, sizeof(end), 0);
+
+    for (int y = y0; y <= y1; y++) { editorRowUnpack(&EC.row[y]); }
+
+    erow *first = &EC.row[y0];
+    erow *last = &EC.row[y1];
+    int size = x0 + last->size - x1;
+    char *chars = malloc(size + 1);
+
+    memcpy(chars, first->chars, x0);
+    memcpy(chars + x0, last->chars + x1, last->size - x1);
+    chars[size] = '\0';
+
+    // The removed rows' text goes to the undo history as it is
+    struct undoLine *old = malloc(sizeof(struct undoLine) * n);
+
+    for (int k = 0; k < n; k++) {
+        old[k].chars = EC.row[y0 + k].chars;
+        old[k].size = EC.row[y0 + k].size;
+        EC.row[y0 + k].chars = NULL;
+    }
+
+    editorUndoAddStep(editorUndoBegin(0), y0, n, 1, old);
+    free(old);
+
+    first->chars = chars;
+    first->size = size;
+    editorDelRows(y0 + 1, n - 1);
+    editorUpdateRow(&EC.row[y0]);
+    EC.dirty++;
+
+    EC.ypos = y0;
+    EC.xpos = x0;
+}
+
+void editorCut() {
+    int y0, x0, y1, x1;
+
+    if (!editorSelection(&y0, &x0, &y1, &x1)) { return; }
+
+    editorCopy();
+    editorDeleteRange(y0, x0, y1, x1);
+    editorClearSelection();
+}
+
+// Inserts lines at the cursor (as one undo step). Lines must point into shared text.
+void editorPasteLines(const struct undoLine *lines, int n) {
+    if (n == 0) { return; }
+
+    if (!EC.journal_off && EC.filename) {
+        size_t len = n - 1;
+
+        for (int l = 0; l < n; l++) { len += lines[l].size; }
+
+        char *joined = malloc(len ? len : 1);
+        char *p = joined;
+
+        for (int l = 0; l < n; l++) {
+            memcpy(p, lines[l].chars, lines[l].size);
+            p += lines[l].size;
+
+            if (l < n - 1) { *p++ = '\n'; }
+        }
+
+        editorJournal(JOURNAL_PASTE, EC.ypos, EC.xpos, joined, len, 0);
+        free(joined);
+    }
+
+    int y = EC.ypos;
+    int x = EC.xpos;
+
+    if (y == EC.numrows) {
+        editorUndoAddStep(editorUndoBegin(0), y, 0, n, NULL);
+        editorInsertRow(y, "", 0);
+        x = 0;
+    } else {
+        editorUndoAddStep(editorUndoBegin(0), y, 1, n, NULL);
+    }
+
+    erow *row = &EC.row[y];
+    int first_len = lines[0].size;
+
+    editorRowOwn(row);
+
+    if (n == 1) {
+        row->chars = realloc(row->chars, row->size + first_len + 1);
+        memmove(&row->chars[x + first_len], &row->chars[x], row->size - x + 1);
+        memcpy(&row->chars[x], lines[0].chars, first_len);
+        row->size += first_len;
+        editorUpdateRow(row);
+
+        EC.xpos = x + first_len;
+        EC.dirty++;
+        return;
+    }
+
+    // Whole lines are shared; only the two that join the row's own text are copied
+    struct undoLine *rest = malloc(sizeof(struct undoLine) * (n - 1));
+    const struct undoLine *tail = &lines[n - 1];
+
+    for (int l = 1; l < n - 1; l++) {
+        rest[l - 1] = lines[l];
+        editorTextRef(lines[l].chars);
+    }
+
+    rest[n - 2].size = tail->size + row->size - x;
+    rest[n - 2].chars = malloc(rest[n - 2].size + 1);
+    memcpy(rest[n - 2].chars, tail->chars, tail->size);
+    memcpy(rest[n - 2].chars + tail->size, &row->chars[x], row->size - x);
+    rest[n - 2].chars[rest[n - 2].size] = '\0';
+
+    row->chars = realloc(row->chars, x + first_len + 1);
+    memcpy(&row->chars[x], lines[0].chars, first_len);
+    row->size = x + first_len;
+    row->chars[row->size] = '\0';
+    editorUpdateRow(row);
+
+    editorInsertRows(y + 1, rest, n - 1);
+    free(rest);
+
+    EC.ypos = y + n - 1;
+    EC.xpos = tail->size;
+    EC.dirty++;
+}
+
+void editorPaste() {
+    if (EC.nclip == 0) {
+        editorSetStatusMessage("%s | Status: Clipboard is empty | v%s", DEFAULT_MSG, VERSION);
+        return;
+    }
+
+    editorPasteLines(EC.clip, EC.nclip);
+}
+
+// Bytes the rows take in the file
+size_t editorRowsLength() {
+    size_t len = 0;
+
+    for (int j = 0; j < EC.numrows; j++) {
+        len += EC.row[j].size + 1;
+    }
+
+    return len;
+}
+
+static int editorWriteAll(int fd, const char *buf, size_t n) {
+    while (n > 0) {
+        ssize_t w = write(fd, buf, n);
+
+        if (w == -1) {
+            if (errno == EINTR) { continue; }
+            return -1;
+        }
+
+        buf += w;
+        n -= w;
+    }
+
+    return 0;
+}
+
+/*
+Writes the rows to fd a chunk at a time, so saving never needs a second copy
+of the whole file in memory (packed rows are unpacked one block at a time).
+Returns -1 with errno set if a write fails.
+*/
+int editorWriteRows(int fd) {
+    char *buf = malloc(SAVE_CHUNK);
+    size_t used = 0;
+    int ret = 0;
+
+    for (int j = 0; j < EC.numrows && ret == 0; j++) {
+        const char *text = editorRowText(&EC.row[j], &EC.pack_cache);
+        size_t size = EC.row[j].size;
+
+        if (used + size + 1 > SAVE_CHUNK) {
+            ret = editorWriteAll(fd, buf, used);
+            used = 0;
+        }
+
+        if (size + 1 > SAVE_CHUNK) {
+            // Too long to buffer: straight out
+            if (ret == 0) { ret = editorWriteAll(fd, text, size); }
+        } else {
+            memcpy(buf + used, text, size);
+            used += size;
+        }
+
+        buf[used++] = '\n';
+    }
+
+    if (ret == 0) { ret = editorWriteAll(fd, buf, used); }
+
+    free(buf);
+    return ret;
+}
+
+// Identifies the syntax rules multi-line comment states depend on (0: no syntax)
+static uint64_t editorSyntaxSig() {
+    if (EC.syntax == NULL) { return 0; }
+
+    const char *parts[] = {EC.syntax->filetype, EC.syntax->singleline_comment_s, EC.syntax->multiline_comment_s,
+                           EC.syntax->multiline_comment_e, EC.syntax->quotes};
+    uint64_t h = 0xcbf29ce484222325ULL;
+
+    for (unsigned int i = 0; i < sizeof(parts) / sizeof(parts[0]); i++) {
+        h = lineCacheHash(h, parts[i] ? parts[i] : "", parts[i] ? strlen(parts[i]) + 1 : 1);
+    }
+
+    h = lineCacheHash(h, &EC.syntax->flags, sizeof(EC.syntax->flags));
+
+    return h | 1;
+}
+
+// Splits the mapped file into rows, one per line without its line ending
+static void editorIndexText() {
+    const char *text = EC.text;
+    size_t len = EC.textlen;
+    size_t lines = (text[len - 1] != '\n');
+
+    for (size_t off = 0; off < len; off += 1 << 30) {
+        lines += remCountByte(text + off, (len - off < (1 << 30)) ? (int) (len - off) : (1 << 30), '\n');
+    }
+
+    EC.row = malloc(sizeof(erow) * lines);
+
+    size_t start = 0;
+    int n = 0;
+
+    while (start < len) {
+        const char *nl = memchr(text + start, '\n', len - start);
+        size_t end = nl ? (size_t) (nl - text) : len;
+        size_t size = end;
+
+        while (size > start && text[size - 1] == '\r') { size--; }
+
+        editorInitRow(&EC.row[n], n, (char *) text + start, size - start);
+        n++;
+        start = end + 1;
+    }
+
+    EC.numrows = n;
+}
+
+// Takes the rows (and their syntax states) from the line cache. Returns 0 on a miss.
+static int editorOpenCached() {
+    struct lineCache c;
+
+    if (lineCacheOpen(&c, EC.filename, &EC.file_st, EC.file_fingerprint) != 0) { return 0; }
+
+    const unsigned char *p = c.rows;
+    size_t off = 0;
+    uint64_t n = 0;
+    int size, strip;
+
+    EC.row = malloc(sizeof(erow) * (c.nrows ? c.nrows : 1));
+
+    while (n < c.nrows && lineCacheNextRow(&c, &p, &size, &strip) && off + size + strip <= EC.textlen) {
+        editorInitRow(&EC.row[n], n, EC.text + off, size);
+        off += size + strip;
+        n++;
+    }
+
+    if (n != c.nrows || off != EC.textlen) {
+        free(EC.row);
+        EC.row = NULL;
+        lineCacheClose(&c);
+        return 0;
+    }
+
+    EC.numrows = n;
+
+    if (EC.syntax == NULL) {
+        EC.cache_pending = 0;
+    } else if (c.states && c.syntax_sig == editorSyntaxSig()) {
+        for (uint64_t i = 0; i < n; i++) {
+            EC.row[i].multi_syntax_hl = (c.states[i >> 3] >> (i & 7)) & 1;
+        }
+
+        EC.hl_valid = n;
+        EC.cache_pending = 0;
+    }
+
+    lineCacheClose(&c);
+
+    return 1;
+}
+
+// Writes the line cache for the file as it is on disk (rows must match it, so only when not dirty)
+static void editorSaveCache() {
+    struct stat st;
+
+    if (EC.filename == NULL || stat(EC.filename, &st) == -1) { return; }
+
+    // Changed behind our back since it was read or written
+    if (st.st_size != EC.file_st.st_size || st.st_mtim.tv_sec != EC.file_st.st_mtim.tv_sec ||
+        st.st_mtim.tv_nsec != EC.file_st.st_mtim.tv_nsec) {
+        return;
+    }
+
+    size_t cap = (size_t) EC.numrows * 2 + 64;
+    size_t len = 0;
+    unsigned char *rows = malloc(cap);
+    unsigned char *states = EC.syntax ? calloc((EC.numrows + 7) / 8 + 1, 1) : NULL;
+
+    for (int i = 0; i < EC.numrows; i++) {
+        erow *row = &EC.row[i];
+        int strip = 1;
+
+        // Straight after opening, line endings are whatever separates the rows in the file
+        if (EC.text_layout) {
+            const char *next = (i + 1 < EC.numrows) ? EC.row[i + 1].chars : EC.text + EC.textlen;
+            strip = next - (row->chars + row->size);
+        }
+
+        if (cap - len < 20) {
+            cap *= 2;
+            rows = realloc(rows, cap);
+        }
+
+        len += lineCachePutRow(&rows[len], row->size, strip);
+
+        if (states && row->multi_syntax_hl) { states[i >> 3] |= 1 << (i & 7); }
+    }
+
+    lineCacheSave(EC.filename, &st, EC.file_fingerprint, editorSyntaxSig(), EC.numrows, rows, len, states);
+
+    free(rows);
+    free(states);
+}
+
+/*
+Points rows at a copy of a mapped file, so the file itself can be rewritten.
+The copy is shared text like any other, so it goes once every row using it
+has been edited or packed.
+*/
+void editorDetachText() {
+    if (!EC.text_mapped) { return; }
+
+    char *copy = malloc(EC.textlen);
+    int refs = 0;
+
+    memcpy(copy, EC.text, EC.textlen);
+
+    for (int i = 0; i < EC.numrows; i++) {
+        if (editorInText(EC.row[i].chars)) {
+            EC.row[i].chars = copy + (EC.row[i].chars - EC.text);
+            refs++;
+        }
+    }
+
+    for (int u = 0; u < EC.nundo; u++) {
+        for (int l = 0; l < EC.undo[u].nlines; l++) {
+            struct undoLine *line = &EC.undo[u].lines[l];
+
+            if (editorInText(line->chars)) {
+                line->chars = copy + (line->chars - EC.text);
+                refs++;
+            }
+        }
+    }
+
+    for (int l = 0; l < EC.nclip; l++) {
+        if (editorInText(EC.clip[l].chars)) {
+            EC.clip[l].chars = copy + (EC.clip[l].chars - EC.text);
+            refs++;
+        }
+    }
+
+    munmap(EC.text, EC.textlen);
+
+    if (refs) {
+        editorAdoptBlock(copy, EC.textlen, refs);
+    } else {
+        free(copy);
+    }
+
+    EC.text = NULL;
+    EC.textlen = 0;
+    EC.text_mapped = 0;
+    EC.text_layout = 0;
+}
+
+/*
+Compressed files
+
+A gzip or zstd file is decompressed on a background thread (see
+utils/zipstream.h) and shown read-only. Each chunk of lines it hands over
+becomes a packed block holding their text, and its rows are added at the
+end, so the top of the file can be read while the rest comes in. Trimming
+drops that text like it packs other rows, and it's decompressed again from
+the nearest checkpoint when it's next read. Once it's all in, the
+checkpoints and line lengths are kept as a seek index, so opening the file
+again lays out every row straight away.
+*/
+
+// Adds a chunk's lines as rows at the end of the file, in a block of their own
+static void editorZipAppend(struct zipChunk *c) {
+    if (c->nlines == 0) {
+        free(c->text);
+        free(c->lines);
+        return;
+    }
+
+    int id = editorPackAlloc();
+    struct packBlock *b = &EC.packs[id];
+
+    b->data = c->text;
+    b->zlen = c->text ? c->len : 0;
+    b->len = c->len;
+    b->rows = c->nlines;
+    b->zoff = c->off;
+    EC.packed_bytes += b->zlen;
+
+    int at = EC.numrows;
+
+    EC.row = realloc(EC.row, sizeof(erow) * (EC.numrows + c->nlines));
+
+    for (int k = 0; k < c->nlines; k++) {
+        erow *row = &EC.row[at + k];
+
+        editorInitRow(row, at + k, NULL, c->lines[k].size);
+        row->packed = id + 1;
+        row->packoff = c->lines[k].off;
+    }
+
+    EC.numrows += c->nlines;
+    EC.mem_grown += b->zlen + sizeof(erow) * c->nlines;
+    EC.lineidx_valid = 0;
+    EC.wrapidx_valid = 0;
+    EC.brackets_valid = 0;
+
+    free(c->lines);
+}
+
+// Takes the rows decompressed since the last call. Returns 1 if the screen needs drawing again.
+int editorZipPoll() {
+    if (EC.zip == NULL || EC.zip_done) { return 0; }
+
+    // Checked first, so no chunk handed over before it finished is missed
+    int done = zipStreamDone(EC.zip);
+    struct zipChunk *chunks;
+    int n = zipTake(EC.zip, &chunks);
+
+    for (int i = 0; i < n; i++) { editorZipAppend(&chunks[i]); }
+
+    free(chunks);
+
+    if (done == 0) {
+        int shown = EC.zip_shown;
+
+        EC.zip_shown = zipProgress(EC.zip);
+        return n > 0 || EC.zip_shown != shown;
+    }
+
+    EC.zip_done = done;
+
+    if (done == -1) {
+        editorSetStatusMessage("%s | Status: Compressed data damaged after line %d | v%s", DEFAULT_MSG, EC.numrows, VERSION);
+    } else if (!EC.zip->indexed && EC.zip->out_len >= LINECACHE_MIN_SIZE) {
+        zipIndexSave(EC.zip, EC.filename, &EC.file_st, EC.file_fingerprint);
+    }
+
+    return 1;
+}
+
+int editorZipRunning() {
+    return EC.zip && !EC.zip_done;
+}
+
+// Opens a mapped compressed file: from its seek index if it has one, else by decompressing it in the background
+static void editorOpenCompressed(int fd, unsigned char *map, int kind) {
+    size_t len = EC.file_st.st_size;
+
+    EC.file_fingerprint = lineCacheFingerprint(fd, len);
+    EC.zip = zipIndexLoad(EC.filename, &EC.file_st, EC.file_fingerprint, map, len, kind);
+
+    if (EC.zip == NULL) { EC.zip = zipStreamStart(map, len, kind); }
+
+    EC.zip_done = 0;
+    EC.zip_shown = -1;
+
+    // Batch scripts need every row from the start
+    if (EC.batch) { zipStreamWait(EC.zip); }
+
+    editorZipPoll();
+}
+
+/*
+Maps the file and points each row at its line, so nothing is copied and
+render/highlighting are only built for rows that get drawn. Big files
+reuse the line cache when it's still valid.
+*/
+void editorOpen(char *filename) {
+    free(EC.filename);
+    EC.filename = strdup(filename);
+
+    editorSetSyntaxHl();
+
+    int fd = open(filename, O_RDONLY);
+
+    if (fd == -1 || fstat(fd, &EC.file_st) == -1) {
+        destroy("fopen");
+    }
+
+    void *map = MAP_FAILED;
+
+    if (S_ISREG(EC.file_st.st_mode) && EC.file_st.st_size > 0) {
+        map = mmap(NULL, EC.file_st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+
+    if (map != MAP_FAILED) {
+        int kind = zipDetect(map, EC.file_st.st_size);
+
+        if (kind != ZIP_NONE) {
+            editorOpenCompressed(fd, map, kind);
+            close(fd);
+            return;
+        }
+
+        EC.text = map;
+        EC.textlen = EC.file_st.st_size;
+        EC.text_mapped = 1;
+
+        // Binary: shown in hex from the mapping, no rows
+        if (hexIsBinary(EC.text, EC.textlen < HEX_SNIFF ? EC.textlen : HEX_SNIFF)) {
+            EC.hex = 1;
+            close(fd);
+            return;
+        }
+
+        EC.text_layout = 1;
+
+        if (EC.textlen >= LINECACHE_MIN_SIZE) {
+            EC.file_fingerprint = lineCacheFingerprint(fd, EC.textlen);
+            EC.cache_pending = 1;
+        }
+
+        if (!EC.cache_pending || !editorOpenCached()) {
+            editorIndexText();
+        }
+
+        close(fd);
+        EC.dirty = 0;
+        EC.mem_grown += sizeof(erow) * EC.numrows;
+        return;
+    }
+
+    FILE *filepath = fdopen(fd, "r");
+
+    if (!filepath) {
+        destroy("fopen");
+    }
+
+    char *line = NULL;
+    size_t linecap = 0;
+    ssize_t line_len;
+
+    while ((line_len = getline(&line, &linecap, filepath)) != -1) {
+        while (line_len > 0 && (line[line_len - 1] == '\n' ||
+                                line[line_len - 1] == '\r')) {
+            line_len--;
+        }
+
+        editorInsertRow(EC.numrows, line, line_len);
+    }
+
+    free(line);
+    fclose(filepath);
+    EC.dirty = 0;
+    EC.mem_grown += sizeof(erow) * EC.numrows;
+}
+
+/*
+Saving
+
+A save patches the file in place when it can: rows still pointing at their
+own bytes in the mapped file are already on disk, so only the runs of rows
+that aren't get written (with pwrite), and the file is cut or extended to
+the new length. That covers edits that keep row lengths and edits near the
+end, however big the file. Past SAVE_PATCH_SHARE of the file, or if the file
+changed on disk, the whole file is written to a temporary one that's renamed
+over it. Files with other hard links, or in directories we can't create
+files in, are rewritten in place as a last resort. Either way the rows are
+then pointed into the file as saved, so the next save can patch it again.
+*/
+
+// Whether a row's bytes (and newline) are in the mapped file at off
+static int editorRowOnDisk(erow *row, size_t off) {
+    return !row->packed && off + row->size < EC.textlen && row->chars == EC.text + off &&
+           EC.text[off + row->size] == '\n';
+}
+
+// Copies what undo steps and the clipboard use of the mapped file, so it can be rewritten or unmapped
+static void editorDetachRefs() {
+    size_t len = 0;
+    int refs = 0;
+
+    for (int u = 0; u < EC.nundo; u++) {
+        for (int l = 0; l < EC.undo[u].nlines; l++) {
+            if (editorInText(EC.undo[u].lines[l].chars)) { len += EC.undo[u].lines[l].size; }
+        }
+    }
+
+    for (int l = 0; l < EC.nclip; l++) {
+        if (editorInText(EC.clip[l].chars)) { len += EC.clip[l].size; }
+    }
+
+    char *copy = malloc(len ? len : 1);
+    char *p = copy;
+
+    for (int u = 0; u < EC.nundo; u++) {
+        for (int l = 0; l < EC.undo[u].nlines; l++) {
+            struct undoLine *line = &EC.undo[u].lines[l];
+
+            if (!editorInText(line->chars)) { continue; }
+
+            memcpy(p, line->chars, line->size);
+            line->chars = p;
+            p += line->size;
+            refs++;
+        }
+    }
+
+    for (int l = 0; l < EC.nclip; l++) {
+        if (!editorInText(EC.clip[l].chars)) { continue; }
+
+        memcpy(p, EC.clip[l].chars, EC.clip[l].size);
+        EC.clip[l].chars = p;
+        p += EC.clip[l].size;
+        refs++;
+    }
+
+    if (refs) {
+        editorAdoptBlock(copy, len ? len : 1, refs);
+    } else {
+        free(copy);
+    }
+}
+
+/*
+Writes only the rows that aren't on disk where they belong. Returns the open
+file, or -1 if the file can't be patched (nothing is lost: the caller then
+writes all of it). *written is set to the bytes written.
+*/
+static int editorSavePatch(size_t len, size_t *written) {
+    struct stat st;
+
+    if (!EC.text_mapped || stat(EC.filename, &st) == -1) { return -1; }
+
+    // Changed behind our back since it was read or written
+    if (st.st_dev != EC.file_st.st_dev || st.st_ino != EC.file_st.st_ino || (size_t) st.st_size != EC.textlen ||
+        st.st_mtim.tv_sec != EC.file_st.st_mtim.tv_sec || st.st_mtim.tv_nsec != EC.file_st.st_mtim.tv_nsec) {
+        return -1;
+    }
+
+    size_t dirty = 0, off = 0;
+
+    for (int j = 0; j < EC.numrows; j++) {
+        if (!editorRowOnDisk(&EC.row[j], off)) { dirty += EC.row[j].size + 1; }
+        off += EC.row[j].size + 1;
+    }
+
+    if (dirty > len / SAVE_PATCH_SHARE) { return -1; }
+
+    int fd = open(EC.filename, O_RDWR);
+
+    if (fd == -1) { return -1; }
+
+    // Nothing may read the bytes about to be overwritten: rows moved within the file get their own copy
+    off = 0;
+
+    for (int j = 0; j < EC.numrows; j++) {
+        if (editorInText(EC.row[j].chars) && !editorRowOnDisk(&EC.row[j], off)) { editorRowOwn(&EC.row[j]); }
+        off += EC.row[j].size + 1;
+    }
+
+    editorDetachRefs();
+
+    char *buf = malloc(SAVE_CHUNK);
+    size_t used = 0, run = 0;
+    int ret = 0;
+
+    off = 0;
+
+    for (int j = 0; j <= EC.numrows && ret == 0; j++) {
+        erow *row = (j < EC.numrows) ? &EC.row[j] : NULL;
+
+        // A run of changed rows ends at a row that's on disk, or when the buffer fills up
+        if (used > 0 && (row == NULL || editorRowOnDisk(row, off) || used + row->size + 1 > SAVE_CHUNK)) {
+            if (pwrite(fd, buf, used, run) != (ssize_t) used) { ret = -1; }
+
+            used = 0;
+        }
+
+        if (row == NULL || ret == -1) { break; }
+
+        if (!editorRowOnDisk(row, off)) {
+            const char *text = editorRowText(row, &EC.pack_cache);
+
+            if (used == 0) { run = off; }
+
+            if ((size_t) row->size + 1 > SAVE_CHUNK) {
+                // Too long to buffer: straight out
+                if (pwrite(fd, text, row->size, off) != row->size || pwrite(fd, "\n", 1, off + row->size) != 1) { ret = -1; }
+            } else {
+                memcpy(buf + used, text, row->size);
+                used += row->size;
+                buf[used++] = '\n';
+            }
+        }
+
+        off += row->size + 1;
+    }
+
+    free(buf);
+
+    if (ret == 0 && len != EC.textlen && ftruncate(fd, len) == -1) { ret = -1; }
+
+    if (ret == -1) {
+        close(fd);
+        return -1;
+    }
+
+    *written = dirty;
+    return fd;
+}
+
+// Writes the file whole to a temporary file renamed over it. Returns the open file, or -1 (errno set).
+static int editorSaveAtomic() {
+    struct stat st;
+    char *path = realpath(EC.filename, NULL);
+    int exists = (path != NULL && stat(path, &st) == 0);
+
+    if (!exists) {
+        free(path);
+        path = strdup(EC.filename);
+    }
+
+    // Renaming over these would break the link, or skip the permission check
+    if (exists && (!S_ISREG(st.st_mode) || st.st_nlink > 1 || access(path, W_OK) == -1)) {
+        free(path);
+        return -1;
+    }
+
+    char *tmp = malloc(strlen(path) + 16);
+    sprintf(tmp, "%s.remXXXXXX", path);
+
+    int fd = mkstemp(tmp);
+    int err = errno;
+
+    if (fd != -1) {
+        mode_t mask = umask(0);
+        umask(mask);
+
+        fchmod(fd, exists ? (st.st_mode & 07777) : (0644 & ~mask));
+
+        if (exists && fchown(fd, st.st_uid, st.st_gid) == -1) {
+            // Not ours to give away: the saved file stays owned by us
+        }
+
+        if (editorWriteRows(fd) == -1 || fsync(fd) == -1 || rename(tmp, path) == -1) {
+            err = errno;
+            unlink(tmp);
+            close(fd);
+            fd = -1;
+        }
+    }
+
+    free(tmp);
+    free(path);
+    errno = err;
+
+    return fd;
+}
+
+// Truncates and rewrites the file where it is. Returns the open file, or -1 (errno set).
+static int editorSaveRewrite(size_t len) {
+    // Rows may still point into the file we're about to overwrite
+    editorDetachText();
+
+    int fo = open(EC.filename, O_RDWR | O_CREAT, 0644); // Create a new file (O_CREAT), open the file for R & W (O_RDWR). Default permissions set to 644 (Owner: RW, Everyone Else: R)
+
+    if (fo == -1) { return -1; }
+
+    // Sets the file length - Safer than O_TRUNC (We can't be losing any data!)
+    if (ftruncate(fo, len) == -1 || editorWriteRows(fo) == -1) {
+        int err = errno;
+
+        close(fo);
+        errno = err;
+        return -1;
+    }
+
+    return fo;
+}
+
+// Maps the file just saved and points every row at its line in it, dropping the copies they held
+static void editorMapSaved(int fd, size_t len) {
+    void *map = (len > 0) ? mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+
+    if (map == MAP_FAILED) {
+        editorDetachText();
+        return;
+    }
+
+    editorDetachRefs();
+
+    size_t off = 0;
+
+    for (int j = 0; j < EC.numrows; j++) {
+        erow *row = &EC.row[j];
+
+        editorRowFreeText(row);
+        row->chars = (char *) map + off;
+        off += row->size + 1;
+    }
+
+    if (EC.text_mapped) { munmap(EC.text, EC.textlen); }
+
+    EC.text = map;
+    EC.textlen = len;
+    EC.text_mapped = 1;
+    EC.text_layout = 1;
+}
+
+// Returns the bytes written, or -1 if the file wasn't saved
+long long editorSave() {
+    // Checks if the file is a new file. Prompts for a new filename.
+    if (EC.filename == NULL) {
+        EC.filename = editorPrompt("Save file as (ESC to cancel): %s", NULL, 0);
+
+        if (EC.filename == NULL) {
+            editorSetStatusMessage("%s | Status: Save Aborted | v%s", DEFAULT_MSG, VERSION);
+            return -1;
+        }
+
+        editorSetSyntaxHl();
+    }
+
+    size_t len = editorRowsLength();
+    size_t written = len;
+    int fo = editorSavePatch(len, &written);
+    int patched = (fo != -1);
+
+    if (fo == -1) { fo = editorSaveAtomic(); }
+    if (fo == -1) { fo = editorSaveRewrite(len); }
+
+    if (fo == -1) {
+        editorSetStatusMessage("%s | Status: Unable to save file: %s | v%s", DEFAULT_MSG, strerror(errno), VERSION); // Notifies of an error is unable to save file
+        return -1;
+    }
+
+    // The swap file is only let go once the file is safely on disk
+    if (fsync(fo) == -1) {
+        editorSetStatusMessage("%s | Status: Unable to save file: %s | v%s", DEFAULT_MSG, strerror(errno), VERSION);
+        close(fo);
+        return -1;
+    }
+
+    fstat(fo, &EC.file_st);
+
+    // Everything journaled is on disk now
+    journalClose(EC.journal, 1);
+    EC.journal = NULL;
+    EC.cache_pending = (len >= LINECACHE_MIN_SIZE);
+
+    if (EC.cache_pending) { EC.file_fingerprint = lineCacheFingerprint(fo, len); }
+
+    editorMapSaved(fo, len);
+    close(fo);
+    EC.dirty = 0;
+
+    if (patched) {
+        editorSetStatusMessage("%s | Status: %zu of %zu bytes written in place | v%s", DEFAULT_MSG, written, len, VERSION);
+    } else {
+        editorSetStatusMessage("%s | Status: %zu bytes written to disk | v%s", DEFAULT_MSG, len, VERSION); // Displays number of bytes written to disk
+    }
+
+    return written;
+}
+
+// Incremental search function
+void editorSearchCallback(char *query, int key) {
+    static int last_match = -1;
+    static int direction = 1;
+    static int save_syn_line;
+    static char *save_syn_hl = NULL;
+
+    if (save_syn_hl) {
+        memcpy(EC.row[save_syn_line].syntax_hl, save_syn_hl, EC.row[save_syn_line].rsize);
+        editorUpdateSpans(&EC.row[save_syn_line]);
+        free(save_syn_hl);
+        save_syn_hl = NULL;
+    }
+
+    if (key == '\r' || key == '\x1b') {
+        last_match = -1;
+        direction = 1;
+        return;
+    } else if (key == ARROW_RIGHT || key == ARROW_DOWN) {
+        direction = 1;
+    } else if (key == ARROW_LEFT || key == ARROW_UP) {
+        direction = -1;
+    } else {
+        last_match = -1;
+        direction = 1;
+    }
+
+    if (last_match == -1) { direction = 1; }
+    
+    int current_pos = last_match;
+    int qlen = strlen(query);
+    int prefilter = (strchr(query, ' ') == NULL);
+    int q;
+
+    for (q = 0; q < EC.numrows; q++) {
+        current_pos += direction;
+
+        if (current_pos == -1) {
+            current_pos = EC.numrows - 1;
+        } else if (current_pos == EC.numrows) {
+            current_pos = 0;
+        }
+
+        erow *row = &EC.row[current_pos];
+
+        // Rows that haven't been drawn are only rendered if their text matches
+        // (a query with spaces could match part of an expanded tab, so it can't skip them)
+        if (row->render == NULL && prefilter && qlen > 0 &&
+            remFindStr(editorRowText(row, &EC.pack_cache), row->size, query, qlen) == row->size) {
+            continue;
+        }
+
+        editorPrepareRow(row);
+
+        int at = remFindStr(row->render, row->rsize, query, qlen);
+
+        if (at < row->rsize || (qlen == 0 && row->rsize == 0)) {
+            last_match = current_pos;
+            EC.ypos = current_pos;
+            EC.xpos = editorRowRxToXpos(row, editorRowRenderToRx(row, at));
+            EC.rowoff = editorVisualRow(EC.numrows);
+
+            save_syn_line = current_pos;
+            save_syn_hl = malloc(row->rsize);
+            
+            memcpy(save_syn_hl, row->syntax_hl, row->rsize);
+            memset(&row->syntax_hl[at], SYNTAX_HL_QUERY, qlen);
+            editorUpdateSpans(row);
+            
+            break;
+        }
+    }
+}
+
+// Searches each row for query
+void editorSearch() {
+    int s_xpos = EC.xpos; // Saves x position
+    int s_ypos = EC.ypos; // Saves y position
+    int s_coloff = EC.coloff; // Saves column position
+    int s_rowoff = EC.rowoff; // Saves row position
+
+    char *query = editorPrompt("Query (ESC to cancel): %s (Search using Arrows/Enter)", editorSearchCallback, 0);
+
+    if (query) {
+        free(query);
+    } else {
+        // Returns user to their original mouse position after search
+        EC.xpos = s_xpos;
+        EC.ypos = s_ypos;
+        EC.coloff = s_coloff;
+        EC.rowoff = s_rowoff;
+    }
+}
+
+// Rows one replace worker rewrote, in file order
+struct replaceChunk {
+    int *rows;
+    struct undoLine *old;
+    int n, cap;
+    long long count;
+};
+
+struct replaceJob {
+    const char *query;
+    int qlen;
+    const char *with;
+    int wlen;
+    int grain;
+    struct replaceChunk *chunks;
+};
+
+static void editorReplaceWorker(void *ctx, int start, int end) {
+    struct replaceJob *job = ctx;
+    struct replaceChunk *c = &job->chunks[start / job->grain];
+    struct packCache cache = {-1, NULL, 0};
+
+    for (int r = start; r < end; r++) {
+        erow *row = &EC.row[r];
+        const char *text = editorRowText(row, &cache);
+        int m = remFindStr(text, row->size, job->query, job->qlen);
+
+        if (m == row->size) { continue; }
+
+        // Rows that grow are counted first, so every row is allocated once at its final size
+        int cap = row->size;
+
+        if (job->wlen > job->qlen) {
+            int matches = 0;
+
+            for (int p = m; p < row->size; ) {
+                matches++;
+                p += job->qlen;
+                p += remFindStr(&text[p], row->size - p, job->query, job->qlen);
+            }
+
+            cap += matches * (job->wlen - job->qlen);
+        }
+
+        char *chars = malloc(cap + 1);
+        int len = 0;
+        int p = 0;
+
+        while (m < row->size) {
+            memcpy(&chars[len], &text[p], m - p);
+            len += m - p;
+            memcpy(&chars[len], job->with, job->wlen);
+            len += job->wlen;
+
+            p = m + job->qlen;
+            m = p + remFindStr(&text[p], row->size - p, job->query, job->qlen);
+            c->count++;
+        }
+
+        memcpy(&chars[len], &text[p], row->size - p);
+        len += row->size - p;
+        chars[len] = '\0';
+
+        if (c->n == c->cap) {
+            c->cap = c->cap ? c->cap * 2 : 64;
+            c->rows = realloc(c->rows, sizeof(int) * c->cap);
+            c->old = realloc(c->old, sizeof(struct undoLine) * c->cap);
+        }
+
+        // The old text moves into the undo batch as is (a packed row's is copied out,
+        // and its block let go of by the caller)
+        c->rows[c->n] = r;
+        c->old[c->n].chars = row->chars;
+        c->old[c->n].size = row->size;
+
+        if (row->packed) {
+            c->old[c->n].chars = malloc(row->size + 1);
+            memcpy(c->old[c->n].chars, text, row->size);
+            c->old[c->n].chars[row->size] = '\0';
+        }
+
+        c->n++;
+
+        row->chars = chars;
+        row->size = len;
+    }
+
+    free(cache.text);
+}
+
+/*
+Replaces every occurrence of query as one undoable batch. Rows are matched
+and rewritten in parallel, then only the rewritten rows are rehighlighted.
+Returns the number of replacements and sets *nrows to the rows changed.
+*/
+long long editorReplaceAll(const char *query, const char *with, int *nrows) {
+    struct replaceJob job = {query, strlen(query), with, strlen(with), 4096, NULL};
+    long long count = 0;
+    int total = 0;
+
+    *nrows = 0;
+
+    if (job.qlen == 0 || EC.numrows == 0) { return 0; }
+
+    int nchunks = (EC.numrows + job.grain - 1) / job.grain;
+    job.chunks = calloc(nchunks, sizeof(struct replaceChunk));
+
+    parallelFor(EC.numrows, job.grain, editorReplaceWorker, &job);
+
+    for (int c = 0; c < nchunks; c++) {
+        total += job.chunks[c].n;
+        count += job.chunks[c].count;
+    }
+
+    if (total) {
+        char *data = malloc(job.qlen + job.wlen);
+
+        memcpy(data, query, job.qlen);
+        memcpy(data + job.qlen, with, job.wlen);
+        editorJournal(JOURNAL_REPLACE, 0, job.qlen, data, job.qlen + job.wlen, 0);
+        free(data);
+
+        struct undoBatch *b = editorUndoBegin(0);
+        int *rows = malloc(sizeof(int) * total);
+        int n = 0;
+
+        editorUndoReserve(b, total, total);
+
+        for (int c = 0; c < nchunks; c++) {
+            for (int k = 0; k < job.chunks[c].n; k++) {
+                erow *row = &EC.row[job.chunks[c].rows[k]];
+
+                if (row->packed) { editorPackRelease(row); }
+
+                editorUndoAddStep(b, row->idx, 1, 1, &job.chunks[c].old[k]);
+                rows[n++] = row->idx;
+            }
+        }
+
+        editorUpdateRows(rows, n);
+        free(rows);
+        EC.dirty++;
+
+        if (EC.ypos < EC.numrows && EC.xpos > EC.row[EC.ypos].size) {
+            EC.xpos = EC.row[EC.ypos].size;
+        }
+    }
+
+    for (int c = 0; c < nchunks; c++) {
+        free(job.chunks[c].rows);
+        free(job.chunks[c].old);
+    }
+
+    free(job.chunks);
+
+    *nrows = total;
+    return count;
+}
+
+// Prompts for a query and its replacement, then replaces every occurrence
+void editorReplace() {
+    char *query = editorPrompt("Replace (ESC to cancel): %s", NULL, 0);
+
+    if (query == NULL) { return; }
+
+    // The query becomes part of the next prompt's format string
+    char prompt[96] = "Replace ";
+    int len = strlen(prompt);
+
+    for (char *q = query; *q && len < 40; q++) {
+        if (*q == '%') { prompt[len++] = '%'; }
+        prompt[len++] = *q;
+    }
+
+    snprintf(&prompt[len], sizeof(prompt) - len, " with (ESC to cancel): %%s");
+
+    char *with = editorPrompt(prompt, NULL, 1);
+
+    if (with) {
+        int rows;
+        long long count = editorReplaceAll(query, with, &rows);
+
+        editorSetStatusMessage("%s | Status: %lld replaced on %d lines | v%s", DEFAULT_MSG, count, rows, VERSION);
+        free(with);
+    }
+
+    free(query);
+}
+
+// Applies one journaled edit. Returns 0 if it doesn't fit the buffer (a damaged journal).
+static int editorReplay(int op, int row, int col, const char *data, int len) {
+    int rows;
+
+    if (op != JOURNAL_MULTI) { editorClearCursors(); }
+
+    if (op == JOURNAL_INSERT || op == JOURNAL_NEWLINE || op == JOURNAL_DELETE || op == JOURNAL_PASTE) {
+        if (row < 0 || row > EC.numrows || col < 0 || col > (row < EC.numrows ? EC.row[row].size : 0)) { return 0; }
+        if (op == JOURNAL_DELETE && (row == EC.numrows || (row == 0 && col == 0))) { return 0; }
+
+        EC.ypos = row;
+        EC.xpos = col;
+    }
+
+    switch (op) {
+        case JOURNAL_INSERT:
+            for (int i = 0; i < len; i++) { editorInsertChar((unsigned char) data[i]); }
+            return 1;
+        case JOURNAL_NEWLINE:
+            editorInsertNewLine();
+            return 1;
+        case JOURNAL_DELETE:
+            editorDelChar();
+            return 1;
+        case JOURNAL_REPLACE: {
+            if (col < 1 || col > len) { return 0; }
+
+            char *query = strndup(data, col);
+            char *with = strndup(data + col, len - col);
+
+            editorReplaceAll(query, with, &rows);
+            free(query);
+            free(with);
+            return 1;
+        }
+        case JOURNAL_UNDO:
+            editorUndo();
+            return 1;
+        case JOURNAL_MULTI: {
+            int n = len / sizeof(struct editorCursor);
+            struct editorCursor *c = malloc(len ? len : 1);
+
+            memcpy(c, data, len);
+
+            // Cursors must be on rows that exist, and the extra ones ascending without the current row
+            int ok = n >= 2 && len % sizeof(struct editorCursor) == 0 && col > 0;
+
+            for (int k = 0; ok && k < n; k++) {
+                ok = c[k].ypos >= 0 && c[k].ypos <= EC.numrows && c[k].xpos >= 0 &&
+                     c[k].xpos <= (c[k].ypos < EC.numrows ? EC.row[c[k].ypos].size : 0) &&
+                     (k == 0 || (c[k].ypos < EC.numrows && c[k].ypos != c[0].ypos)) &&
+                     (k < 2 || c[k].ypos > c[k - 1].ypos);
+            }
+
+            if (ok) {
+                EC.xpos = c[0].xpos;
+                EC.ypos = c[0].ypos;
+                EC.cursors = realloc(EC.cursors, sizeof(struct editorCursor) * (n - 1));
+                memcpy(EC.cursors, &c[1], sizeof(struct editorCursor) * (n - 1));
+                EC.ncursors = n - 1;
+                editorMultiEdit(col);
+            }
+
+            free(c);
+            return ok;
+        }
+        case JOURNAL_CUT: {
+            int32_t end[2];
+
+            if (len != sizeof(end)) { return 0; }
+
+            memcpy(end, data, sizeof(end));
+
+            if (row < 0 || row > end[0] || end[0] >= EC.numrows || col < 0 || col > EC.row[row].size ||
+                end[1] < 0 || end[1] > EC.row[end[0]].size || (row == end[0] && col > end[1])) {
+                return 0;
+            }
+
+            editorDeleteRange(row, col, end[0], end[1]);
+            return 1;
+        }
+        case JOURNAL_PASTE: {
+            // The lines go into a block of their own (with a '\n' after the last, so none points past it)
+            char *block = malloc(len + 1);
+            int n = 1;
+
+            memcpy(block, data, len);
+            block[len] = '\n';
+
+            for (int i = 0; i < len; i++) { n += (block[i] == '\n'); }
+
+            struct undoLine *lines = malloc(sizeof(struct undoLine) * n);
+            char *p = block;
+
+            for (int l = 0; l < n; l++) {
+                char *nl = memchr(p, '\n', block + len + 1 - p);
+
+                lines[l].chars = p;
+                lines[l].size = nl - p;
+                p = nl + 1;
+            }
+
+            editorAdoptBlock(block, len + 1, n);
+            editorPasteLines(lines, n);
+
+            for (int l = 0; l < n; l++) { editorFreeText(lines[l].chars); }
+
+            free(lines);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+// Replays the swap file a session that didn't exit cleanly left behind
+void editorRecover() {
+    struct journalReader r;
+    char jpath[4096];
+    int fd;
+
+    // Nothing is ever journaled for a binary or compressed file
+    if (EC.hex || EC.zip || EC.filename == NULL || (fd = open(EC.filename, O_RDONLY)) == -1) { return; }
+
+    int found = journalLoad(&r, EC.filename, &EC.file_st, lineCacheFingerprint(fd, EC.file_st.st_size), jpath, sizeof(jpath));
+    close(fd);
+
+    if (found == 0) { return; }
+
+    if (found == -1) {
+        char old[4200];
+
+        snprintf(old, sizeof(old), "%s.old", jpath);
+        rename(jpath, old);
+        editorSetStatusMessage("%s | Status: Stale swap file moved to .swp.old | v%s", DEFAULT_MSG, VERSION);
+        return;
+    }
+
+    int op, row, col, len;
+    const char *data;
+    size_t good = r.pos;
+    int n = 0;
+
+    EC.journal_off = 1;
+
+    while (journalNext(&r, &op, &row, &col, &data, &len) && editorReplay(op, row, col, data, len)) {
+        good = r.pos;
+        n++;
+    }
+
+    EC.journal_off = 0;
+    editorClearCursors();
+    journalFreeReader(&r);
+
+    if (n == 0) {
+        unlink(jpath);
+        return;
+    }
+
+    // Keep journaling into the same file, minus anything damaged at its end
+    truncate(jpath, good);
+    EC.journal = journalReopen(jpath);
+
+    editorSetStatusMessage("%s | Status: Recovered %d edits, ^S to keep | v%s", DEFAULT_MSG, n, VERSION);
+}
+
+// Counts the brackets of rows that haven't been summarised (their comment states must be known)
+static void editorBracketsWorker(void *ctx, int start, int end) {
+    int base = *(int *) ctx;
+    unsigned char *hl = NULL;
+    int cap = 0;
+    struct packCache c = {-1, NULL, 0};
+
+    for (int i = base + start; i < base + end; i++) {
+        erow *row = &EC.row[i];
+
+        if (row->bmin != BRACKET_UNKNOWN) { continue; }
+
+        if (row->size > cap) {
+            cap = row->size * 2;
+            hl = realloc(hl, cap);
+        }
+
+        const char *chars = editorRowText(row, &c);
+
+        if (EC.syntax) {
+            lexerRun(EC.syntax->lexer, chars, row->size, hl, i > 0 && EC.row[i - 1].multi_syntax_hl);
+        } else {
+            memset(hl, SYNTAX_HL_DEFAULT, row->size);
+        }
+
+        bracketScan(chars, hl, row->size, &row->bsum, &row->bmin);
+    }
+
+    free(hl);
+    free(c.text);
+}
+
+static void editorBracketsSummarise(int from, int to) {
+    if (to > EC.numrows) { to = EC.numrows; }
+    if (from >= to) { return; }
+
+    editorHlAdvance(to - 1);
+    parallelFor(to - from, 4096, editorBracketsWorker, &from);
+}
+
+// Recomputes a block's leaf from its (summarised) rows
+static void editorBracketsLeaf(int block) {
+    struct bracketNode node = {0, 0};
+    int end = (block + 1) * BRACKET_BLOCK < EC.numrows ? (block + 1) * BRACKET_BLOCK : EC.numrows;
+
+    for (int i = block * BRACKET_BLOCK; i < end; i++) {
+        struct bracketNode row = {EC.row[i].bsum, EC.row[i].bmin};
+        node = bracketCombine(node, row);
+    }
+
+    *bracketLeaf(&EC.brackets, block) = node;
+}
+
+/*
+Brings the bracket index up to date: a full build after rows were inserted
+or deleted (rows keep their summaries, so only the blocks are re-added),
+otherwise just the blocks holding rows that were lexed again.
+*/
+static void editorBracketsUpdate() {
+    editorHlAdvance(EC.numrows - 1);
+
+    if (!EC.brackets_valid) {
+        int nblocks = (EC.numrows + BRACKET_BLOCK - 1) / BRACKET_BLOCK;
+
+        editorBracketsSummarise(0, EC.numrows);
+        bracketReset(&EC.brackets, nblocks);
+
+        for (int b = 0; b < nblocks; b++) { editorBracketsLeaf(b); }
+
+        bracketBuild(&EC.brackets);
+        EC.brackets_valid = 1;
+        return;
+    }
+
+    struct bracketIndex *idx = &EC.brackets;
+
+    for (int k = 0; k < idx->ndirty; k++) {
+        editorBracketsSummarise(idx->dirty_list[k] * BRACKET_BLOCK, (idx->dirty_list[k] + 1) * BRACKET_BLOCK);
+        editorBracketsLeaf(idx->dirty_list[k]);
+        bracketUpdate(idx, idx->dirty_list[k]);
+        idx->dirty[idx->dirty_list[k]] = 0;
+    }
+
+    idx->ndirty = 0;
+}
+
+// Bracket depth at the start of row at
+static int editorBracketsDepth(int at) {
+    int block = at / BRACKET_BLOCK;
+    int depth = bracketDepth(&EC.brackets, block);
+
+    for (int i = block * BRACKET_BLOCK; i < at; i++) { depth += EC.row[i].bsum; }
+
+    return depth;
+}
+
+// First row >= from where the depth (*depth at the start of from) falls to target, or -1
+static int editorBracketsNextRow(int from, int *depth, int target) {
+    int block_end = (from / BRACKET_BLOCK + 1) * BRACKET_BLOCK;
+
+    for (; from < EC.numrows; from++) {
+        if (from == block_end) {
+            int block = bracketFindNext(&EC.brackets, from / BRACKET_BLOCK, *depth, target);
+
+            if (block == -1) { return -1; }
+
+            *depth = bracketDepth(&EC.brackets, block);
+            from = block * BRACKET_BLOCK;
+            block_end = -1;
+        }
+
+        if (*depth + EC.row[from].bmin <= target) { return from; }
+
+        *depth += EC.row[from].bsum;
+    }
+
+    return -1;
+}
+
+// Last row <= to where the depth falls to target, or -1 (*depth gets the depth at its start)
+static int editorBracketsPrevRow(int to, int *depth, int target) {
+    int block = to / BRACKET_BLOCK;
+    int found = -1;
+
+    while (block >= 0) {
+        int d = bracketDepth(&EC.brackets, block);
+
+        for (int i = block * BRACKET_BLOCK; i <= to; i++) {
+            if (d + EC.row[i].bmin <= target) {
+                found = i;
+                *depth = d;
+            }
+
+            d += EC.row[i].bsum;
+        }
+
+        if (found != -1) { return found; }
+
+        block = bracketFindPrev(&EC.brackets, block - 1, target);
+        to = (block + 1) * BRACKET_BLOCK - 1;
+    }
+
+    return -1;
+}
+
+// Render offset of the first bracket in row from render offset from that takes the depth to target, or -1
+static int editorBracketsScanFwd(erow *row, int from, int depth, int target) {
+    for (int i = from; i < row->rsize; i++) {
+        if (!bracketCounts(row->syntax_hl[i])) { continue; }
+
+        if (bracketOpen(row->render[i])) {
+            depth++;
+        } else if (bracketClose(row->render[i]) && --depth <= target) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+/*
+Render offset of the opening bracket of the innermost block still open at
+render offset end of row, where depth is the depth at the row's start and
+target one less than the depth at end. -1 if it isn't in this row.
+*/
+static int editorBracketsScanBack(erow *row, int end, int depth, int target) {
+    int after = (depth <= target) ? 0 : -1;
+
+    for (int i = 0; i < end; i++) {
+        if (!bracketCounts(row->syntax_hl[i])) { continue; }
+
+        if (bracketOpen(row->render[i])) {
+            depth++;
+        } else if (bracketClose(row->render[i])) {
+            depth--;
+        } else {
+            continue;
+        }
+
+        if (depth <= target) { after = i + 1; }
+    }
+
+    if (after == -1) { return -1; }
+
+    // The last point at the target depth is followed by the opening bracket
+    while (after < end && !(bracketOpen(row->render[after]) && bracketCounts(row->syntax_hl[after]))) { after++; }
+
+    return after < end ? after : -1;
+}
+
+// Finds the bracket at the other end of a block. Returns 0 if there's none.
+static int editorBracketsFind(int r, int roff, int forward, int *out_row, int *out_roff) {
+    erow *row = &EC.row[r];
+    int start = editorBracketsDepth(r);
+    int depth = start;
+
+    for (int i = 0; i < roff; i++) {
+        if (!bracketCounts(row->syntax_hl[i])) { continue; }
+
+        if (bracketOpen(row->render[i])) { depth++; }
+        if (bracketClose(row->render[i])) { depth--; }
+    }
+
+    if (forward) {
+        // From just after the opening bracket, the first point back at the depth before it
+        int hit = editorBracketsScanFwd(row, roff + 1, depth + 1, depth);
+        int d = start + row->bsum;
+
+        if (hit == -1) {
+            int at = editorBracketsNextRow(r + 1, &d, depth);
+
+            if (at == -1) { return 0; }
+
+            editorPrepareRow(&EC.row[at]);
+            hit = editorBracketsScanFwd(&EC.row[at], 0, d, depth);
+            r = at;
+        }
+
+        *out_row = r;
+        *out_roff = hit;
+        return hit != -1;
+    }
+
+    int hit = editorBracketsScanBack(row, roff, start, depth - 1);
+
+    if (hit == -1) {
+        int d;
+        int at = (r > 0) ? editorBracketsPrevRow(r - 1, &d, depth - 1) : -1;
+
+        if (at == -1) { return 0; }
+
+        editorPrepareRow(&EC.row[at]);
+        hit = editorBracketsScanBack(&EC.row[at], EC.row[at].rsize, d, depth - 1);
+        r = at;
+    }
+
+    *out_row = r;
+    *out_roff = hit;
+    return hit != -1;
+}
+
+static void editorBracketsJump(int at, int roff) {
+    EC.ypos = at;
+    EC.xpos = editorRowRxToXpos(&EC.row[at], editorRowRenderToRx(&EC.row[at], roff));
+}
+
+// Jumps to the bracket matching the one at (or just before) the cursor
+void editorMatchBracket() {
+    if (EC.ypos >= EC.numrows) { return; }
+
+    erow *row = &EC.row[EC.ypos];
+    editorPrepareRow(row);
+
+    int roff = editorRowRxToRender(row, editorRowXposToRx(row, EC.xpos));
+    int on = roff < row->rsize && bracketCounts(row->syntax_hl[roff]) &&
+             (bracketOpen(row->render[roff]) || bracketClose(row->render[roff]));
+
+    if (!on && roff > 0 && bracketCounts(row->syntax_hl[roff - 1]) &&
+        (bracketOpen(row->render[roff - 1]) || bracketClose(row->render[roff - 1]))) {
+        roff--;
+        on = 1;
+    }
+
+    if (!on) {
+        editorSetStatusMessage("%s | Status: No bracket at the cursor | v%s", DEFAULT_MSG, VERSION);
+        return;
+    }
+
+    editorBracketsUpdate();
+
+    char c = row->render[roff];
+    int at, hit;
+
+    if (!editorBracketsFind(EC.ypos, roff, bracketOpen(c), &at, &hit)) {
+        editorSetStatusMessage("%s | Status: No matching bracket | v%s", DEFAULT_MSG, VERSION);
+        return;
+    }
+
+    char m = EC.row[at].render[hit];
+
+    if (!bracketPair(bracketOpen(c) ? c : m, bracketOpen(c) ? m : c)) {
+        editorSetStatusMessage("%s | Status: Mismatched %c and %c | v%s", DEFAULT_MSG, c, m, VERSION);
+    }
+
+    editorBracketsJump(at, hit);
+}
+
+// Jumps to the opening bracket of the block around the cursor and shows its line
+void editorEnclosingBlock() {
+    if (EC.ypos >= EC.numrows) { return; }
+
+    erow *row = &EC.row[EC.ypos];
+    editorPrepareRow(row);
+    editorBracketsUpdate();
+
+    int roff = editorRowRxToRender(row, editorRowXposToRx(row, EC.xpos));
+    int at, hit;
+
+    if (!editorBracketsFind(EC.ypos, roff, 0, &at, &hit)) {
+        editorSetStatusMessage("%s | Status: Not inside a block | v%s", DEFAULT_MSG, VERSION);
+        return;
+    }
+
+    erow *open = &EC.row[at];
+    int skip = 0;
+
+    while (skip < open->rsize && isspace((unsigned char) open->render[skip])) { skip++; }
+
+    editorSetStatusMessage("Block at line %d: %.*s", at + 1, open->rsize - skip, &open->render[skip]);
+    editorBracketsJump(at, hit);
+}
+
+/*
+Code folding
+
+^F closes the block the cursor is on, or the innermost one around it, into
+its first row: up to the line before its closing bracket, or for code
+without brackets, the rows indented deeper than it. Closed folds live in a
+fold tree (utils/folds.h) that maps between file rows and the visual rows on
+screen in O(log n), so scrolling and cursor movement step over a closed fold
+like a single line. ^F on a closed fold opens it again, as does the cursor
+landing inside one.
+*/
+
+// Row the cursor reaches moving dir rows from row at, skipping closed folds (past the end is numrows)
+int editorStepRow(int at, int dir) {
+    int v = editorVisualRow(at);
+    int sub;
+
+    // With wrap on, the next row starts after all of this one's screen lines
+    if (dir > 0 && EC.wrap && at < EC.numrows) { v += EC.row[at].vlines - 1; }
+
+    return editorFileRow(v + dir, &sub);
+}
+
+// Opens the folds hiding row at
+void editorFoldReveal(int at) {
+    int k;
+
+    while ((k = foldHiding(&EC.folds, at)) != -1) {
+        foldRemove(&EC.folds, EC.folds.roots[k]);
+        EC.wrapidx_valid = 0;
+    }
+}
+
+// Indentation of a row in display columns, or -1 if it's blank
+static int editorRowIndent(erow *row) {
+    const char *chars = editorRowText(row, &EC.pack_cache);
+    int col = 0;
+
+    for (int i = 0; i < row->size; i++) {
+        if (chars[i] == '\t') {
+            col += TAB_STOP - (col % TAB_STOP);
+        } else if (chars[i] == ' ') {
+            col++;
+        } else {
+            return col;
+        }
+    }
+
+    return -1;
+}
+
+// Last row of the block opened by the bracket at render offset roff of row at, or -1
+static int editorFoldBracketEnd(int at, int roff) {
+    int r, hit;
+
+    if (!editorBracketsFind(at, roff, 1, &r, &hit)) { return -1; }
+
+    // The closing bracket's row stays visible
+    return r - 1;
+}
+
+/*
+Last row to hide under row at if it starts a block: the bracket it leaves
+open, else the rows indented deeper that follow it. -1 if it starts none.
+*/
+static int editorFoldEnd(int at) {
+    erow *row = &EC.row[at];
+    editorPrepareRow(row);
+
+    // Last bracket on the row that isn't closed on it
+    int closed = 0;
+
+    for (int i = row->rsize - 1; i >= 0; i--) {
+        if (!bracketCounts(row->syntax_hl[i])) { continue; }
+
+        if (bracketClose(row->render[i])) {
+            closed++;
+        } else if (bracketOpen(row->render[i]) && closed > 0) {
+            closed--;
+        } else if (bracketOpen(row->render[i])) {
+            int end = editorFoldBracketEnd(at, i);
+
+            if (end > at) { return end; }
+
+            break;
+        }
+    }
+
+    int indent = editorRowIndent(row);
+    int end = -1;
+
+    if (indent == -1) { return -1; }
+
+    for (int i = at + 1; i < EC.numrows; i++) {
+        int in = editorRowIndent(&EC.row[i]);
+
+        if (in == -1) { continue; }
+        if (in <= indent) { break; }
+
+        end = i;
+    }
+
+    return end;
+}
+
+// Finds the rows to fold for the cursor on row at. Returns 0 if it's not in a block.
+static int editorFoldRange(int at, int *start, int *end) {
+    editorBracketsUpdate();
+
+    *start = at;
+    *end = editorFoldEnd(at);
+
+    if (*end > at) { return 1; }
+
+    // Inside a block: the innermost bracket open at the start of the row
+    int r, hit;
+
+    if (editorBracketsFind(at, 0, 0, &r, &hit)) {
+        *start = r;
+        *end = editorFoldBracketEnd(r, hit);
+
+        if (*end > r) { return 1; }
+    }
+
+    // Or the nearest row above that's indented less
+    int indent = -1;
+
+    for (int i = at; i < EC.numrows && indent == -1; i++) { indent = editorRowIndent(&EC.row[i]); }
+
+    for (int i = at - 1; i >= 0 && indent > 0; i--) {
+        int in = editorRowIndent(&EC.row[i]);
+
+        if (in == -1 || in >= indent) { continue; }
+
+        *start = i;
+        *end = editorFoldEnd(i);
+
+        return *end >= at;
+    }
+
+    return 0;
+}
+
+// Closes the block at the cursor, or opens the fold the cursor is on
+void editorToggleFold() {
+    if (EC.ypos >= EC.numrows) { return; }
+
+    int i = foldAt(&EC.folds, EC.ypos);
+
+    EC.wrapidx_valid = 0;
+
+    if (i != -1) {
+        foldRemove(&EC.folds, i);
+        return;
+    }
+
+    int start, end;
+
+    if (!editorFoldRange(EC.ypos, &start, &end) || !foldAdd(&EC.folds, start, end)) {
+        editorSetStatusMessage("%s | Status: No block to fold here | v%s", DEFAULT_MSG, VERSION);
+        return;
+    }
+
+    // The cursor goes to the fold's first row, keeping its column
+    int rx = editorRowXposToRx(&EC.row[EC.ypos], EC.xpos);
+
+    EC.ypos = start;
+    EC.xpos = editorRowRxToXpos(&EC.row[start], rx);
+
+    editorSetStatusMessage("%s | Status: Folded %d lines | v%s", DEFAULT_MSG, end - start, VERSION);
+}
+
+/*
+Word completion
+
+^N completes the word before the cursor with words from the rest of the
+file, most used first; pressing it again swaps in the next one. The words
+come from an index (see utils/words.h) that the background scan builds from
+the rows' highlighting and that's kept up to date as rows change, so a
+lookup doesn't read the rows at all.
+*/
+
+// Indexes the words of the next rows the scan hasn't reached, then tidies the index. Returns 1 while there's more to do.
+static int editorWordsScan() {
+    // The index stops growing once it would take more than its share of the memory budget
+    if (EC.words_off || EC.words_scan >= EC.numrows || wordsHeap(&EC.words) > EC.mem_budget / 8) { return wordsSettle(&EC.words); }
+
+    int end = (EC.words_scan + WORDS_SCAN_ROWS < EC.numrows) ? EC.words_scan + WORDS_SCAN_ROWS : EC.numrows;
+    size_t held = wordsHeap(&EC.words);
+
+    editorHlAdvance(end - 1);
+
+    for (int i = EC.words_scan; i < end; i++) { EC.row[i].words = editorWordsLine(&EC.row[i]); }
+
+    EC.words_scan = end;
+    EC.mem_grown += wordsHeap(&EC.words) - held;
+
+    return 1;
+}
+
+void editorComplete() {
+    if (EC.ypos >= EC.numrows) { return; }
+
+    // A batch script has no idle time to build the index in
+    if (EC.batch) {
+        while (editorWordsScan()) {}
+    }
+
+    erow *row = &EC.row[EC.ypos];
+
+    // Straight after a completion: take it back and insert the next one
+    if (EC.complete_n && EC.complete_row == EC.ypos && EC.complete_x == EC.xpos) {
+        for (int k = 0; k < EC.complete_len; k++) { editorDelChar(); }
+
+        EC.complete_at = (EC.complete_at + 1) % EC.complete_n;
+    } else {
+        int start = EC.xpos;
+
+        while (start > 0 && wordsChar(row->chars[start - 1])) { start--; }
+
+        if (start == EC.xpos) {
+            editorSetStatusMessage("%s | Status: No word to complete | v%s", DEFAULT_MSG, VERSION);
+            return;
+        }
+
+        int ids[COMPLETE_MAX];
+        int n = wordsComplete(&EC.words, &row->chars[start], EC.xpos - start, ids, COMPLETE_MAX);
+
+        if (n == 0 && EC.words_off) {
+            editorSetStatusMessage("%s | Status: Word index dropped (memory budget) | v%s", DEFAULT_MSG, VERSION);
+            return;
+        }
+
+        if (n == 0) {
+            editorSetStatusMessage("%s | Status: No completions for %.20s | v%s", DEFAULT_MSG, &row->chars[start], VERSION);
+            return;
+        }
+
+        // Kept as text, since inserting them changes the index
+        for (int k = 0; k < n; k++) {
+            int len;
+            const char *s = wordsText(&EC.words, ids[k], &len);
+
+            memcpy(EC.complete_words[k], s, len);
+            EC.complete_words[k][len] = '\0';
+        }
+
+        EC.complete_n = n;
+        EC.complete_at = 0;
+        EC.complete_prefix = EC.xpos - start;
+    }
+
+    const char *word = EC.complete_words[EC.complete_at];
+    int len = strlen(word);
+
+    // Typed like any other keys, so it's one undo step and journaled
+    for (int k = EC.complete_prefix; k < len; k++) { editorInsertChar(word[k]); }
+
+    EC.complete_len = len - EC.complete_prefix;
+    EC.complete_row = EC.ypos;
+    EC.complete_x = EC.xpos;
+
+    editorSetStatusMessage("%s | Status: %.30s (%d of %d, ^N: Next) | v%s", DEFAULT_MSG, word, EC.complete_at + 1, EC.complete_n, VERSION);
+}
+
+struct abuf {
+    char *b;
+    int len;
+    int cap;
+};
+
+#define ABUF_INIT {NULL, 0, 0}
+
+void aAppend(struct abuf *ab, const char *s, int len) {
+    if (ab->len + len > ab->cap) {
+        int cap = ab->cap ? ab->cap : 4096;
+
+        while (cap < ab->len + len) { cap *= 2; }
+
+        char *new = realloc(ab->b, cap);
+
+        if (new == NULL) { return; }
+
+        ab->b = new;
+        ab->cap = cap;
+    }
+
+    memcpy(&ab->b[ab->len], s, len);
+    ab->len += len;
+}
+
+void aFree(struct abuf *ab) {
+    free(ab->b);
+}
+
+// Emits the SGR sequence for a span color (-1 resets to the default)
+void aAppendColor(struct abuf *ab, int color) {
+    if (color == -1) {
+        aAppend(ab, "\x1b[39m", 5);
+    } else {
+        char buf[16];
+        int c_len = snprintf(buf, sizeof(buf), "\x1b[%dm", color);
+        aAppend(ab, buf, c_len);
+    }
+}
+
+/*
+Hex view of binary files
+
+A file that looks binary when it's opened (see hexIsBinary) gets no rows:
+it stays mapped and is read-only, shown a line of bytes at a time with the
+cursor on a byte. ^G goes to an offset and ^Q searches for bytes, both over
+the mapping, so memory use doesn't depend on the file's size.
+*/
+
+static int editorHexDigits() {
+    return hexOffsetDigits(EC.textlen);
+}
+
+// Bytes per line at the current width
+static int editorHexPer() {
+    return hexLineBytes(EC.screencols, editorHexDigits());
+}
+
+static void editorHexScroll() {
+    size_t line = EC.hex_cur / editorHexPer();
+
+    if (line < EC.hex_top) { EC.hex_top = line; }
+    if (line >= EC.hex_top + EC.screenrows) { EC.hex_top = line - EC.screenrows + 1; }
+}
+
+// Draws screen line r: a line of bytes, with the cursor's byte reversed in the ASCII column
+static void editorDrawHexRow(struct abuf *ab, int r) {
+    int per = editorHexPer();
+    int digits = editorHexDigits();
+    size_t off = (EC.hex_top + r) * per;
+
+    if (off < EC.textlen) {
+        char out[128];
+        int n = (EC.textlen - off < (size_t) per) ? (int) (EC.textlen - off) : per;
+        int len = hexFormatLine(out, (const unsigned char *) EC.text + off, n, per, off, digits);
+        int mark = (EC.hex_cur >= off && EC.hex_cur < off + n) ? hexAsciiColumn(EC.hex_cur - off, per, digits) : -1;
+
+        if (len > EC.screencols) { len = EC.screencols; }
+
+        if (mark >= 0 && mark < len) {
+            aAppend(ab, out, mark);
+            aAppend(ab, "\x1b[7m", 4);
+            aAppend(ab, &out[mark], 1);
+            aAppend(ab, "\x1b[27m", 5);
+            aAppend(ab, &out[mark + 1], len - mark - 1);
+        } else {
+            aAppend(ab, out, len);
+        }
+    }
+
+    aAppend(ab, "\x1b[K", 3);
+}
+
+// Puts the cursor on byte off (clamped to the file), with its line in the middle of the screen
+static void editorHexJump(long long off) {
+    if (off >= (long long) EC.textlen) { off = EC.textlen - 1; }
+    if (off < 0) { off = 0; }
+
+    EC.hex_cur = off;
+
+    size_t line = EC.hex_cur / editorHexPer();
+    EC.hex_top = (line > (size_t) EC.screenrows / 2) ? line - EC.screenrows / 2 : 0;
+}
+
+// Prompts for a byte offset (decimal, 0x hex or N% of the file) and goes there
+static void editorHexGoto() {
+    char *input = editorPrompt("Goto offset, 0x offset or N%% (ESC to cancel): %s", NULL, 0);
+
+    if (input == NULL) { return; }
+
+    char *start = (input[0] == '@') ? input + 1 : input;
+    int len = strlen(start);
+    char *end = start;
+
+    if (len > 0 && start[len - 1] == '%') {
+        double pct = strtod(start, &end);
+
+        if (end == start + len - 1) {
+            editorHexJump((long long) (EC.textlen * (pct / 100)));
+            end++;
+        }
+    } else if (len > 0) {
+        long long off = strtoll(start, &end, 0);
+
+        if (*end == '\0') { editorHexJump(off); }
+    }
+
+    if (*end != '\0' || len == 0) {
+        editorSetStatusMessage("%s | Status: Not an offset or N%%: %s | v%s", DEFAULT_MSG, input, VERSION);
+    }
+
+    free(input);
+}
+
+// Incremental byte search: hex pairs ("7f 45 4c") or else the text typed, arrows for the next/previous match
+static void editorHexSearchCallback(char *query, int key) {
+    static long long last_match = -1;
+    static int direction = 1;
+
+    if (key == '\r' || key == '\x1b') {
+        last_match = -1;
+        direction = 1;
+        return;
+    } else if (key == ARROW_RIGHT || key == ARROW_DOWN) {
+        direction = 1;
+    } else if (key == ARROW_LEFT || key == ARROW_UP) {
+        direction = -1;
+    } else {
+        last_match = -1;
+        direction = 1;
+    }
+
+    int qlen = strlen(query);
+
+    if (qlen == 0) { return; }
+
+    unsigned char *pat = malloc(qlen + 1);
+    int m = hexParseBytes(query, pat);
+
+    if (m < 0) {
+        memcpy(pat, query, qlen);
+        m = qlen;
+    }
+
+    long long at;
+
+    // Wraps around the end (or start) of the file
+    if (direction == 1) {
+        size_t from = (size_t) (last_match + 1);
+        size_t wrap = (from + m - 1 < EC.textlen) ? from + m - 1 : EC.textlen;
+
+        at = hexFind(EC.text, from, EC.textlen, pat, m);
+
+        if (at == -1) { at = hexFind(EC.text, 0, wrap, pat, m); }
+    } else {
+        size_t to = (last_match > 0) ? (size_t) last_match : 0;
+
+        at = hexFindPrev(EC.text, EC.textlen, 0, to, pat, m);
+
+        if (at == -1) { at = hexFindPrev(EC.text, EC.textlen, to, EC.textlen, pat, m); }
+    }
+
+    free(pat);
+
+    if (at != -1) {
+        last_match = at;
+        editorHexJump(at);
+    }
+}
+
+static void editorHexSearch() {
+    size_t s_cur = EC.hex_cur;
+    size_t s_top = EC.hex_top;
+
+    char *query = editorPrompt("Bytes (7f 45 4c) or text (ESC to cancel): %s (Search using Arrows/Enter)", editorHexSearchCallback, 0);
+
+    if (query) {
+        free(query);
+    } else {
+        EC.hex_cur = s_cur;
+        EC.hex_top = s_top;
+    }
+}
+
+// Handles a key in the hex view. Returns 0 for keys that work as usual (^X).
+static int editorHexKey(int key) {
+    size_t per = editorHexPer();
+    size_t page = per * EC.screenrows;
+    size_t last = EC.textlen - 1;
+
+    switch (key) {
+        case CTRL_KEY('x'):
+        case CTRL_KEY('p'):
+        case CTRL_KEY('t'):
+            return 0;
+        case ARROW_LEFT:
+            if (EC.hex_cur > 0) { EC.hex_cur--; }
+            break;
+        case ARROW_RIGHT:
+            if (EC.hex_cur < last) { EC.hex_cur++; }
+            break;
+        case ARROW_UP:
+            if (EC.hex_cur >= per) { EC.hex_cur -= per; }
+            break;
+        case ARROW_DOWN:
+            if (EC.hex_cur + per <= last) { EC.hex_cur += per; }
+            break;
+        case PAGE_UP:
+            EC.hex_cur = (EC.hex_cur >= page) ? EC.hex_cur - page : EC.hex_cur % per;
+            EC.hex_top = (EC.hex_top >= (size_t) EC.screenrows) ? EC.hex_top - EC.screenrows : 0;
+            break;
+        case PAGE_DOWN:
+            if (EC.hex_cur + page <= last) {
+                EC.hex_cur += page;
+                EC.hex_top += EC.screenrows;
+            }
+            break;
+        case HOME_KEY:
+            EC.hex_cur -= EC.hex_cur % per;
+            break;
+        case END_KEY:
+            EC.hex_cur += per - 1 - EC.hex_cur % per;
+
+            if (EC.hex_cur > last) { EC.hex_cur = last; }
+            break;
+        case FILE_START:
+            EC.hex_cur = 0;
+            break;
+        case FILE_END:
+            EC.hex_cur = last;
+            break;
+        case CTRL_KEY('g'):
+            editorHexGoto();
+            break;
+        case CTRL_KEY('q'):
+            editorHexSearch();
+            break;
+        default:
+            editorSetStatusMessage("%s | Status: Binary file, read-only (^G: Offset) | v%s", DEFAULT_MSG, VERSION);
+            break;
+    }
+
+    return 1;
+}
+
+/*
+Project search
+
+^P searches every file under the current directory (see utils/grep.h) and
+shows the hits as a list in place of the file, filling in as the search
+runs. Enter on a hit goes to it: in the open file if that's where it is,
+otherwise the other file is opened in its place (once it's saved). Esc goes
+back to the file, and ^P with nothing typed brings the last list back.
+*/
+
+#define GREP_POLL_MS 50  // How often the list is redrawn while a search runs
+
+// Lets go of the open file and everything worked out from it (the clipboard stays)
+void editorCloseFile() {
+    for (int u = 0; u < EC.nundo; u++) { editorUndoFreeBatch(&EC.undo[u]); }
+
+    free(EC.undo);
+    EC.undo = NULL;
+    EC.nundo = 0;
+
+    // The clipboard may still point into the mapped file
+    editorDetachRefs();
+    editorWordsReset();
+    EC.words_off = 0;
+
+    for (int j = 0; j < EC.numrows; j++) { editorFreeRow(&EC.row[j]); }
+
+    free(EC.row);
+    EC.row = NULL;
+    EC.numrows = 0;
+
+    if (EC.text_mapped) { munmap(EC.text, EC.textlen); }
+
+    EC.text = NULL;
+    EC.textlen = 0;
+    EC.text_mapped = 0;
+    EC.text_layout = 0;
+
+    // Along with the compressed file's mapping
+    zipStreamFree(EC.zip);
+    EC.zip = NULL;
+    EC.zip_done = 0;
+
+    journalClose(EC.journal, 1);
+    EC.journal = NULL;
+
+    // Every packed block went with its rows
+    free(EC.packs);
+    free(EC.pack_spare);
+    EC.packs = NULL;
+    EC.npacks = 0;
+    EC.pack_spare = NULL;
+    EC.nspare = 0;
+    EC.pack_cache.block = -1;
+    EC.packed_bytes = 0;
+
+    bracketFree(&EC.brackets);
+    EC.brackets_valid = 0;
+    EC.brackets_scan = 0;
+    foldFree(&EC.folds);
+    fenwickFree(&EC.lineidx);
+    EC.lineidx_valid = 0;
+    fenwickFree(&EC.wrapidx);
+    EC.wrapidx_valid = 0;
+
+    EC.xpos = EC.ypos = EC.rx = 0;
+    EC.rowoff = EC.coloff = 0;
+    EC.ncursors = 0;
+    EC.sel_active = 0;
+    EC.hl_valid = 0;
+    EC.dirty = 0;
+    EC.cache_pending = 0;
+    EC.file_fingerprint = 0;
+    EC.mem_rows = 0;
+    EC.mem_grown = 0;
+    EC.trim_phase = 0;
+    EC.hex = 0;
+    EC.hex_cur = 0;
+    EC.hex_top = 0;
+
+    editorInvalidateScreen();
+}
+
+// Whether the list on screen is behind the search (new hits, or it finished)
+int editorGrepPending() {
+    if (EC.grep == NULL || !EC.grep_view) { return 0; }
+
+    pthread_mutex_lock(&EC.grep->lock);
+    int state = EC.grep->nhits * 2 + grepDone(EC.grep);
+    pthread_mutex_unlock(&EC.grep->lock);
+
+    return state != EC.grep_drawn;
+}
+
+int editorGrepRunning() {
+    return EC.grep && EC.grep_view && !grepDone(EC.grep);
+}
+
+static void editorGrepScroll() {
+    if (EC.grep_sel >= EC.grep->nhits) { EC.grep_sel = EC.grep->nhits - 1; }
+    if (EC.grep_sel < 0) { EC.grep_sel = 0; }
+
+    if (EC.grep_sel < EC.grep_top) { EC.grep_top = EC.grep_sel; }
+    if (EC.grep_sel >= EC.grep_top + EC.screenrows) { EC.grep_top = EC.grep_sel - EC.screenrows + 1; }
+}
+
+// Draws screen line r of the list (the caller holds the search's lock): path:line: text
+static void editorDrawGrepRow(struct abuf *ab, int r) {
+    int at = EC.grep_top + r;
+
+    if (at < EC.grep->nhits) {
+        struct grepHit *h = &EC.grep->hits[at];
+        char out[GREP_LINE_MAX + 256];
+        int len = snprintf(out, sizeof(out), "%s:%d: ", EC.grep->files[h->file], h->line + 1);
+
+        if (len > (int) sizeof(out) - 1) { len = sizeof(out) - 1; }
+
+        for (const char *c = h->text; *c && len < (int) sizeof(out) - 1; c++) {
+            out[len++] = ((unsigned char) *c < 32 || *c == 127) ? ' ' : *c;
+        }
+
+        if (len > EC.screencols) { len = EC.screencols; }
+
+        // Don't cut a character in half at the right edge
+        while (len > 0 && len < EC.screencols && utf8IsCont(out[len])) { len--; }
+
+        if (at == EC.grep_sel) { aAppend(ab, "\x1b[7m", 4); }
+
+        aAppend(ab, out, len);
+
+        if (at == EC.grep_sel) { aAppend(ab, "\x1b[27m", 5); }
+    }
+
+    aAppend(ab, "\x1b[K", 3);
+}
+
+// Puts the cursor on a search hit, with its line in the middle of the screen
+static void editorGrepJump(int line, int col) {
+    if (EC.hex || EC.numrows == 0) { return; }
+
+    editorJumpRow(line < EC.numrows ? line : EC.numrows - 1);
+
+    erow *row = &EC.row[EC.ypos];
+    EC.xpos = (col <= row->size) ? col : row->size;
+
+    editorFoldReveal(EC.ypos);
+    EC.rowoff = editorVisualRow(EC.ypos) - EC.screenrows / 2;
+
+    if (EC.rowoff < 0) { EC.rowoff = 0; }
+}
+
+// Goes to the selected hit, opening its file if it isn't the one open
+static void editorGrepOpen() {
+    struct stat st;
+
+    pthread_mutex_lock(&EC.grep->lock);
+
+    if (EC.grep_sel >= EC.grep->nhits) {
+        pthread_mutex_unlock(&EC.grep->lock);
+        return;
+    }
+
+    struct grepHit h = EC.grep->hits[EC.grep_sel];
+
+    pthread_mutex_unlock(&EC.grep->lock);
+
+    char *path = EC.grep->files[h.file];
+
+    if (stat(path, &st) == -1 || access(path, R_OK) == -1) {
+        editorSetStatusMessage("%s | Status: Can't open %s: %s | v%s", DEFAULT_MSG, path, strerror(errno), VERSION);
+        return;
+    }
+
+    // Already open: just move there
+    if (EC.filename && st.st_dev == EC.file_st.st_dev && st.st_ino == EC.file_st.st_ino) {
+        EC.grep_view = 0;
+        editorGrepJump(h.line, h.col);
+        return;
+    }
+
+    if (EC.dirty) {
+        editorSetStatusMessage("%s | Status: Save (^S) before opening %s | v%s", DEFAULT_MSG, path, VERSION);
+        EC.grep_view = 0;
+        return;
+    }
+
+    editorCloseFile();
+    editorOpen(path);
+    editorSetStatusMessage("%s | v%s", DEFAULT_MSG, VERSION);
+    editorRecover();
+
+    EC.grep_view = 0;
+    editorGrepJump(h.line, h.col);
+}
+
+// Handles a key while the list is shown. Returns 0 for keys that work as usual (^X, ^P, ^T).
+static int editorGrepKey(int key) {
+    switch (key) {
+        case CTRL_KEY('x'):
+        case CTRL_KEY('p'):
+        case CTRL_KEY('t'):
+            return 0;
+        case ARROW_UP:
+            EC.grep_sel--;
+            break;
+        case ARROW_DOWN:
+            EC.grep_sel++;
+            break;
+        case PAGE_UP:
+            EC.grep_sel -= EC.screenrows;
+            break;
+        case PAGE_DOWN:
+            EC.grep_sel += EC.screenrows;
+            break;
+        case HOME_KEY:
+        case FILE_START:
+            EC.grep_sel = 0;
+            break;
+        case END_KEY:
+        case FILE_END:
+            EC.grep_sel = INT_MAX;
+            break;
+        case '\r':
+            editorGrepOpen();
+            break;
+        case '\x1b':
+            EC.grep_view = 0;
+            break;
+        default:
+            editorSetStatusMessage("%s | Status: Enter: Go to the hit | Esc: Back | v%s", DEFAULT_MSG, VERSION);
+            break;
+    }
+
+    pthread_mutex_lock(&EC.grep->lock);
+    editorGrepScroll();
+    pthread_mutex_unlock(&EC.grep->lock);
+
+    return 1;
+}
+
+// Prompts for a string and starts searching the project for it (or shows the last results)
+void editorProjectSearch() {
+    char *query = editorPrompt("Search project (Enter: last results, ESC to cancel): %s", NULL, 1);
+
+    if (query == NULL) { return; }
+
+    if (query[0] == '\0') {
+        EC.grep_view = (EC.grep != NULL);
+        free(query);
+        return;
+    }
+
+    grepFree(EC.grep);
+    EC.grep = grepStart(".", query);
+    EC.grep_view = 1;
+    EC.grep_sel = 0;
+    EC.grep_top = 0;
+    EC.grep_drawn = -1;
+
+    free(query);
+}
+
+void editorScroll() {
+    if (EC.grep_view) {
+        pthread_mutex_lock(&EC.grep->lock);
+        editorGrepScroll();
+        pthread_mutex_unlock(&EC.grep->lock);
+        return;
+    }
+
+    if (EC.hex) {
+        editorHexScroll();
+        return;
+    }
+
+    EC.rx = 0;
+
+    // A jump or search hit inside a closed fold opens it
+    editorFoldReveal(EC.ypos);
+
+    if (EC.ypos < EC.numrows) {
+        EC.rx = editorRowXposToRx(&EC.row[EC.ypos], EC.xpos);
+    }
+
+    int vy = editorCursorLine();
+
+    // Wrapped rows never scroll sideways
+    if (EC.wrap) { EC.coloff = 0; }
+
+    if (vy < EC.rowoff) {
+        EC.rowoff = vy;
+    }
+
+    if (vy >= EC.rowoff + EC.screenrows) {
+        EC.rowoff = vy - EC.screenrows + 1;
+    }
+
+    if (EC.wrap) { return; }
+
+    if (EC.rx < EC.coloff) {
+        EC.coloff = EC.rx;
+    }
+
+    if (EC.rx >= EC.coloff + EC.screencols) {
+        EC.coloff = EC.rx - EC.screencols + 1;
+    }
+}
+
+// Draws a $ on the left side of the terminal, regardless of size + draws a row of the terminal
+// (filerow is the file row shown there, sub which of its wrapped lines, folded how many rows a closed fold on it hides)
+// Returns the color the line ends in (the line itself starts in the default color)
+int editorDrawRow(struct abuf *ab, int r, int filerow, int sub, int folded) {
+    int current_color = -1;
+    int coloff = EC.wrap ? sub * EC.screencols : EC.coloff;
+
+    if (filerow >= EC.numrows) {
+        if (EC.numrows == 0 && r == EC.screenrows / 3) {
+            char intro[80];
+            int intro_len = snprintf(intro, sizeof(intro), "Rem Terminal Editor | v%s", VERSION);
+
+            if (intro_len > EC.screencols) {
+                intro_len = EC.screencols;
+            }
+
+            int padding = (EC.screencols - intro_len) / 2;
+
+            if (padding) {
+                aAppend(ab, "$", 1);
+                padding--;
+            }
+
+            while (padding--) { aAppend(ab," ", 1); }
+            
+            aAppend(ab, intro, intro_len);
+        
+        } else {
+            aAppend(ab, "$", 1);
+        }
+    } else {
+        erow *row = &EC.row[filerow];
+        int col_start = coloff;
+
+        editorPrepareRow(row);
+
+        int col_end = coloff + EC.screencols;
+        int pad_right = 0;
+
+        if (row->cols) {
+            // Visible columns to render bytes; wide characters cut by an edge become padding
+            int first = editorRowRxToRender(row, col_start);
+            int last = editorRowRxToRender(row, col_end);
+
+            if (last > first && row->cols[last] > col_end) {
+                pad_right = col_end - row->cols[last - 1];
+                last = editorRowRxToRender(row, row->cols[last - 1]);
+            }
+
+            if (first < row->rsize) {
+                for (int p = col_start; p < row->cols[first]; p++) { aAppend(ab, " ", 1); }
+            }
+
+            col_start = first;
+            col_end = last;
+        } else if (col_end > row->rsize) {
+            col_end = row->rsize;
+        }
+
+        // Render byte an extra cursor on this row sits on (drawn in reverse), or -1
+        struct editorCursor *cursor = EC.ncursors ? editorCursorAt(filerow) : NULL;
+        int mark_rx = cursor ? editorRowXposToRx(row, cursor->xpos) : -1;
+        int mark = cursor ? editorRowRxToRender(row, mark_rx) : -1;
 
-#define ABUF_INIT {NULL, 0}
+        // Selected render bytes [sel_start, sel_end), where rsize + 1 includes the line break
+        int sel_start = -1, sel_end = -1, y0, x0, y1, x1;
+        int rev = 0;
 
-void aAppend(struct abuf *ab, const char *s, int len) {
-    char *new = realloc(ab->b, ab->len + len);
+        if (editorSelection(&y0, &x0, &y1, &x1) && filerow >= y0 && filerow <= y1) {
+            sel_start = (filerow == y0) ? editorRowRxToRender(row, editorRowXposToRx(row, x0)) : 0;
+            sel_end = (filerow == y1) ? editorRowRxToRender(row, editorRowXposToRx(row, x1)) : row->rsize + 1;
+        }
 
-    if (new == NULL) { return; }
+        // First span that reaches the visible columns
+        int lo = 0, hi = row->nspans;
 
-    memcpy(&new[ab->len], s, len);
-    ab->b = new;
-    ab->len += len;
-}
+        while (lo < hi) {
+            int mid = (lo + hi) / 2;
 
-void aFree(struct abuf *ab) {
-    free(ab->b);
-}
+            if (row->spans[mid].start + row->spans[mid].len <= col_start) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
 
-void editorScroll() {
-    EC.rx = 0;
+        for (int sp = lo; sp < row->nspans && row->spans[sp].start < col_end; sp++) {
+            struct hlspan *span = &row->spans[sp];
+            int a = span->start > col_start ? span->start : col_start;
+            int b = span->start + span->len < col_end ? span->start + span->len : col_end;
 
-    if (EC.ypos < EC.numrows) {
-        EC.rx = editorRowXposToRx(&EC.row[EC.ypos], EC.xpos);
-    }
+            if (span->color != current_color) {
+                aAppendColor(ab, span->color);
+                current_color = span->color;
+            }
 
-    if (EC.ypos < EC.rowoff) {
-        EC.rowoff = EC.ypos;
-    }
+            while (a < b) {
+                int in_sel = (a >= sel_start && a < sel_end);
+                int end = b;
 
-    if (EC.ypos >= EC.rowoff + EC.screenrows) {
-        EC.rowoff = EC.ypos - EC.screenrows + 1;
-    }
+                if (in_sel != rev) {
+                    aAppend(ab, in_sel ? "\x1b[7m" : "\x1b[27m", in_sel ? 4 : 5);
+                    rev = in_sel;
+                }
 
-    if (EC.rx < EC.coloff) {
-        EC.coloff = EC.rx;
-    }
+                if (sel_start > a && sel_start < end) { end = sel_start; }
+                if (sel_end > a && sel_end < end) { end = sel_end; }
 
-    if (EC.rx >= EC.coloff + EC.screencols) {
-        EC.coloff = EC.rx - EC.screencols + 1;
-    }
-}
+                int ctrl = a + remFindCtrl(&row->render[a], end - a);
+                int special = ctrl;
 
-// Draws a $ on the left side of the terminal, regardless of size + draws entire row of terminal
-void editorDrawRows(struct abuf *ab) {
-    int r;
+                if (mark >= a && mark < ctrl) { special = mark; }
 
-    for (r = 0; r < EC.screenrows; r++) {
-        int filerow = r + EC.rowoff;
+                aAppend(ab, &row->render[a], special - a);
+
+                if (special == end) {
+                    a = end;
+                    continue;
+                }
 
-        if (filerow >= EC.numrows) {
-            if (EC.numrows == 0 && r == EC.screenrows / 3) {
-                char intro[80];
-                int intro_len = snprintf(intro, sizeof(intro), "Rem Terminal Editor | v%s", VERSION);
+                if (special == mark) {
+                    int next = utf8Next(row->render, end, mark);
 
-                if (intro_len > EC.screencols) {
-                    intro_len = EC.screencols;
+                    aAppend(ab, "\x1b[7m", 4);
+                    aAppend(ab, &row->render[mark], next - mark);
+                    a = next;
+                } else {
+                    char c = row->render[ctrl];
+                    char sym = (c <= 26) ? '@' + c : '?';
+                    aAppend(ab, "\x1b[7m", 4);
+                    aAppend(ab, &sym, 1);
+                    a = ctrl + 1;
                 }
 
-                int padding = (EC.screencols - intro_len) / 2;
+                aAppend(ab, "\x1b[m", 3);
 
-                if (padding) {
-                    aAppend(ab, "$", 1);
-                    padding--;
+                if (current_color != -1) {
+                    aAppendColor(ab, current_color);
                 }
 
-                while (padding--) { aAppend(ab," ", 1); }
-                
-                aAppend(ab, intro, intro_len);
-            
-            } else {
-                aAppend(ab, "$", 1);
+                if (rev) { aAppend(ab, "\x1b[7m", 4); }
             }
-        } else {
-            int col_len = EC.row[filerow].rsize - EC.coloff;
+        }
 
-            if (col_len < 0) {
-                col_len = 0;
-            }
-            
-            if (col_len > EC.screencols) {
-                col_len = EC.screencols;
-            }
+        if (rev) { aAppend(ab, "\x1b[27m", 5); }
 
-            char *c = &EC.row[filerow].render[EC.coloff];
-            unsigned char *syntax_hl = &EC.row[filerow].syntax_hl[EC.coloff];
-            int current_color = -1;
-            
-            int j;
+        // A cursor or a selected line break past the end of the text shows as a reversed space
+        int end_rx = row->cols ? row->rcols : row->rsize;
 
-            for (j = 0; j < col_len; j++) {
-                if (iscntrl(c[j])) {
-                    char sym = (c[j] <= 26) ? '@' + c[j] : '?';
-                    aAppend(ab, "\x1b[7m", 4);
-                    aAppend(ab, &sym, 1);
-                    aAppend(ab, "\x1b[m", 3);
+        if ((mark >= row->rsize || (sel_end > row->rsize && sel_start <= row->rsize)) &&
+            end_rx >= coloff && end_rx < coloff + EC.screencols) {
+            aAppend(ab, "\x1b[7m \x1b[27m", 10);
+            end_rx++;
+        }
 
-                    if (current_color != -1) {
-                        char buf[16];
-                        int c_len = snprintf(buf, sizeof(buf), "\x1b[%dm", current_color);
-                        aAppend(ab, buf, c_len);
-                    }
-                } else if (syntax_hl[j] == SYNTAX_HL_DEFAULT) {
+        // A closed fold's first row is followed by how many rows it hides
+        if (folded && end_rx >= coloff && end_rx + 1 < coloff + EC.screencols) {
+            char tag[32];
+            int tag_len = snprintf(tag, sizeof(tag), "+%d lines", folded);
+            int room = coloff + EC.screencols - end_rx - 1;
 
-                    if (current_color != -1) {
-                        aAppend(ab, "\x1b[39m", 5);
-                        current_color = -1;
-                    }
-                    
-                    aAppend(ab, &c[j], 1);
-                
-                } else {
-                    int syntax_color = editorSyntaxToColor(syntax_hl[j]);
+            aAppend(ab, " \x1b[7m", 5);
+            aAppend(ab, tag, tag_len < room ? tag_len : room);
+            aAppend(ab, "\x1b[27m", 5);
+        }
 
-                    if (syntax_color != current_color) {
-                        current_color = syntax_color;
+        while (pad_right-- > 0) { aAppend(ab, " ", 1); }
+    }
 
-                        char buf[16];
-                        int c_len = snprintf(buf, sizeof(buf), "\x1b[%dm", syntax_color);
-                        aAppend(ab, buf, c_len);
-                    }
+    aAppend(ab, "\x1b[K", 3);
 
-                    aAppend(ab, &c[j], 1);
-                }
-            }
+    return current_color;
+}
 
-            aAppend(ab, "\x1b[39m", 5);
-        }
+static uint64_t editorHashLine(const char *s, int len) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+
+    for (int i = 0; i < len; i++) {
+        h = (h ^ (unsigned char) s[i]) * 0x100000001b3ULL;
+    }
+
+    return h;
+}
 
-        aAppend(ab, "\x1b[K", 3);
-        aAppend(ab, "\r\n", 2);
+/*
+Sends one screen line unless the terminal already shows it. Skipped lines
+are jumped over with a cursor move; *last is the last line actually sent and
+*term_color the color the terminal was left in.
+*/
+void editorEmitLine(struct abuf *ab, struct abuf *line, int r, int end_color, int *last, int *term_color) {
+    uint64_t h = editorHashLine(line->b, line->len);
+
+    if (EC.shadow[r] == h) { return; }
+
+    EC.shadow[r] = h;
+
+    if (r == *last + 1) {
+        if (r > 0) { aAppend(ab, "\r\n", 2); }
+    } else {
+        char buf[32];
+        int len = snprintf(buf, sizeof(buf), "\x1b[%d;1H", r + 1);
+        aAppend(ab, buf, len);
     }
+
+    if (*term_color != -1) {
+        aAppendColor(ab, -1);
+    }
+
+    aAppend(ab, line->b, line->len);
+    *last = r;
+    *term_color = end_color;
 }
 
 void editorDrawStatusBar(struct abuf *ab) {
@@ -879,9 +5021,27 @@ void editorDrawStatusBar(struct abuf *ab) {
 
     char status[80], rstatus[80];
 
-    int len = snprintf(status, sizeof(status), "%.20s - %d lines %s", EC.filename ? EC.filename : "[No File Chosen]", EC.numrows, EC.dirty ? "(modified)" : "");
-
-    int rlen = snprintf(rstatus, sizeof(rstatus), "Filetype: %s | %d/%d", EC.syntax ? EC.syntax->filetype : "No Filetype Present", EC.ypos + 1, EC.numrows);
+    int len = EC.grep_view ?
+        snprintf(status, sizeof(status), "Search: %.20s - %d hits%s", EC.grep->query, EC.grep->nhits, EC.grep->nhits >= GREP_MAX_HITS ? " (limit)" : "") :
+        EC.hex ?
+        snprintf(status, sizeof(status), "%.20s - %llu bytes", EC.filename, (unsigned long long) EC.textlen) :
+        snprintf(status, sizeof(status), "%.20s - %d lines %s", EC.filename ? EC.filename : "[No File Chosen]", EC.numrows, EC.zip ? "(read-only)" : EC.dirty ? "(modified)" : "");
+
+    int rlen = EC.grep_view ?
+        (grepDone(EC.grep) ?
+            snprintf(rstatus, sizeof(rstatus), "%d files | %d/%d", EC.grep->nfiles, EC.grep->nhits ? EC.grep_sel + 1 : 0, EC.grep->nhits) :
+            snprintf(rstatus, sizeof(rstatus), "Searching... %d files", __atomic_load_n(&EC.grep->files_done, __ATOMIC_RELAXED))) :
+        EC.hex ?
+        snprintf(rstatus, sizeof(rstatus), "Hex, read-only | 0x%llx/0x%llx", (unsigned long long) EC.hex_cur, (unsigned long long) EC.textlen) :
+        editorZipRunning() ?
+        snprintf(rstatus, sizeof(rstatus), "Decompressing... %d%% | %d/%d", EC.zip_shown, EC.ypos + 1, EC.numrows) :
+        EC.ncursors ?
+        snprintf(rstatus, sizeof(rstatus), "Filetype: %.20s | %d cursors | %d/%d", EC.syntax ? EC.syntax->filetype : "No Filetype Present", EC.ncursors + 1, EC.ypos + 1, EC.numrows) :
+        snprintf(rstatus, sizeof(rstatus), "Filetype: %.20s | %d/%d", EC.syntax ? EC.syntax->filetype : "No Filetype Present", EC.ypos + 1, EC.numrows);
+
+    // snprintf counts what didn't fit too
+    if (len >= (int) sizeof(status)) { len = sizeof(status) - 1; }
+    if (rlen >= (int) sizeof(rstatus)) { rlen = sizeof(rstatus) - 1; }
 
     if (len > EC.screencols) {
         len = EC.screencols;
@@ -899,7 +5059,6 @@ void editorDrawStatusBar(struct abuf *ab) {
         }
     }
     aAppend(ab, "\x1b[m", 3);
-    aAppend(ab, "\r\n", 2);
 }
 
 void editorDrawMessageBar(struct abuf *ab) {
@@ -917,29 +5076,397 @@ void editorDrawMessageBar(struct abuf *ab) {
     }
 }
 
+static long long editorNowMs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+// Forgets what the terminal shows, so the next frame is sent in full
+void editorInvalidateScreen() {
+    free(EC.shadow);
+    EC.shadow_rows = EC.screenrows + 2;
+    EC.shadow = calloc(EC.shadow_rows, sizeof(uint64_t));
+}
+
+void editorOnResize(int sig) {
+    (void) sig;
+    EC.resized = 1;
+}
+
+/*
+Lays the screen out again for the terminal's new size. Only what depends on
+the size is redone: the viewport (keeping the cursor's line where it was on
+the screen), the wrapped line counts (recounted lazily once the width
+differs from wrap_cols) and the shadow screen. Rows keep their text and
+highlighting.
+*/
+void editorResize() {
+    int rows, cols;
+
+    EC.resized = 0;
+
+    if (getWindowSize(&rows, &cols) == -1) { return; }
+
+    editorScroll();
+
+    int y = editorCursorLine() - EC.rowoff;
+
+    EC.screenrows = (rows > 3) ? rows - 2 : 1;
+    EC.screencols = (cols > 1) ? cols : 1;
+
+    if (y >= EC.screenrows) { y = EC.screenrows - 1; }
+
+    int v = editorCursorLine();
+
+    EC.rowoff = (v > y) ? v - y : 0;
+    editorInvalidateScreen();
+}
+
 void editorRefreshScreen() {
+    if (EC.batch) { return; }
+    if (EC.resized) { editorResize(); }
+
     editorScroll();
 
+    if (EC.shadow_rows != EC.screenrows + 2) {
+        editorInvalidateScreen();
+    }
+
     struct abuf ab = ABUF_INIT;
+    struct abuf line = ABUF_INIT;
+    int last = -1;
+    int term_color = -1;
 
     aAppend(&ab, "\x1b[?25l", 6);
     aAppend(&ab, "\x1b[H", 3);
 
-    editorDrawRows(&ab);
-    editorDrawStatusBar(&ab);
-    editorDrawMessageBar(&ab);
+    // The hit list can't grow while it's drawn
+    if (EC.grep_view) {
+        pthread_mutex_lock(&EC.grep->lock);
+        editorGrepScroll();
+        EC.grep_drawn = EC.grep->nhits * 2 + grepDone(EC.grep);
+    }
+
+    // Screen rows step through a row's wrapped lines, then from a closed fold's first row straight past it
+    int sub;
+    int filerow = editorFileRow(EC.rowoff, &sub);
+    int root = foldRootFrom(&EC.folds, filerow);
+
+    for (int r = 0; r < EC.screenrows; r++) {
+        int folded = 0;
+
+        if (EC.grep_view) {
+            line.len = 0;
+            editorDrawGrepRow(&line, r);
+            editorEmitLine(&ab, &line, r, -1, &last, &term_color);
+            continue;
+        }
+
+        if (EC.hex) {
+            line.len = 0;
+            editorDrawHexRow(&line, r);
+            editorEmitLine(&ab, &line, r, -1, &last, &term_color);
+            continue;
+        }
+
+        if (root < EC.folds.nroots && foldRoot(&EC.folds, root)->start == filerow) {
+            folded = foldRoot(&EC.folds, root)->end - filerow;
+        }
+
+        line.len = 0;
+        int end_color = editorDrawRow(&line, r, filerow, sub, folded);
+        editorEmitLine(&ab, &line, r, end_color, &last, &term_color);
+
+        if (EC.wrap && filerow < EC.numrows && sub + 1 < EC.row[filerow].vlines) {
+            sub++;
+            continue;
+        }
+
+        if (folded) { root++; }
+
+        filerow += 1 + folded;
+        sub = 0;
+    }
+
+    line.len = 0;
+    editorDrawStatusBar(&line);
+    editorEmitLine(&ab, &line, EC.screenrows, -1, &last, &term_color);
+
+    if (EC.grep_view) { pthread_mutex_unlock(&EC.grep->lock); }
+
+    line.len = 0;
+    editorDrawMessageBar(&line);
+    editorEmitLine(&ab, &line, EC.screenrows + 1, -1, &last, &term_color);
+
+    if (term_color != -1) {
+        aAppendColor(&ab, -1);
+    }
+
+    aFree(&line);
+
+    int cy = editorVisualRow(EC.ypos) - EC.rowoff;
+    int cx = EC.rx - EC.coloff;
+
+    if (EC.grep_view) {
+        cy = EC.grep_sel - EC.grep_top;
+        cx = 0;
+    } else if (EC.hex) {
+        cy = EC.hex_cur / editorHexPer() - EC.hex_top;
+        cx = hexByteColumn(EC.hex_cur % editorHexPer(), editorHexDigits());
+    } else if (EC.wrap) {
+        int line = editorWrapLine(EC.ypos, EC.rx);
+
+        cy += line;
+        cx = EC.rx - line * EC.wrap_cols;
+
+        if (cx >= EC.wrap_cols) { cx = EC.wrap_cols - 1; }
+    }
 
     char buf[32];
-    snprintf(buf, sizeof(buf), "\x1b[%d;%dH", (EC.ypos - EC.rowoff) + 1,
-                                              (EC.rx - EC.coloff) + 1);
+    snprintf(buf, sizeof(buf), "\x1b[%d;%dH", cy + 1, cx + 1);
 
     aAppend(&ab, buf, strlen(buf));
     aAppend(&ab, "\x1b[?25h", 6);
 
+    long long start = editorNowMs();
     write(STDOUT_FILENO, ab.b, ab.len);
+    long long took = editorNowMs() - start;
+    EC.frame_bytes = ab.cap + line.cap;
     aFree(&ab);
+
+    // A slow write means the terminal is backed up: space frames out, then recover
+    EC.frame_ms = (EC.frame_ms * 3 + took * 2) / 4;
+
+    if (EC.frame_ms > FRAME_MAX_MS) {
+        EC.frame_ms = FRAME_MAX_MS;
+    }
+}
+
+// Waits up to timeout ms (-1: forever) for input; also wakes when stdout drains if want_output
+int editorWaitIO(int timeout, int want_output) {
+    struct pollfd fds[2] = {
+        {STDIN_FILENO, POLLIN, 0},
+        {STDOUT_FILENO, POLLOUT, 0}
+    };
+
+    return poll(fds, want_output ? 2 : 1, timeout);
+}
+
+int editorInputPending() {
+    struct pollfd fd = {STDIN_FILENO, POLLIN, 0};
+    return poll(&fd, 1, 0) > 0;
+}
+
+int editorOutputReady() {
+    struct pollfd fd = {STDOUT_FILENO, POLLOUT, 0};
+    return poll(&fd, 1, 0) > 0 && (fd.revents & POLLOUT);
 }
 
+// Frees caches and the results of a project search that isn't shown. Returns the bytes freed.
+static long long editorDropCaches() {
+    long long freed = EC.pack_cache.cap;
+
+    free(EC.pack_cache.text);
+    EC.pack_cache.text = NULL;
+    EC.pack_cache.cap = 0;
+    EC.pack_cache.block = -1;
+
+    if (EC.grep && !EC.grep_view) {
+        freed += grepHeap(EC.grep);
+        grepFree(EC.grep);
+        EC.grep = NULL;
+    }
+
+    return freed;
+}
+
+// Drops the rendering and highlighting of rows [from, to), rebuilt when they're next drawn. Returns the bytes freed.
+static long long editorColdRows(int from, int to) {
+    long long freed = 0;
+
+    for (int i = from; i < to; i++) {
+        erow *row = &EC.row[i];
+
+        if (row->render == NULL && row->syntax_hl == NULL) { continue; }
+
+        freed += editorRowHeap(row);
+        editorColdRow(row);
+        freed -= editorRowHeap(row);
+    }
+
+    return freed;
+}
+
+// Drops the word index for good (completion stops). Returns the bytes freed.
+static long long editorWordsDrop() {
+    long long freed = wordsHeap(&EC.words);
+
+    editorWordsReset();
+    EC.words_off = 1;
+
+    return freed;
+}
+
+/*
+Keeps what the editor holds on the heap under mem_budget. Once roughly that
+much has been made resident, it's all measured (the rows a chunk at a time),
+and if it's over the budget it's brought down to 3/4 of it, cheapest to
+rebuild first: caches and the results of a hidden project search go, then
+rows lose their rendering and highlighting, then the word index goes, and
+last the rows' text is packed. Rows are evicted from the ends of the file
+inwards (the end further from the view first), and rows near the view and
+the cursor are kept. Returns 1 while there's more to do.
+*/
+static int editorTrimStep() {
+    long long target = (long long) EC.mem_budget / 4 * 3;
+
+    if (EC.trim_phase == 0) {
+        // Rows that couldn't be brought under it aren't measured again until they've grown some more
+        if (EC.mem_rows + EC.mem_grown <= EC.mem_budget || EC.mem_grown < EC.mem_budget / 16) { return 0; }
+
+        size_t use[MEM_KINDS];
+
+        editorMemUse(use, 0);
+
+        EC.trim_phase = 1;
+        EC.trim_row = 0;
+        EC.trim_total = memTotal(use) + sizeof(erow) * EC.numrows;
+        EC.mem_grown = 0;
+    }
+
+    if (EC.trim_phase == 1) {
+        int end = (EC.trim_row + 65536 < EC.numrows) ? EC.trim_row + 65536 : EC.numrows;
+
+        for (int i = EC.trim_row; i < end; i++) { EC.trim_total += editorRowHeap(&EC.row[i]); }
+
+        EC.trim_row = end;
+
+        if (end < EC.numrows) { return 1; }
+
+        if (EC.trim_total > target) { EC.trim_total -= editorDropCaches(); }
+
+        EC.trim_phase = 2;
+        EC.trim_lo = 0;
+        EC.trim_hi = EC.numrows;
+    }
+
+    int sub;
+    int top = editorFileRow(EC.rowoff, &sub);
+    int bottom = editorFileRow(EC.rowoff + EC.screenrows, &sub);
+    int keep_lo = ((EC.ypos < top) ? EC.ypos : top) - PACK_MARGIN;
+    int keep_hi = ((EC.ypos > bottom) ? EC.ypos : bottom) + PACK_MARGIN;
+
+    if (EC.trim_hi > EC.numrows) { EC.trim_hi = EC.numrows; }
+
+    int before = keep_lo - EC.trim_lo;  // Rows left to evict before the view
+    int after = EC.trim_hi - keep_hi;   // And after it
+
+    // Phase 2 drops what rows worked out from their text, phase 3 packs the text
+    long long (*evict)(int, int) = (EC.trim_phase == 2) ? editorColdRows : editorPackRows;
+
+    if (EC.trim_total > target && (before > 0 || after > 0)) {
+        if (before >= after) {
+            int to = (EC.trim_lo + 16384 < keep_lo) ? EC.trim_lo + 16384 : keep_lo;
+
+            EC.trim_total -= evict(EC.trim_lo, to);
+            EC.trim_lo = to;
+        } else {
+            int from = (EC.trim_hi - 16384 > keep_hi) ? EC.trim_hi - 16384 : keep_hi;
+
+            EC.trim_total -= evict(from, EC.trim_hi);
+            EC.trim_hi = from;
+        }
+
+        return 1;
+    }
+
+    if (EC.trim_phase == 2 && EC.trim_total > target) {
+        EC.trim_total -= editorWordsDrop();
+        EC.trim_phase = 3;
+        EC.trim_lo = 0;
+        EC.trim_hi = EC.numrows;
+
+        return 1;
+    }
+
+    // Rows near the view keep their text, but needn't keep a big shared block (the file copied on save) alive
+    if (EC.trim_total > target) {
+        long long held = editorBlocksHeap();
+
+        for (int i = (keep_lo > 0) ? keep_lo : 0; i < keep_hi && i < EC.numrows; i++) {
+            if (!editorInText(EC.row[i].chars) && editorTextShared(EC.row[i].chars)) { editorRowOwn(&EC.row[i]); }
+        }
+
+        EC.trim_total -= held - (long long) editorBlocksHeap();
+    }
+
+    EC.mem_rows = (EC.trim_total > 0) ? EC.trim_total : 0;
+    EC.trim_phase = 0;
+
+    return 0;
+}
+// Shows what the editor holds on the heap in the status bar, largest first; straight after, ^T writes it all to a file
+void editorMemoryShow() {
+    size_t use[MEM_KINDS];
+
+    editorMemUse(use, 1);
+
+    if (!EC.mem_shown) {
+        char line[sizeof(EC.statusmsg) - 12];
+
+        memSummary(line, sizeof(line), use, EC.mem_budget);
+        editorSetStatusMessage("%s | ^T: Dump", line);
+        EC.mem_shown = 1;
+        return;
+    }
+
+    EC.mem_shown = 0;
+
+    char *path = editorPrompt("Write memory use to (Enter: " MEMORY_DUMP ", ESC to cancel): %s", NULL, 1);
+
+    if (path == NULL) { return; }
+
+    FILE *f = fopen(path[0] ? path : MEMORY_DUMP, "w");
+
+    if (f == NULL) {
+        editorSetStatusMessage("%s | Status: Can't write %.20s: %s | v%s", DEFAULT_MSG, path[0] ? path : MEMORY_DUMP, strerror(errno), VERSION);
+    } else {
+        memReport(f, use, EC.mem_budget, EC.text_mapped ? EC.textlen : 0);
+        fclose(f);
+        editorSetStatusMessage("%s | Status: Memory use written to %.20s | v%s", DEFAULT_MSG, path[0] ? path : MEMORY_DUMP, VERSION);
+    }
+
+    free(path);
+}
+
+/*
+Background work for when there's no input: works out the remaining syntax
+states a chunk at a time, then writes the line cache, indexes words for
+completion and keeps rows within the memory budget. Returns 1 while there's more to do.
+*/
+int editorIdleWork() {
+    if (EC.hl_valid < EC.numrows) {
+        editorHlAdvance(EC.hl_valid + 65535);
+        return 1;
+    }
+
+    if (EC.cache_pending && !EC.dirty) {
+        editorSaveCache();
+        EC.cache_pending = 0;
+    }
+
+    // Count brackets ahead of time so the first match doesn't have to lex the whole file
+    if (EC.brackets_scan < EC.numrows) {
+        editorBracketsSummarise(EC.brackets_scan, EC.brackets_scan + 65536);
+        EC.brackets_scan += 65536;
+        return 1;
+    }
+
+    if (editorWordsScan()) { return 1; }
+
+    return editorTrimStep();
+}
 
 void editorSetStatusMessage(const char *fmt, ...) {
     va_list ap;
@@ -951,7 +5478,7 @@ void editorSetStatusMessage(const char *fmt, ...) {
 }
 
 // Prompt for status bar (saving files)
-char *editorPrompt(char *prompt, void (*callback)(char *, int)) {
+char *editorPrompt(char *prompt, void (*callback)(char *, int), int allow_empty) {
     size_t bufsize = 128;
     char *buf = malloc(bufsize);
 
@@ -966,7 +5493,8 @@ char *editorPrompt(char *prompt, void (*callback)(char *, int)) {
 
         if (k == DEL_KEY || k == CTRL_KEY('h') || k == BACKSPACE) {
             if (buflen != 0) {
-                buf[--buflen] = '\0';
+                buflen = utf8Prev(buf, buflen, buflen);
+                buf[buflen] = '\0';
             }
         } else if (k == '\x1b') { // ESC key
             // editorSetStatusMessage("");
@@ -975,12 +5503,12 @@ char *editorPrompt(char *prompt, void (*callback)(char *, int)) {
             free(buf);
             return NULL;
         }  else if (k == '\r') {
-            if (buflen != 0) {
+            if (buflen != 0 || allow_empty) {
                 editorSetStatusMessage("");
                 if (callback) { callback(buf, k); }
                 return buf;
             }
-        } else if (!iscntrl(k) && k < 128) {
+        } else if ((!iscntrl(k) && k < 128) || (k >= 128 && k < 256)) {
             if (buflen == bufsize -1) {
                 bufsize += 2;
                 buf = realloc(buf, bufsize);
@@ -995,77 +5523,289 @@ char *editorPrompt(char *prompt, void (*callback)(char *, int)) {
 }
 
 void editorMoveCursor(int key) {
+    editorFoldReveal(EC.ypos);
+
     erow *row = (EC.ypos >= EC.numrows) ? NULL : &EC.row[EC.ypos];
+    int rx = row ? editorRowXposToRx(row, EC.xpos) : 0;
 
     switch (key) {
         case ARROW_LEFT:
             if (EC.xpos != 0) {
-                EC.xpos--;
+                EC.xpos = utf8Prev(row->chars, row->size, EC.xpos);
             } else if (EC.ypos > 0) {
-                EC.ypos--;
+                EC.ypos = editorStepRow(EC.ypos, -1);
                 EC.xpos = EC.row[EC.ypos].size;
             }
             break;
         case ARROW_RIGHT:
             if (row && EC.xpos < row->size) {
-                EC.xpos++;
+                EC.xpos = utf8Next(row->chars, row->size, EC.xpos);
             } else if (row && EC.xpos == row->size) {
-                EC.ypos++;
+                EC.ypos = editorStepRow(EC.ypos, 1);
                 EC.xpos = 0;
             }
             break;
         case ARROW_UP:
-            if (EC.ypos != 0) {
-                EC.ypos--;
+            if (EC.wrap) {
+                editorWrapMove(-1, rx);
+            } else if (EC.ypos != 0) {
+                EC.ypos = editorStepRow(EC.ypos, -1);
+                EC.xpos = editorRowRxToXpos(&EC.row[EC.ypos], rx);
             }
             break;
         case ARROW_DOWN:
-            if (EC.ypos < EC.numrows) {
-                EC.ypos++;
+            if (EC.wrap) {
+                if (EC.ypos < EC.numrows) { editorWrapMove(1, rx); }
+            } else if (EC.ypos < EC.numrows) {
+                EC.ypos = editorStepRow(EC.ypos, 1);
+
+                if (EC.ypos < EC.numrows) {
+                    EC.xpos = editorRowRxToXpos(&EC.row[EC.ypos], rx);
+                }
             }
             break;
     }
 
-    row = (EC.ypos >= EC.numrows) ? NULL : &EC.row[EC.ypos];
-    int row_len = row ? row->size : 0;
+    row = (EC.ypos >= EC.numrows) ? NULL : &EC.row[EC.ypos];
+    int row_len = row ? row->size : 0;
+
+    if (EC.xpos > row_len) {
+        EC.xpos = row_len;
+    }
+}
+
+// Moves the cursor straight to row at (clamped), keeping its display column
+void editorJumpRow(int at) {
+    int rx = (EC.ypos < EC.numrows) ? editorRowXposToRx(&EC.row[EC.ypos], EC.xpos) : 0;
+
+    if (at > EC.numrows) { at = EC.numrows; }
+    if (at < 0) { at = 0; }
+
+    EC.ypos = at;
+    EC.xpos = (at < EC.numrows) ? editorRowRxToXpos(&EC.row[at], rx) : 0;
+}
+
+// Puts the cursor on the row holding byte offset off (as the buffer would be saved)
+void editorGotoOffset(int64_t off) {
+    if (EC.numrows == 0) { return; }
+
+    editorLineIndexBuild();
+
+    int64_t total = fenwickPrefix(&EC.lineidx, EC.numrows);
+
+    if (off >= total) { off = total - 1; }
+    if (off < 0) { off = 0; }
+
+    int at = fenwickFind(&EC.lineidx, off);
+
+    if (at >= EC.numrows) { at = EC.numrows - 1; }
+
+    erow *row = &EC.row[at];
+    int xpos = off - fenwickPrefix(&EC.lineidx, at);
+
+    if (xpos > row->size) { xpos = row->size; }
+
+    const char *chars = editorRowText(row, &EC.pack_cache);
+
+    // Land on the start of a character, not inside one
+    while (xpos > 0 && xpos < row->size && utf8IsCont(chars[xpos])) { xpos--; }
+
+    EC.ypos = at;
+    EC.xpos = xpos;
+}
+
+// Prompts for a line number, a percentage of the file or a byte offset, and jumps there
+void editorGoto() {
+    char *input = editorPrompt("Goto line, N%% or @offset (ESC to cancel): %s", NULL, 0);
+
+    if (input == NULL) { return; }
+
+    int len = strlen(input);
+    int ok = 0;
+    char *end;
+
+    if (input[0] == '@') {
+        long long off = strtoll(input + 1, &end, 0);
+
+        ok = (*end == '\0' && end != input + 1);
+
+        if (ok) { editorGotoOffset(off); }
+    } else if (input[len - 1] == '%') {
+        double pct = strtod(input, &end);
+
+        ok = (end == input + len - 1 && end != input);
+
+        if (ok) {
+            editorLineIndexBuild();
+            editorGotoOffset((int64_t) (fenwickPrefix(&EC.lineidx, EC.numrows) * (pct / 100)));
+        }
+    } else {
+        long long line = strtoll(input, &end, 10);
+
+        ok = (*end == '\0' && end != input);
+
+        if (ok) { editorJumpRow(line - 1 < EC.numrows ? line - 1 : EC.numrows - 1); }
+    }
+
+    if (!ok) {
+        editorSetStatusMessage("%s | Status: Not a line, N%% or @offset: %s | v%s", DEFAULT_MSG, input, VERSION);
+    }
+
+    // Show the target in the middle of the screen
+    editorFoldReveal(EC.ypos);
+    EC.rowoff = editorVisualRow(EC.ypos) - EC.screenrows / 2;
+
+    if (EC.rowoff < 0) { EC.rowoff = 0; }
+
+    free(input);
+}
+
+// Turns soft wrap on or off, keeping the cursor's line where it is on the screen
+void editorToggleWrap() {
+    editorScroll();
+
+    int y = editorCursorLine() - EC.rowoff;
+
+    EC.wrap = !EC.wrap;
+    EC.wrapidx_valid = 0;
+    EC.coloff = 0;
+
+    int v = editorCursorLine();
+
+    EC.rowoff = (v > y) ? v - y : 0;
+
+    editorSetStatusMessage("%s | Status: Soft wrap %s | v%s", DEFAULT_MSG, EC.wrap ? "on" : "off", VERSION);
+}
+
+// Keys that move the cursor or act on the selection; any other key drops it
+static int editorKeepsSelection(int key) {
+    switch (key) {
+        case ARROW_UP: case ARROW_DOWN: case ARROW_LEFT: case ARROW_RIGHT:
+        case SELECT_UP: case SELECT_DOWN: case SELECT_LEFT: case SELECT_RIGHT:
+        case HOME_KEY: case END_KEY: case PAGE_UP: case PAGE_DOWN: case FILE_START: case FILE_END:
+        case CTRL_KEY('b'): case CTRL_KEY('c'): case CTRL_KEY('k'):
+        case CTRL_KEY('g'): case CTRL_KEY('q'): case CTRL_KEY('s'): case CTRL_KEY('l'):
+        case CTRL_KEY(']'): case CTRL_KEY('e'): case CTRL_KEY('w'): case CTRL_KEY('t'):
+            return 1;
+    }
+
+    return 0;
+}
 
-    if (EC.xpos > row_len) {
-        EC.xpos = row_len;
+// Keys that leave the text as it is, the only ones a compressed file takes
+static int editorViewKey(int key) {
+    switch (key) {
+        case ARROW_UP:
+        case ARROW_DOWN:
+        case ARROW_LEFT:
+        case ARROW_RIGHT:
+        case SELECT_UP:
+        case SELECT_DOWN:
+        case SELECT_LEFT:
+        case SELECT_RIGHT:
+        case HOME_KEY:
+        case END_KEY:
+        case PAGE_UP:
+        case PAGE_DOWN:
+        case FILE_START:
+        case FILE_END:
+        case CTRL_KEY('x'):
+        case CTRL_KEY('q'):
+        case CTRL_KEY('g'):
+        case CTRL_KEY('b'):
+        case CTRL_KEY('c'):
+        case CTRL_KEY(']'):
+        case CTRL_KEY('e'):
+        case CTRL_KEY('f'):
+        case CTRL_KEY('w'):
+        case CTRL_KEY('p'):
+        case CTRL_KEY('t'):
+        case CTRL_KEY('l'):
+        case '\x1b':
+            return 1;
+        default:
+            return 0;
     }
 }
 
 void editorProcessKey() {
     static int quit_times = QUIT_TIMES;
+    int sub;
 
     int i = editorReadKey();
 
+    if (EC.grep_view && editorGrepKey(i)) { return; }
+    if (EC.hex && editorHexKey(i)) { return; }
+
+    if (EC.zip && !editorViewKey(i)) {
+        editorSetStatusMessage("%s | Status: Compressed files are read-only | v%s", DEFAULT_MSG, VERSION);
+        return;
+    }
+
+    // ^N again moves on to the next completion, anything else keeps the one inserted
+    if (i != CTRL_KEY('n')) { EC.complete_n = 0; }
+    if (i != CTRL_KEY('t')) { EC.mem_shown = 0; }
+
+    // Keys work on the text of the rows with cursors, so those can't stay packed
+    if (EC.ypos < EC.numrows) { editorRowUnpack(&EC.row[EC.ypos]); }
+
+    for (int c = 0; c < EC.ncursors; c++) {
+        if (EC.cursors[c].ypos < EC.numrows) { editorRowUnpack(&EC.row[EC.cursors[c].ypos]); }
+    }
+
+    if (EC.ncursors && editorMultiKey(i)) {
+        quit_times = QUIT_TIMES;
+        return;
+    }
+
+    if (EC.sel_active && !editorKeepsSelection(i)) { editorClearSelection(); }
+
     switch (i) {
         case '\r': // Enter key
             editorInsertNewLine();
             break;
         case CTRL_KEY('x'): // Exits the editor
+            // A batch script just ends here (the file is saved after it)
+            if (EC.batch) {
+                EC.batch_pos = EC.batch_len;
+                return;
+            }
+
             if (EC.dirty && quit_times > 0) {
                 editorSetStatusMessage("[WARNING] File has unsaved changes! Press ^X again to exit", quit_times);
                 quit_times--;
                 return;
             }
 
+            // A server's client only detaches: the file stays open for the next one
+            if (SS.attached) {
+                editorDetach();
+                return;
+            }
+
+            journalClose(EC.journal, 1);
+
             write(STDOUT_FILENO, "\x1b[2J", 4);
             write(STDOUT_FILENO, "\x1b[H", 3);
             exit(0);
             break;
+        case CTRL_KEY('p'): // Searches every file under the current directory
+            editorProjectSearch();
+            break;
+        case CTRL_KEY('n'): // Completes the word before the cursor
+            editorComplete();
+            break;
+        case CTRL_KEY('t'): // Shows where memory goes
+            editorMemoryShow();
+            break;
         case CTRL_KEY('s'): // Saves the file
-            editorSave();
-            
-            int is_writable;
-            is_writable = access(EC.filename, W_OK);
+            if (EC.batch) { break; } // Saved once the script is done
 
-            if (EC.filename != NULL && is_writable == 0) {
-                editorSetStatusMessage("%s | Status: File saved | v%s", DEFAULT_MSG, VERSION); // Displays message only if a file is open + saved
-            } else {
+            // editorSave() reports the bytes written, or why it couldn't save
+            if (editorSave() == -1 && EC.filename != NULL && access(EC.filename, W_OK) != 0) {
                 editorSetStatusMessage("%s | Status: File is not writable | v%s", DEFAULT_MSG, VERSION);
             }
-            
+
             break;
         case HOME_KEY:
             EC.xpos = 0;
@@ -1082,6 +5822,12 @@ void editorProcessKey() {
                 editorSetStatusMessage("%s | Status: Search Aborted | v%s", DEFAULT_MSG, VERSION); // Displays message only if a file is open + saved
             }
 
+            break;
+        case CTRL_KEY('r'):
+            editorReplace();
+            break;
+        case CTRL_KEY('z'):
+            editorUndo();
             break;
         case BACKSPACE:
         case CTRL_KEY('h'):
@@ -1093,25 +5839,75 @@ void editorProcessKey() {
             editorDelChar();
             break;
         case PAGE_UP:
+            // A screen above the top row, as if moving up from there
+            editorJumpRow(editorFileRow(EC.rowoff - EC.screenrows, &sub));
+            break;
         case PAGE_DOWN:
-            {
-                if (i == PAGE_UP) {
-                    EC.ypos = EC.rowoff;
-                } else if (i == PAGE_DOWN) {
-                    EC.ypos = EC.rowoff + EC.screenrows - 1;
-                    
-                    if (EC.ypos > EC.numrows) {
-                        EC.ypos = EC.numrows;
-                    }
-                }
-
-                int n_times = EC.screenrows;
+            editorJumpRow(editorFileRow(EC.rowoff + 2 * EC.screenrows - 1, &sub));
+            break;
+        case FILE_START:
+            EC.ypos = 0;
+            EC.xpos = 0;
+            break;
+        case FILE_END:
+            EC.ypos = EC.numrows ? EC.numrows - 1 : 0;
+            EC.xpos = EC.numrows ? EC.row[EC.ypos].size : 0;
+            break;
+        case CTRL_KEY('g'):
+            editorGoto();
+            break;
+        case CTRL_KEY('b'):
+            if (EC.sel_active) {
+                editorClearSelection();
+            } else {
+                EC.sel_active = 1;
+                EC.sel_x = EC.xpos;
+                EC.sel_y = EC.ypos;
+            }
+            break;
+        case SELECT_UP:
+        case SELECT_DOWN:
+        case SELECT_LEFT:
+        case SELECT_RIGHT:
+            if (!EC.sel_active) {
+                EC.sel_active = 1;
+                EC.sel_x = EC.xpos;
+                EC.sel_y = EC.ypos;
+            }
 
-                while (n_times--) {
-                    editorMoveCursor(i == PAGE_UP ? ARROW_UP : ARROW_DOWN);
-                }
+            {
+                static const int arrows[] = {ARROW_UP, ARROW_DOWN, ARROW_LEFT, ARROW_RIGHT};
+                editorMoveCursor(arrows[i - SELECT_UP]);
             }
             break;
+        case CTRL_KEY('c'):
+            editorCopy();
+            editorClearSelection();
+            break;
+        case CTRL_KEY('k'):
+            editorCut();
+            break;
+        case CTRL_KEY('v'):
+            editorPaste();
+            break;
+        case CTRL_KEY(']'):
+            editorMatchBracket();
+            break;
+        case CTRL_KEY('e'):
+            editorEnclosingBlock();
+            break;
+        case CTRL_KEY('f'):
+            editorToggleFold();
+            break;
+        case CTRL_KEY('w'):
+            editorToggleWrap();
+            break;
+        case ADD_CURSOR_UP:
+            editorAddCursor(-1);
+            break;
+        case ADD_CURSOR_DOWN:
+            editorAddCursor(1);
+            break;
         case ARROW_UP:
         case ARROW_DOWN:
         case ARROW_LEFT:
@@ -1142,14 +5938,524 @@ void initEditor() {
     EC.statusmsg[0] = '\0';
     EC.statusmsg_time = 0;
     EC.syntax = NULL;
+    EC.shadow = NULL;
+    EC.shadow_rows = 0;
+    EC.frame_ms = 0;
+    EC.undo = NULL;
+    EC.nundo = 0;
+    EC.text = NULL;
+    EC.textlen = 0;
+    EC.text_mapped = 0;
+    EC.text_layout = 0;
+    EC.hl_valid = 0;
+    EC.file_fingerprint = 0;
+    EC.cache_pending = 0;
+    EC.journal = NULL;
+    EC.journal_off = 0;
+    EC.lineidx.tree = NULL;
+    EC.lineidx.n = 0;
+    EC.lineidx_valid = 0;
+    EC.cursors = NULL;
+    EC.ncursors = 0;
+    EC.cursor_rx = 0;
+    EC.sel_active = 0;
+    EC.sel_x = 0;
+    EC.sel_y = 0;
+    EC.clip = NULL;
+    EC.nclip = 0;
+    EC.blocks = NULL;
+    EC.nblocks = 0;
+    memset(&EC.brackets, 0, sizeof(EC.brackets));
+    EC.brackets_valid = 0;
+    EC.brackets_scan = 0;
+    EC.lex_parallel = 0;
+    memset(&EC.folds, 0, sizeof(EC.folds));
+    EC.wrap = 0;
+    EC.wrap_cols = 0;
+    EC.wrapidx.tree = NULL;
+    EC.wrapidx.n = 0;
+    EC.wrapidx_valid = 0;
+    EC.resized = 0;
+    EC.packs = NULL;
+    EC.npacks = 0;
+    EC.pack_spare = NULL;
+    EC.nspare = 0;
+    EC.pack_cache.block = -1;
+    EC.pack_cache.text = NULL;
+    EC.pack_cache.cap = 0;
+    EC.packed_bytes = 0;
+    EC.mem_rows = 0;
+    EC.mem_grown = 0;
+    EC.trim_phase = 0;
+    EC.hex = 0;
+    EC.hex_cur = 0;
+    EC.hex_top = 0;
+    EC.grep = NULL;
+    EC.grep_view = 0;
+    EC.grep_sel = 0;
+    EC.grep_top = 0;
+    EC.grep_drawn = -1;
+    memset(&EC.words, 0, sizeof(EC.words));
+    EC.words_scan = 0;
+    EC.complete_n = 0;
+
+    EC.words_off = 0;
+    EC.frame_bytes = 0;
+    EC.mem_shown = 0;
+    EC.zip = NULL;
+    EC.zip_done = 0;
+    EC.zip_shown = -1;
+
+    // A container's memory limit keeps the default well under it
+    char *budget = getenv("REM_MEMORY_BUDGET");
+    size_t limit = memCgroupLimit();
+
+    EC.mem_budget = budget ? memParseSize(budget) : 0;
+
+    if (EC.mem_budget == 0) {
+        EC.mem_budget = (size_t) MEMORY_BUDGET_MB << 20;
+
+        if (limit && EC.mem_budget > limit / 2) { EC.mem_budget = limit / 2; }
+    }
+
+    // No terminal in batch mode: lay rows out as if on a plain 80x24 one
+    if (EC.batch) {
+        EC.screenrows = 24 - 2;
+        EC.screencols = 80;
+        return;
+    }
 
     if (getWindowSize(&EC.screenrows, &EC.screencols) == -1) {
         destroy("getWindowSize");
     }
 
     EC.screenrows -= 2;
+
+    // No SA_RESTART, so a resize also wakes the main loop out of poll()
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = editorOnResize;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGWINCH, &sa, NULL);
+}
+
+/*
+Batch mode
+
+rem --batch script file... plays a key script (see utils/script.h) on each
+file with no terminal and saves the file if the script changed it. The
+editor state is a single global, so each file gets a forked worker, with as
+many running at once as there are cores ($REM_THREADS).
+*/
+
+// Runs in the worker: never returns
+static void editorBatchFile(char *filename) {
+    initEditor();
+    EC.journal_off = 1; // No swap file: the edits are saved straight away
+    editorOpen(filename);
+
+    EC.batch_pos = 0;
+
+    while (EC.batch_pos < EC.batch_len) {
+        editorProcessKey();
+    }
+
+    if (!EC.dirty) {
+        printf("%s: unchanged\n", filename);
+        exit(0);
+    }
+
+    long long written = editorSave();
+
+    if (written == -1) {
+        fprintf(stderr, "%s: unable to save: %s\n", filename, strerror(errno));
+        exit(2);
+    }
+
+    printf("%s: %lld bytes written\n", filename, written);
+    exit(0);
+}
+
+// Waits for a worker and reports it if it failed (without saying why itself). Returns 1 if it failed.
+static int editorBatchReap(pid_t *pids, char **files, int nfiles) {
+    int status;
+    pid_t pid = wait(&status);
+
+    if (pid == -1) { return 0; }
+
+    for (int k = 0; k < nfiles; k++) {
+        if (pids[k] != pid) { continue; }
+
+        if (WIFEXITED(status) && WEXITSTATUS(status) == 0) { return 0; }
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 2) { fprintf(stderr, "%s: failed\n", files[k]); }
+
+        return 1;
+    }
+
+    return 0;
+}
+
+// Plays script on every file. Returns the exit status: 1 if any file failed.
+int editorBatch(const char *script, char **files, int nfiles) {
+    FILE *fp = fopen(script, "rb");
+
+    if (fp == NULL) {
+        perror(script);
+        return 1;
+    }
+
+    char *text = NULL;
+    size_t len = 0, cap = 0, got;
+
+    do {
+        if (len + 4096 > cap) {
+            cap = cap ? cap * 2 : 4096;
+            text = realloc(text, cap);
+        }
+
+        got = fread(text + len, 1, cap - len, fp);
+        len += got;
+    } while (got > 0);
+
+    fclose(fp);
+
+    EC.batch = 1;
+    EC.batch_len = scriptParse(text, (int) len, &EC.batch_keys);
+    free(text);
+
+    pid_t *pids = calloc(nfiles, sizeof(pid_t));
+    int workers = parallelThreads();
+    int running = 0, failed = 0;
+
+    // Whatever is buffered would otherwise be printed again by every worker
+    fflush(stdout);
+
+    for (int i = 0; i < nfiles; i++) {
+        if (running == workers) {
+            failed += editorBatchReap(pids, files, nfiles);
+            running--;
+        }
+
+        pids[i] = fork();
+
+        if (pids[i] == 0) { editorBatchFile(files[i]); }
+
+        if (pids[i] == -1) {
+            perror(files[i]);
+            failed++;
+            continue;
+        }
+
+        running++;
+    }
+
+    while (running-- > 0) {
+        failed += editorBatchReap(pids, files, nfiles);
+    }
+
+    free(pids);
+    free(EC.batch_keys);
+
+    return failed ? 1 : 0;
 }
 
+// Main editor loop: drain all pending input, then draw at most one frame. Returns once a server's client detaches.
+void editorLoop() {
+    int needs_redraw = 1;
+    long long last_frame = 0;
+
+    while (!SS.detached) {
+        if (EC.resized || editorGrepPending() || editorZipPoll()) { needs_redraw = 1; }
+
+        while (!SS.detached && editorInputPending()) {
+            editorProcessKey();
+            needs_redraw = 1;
+
+            // Still show progress during a long burst (e.g. a big paste)
+            if (editorNowMs() - last_frame >= FRAME_MAX_MS) { break; }
+        }
+
+        if (SS.detached) { break; }
+
+        if (!needs_redraw) {
+            if (!editorIdleWork()) { editorWaitIO(editorGrepRunning() ? GREP_POLL_MS : editorZipRunning() ? ZIP_POLL_MS : -1, 0); }
+            continue;
+        }
+
+        long long wait = last_frame + EC.frame_ms - editorNowMs();
+
+        if (wait <= 0 && editorOutputReady()) {
+            editorRefreshScreen();
+            needs_redraw = 0;
+            last_frame = editorNowMs();
+        } else {
+            editorWaitIO(wait > 0 ? (int) wait : -1, wait <= 0);
+        }
+    }
+}
+
+/*
+Server mode
+
+rem --server starts a daemon that keeps files open between sessions, so
+opening one again costs a round trip on a socket instead of mapping,
+indexing and highlighting it (see utils/server.h for the protocol). The
+editor state is a single global, so the file a client is attached to is in
+EC and up to SERVER_BUFFERS - 1 others are kept as copies of it in SS.bufs,
+swapped in as clients ask for them. A client that hangs up leaves its file
+as it was, edits and all. ^X keeps a saved file open, and closes one with
+unsaved edits, dropping them as it does without a server. A kept file that
+changed on disk is opened again, unless it has edits.
+*/
+
+// Closes the file in EC and frees everything of it. Unsaved edits stay in the swap file if keep_journal.
+static void editorFreeBuffer(int keep_journal) {
+    if (keep_journal) {
+        journalClose(EC.journal, 0);
+        EC.journal = NULL;
+    }
+
+    editorCloseFile();
+    editorFreeClip();
+
+    for (int b = 0; b < EC.nblocks; b++) { free(EC.blocks[b].data); }
+
+    free(EC.blocks);
+    free(EC.cursors);
+    free(EC.shadow);
+    free(EC.pack_cache.text);
+    free(EC.filename);
+
+    grepFree(EC.grep);
+
+    memset(&EC, 0, sizeof(EC));
+}
+
+// Closes the least recently attached of the files kept besides EC (its unsaved edits are recovered when it's opened again)
+static void editorEvictBuffer() {
+    struct editorConfig active = EC;
+
+    EC = *SS.bufs[0];
+    editorFreeBuffer(EC.dirty);
+    EC = active;
+
+    free(SS.bufs[0]);
+    memmove(SS.bufs, SS.bufs + 1, sizeof(SS.bufs[0]) * --SS.nbufs);
+}
+
+// Makes path (absolute) the file in EC: the one there already, one kept open, or a newly opened one
+static void editorSwitchBuffer(char *path) {
+    struct stat st;
+
+    if (EC.filename && strcmp(EC.filename, path) != 0) {
+        if (SS.nbufs == SERVER_BUFFERS - 1) { editorEvictBuffer(); }
+
+        SS.bufs[SS.nbufs] = malloc(sizeof(EC));
+        *SS.bufs[SS.nbufs++] = EC;
+        memset(&EC, 0, sizeof(EC));
+    }
+
+    for (int b = 0; b < SS.nbufs && EC.filename == NULL; b++) {
+        if (strcmp(SS.bufs[b]->filename, path) != 0) { continue; }
+
+        EC = *SS.bufs[b];
+        free(SS.bufs[b]);
+        memmove(SS.bufs + b, SS.bufs + b + 1, sizeof(SS.bufs[0]) * (--SS.nbufs - b));
+    }
+
+    int changed = EC.filename && (stat(path, &st) == -1 || st.st_dev != EC.file_st.st_dev || st.st_ino != EC.file_st.st_ino ||
+                                  st.st_size != EC.file_st.st_size || st.st_mtim.tv_sec != EC.file_st.st_mtim.tv_sec ||
+                                  st.st_mtim.tv_nsec != EC.file_st.st_mtim.tv_nsec);
+
+    if (changed && !EC.dirty) { editorFreeBuffer(0); }
+
+    if (EC.filename == NULL) {
+        initEditor();
+        editorOpen(path);
+
+        if (access(EC.filename, W_OK) == 0) {
+            editorSetStatusMessage("%s | v%s", DEFAULT_MSG, VERSION);
+        } else {
+            editorSetStatusMessage("%s | v%s - %s is not writable", DEFAULT_MSG, VERSION, EC.filename);
+        }
+
+        editorRecover();
+        return;
+    }
+
+    // Kept open: only the terminal is new
+    EC.resized = 1;
+    EC.frame_ms = 0;
+
+    if (changed) {
+        editorSetStatusMessage("%s | Status: File changed on disk since it was edited | v%s", DEFAULT_MSG, VERSION);
+    } else {
+        editorSetStatusMessage("%s | v%s", DEFAULT_MSG, VERSION);
+    }
+}
+
+// Ends the session on ^X
+void editorDetach() {
+    write(STDOUT_FILENO, "\x1b[2J", 4);
+    write(STDOUT_FILENO, "\x1b[H", 3);
+
+    if (EC.dirty) { editorFreeBuffer(0); }
+
+    SS.detached = 1;
+}
+
+// Serves the client on fd until it detaches
+static void editorSession(int fd) {
+    struct serverHello h;
+    struct stat st;
+    char cwd[4096], name[4096];
+    char *path = NULL;
+    char reply = SERVER_NO;
+
+    int ok = serverReadFull(fd, &h, sizeof(h), SERVER_REPLY_MS) == 0 && !memcmp(h.magic, SERVER_MAGIC, sizeof(h.magic)) &&
+             h.cwd_len < sizeof(cwd) && h.path_len > 0 && h.path_len < sizeof(name) &&
+             serverReadFull(fd, cwd, h.cwd_len, SERVER_REPLY_MS) == 0 && serverReadFull(fd, name, h.path_len, SERVER_REPLY_MS) == 0;
+
+    // Files the server can't open (a new one, say) the client opens itself, and says why if it can't either
+    if (ok) {
+        cwd[h.cwd_len] = '\0';
+        name[h.path_len] = '\0';
+        ok = chdir(cwd) == 0 && (path = realpath(name, NULL)) != NULL &&
+             stat(path, &st) == 0 && S_ISREG(st.st_mode) && access(path, R_OK) == 0;
+    }
+
+    if (ok) { reply = SERVER_YES; }
+
+    if (serverWriteFull(fd, &reply, 1) == -1 || !ok) {
+        close(fd);
+        free(path);
+        return;
+    }
+
+    dup2(fd, STDIN_FILENO);
+    dup2(fd, STDOUT_FILENO);
+    close(fd);
+
+    SS.attached = 1;
+    SS.detached = 0;
+    SS.rows = (h.rows < 3) ? 3 : (h.rows > 10000) ? 10000 : h.rows;
+    SS.cols = (h.cols < 1) ? 1 : (h.cols > 10000) ? 10000 : h.cols;
+
+    editorSwitchBuffer(path);
+    free(path);
+    editorLoop();
+
+    // ^P may have opened a file by a relative path, which the next client's directory would change
+    char *real = EC.filename ? realpath(EC.filename, NULL) : NULL;
+
+    if (real) {
+        free(EC.filename);
+        EC.filename = real;
+    }
+
+    SS.attached = 0;
+}
+
+// rem --server: starts the server in the background. Returns the exit status.
+int editorServe() {
+    char path[4096];
+    struct serverDoor door;
+
+    if (serverSocketPath(path, sizeof(path)) == -1) {
+        fprintf(stderr, "rem: no socket path (set $HOME, or $REM_SOCKET to a shorter path)\n");
+        return 1;
+    }
+
+    int fd = serverListen(path);
+
+    if (fd == -1) {
+        if (errno == EADDRINUSE) {
+            fprintf(stderr, "rem: a server is already running on %s\n", path);
+        } else {
+            perror(path);
+        }
+
+        return 1;
+    }
+
+    fflush(stdout);
+
+    pid_t pid = fork();
+
+    if (pid == -1) {
+        perror("fork");
+        return 1;
+    }
+
+    if (pid > 0) {
+        printf("Rem server running on %s (pid %d)\n", path, (int) pid);
+        return 0;
+    }
+
+    // No terminal of its own, and a client hanging up mid-frame mustn't kill it
+    int null = open("/dev/null", O_RDWR);
+
+    setsid();
+    dup2(null, STDIN_FILENO);
+    dup2(null, STDOUT_FILENO);
+    dup2(null, STDERR_FILENO);
+    signal(SIGPIPE, SIG_IGN);
+
+    if (serverDoorStart(&door, fd) == -1) { exit(1); }
+
+    while (1) {
+        editorSession(serverDoorNext(&door));
+
+        dup2(null, STDIN_FILENO);
+        dup2(null, STDOUT_FILENO);
+        serverDoorIdle(&door);
+    }
+}
+
+// Opens filename in the server, if one is running, and relays the terminal to it. Returns -1 if it didn't (the editor runs here instead), or the exit status.
+int editorAttach(const char *filename) {
+    char path[4096], cwd[4096];
+    char reply = SERVER_NO;
+    struct serverHello h;
+    struct winsize w;
+    int fd;
+
+    if (serverSocketPath(path, sizeof(path)) == -1 || getcwd(cwd, sizeof(cwd)) == NULL ||
+        ioctl(STDOUT_FILENO, TIOCGWINSZ, &w) == -1 || w.ws_col == 0) {
+        return -1;
+    }
+
+    // A busy server hangs up without reading the request
+    signal(SIGPIPE, SIG_IGN);
+
+    if ((fd = serverConnect(path)) == -1) { return -1; }
+
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, SERVER_MAGIC, sizeof(h.magic));
+    h.rows = w.ws_row;
+    h.cols = w.ws_col;
+    h.cwd_len = strlen(cwd);
+    h.path_len = strlen(filename);
+
+    serverWriteFull(fd, &h, sizeof(h));
+    serverWriteFull(fd, cwd, h.cwd_len);
+    serverWriteFull(fd, filename, h.path_len);
+
+    if (serverReadFull(fd, &reply, 1, SERVER_REPLY_MS) == -1 || reply != SERVER_YES) {
+        close(fd);
+        return -1;
+    }
+
+    enableRawMode();
+
+    int status = serverRelay(fd);
+
+    close(fd);
+
+    return status == 0 ? 0 : 1;
+}
+
+#ifndef REM_NO_MAIN
 /* ⚡ ᕙ(`▿´)ᕗ ⚡ */
 int main(int argc, char *argv[]) {
 
@@ -1167,7 +6473,28 @@ int main(int argc, char *argv[]) {
             printf("Simple Command(s) Overview:\n");
             printf("Ctrl+X => Exit the terminal editor\n");
             printf("Ctrl+Q => Search the contents of the open file\n");
-            printf("Ctrl+S => Save the contents of the file to disk\n\n");
+            printf("Ctrl+S => Save the contents of the file to disk\n");
+            printf("Ctrl+R => Replace every occurrence of a string\n");
+            printf("Ctrl+Z => Undo the last edit\n");
+            printf("Ctrl+G => Go to a line, N%% of the file or @byte offset\n");
+            printf("Ctrl+Up/Down => Add a cursor above/below (type at all of them, Esc to clear)\n");
+            printf("Ctrl+B => Start/stop selecting (or Shift+arrows)\n");
+            printf("Ctrl+C / Ctrl+K / Ctrl+V => Copy / cut / paste\n");
+            printf("Ctrl+] => Jump to the matching bracket\n");
+            printf("Ctrl+E => Jump to the start of the enclosing block\n");
+            printf("Ctrl+F => Fold the block at the cursor (or unfold it)\n");
+            printf("Ctrl+W => Turn soft wrap on/off\n");
+            printf("Ctrl+P => Search every file under the current directory (Enter on a hit goes there)\n");
+            printf("Ctrl+N => Complete the word before the cursor (again for the next match)\n");
+            printf("Ctrl+T => Show memory use by kind (again to write it to a file)\n\n");
+
+            printf("Binary files open read-only in hex (Ctrl+G: go to an offset, Ctrl+Q: search for bytes like 7f 45 4c)\n\n");
+            printf("gzip and zstd files open read-only, decompressed in the background\n\n");
+
+            printf("Batch Edits:\n");
+            printf("rem --batch script file... => Play the keys in script on each file and save it (no terminal needed)\n\n");
+            printf("Server Mode:\n");
+            printf("rem --server => Keep files open in the background; rem <file> then attaches to it and opens instantly\n\n");
             exit(0);
         } else if (!strcmp(argv[1], "-v") || !strcmp(argv[1], "--version")) {
             printf("Rem: v%s\n\n", VERSION);
@@ -1175,6 +6502,27 @@ int main(int argc, char *argv[]) {
         }
     }
     
+    // With a server running, it opens the file (or has it open already) and this is only its terminal
+    if (argc == 2 && strcmp(argv[1], "--server") != 0) {
+        int status = editorAttach(argv[1]);
+
+        if (status != -1) { exit(status); }
+    }
+
+    simdInit();
+    syntaxLoadAll();
+
+    if (argc == 2 && !strcmp(argv[1], "--server")) { exit(editorServe()); }
+
+    if (argc >= 2 && !strcmp(argv[1], "--batch")) {
+        if (argc < 4) {
+            fprintf(stderr, "Usage: rem --batch script file...\n");
+            exit(1);
+        }
+
+        exit(editorBatch(argv[2], argv + 3, argc - 3));
+    }
+
     enableRawMode();
     initEditor();
 
@@ -1190,11 +6538,9 @@ int main(int argc, char *argv[]) {
         editorSetStatusMessage("%s | v%s - %s is not writable", DEFAULT_MSG, VERSION, EC.filename);
     }
 
-    // Main editor loop
-    while (1) {
-        editorRefreshScreen();
-        editorProcessKey();
-    }
-    
+    editorRecover();
+    editorLoop();
+
     return 0;
 }
+#endif
@@ -9,4 +9,12 @@ enum editorKey {
     END_KEY,
     PAGE_UP,
     PAGE_DOWN,
+    FILE_START,
+    FILE_END,
+    ADD_CURSOR_UP,
+    ADD_CURSOR_DOWN,
+    SELECT_UP,
+    SELECT_DOWN,
+    SELECT_LEFT,
+    SELECT_RIGHT,
 };
@@ -0,0 +1,199 @@
+/*
+Bracket structure index
+
+Each row is summarised by how much it changes the bracket depth and the
+lowest depth it reaches relative to its start (counting (), [] and {} alike,
+outside strings and comments). Rows are grouped into BRACKET_BLOCK-row
+blocks, and a segment tree over the blocks keeps the sum and lowest prefix
+of each range, so the depth at any row and the next or previous row that
+dips to a given depth are found in O(log n).
+*/
+
+#define BRACKET_BLOCK 64
+#define BRACKET_UNKNOWN 1   // bmin of a row not summarised yet (real values are <= 0)
+
+struct bracketNode {
+    int32_t sum;   // Net depth change
+    int32_t min;   // Lowest depth relative to the start (<= 0)
+};
+
+struct bracketIndex {
+    struct bracketNode *tree;  // 1-based heap, leaves from size
+    int size;
+    int nblocks;
+    unsigned char *dirty;      // Blocks whose rows changed since the tree was updated
+    int *dirty_list;
+    int ndirty;
+};
+
+static struct bracketNode bracketCombine(struct bracketNode a, struct bracketNode b) {
+    struct bracketNode r;
+
+    r.sum = a.sum + b.sum;
+    r.min = (a.sum + b.min < a.min) ? a.sum + b.min : a.min;
+
+    return r;
+}
+
+static int bracketOpen(char c) {
+    return c == '(' || c == '[' || c == '{';
+}
+
+static int bracketClose(char c) {
+    return c == ')' || c == ']' || c == '}';
+}
+
+static int bracketPair(char open, char close) {
+    return (open == '(' && close == ')') || (open == '[' && close == ']') || (open == '{' && close == '}');
+}
+
+// Whether a bracket with highlight class hl counts (not in a string or comment)
+static int bracketCounts(unsigned char hl) {
+    return hl != SYNTAX_HL_STR && hl != SYNTAX_HL_COMMENT && hl != SYNTAX_HL_MULTI_COMMENT;
+}
+
+// Summarises a highlighted line
+void bracketScan(const char *s, const unsigned char *hl, int len, int *sum, int *min) {
+    int depth = 0, low = 0;
+
+    for (int i = 0; i < len; i++) {
+        if (bracketOpen(s[i]) && bracketCounts(hl[i])) {
+            depth++;
+        } else if (bracketClose(s[i]) && bracketCounts(hl[i])) {
+            if (--depth < low) { low = depth; }
+        }
+    }
+
+    *sum = depth;
+    *min = low;
+}
+
+void bracketFree(struct bracketIndex *b) {
+    free(b->tree);
+    free(b->dirty);
+    free(b->dirty_list);
+    memset(b, 0, sizeof(*b));
+}
+
+// Sets up an index of nblocks blocks; fill the leaves with bracketLeaf() and call bracketBuild()
+void bracketReset(struct bracketIndex *b, int nblocks) {
+    bracketFree(b);
+
+    b->size = 1;
+    while (b->size < nblocks) { b->size *= 2; }
+
+    b->nblocks = nblocks;
+    b->tree = calloc(2 * b->size, sizeof(struct bracketNode));
+    b->dirty = calloc(nblocks ? nblocks : 1, 1);
+    b->dirty_list = malloc(sizeof(int) * (nblocks ? nblocks : 1));
+}
+
+struct bracketNode *bracketLeaf(struct bracketIndex *b, int block) {
+    return &b->tree[b->size + block];
+}
+
+void bracketBuild(struct bracketIndex *b) {
+    for (int i = b->size - 1; i >= 1; i--) {
+        b->tree[i] = bracketCombine(b->tree[2 * i], b->tree[2 * i + 1]);
+    }
+}
+
+// Notes that a row in block changed; its leaf is redone by the caller before the next query
+void bracketTouch(struct bracketIndex *b, int block) {
+    if (block >= b->nblocks || b->dirty[block]) { return; }
+
+    b->dirty[block] = 1;
+    b->dirty_list[b->ndirty++] = block;
+}
+
+// Refreshes the path above a leaf that was just rewritten
+void bracketUpdate(struct bracketIndex *b, int block) {
+    for (int i = (b->size + block) / 2; i >= 1; i /= 2) {
+        b->tree[i] = bracketCombine(b->tree[2 * i], b->tree[2 * i + 1]);
+    }
+}
+
+// Depth at the start of block (sum of the blocks before it)
+int bracketDepth(const struct bracketIndex *b, int block) {
+    int depth = 0;
+
+    // Walk up from the leaf, adding every left sibling
+    for (int i = b->size + block; i > 1; i /= 2) {
+        if (i & 1) { depth += b->tree[i - 1].sum; }
+    }
+
+    return depth;
+}
+
+/*
+First block >= from in which the depth falls to target or below, given the
+depth at the start of from. Returns -1 if there is none.
+*/
+int bracketFindNext(const struct bracketIndex *b, int from, int depth, int target) {
+    if (from >= b->nblocks) { return -1; }
+
+    // Climb while the rest of the current subtree doesn't get low enough
+    int i = b->size + from;
+
+    while (depth + b->tree[i].min > target) {
+        depth += b->tree[i].sum;
+
+        while (i & 1) {
+            i /= 2;
+
+            if (i == 0) { return -1; }
+        }
+
+        i++;
+    }
+
+    // Then descend to the leftmost leaf that does
+    while (i < b->size) {
+        if (depth + b->tree[2 * i].min <= target) {
+            i = 2 * i;
+        } else {
+            depth += b->tree[2 * i].sum;
+            i = 2 * i + 1;
+        }
+    }
+
+    return (i - b->size < b->nblocks) ? i - b->size : -1;
+}
+
+/*
+Last block <= to in which the depth falls to target or below. Returns -1
+if there is none.
+*/
+int bracketFindPrev(const struct bracketIndex *b, int to, int target) {
+    if (to < 0) { return -1; }
+
+    int i = b->size + to;
+    int depth = bracketDepth(b, to);
+
+    while (depth + b->tree[i].min > target) {
+        while (!(i & 1)) {
+            i /= 2;
+
+            if (i == 0) { return -1; }
+        }
+
+        if (i == 1) { return -1; }
+
+        i--;
+        depth -= b->tree[i].sum;
+    }
+
+    // Then descend to the rightmost leaf that does
+    while (i < b->size) {
+        int left = 2 * i;
+
+        if (depth + b->tree[left].sum + b->tree[left + 1].min <= target) {
+            depth += b->tree[left].sum;
+            i = left + 1;
+        } else {
+            i = left;
+        }
+    }
+
+    return i - b->size;
+}
@@ -0,0 +1,68 @@
+/*
+Fenwick (binary indexed) tree over n int64 values
+
+Prefix sums, point updates and "which item holds position x" are all
+O(log n). Fill tree[1..n] with the values and call fenwickBuild() to set one
+up in O(n).
+*/
+
+struct fenwick {
+    int64_t *tree;  // 1-based
+    int n;
+};
+
+// Allocates a tree of n zero values
+void fenwickReset(struct fenwick *f, int n) {
+    free(f->tree);
+    f->tree = calloc(n + 1, sizeof(int64_t));
+    f->n = n;
+}
+
+void fenwickFree(struct fenwick *f) {
+    free(f->tree);
+    f->tree = NULL;
+    f->n = 0;
+}
+
+// Turns tree[1..n] holding plain values into a Fenwick tree
+void fenwickBuild(struct fenwick *f) {
+    for (int i = 1; i <= f->n; i++) {
+        int parent = i + (i & -i);
+
+        if (parent <= f->n) { f->tree[parent] += f->tree[i]; }
+    }
+}
+
+void fenwickAdd(struct fenwick *f, int i, int64_t delta) {
+    for (i++; i <= f->n; i += i & -i) {
+        f->tree[i] += delta;
+    }
+}
+
+// Sum of values [0, i)
+int64_t fenwickPrefix(const struct fenwick *f, int i) {
+    int64_t sum = 0;
+
+    for (; i > 0; i -= i & -i) {
+        sum += f->tree[i];
+    }
+
+    return sum;
+}
+
+// Largest i with fenwickPrefix(i) <= target (values must be non-negative)
+int fenwickFind(const struct fenwick *f, int64_t target) {
+    int pos = 0;
+    int step = 1;
+
+    while (step * 2 <= f->n) { step *= 2; }
+
+    for (; step > 0; step /= 2) {
+        if (pos + step <= f->n && f->tree[pos + step] <= target) {
+            pos += step;
+            target -= f->tree[pos];
+        }
+    }
+
+    return pos;
+}
@@ -0,0 +1,218 @@
+/*
+Fold tree
+
+Closed folds are kept in preorder (by header row, enclosing folds before the
+ones nested in them), so a fold's children follow it and survive it being
+opened. The roots, the folds not inside another, are the ones actually
+hiding rows; each carries the count of rows hidden before it, so file rows
+and visual (on screen) rows are converted in O(log n) with a binary search.
+*/
+
+// Rows start + 1 .. end are hidden under the header row start
+struct fold {
+    int start;
+    int end;
+};
+
+struct foldTree {
+    struct fold *folds;  // Preorder, header rows are unique
+    int n, cap;
+    int *roots;          // Indices of the outermost folds
+    int *hidden;         // hidden[k]: rows hidden by roots[0 .. k)
+    int nroots;
+};
+
+void foldFree(struct foldTree *t) {
+    free(t->folds);
+    free(t->roots);
+    free(t->hidden);
+    memset(t, 0, sizeof(*t));
+}
+
+// Works out the roots and their hidden counts again after the folds changed
+void foldIndex(struct foldTree *t) {
+    t->roots = realloc(t->roots, sizeof(int) * (t->n ? t->n : 1));
+    t->hidden = realloc(t->hidden, sizeof(int) * (t->n + 1));
+    t->nroots = 0;
+    t->hidden[0] = 0;
+
+    int reach = -1;
+
+    for (int i = 0; i < t->n; i++) {
+        if (t->folds[i].start <= reach) { continue; }
+
+        t->roots[t->nroots] = i;
+        t->hidden[t->nroots + 1] = t->hidden[t->nroots] + t->folds[i].end - t->folds[i].start;
+        t->nroots++;
+        reach = t->folds[i].end;
+    }
+}
+
+static struct fold *foldRoot(const struct foldTree *t, int k) {
+    return &t->folds[t->roots[k]];
+}
+
+// First root with its header at or after row (the number of roots before it)
+int foldRootFrom(const struct foldTree *t, int row) {
+    int lo = 0, hi = t->nroots;
+
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+
+        if (foldRoot(t, mid)->start < row) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+// Index of the fold whose header is row, or -1
+int foldAt(const struct foldTree *t, int row) {
+    int lo = 0, hi = t->n;
+
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+
+        if (t->folds[mid].start < row) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return (lo < t->n && t->folds[lo].start == row) ? lo : -1;
+}
+
+// The root hiding row, or -1 if it's visible
+int foldHiding(const struct foldTree *t, int row) {
+    int k = foldRootFrom(t, row) - 1;
+
+    return (k >= 0 && row <= foldRoot(t, k)->end) ? k : -1;
+}
+
+/*
+Closes rows start + 1 .. end under start. Returns 0 (and changes nothing) if
+the range is empty, start already heads a fold, or the range would cross an
+existing fold instead of nesting with it.
+*/
+int foldAdd(struct foldTree *t, int start, int end) {
+    if (end <= start || foldAt(t, start) != -1) { return 0; }
+
+    for (int i = 0; i < t->n; i++) {
+        const struct fold *f = &t->folds[i];
+
+        if ((f->start < start && start <= f->end && f->end < end) ||
+            (start < f->start && f->start <= end && end < f->end)) {
+            return 0;
+        }
+    }
+
+    int at = 0;
+
+    while (at < t->n && t->folds[at].start < start) { at++; }
+
+    if (t->n == t->cap) {
+        t->cap = t->cap ? t->cap * 2 : 16;
+        t->folds = realloc(t->folds, sizeof(struct fold) * t->cap);
+    }
+
+    memmove(&t->folds[at + 1], &t->folds[at], sizeof(struct fold) * (t->n - at));
+    t->folds[at].start = start;
+    t->folds[at].end = end;
+    t->n++;
+
+    foldIndex(t);
+    return 1;
+}
+
+// Opens fold i; the folds nested in it stay closed
+void foldRemove(struct foldTree *t, int i) {
+    memmove(&t->folds[i], &t->folds[i + 1], sizeof(struct fold) * (t->n - i - 1));
+    t->n--;
+
+    foldIndex(t);
+}
+
+// n rows were inserted at row at: folds after it move down, folds around it grow
+void foldInsertRows(struct foldTree *t, int at, int n) {
+    if (t->n == 0) { return; }
+
+    for (int i = 0; i < t->n; i++) {
+        struct fold *f = &t->folds[i];
+
+        if (f->start >= at) {
+            f->start += n;
+            f->end += n;
+        } else if (f->end >= at) {
+            f->end += n;
+        }
+    }
+
+    foldIndex(t);
+}
+
+/*
+Rows [at, at + n) were deleted: folds whose header went are dropped, folds
+around the rows shrink (and are dropped once nothing is left to hide).
+*/
+void foldDeleteRows(struct foldTree *t, int at, int n) {
+    if (t->n == 0) { return; }
+
+    int kept = 0;
+
+    for (int i = 0; i < t->n; i++) {
+        struct fold f = t->folds[i];
+
+        if (f.start >= at + n) {
+            f.start -= n;
+            f.end -= n;
+        } else if (f.start >= at) {
+            continue;
+        } else if (f.end >= at) {
+            f.end -= ((f.end < at + n) ? f.end + 1 : at + n) - at;
+
+            if (f.end <= f.start) { continue; }
+        }
+
+        t->folds[kept++] = f;
+    }
+
+    t->n = kept;
+    foldIndex(t);
+}
+
+// Visual row of a file row (a hidden row maps to the header it's folded under)
+int foldToVisual(const struct foldTree *t, int row) {
+    if (t->nroots == 0) { return row; }
+
+    int k = foldRootFrom(t, row);
+
+    if (k > 0 && row <= foldRoot(t, k - 1)->end) {
+        return foldRoot(t, k - 1)->start - t->hidden[k - 1];
+    }
+
+    return row - t->hidden[k];
+}
+
+// File row shown at visual row v
+int foldToFile(const struct foldTree *t, int v) {
+    if (t->nroots == 0) { return v; }
+
+    int lo = 0, hi = t->nroots;
+
+    // Roots whose header is shown above v hide all their rows before it
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+
+        if (foldRoot(t, mid)->start - t->hidden[mid] < v) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return v + t->hidden[lo];
+}
@@ -0,0 +1,244 @@
+/*
+Project search
+
+grepStart() looks for a string in every file under a directory on a
+background thread. It walks the tree first (skipping hidden entries and
+symlinks), then hands the files to a parallelFor() worker pool. Each file is
+mapped and searched with remFindStr(), the same kernel as the search in the
+buffer; files over GREP_MAX_FILE or that look binary are skipped. Hits (the
+first on each line) are added to a shared list as they're found, so it can be
+shown while the search is still running.
+*/
+
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define GREP_MAX_FILE (64 << 20)  // Larger files are skipped
+#define GREP_MAX_HITS 100000      // The search stops after this many
+#define GREP_LINE_MAX 240         // Bytes kept of each hit's line
+
+struct grepHit {
+    int file;    // Index into files
+    int line;    // From 0
+    int col;     // Byte in the line
+    char *text;  // The line, cut at GREP_LINE_MAX bytes
+};
+
+struct grepSearch {
+    char *root;
+    char *query;
+    int qlen;
+    char **files;          // Final once walked is set
+    int nfiles, capfiles;
+    pthread_t thread;
+    int threaded;
+    pthread_mutex_t lock;  // Guards hits and nhits
+    struct grepHit *hits;
+    int nhits, caphits;
+    int files_done;        // The rest are read and written atomically
+    int walked;
+    int done;
+    int stop;              // Asks the search to finish early
+};
+
+static void grepAddFile(struct grepSearch *g, char *path) {
+    if (g->nfiles == g->capfiles) {
+        g->capfiles = g->capfiles ? g->capfiles * 2 : 256;
+        g->files = realloc(g->files, sizeof(char *) * g->capfiles);
+    }
+
+    g->files[g->nfiles++] = path;
+}
+
+static void grepWalk(struct grepSearch *g, const char *dir) {
+    DIR *d = opendir(dir);
+    struct dirent *e;
+
+    if (d == NULL) { return; }
+
+    while ((e = readdir(d)) != NULL && !__atomic_load_n(&g->stop, __ATOMIC_RELAXED)) {
+        if (e->d_name[0] == '.') { continue; }
+
+        // Paths under "." are kept relative, as they'd be typed
+        char *path = malloc(strlen(dir) + strlen(e->d_name) + 2);
+
+        if (strcmp(dir, ".") == 0) {
+            strcpy(path, e->d_name);
+        } else {
+            sprintf(path, "%s/%s", dir, e->d_name);
+        }
+
+        int type = e->d_type;
+
+        if (type == DT_UNKNOWN) {
+            struct stat st;
+
+            type = (lstat(path, &st) == -1) ? DT_UNKNOWN : S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN;
+        }
+
+        if (type == DT_DIR) {
+            grepWalk(g, path);
+            free(path);
+        } else if (type == DT_REG) {
+            grepAddFile(g, path);
+        } else {
+            free(path);
+        }
+    }
+
+    closedir(d);
+}
+
+static void grepAddHit(struct grepSearch *g, int file, int line, int col, const char *text, int len) {
+    while (len > 0 && text[len - 1] == '\r') { len--; }
+    if (len > GREP_LINE_MAX) { len = GREP_LINE_MAX; }
+
+    char *copy = malloc(len + 1);
+
+    memcpy(copy, text, len);
+    copy[len] = '\0';
+
+    pthread_mutex_lock(&g->lock);
+
+    if (g->nhits == g->caphits) {
+        g->caphits = g->caphits ? g->caphits * 2 : 256;
+        g->hits = realloc(g->hits, sizeof(struct grepHit) * g->caphits);
+    }
+
+    struct grepHit *h = &g->hits[g->nhits++];
+    h->file = file;
+    h->line = line;
+    h->col = col;
+    h->text = copy;
+
+    if (g->nhits >= GREP_MAX_HITS) { __atomic_store_n(&g->stop, 1, __ATOMIC_RELAXED); }
+
+    pthread_mutex_unlock(&g->lock);
+}
+
+static void grepFile(struct grepSearch *g, int idx) {
+    struct stat st;
+    int fd = open(g->files[idx], O_RDONLY);
+
+    if (fd == -1) { return; }
+
+    if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) || st.st_size == 0 || st.st_size > GREP_MAX_FILE) {
+        close(fd);
+        return;
+    }
+
+    int size = st.st_size;
+    char *p = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    close(fd);
+
+    if (p == MAP_FAILED) { return; }
+
+    if (!hexIsBinary(p, size < HEX_SNIFF ? size : HEX_SNIFF)) {
+        int pos = 0, line = 0;
+
+        while (pos < size && !__atomic_load_n(&g->stop, __ATOMIC_RELAXED)) {
+            int at = pos + remFindStr(p + pos, size - pos, g->query, g->qlen);
+
+            if (at >= size) { break; }
+
+            // Lines are counted up to the hit's; pos is always at the start of one
+            const char *start = memrchr(p + pos, '\n', at - pos);
+            int ls = start ? start - p + 1 : pos;
+            const char *end = memchr(p + at, '\n', size - at);
+            int le = end ? end - p : size;
+
+            line += remCountByte(p + pos, ls - pos, '\n');
+            grepAddHit(g, idx, line, at - ls, p + ls, le - ls);
+
+            pos = le + 1;
+            line++;
+        }
+    }
+
+    munmap(p, size);
+}
+
+static void grepWorker(void *ctx, int start, int end) {
+    struct grepSearch *g = ctx;
+
+    for (int i = start; i < end && !__atomic_load_n(&g->stop, __ATOMIC_RELAXED); i++) {
+        grepFile(g, i);
+        __atomic_add_fetch(&g->files_done, 1, __ATOMIC_RELAXED);
+    }
+}
+
+static void *grepRun(void *arg) {
+    struct grepSearch *g = arg;
+
+    grepWalk(g, g->root);
+    __atomic_store_n(&g->walked, 1, __ATOMIC_RELEASE);
+
+    if (g->nfiles) { parallelFor(g->nfiles, 4, grepWorker, g); }
+
+    __atomic_store_n(&g->done, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+// Starts searching the files under root for query
+struct grepSearch *grepStart(const char *root, const char *query) {
+    struct grepSearch *g = calloc(1, sizeof(struct grepSearch));
+
+    g->root = strdup(root);
+    g->query = strdup(query);
+    g->qlen = strlen(query);
+    pthread_mutex_init(&g->lock, NULL);
+
+    // Without a thread it's done before returning
+    g->threaded = (pthread_create(&g->thread, NULL, grepRun, g) == 0);
+
+    if (!g->threaded) { grepRun(g); }
+
+    return g;
+}
+
+int grepDone(struct grepSearch *g) {
+    return __atomic_load_n(&g->done, __ATOMIC_ACQUIRE);
+}
+
+// Bytes the search holds on the heap: its file list and hits
+size_t grepHeap(struct grepSearch *g) {
+    if (g == NULL) { return 0; }
+
+    pthread_mutex_lock(&g->lock);
+
+    size_t n = sizeof(struct grepSearch) + sizeof(struct grepHit) * g->caphits;
+
+    for (int i = 0; i < g->nhits; i++) { n += strlen(g->hits[i].text) + 1; }
+
+    pthread_mutex_unlock(&g->lock);
+
+    // The list is final once walked
+    if (__atomic_load_n(&g->walked, __ATOMIC_ACQUIRE)) {
+        n += sizeof(char *) * g->capfiles;
+
+        for (int i = 0; i < g->nfiles; i++) { n += strlen(g->files[i]) + 1; }
+    }
+
+    return n;
+}
+
+// Stops the search if it's still running and frees it
+void grepFree(struct grepSearch *g) {
+    if (g == NULL) { return; }
+
+    __atomic_store_n(&g->stop, 1, __ATOMIC_RELAXED);
+
+    if (g->threaded) { pthread_join(g->thread, NULL); }
+
+    for (int i = 0; i < g->nhits; i++) { free(g->hits[i].text); }
+    for (int i = 0; i < g->nfiles; i++) { free(g->files[i]); }
+
+    free(g->hits);
+    free(g->files);
+    free(g->root);
+    free(g->query);
+    pthread_mutex_destroy(&g->lock);
+    free(g);
+}
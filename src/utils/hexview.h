@@ -0,0 +1,140 @@
+/*
+Hex view
+
+Binary files are shown as lines of 16 bytes (8 on narrow terminals): the
+offset, the bytes in hex, then the printable ones as ASCII. Lines are
+formatted straight from the mapped file as they're drawn and searches run
+over it in place, so nothing is kept per byte or per line.
+*/
+
+#define HEX_SNIFF 65536  // Bytes at the start of a file looked at to tell if it's binary
+
+// Whether the first n bytes of a file look binary: any NUL, or more than 1 in 8 other control bytes
+int hexIsBinary(const char *p, size_t n) {
+    if (memchr(p, '\0', n)) { return 1; }
+
+    size_t ctrl = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        unsigned char c = p[i];
+
+        if ((c < 32 && c != '\t' && c != '\n' && c != '\r' && c != '\f' && c != '\x1b') || c == 127) { ctrl++; }
+    }
+
+    return ctrl * 8 > n;
+}
+
+// Hex digits offsets in a file of size bytes are shown with (at least 8)
+int hexOffsetDigits(size_t size) {
+    int digits = 8;
+
+    while (digits < 16 && size > 0 && (size - 1) >> (4 * digits)) { digits++; }
+
+    return digits;
+}
+
+// Column of the hex pair for byte i of a line
+int hexByteColumn(int i, int digits) {
+    return digits + 2 + i * 3 + i / 8;
+}
+
+// Column of the ASCII for byte i of a line of per bytes
+int hexAsciiColumn(int i, int per, int digits) {
+    return hexByteColumn(per, digits) + i;
+}
+
+// Bytes per line that fit in cols columns
+int hexLineBytes(int cols, int digits) {
+    return (hexAsciiColumn(16, 16, digits) + 1 <= cols) ? 16 : 8;
+}
+
+/*
+Formats a line of per bytes starting at offset off, of which the first n
+exist (the last line of a file is short), into out. out needs room for
+hexAsciiColumn(per, per, digits) + 1 bytes. Returns the length.
+*/
+int hexFormatLine(char *out, const unsigned char *p, int n, int per, unsigned long long off, int digits) {
+    static const char xdigits[] = "0123456789abcdef";
+    int len = 0;
+
+    for (int d = digits - 1; d >= 0; d--) {
+        out[len++] = xdigits[(off >> (4 * d)) & 15];
+    }
+
+    out[len++] = ' ';
+    out[len++] = ' ';
+
+    for (int i = 0; i < per; i++) {
+        if (i > 0 && i % 8 == 0) { out[len++] = ' '; }
+
+        out[len++] = (i < n) ? xdigits[p[i] >> 4] : ' ';
+        out[len++] = (i < n) ? xdigits[p[i] & 15] : ' ';
+        out[len++] = ' ';
+    }
+
+    out[len++] = '|';
+
+    for (int i = 0; i < n; i++) {
+        out[len++] = (p[i] >= 32 && p[i] < 127) ? p[i] : '.';
+    }
+
+    out[len++] = '|';
+
+    return len;
+}
+
+static int hexDigit(char c) {
+    if (c >= '0' && c <= '9') { return c - '0'; }
+    if (c >= 'a' && c <= 'f') { return c - 'a' + 10; }
+    if (c >= 'A' && c <= 'F') { return c - 'A' + 10; }
+
+    return -1;
+}
+
+// Reads a query of hex byte pairs separated by spaces ("7f 45 4c 46") into out. Returns the count, or -1 if it's not one.
+int hexParseBytes(const char *q, unsigned char *out) {
+    int n = 0;
+
+    while (*q) {
+        if (*q == ' ') {
+            q++;
+            continue;
+        }
+
+        int hi = hexDigit(q[0]);
+        int lo = (hi >= 0) ? hexDigit(q[1]) : -1;
+
+        if (lo < 0 || (q[2] != ' ' && q[2] != '\0')) { return -1; }
+
+        out[n++] = (hi << 4) | lo;
+        q += 2;
+    }
+
+    return n ? n : -1;
+}
+
+// Offset of the first match of pat (m bytes) in [from, to) of p, or -1
+long long hexFind(const char *p, size_t from, size_t to, const unsigned char *pat, int m) {
+    if (to <= from) { return -1; }
+
+    const char *hit = memmem(p + from, to - from, pat, m);
+
+    return hit ? hit - p : -1;
+}
+
+// Offset of the last match of pat starting in [from, to) of p (which has len bytes), or -1
+long long hexFindPrev(const char *p, size_t len, size_t from, size_t to, const unsigned char *pat, int m) {
+    while (to > from) {
+        const char *hit = memrchr(p + from, pat[0], to - from);
+
+        if (hit == NULL) { return -1; }
+
+        size_t at = hit - p;
+
+        if (at + m <= len && !memcmp(hit, pat, m)) { return at; }
+
+        to = at;
+    }
+
+    return -1;
+}
@@ -0,0 +1,454 @@
+/*
+gzip decompressor
+
+A DEFLATE decoder (RFC 1951) for gzip files (RFC 1952), any number of
+members one after the other. It works a block at a time and keeps nothing
+between blocks but its position in the input, so a decode can stop at any
+block boundary and start again there later from a copy of inflateState and
+the last 32K of output (see zipstream.h, which keeps such checkpoints).
+Huffman codes are decoded with a table on their first INFLATE_FAST_BITS
+bits, longer ones a bit at a time. Each member's length is checked against
+its trailer; the CRC isn't.
+
+The output goes to a zipOut, shared with unzstd.h: one growing buffer whose
+earlier bytes are the history matches copy from.
+*/
+
+#define INFLATE_WINDOW 32768
+#define INFLATE_FAST_BITS 10
+
+struct zipOut {
+    unsigned char *buf;
+    size_t len, cap;
+};
+
+static void zipOutReserve(struct zipOut *out, size_t n) {
+    if (out->len + n <= out->cap) { return; }
+
+    while (out->len + n > out->cap) { out->cap = out->cap ? out->cap * 2 : 1 << 20; }
+
+    out->buf = realloc(out->buf, out->cap);
+}
+
+// Copies a match of len bytes from dist back (they may overlap)
+static void zipOutCopy(struct zipOut *out, size_t dist, size_t len) {
+    unsigned char *dst = out->buf + out->len;
+    const unsigned char *src = dst - dist;
+
+    if (dist >= len) {
+        memcpy(dst, src, len);
+    } else {
+        for (size_t i = 0; i < len; i++) { dst[i] = src[i]; }
+    }
+
+    out->len += len;
+}
+
+enum inflateStage {
+    INFLATE_HEADER,   // At a member header (or the end of the file)
+    INFLATE_BLOCKS,   // Between two blocks of a member
+    INFLATE_TRAILER,  // After a member's last block
+    INFLATE_END
+};
+
+// Where a decode stands between two blocks: enough to go on from there
+struct inflateState {
+    uint64_t bitpos;        // Bits of input consumed
+    int stage;
+    uint64_t member_start;  // Output offset the member started at
+    uint64_t out_total;     // Bytes decompressed so far
+};
+
+struct inflateHuff {
+    uint16_t fast[1 << INFLATE_FAST_BITS];  // sym << 4 | length, 0 if the code is longer
+    uint16_t count[16];     // Codes of each length
+    uint16_t symbol[320];   // Symbols by code
+};
+
+struct inflater {
+    const unsigned char *in;
+    size_t inlen;
+    size_t pos;             // Next input byte to load into bits
+    uint64_t bits;
+    int nbits;
+    struct inflateState st;
+    struct inflateHuff lit, dist;
+};
+
+static const uint16_t inflateLenBase[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+
+static const uint8_t inflateLenExtra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+
+static const uint16_t inflateDistBase[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097,
+    6145, 8193, 12289, 16385, 24577
+};
+
+static const uint8_t inflateDistExtra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+// Keeps at least 32 bits loaded (past the end of the input they're zeros, which inflateOverrun catches)
+static void inflateRefill(struct inflater *z) {
+    while (z->nbits <= 56) {
+        uint64_t b = (z->pos < z->inlen) ? z->in[z->pos] : 0;
+
+        z->pos++;
+        z->bits |= b << z->nbits;
+        z->nbits += 8;
+    }
+}
+
+static uint32_t inflateBits(struct inflater *z, int n) {
+    if (z->nbits < n) { inflateRefill(z); }
+
+    uint32_t v = z->bits & ((1ULL << n) - 1);
+
+    z->bits >>= n;
+    z->nbits -= n;
+
+    return v;
+}
+
+// Bits consumed so far
+static uint64_t inflateBitPos(const struct inflater *z) {
+    return (uint64_t) z->pos * 8 - z->nbits;
+}
+
+static int inflateOverrun(const struct inflater *z) {
+    return inflateBitPos(z) > (uint64_t) z->inlen * 8;
+}
+
+// Goes to a bit position in the input
+static void inflateSeek(struct inflater *z, uint64_t bitpos) {
+    z->pos = bitpos / 8;
+    z->bits = 0;
+    z->nbits = 0;
+
+    if (bitpos % 8) { inflateBits(z, bitpos % 8); }
+}
+
+// Builds a code from symbol lengths. Returns -1 if they don't make a usable code.
+static int inflateBuild(struct inflateHuff *h, const uint8_t *lengths, int n) {
+    uint16_t offs[16];
+    int left = 1;
+
+    memset(h->count, 0, sizeof(h->count));
+    memset(h->fast, 0, sizeof(h->fast));
+
+    for (int s = 0; s < n; s++) { h->count[lengths[s]]++; }
+
+    for (int len = 1; len < 16; len++) {
+        left = left * 2 - h->count[len];
+
+        if (left < 0) { return -1; }
+    }
+
+    offs[1] = 0;
+
+    for (int len = 1; len < 15; len++) { offs[len + 1] = offs[len] + h->count[len]; }
+
+    for (int s = 0; s < n; s++) {
+        if (lengths[s]) { h->symbol[offs[lengths[s]]++] = s; }
+    }
+
+    // Canonical codes, first to last, reversed into the order their bits arrive in
+    int code = 0, k = 0;
+
+    for (int len = 1; len < 16; len++) {
+        for (int c = 0; c < h->count[len]; c++, k++, code++) {
+            if (len > INFLATE_FAST_BITS) { continue; }
+
+            int rev = 0;
+
+            for (int b = 0; b < len; b++) { rev |= ((code >> b) & 1) << (len - 1 - b); }
+
+            for (int e = rev; e < (1 << INFLATE_FAST_BITS); e += 1 << len) { h->fast[e] = (h->symbol[k] << 4) | len; }
+        }
+
+        code <<= 1;
+    }
+
+    return 0;
+}
+
+// Decodes one symbol. Returns -1 on a code that isn't in the table.
+static int inflateDecode(struct inflater *z, const struct inflateHuff *h) {
+    if (z->nbits < 16) { inflateRefill(z); }
+
+    uint16_t e = h->fast[z->bits & ((1 << INFLATE_FAST_BITS) - 1)];
+
+    if (e) {
+        z->bits >>= e & 15;
+        z->nbits -= e & 15;
+        return e >> 4;
+    }
+
+    // Longer codes, a bit at a time
+    int code = 0, first = 0, index = 0;
+
+    for (int len = 1; len < 16; len++) {
+        code |= inflateBits(z, 1);
+
+        int count = h->count[len];
+
+        if (code - count < first) { return h->symbol[index + (code - first)]; }
+
+        index += count;
+        first = (first + count) << 1;
+        code <<= 1;
+    }
+
+    return -1;
+}
+
+static int inflateStored(struct inflater *z, struct zipOut *out) {
+    // Byte aligned from here, so go back to reading bytes
+    inflateSeek(z, (inflateBitPos(z) + 7) / 8 * 8);
+
+    if (z->pos + 4 > z->inlen) { return -1; }
+
+    const unsigned char *p = z->in + z->pos;
+    size_t len = p[0] | (p[1] << 8);
+
+    if ((len ^ (p[2] | (p[3] << 8))) != 0xffff || z->pos + 4 + len > z->inlen) { return -1; }
+
+    zipOutReserve(out, len);
+    memcpy(out->buf + out->len, p + 4, len);
+    out->len += len;
+    inflateSeek(z, (uint64_t) (z->pos + 4 + len) * 8);
+
+    return 0;
+}
+
+static int inflateDynamic(struct inflater *z) {
+    static const uint8_t order[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+    uint8_t lengths[320];
+    struct inflateHuff lencode;
+
+    int nlit = inflateBits(z, 5) + 257;
+    int ndist = inflateBits(z, 5) + 1;
+    int ncode = inflateBits(z, 4) + 4;
+
+    if (nlit > 286 || ndist > 30) { return -1; }
+
+    memset(lengths, 0, 19);
+
+    for (int i = 0; i < ncode; i++) { lengths[order[i]] = inflateBits(z, 3); }
+
+    if (inflateBuild(&lencode, lengths, 19) == -1) { return -1; }
+
+    for (int i = 0; i < nlit + ndist;) {
+        int sym = inflateDecode(z, &lencode);
+        int len = 0, rep;
+
+        if (sym < 0) { return -1; }
+
+        if (sym < 16) {
+            lengths[i++] = sym;
+            continue;
+        }
+
+        if (sym == 16) {
+            if (i == 0) { return -1; }
+
+            len = lengths[i - 1];
+            rep = 3 + inflateBits(z, 2);
+        } else if (sym == 17) {
+            rep = 3 + inflateBits(z, 3);
+        } else {
+            rep = 11 + inflateBits(z, 7);
+        }
+
+        if (i + rep > nlit + ndist) { return -1; }
+
+        while (rep--) { lengths[i++] = len; }
+    }
+
+    // There has to be an end of block code
+    if (lengths[256] == 0) { return -1; }
+
+    if (inflateBuild(&z->lit, lengths, nlit) == -1 || inflateBuild(&z->dist, lengths + nlit, ndist) == -1) { return -1; }
+
+    return 0;
+}
+
+static void inflateFixed(struct inflater *z) {
+    uint8_t lengths[320];
+    int i = 0;
+
+    while (i < 144) { lengths[i++] = 8; }
+    while (i < 256) { lengths[i++] = 9; }
+    while (i < 280) { lengths[i++] = 7; }
+    while (i < 288) { lengths[i++] = 8; }
+
+    inflateBuild(&z->lit, lengths, 288);
+
+    for (i = 0; i < 30; i++) { lengths[i] = 5; }
+
+    inflateBuild(&z->dist, lengths, 30);
+}
+
+static int inflateCodes(struct inflater *z, struct zipOut *out) {
+    while (1) {
+        int sym = inflateDecode(z, &z->lit);
+
+        if (sym < 256) {
+            if (sym < 0) { return -1; }
+
+            zipOutReserve(out, 1);
+            out->buf[out->len++] = sym;
+            continue;
+        }
+
+        if (sym == 256) { return 0; }
+
+        sym -= 257;
+
+        if (sym >= 29) { return -1; }
+
+        int len = inflateLenBase[sym] + inflateBits(z, inflateLenExtra[sym]);
+        int dsym = inflateDecode(z, &z->dist);
+
+        if (dsym < 0 || dsym >= 30) { return -1; }
+
+        size_t dist = inflateDistBase[dsym] + inflateBits(z, inflateDistExtra[dsym]);
+
+        if (dist > out->len || inflateOverrun(z)) { return -1; }
+
+        zipOutReserve(out, len);
+        zipOutCopy(out, dist, len);
+    }
+}
+
+// Reads a member header. Returns 1 if there is one, 0 at the end of the file, -1 if it's broken.
+static int inflateHeader(struct inflater *z) {
+    size_t p = (inflateBitPos(z) + 7) / 8;
+    const unsigned char *in = z->in;
+
+    // Anything but another member after the first is padding
+    if (p + 10 > z->inlen || in[p] != 0x1f || in[p + 1] != 0x8b) { return (p > 0) ? 0 : -1; }
+    if (in[p + 2] != 8) { return -1; }
+
+    int flags = in[p + 3];
+
+    p += 10;
+
+    if (flags & 4) {
+        if (p + 2 > z->inlen) { return -1; }
+
+        p += 2 + (in[p] | (in[p + 1] << 8));
+    }
+
+    for (int f = 8; f <= 16; f <<= 1) {
+        if (!(flags & f)) { continue; }
+
+        while (p < z->inlen && in[p]) { p++; }
+
+        p++;
+    }
+
+    if (flags & 2) { p += 2; }
+
+    if (p > z->inlen) { return -1; }
+
+    inflateSeek(z, (uint64_t) p * 8);
+
+    return 1;
+}
+
+void inflateInit(struct inflater *z, const unsigned char *in, size_t inlen) {
+    memset(z, 0, sizeof(*z));
+    z->in = in;
+    z->inlen = inlen;
+    z->st.stage = INFLATE_HEADER;
+}
+
+// Goes on from a state saved between two blocks
+void inflateResume(struct inflater *z, const struct inflateState *st) {
+    z->st = *st;
+    inflateSeek(z, st->bitpos);
+}
+
+/*
+Decodes the next block (or member header or trailer) onto out. Returns 1 if
+there's more, 0 at the end of the file and -1 if the data is broken. Between
+calls, z->st describes where the decode is.
+*/
+int inflateStep(struct inflater *z, struct zipOut *out) {
+    size_t before = out->len;
+    int ret = 1;
+
+    switch (z->st.stage) {
+        case INFLATE_HEADER:
+            ret = inflateHeader(z);
+
+            if (ret == 1) {
+                z->st.stage = INFLATE_BLOCKS;
+                z->st.member_start = z->st.out_total;
+            } else if (ret == 0) {
+                z->st.stage = INFLATE_END;
+            }
+
+            break;
+        case INFLATE_BLOCKS:
+            {
+                int last = inflateBits(z, 1);
+                int type = inflateBits(z, 2);
+
+                if (type == 0) {
+                    ret = inflateStored(z, out);
+                } else if (type == 1) {
+                    inflateFixed(z);
+                    ret = inflateCodes(z, out);
+                } else if (type == 2) {
+                    ret = inflateDynamic(z);
+
+                    if (ret == 0) { ret = inflateCodes(z, out); }
+                } else {
+                    ret = -1;
+                }
+
+                if (ret == 0) {
+                    ret = 1;
+
+                    if (last) { z->st.stage = INFLATE_TRAILER; }
+                }
+
+                break;
+            }
+        case INFLATE_TRAILER:
+            {
+                size_t p = (inflateBitPos(z) + 7) / 8;
+
+                if (p + 8 > z->inlen) {
+                    ret = -1;
+                    break;
+                }
+
+                uint32_t isize = z->in[p + 4] | (z->in[p + 5] << 8) | (z->in[p + 6] << 16) | ((uint32_t) z->in[p + 7] << 24);
+
+                if (isize != (uint32_t) (z->st.out_total - z->st.member_start)) {
+                    ret = -1;
+                    break;
+                }
+
+                inflateSeek(z, (uint64_t) (p + 8) * 8);
+                z->st.stage = INFLATE_HEADER;
+                break;
+            }
+        default:
+            ret = 0;
+    }
+
+    if (ret == 1 && inflateOverrun(z)) { ret = -1; }
+
+    z->st.out_total += out->len - before;
+    z->st.bitpos = inflateBitPos(z);
+
+    return ret;
+}
@@ -0,0 +1,359 @@
+/*
+Edit journal (swap file)
+
+Edits are appended to ~/.rem/swap/<hash of path>.swp (or $REM_SWAP_DIR) as
+binary records, so a crash loses nothing that was typed before it. A
+journal is:
+
+    struct journalHeader     the file on disk the edits apply to
+    path                     path_len bytes
+    records                  op (1 byte), row, col, len (4 bytes each), len bytes of data
+
+journalAppend() only copies the record into memory. A writer thread picks
+up whatever has accumulated every JOURNAL_BATCH_MS and writes and
+fdatasyncs it, so the editor never waits on the disk.
+*/
+
+#define JOURNAL_MAGIC "REMSWP1"
+#define JOURNAL_BATCH_MS 100
+#define JOURNAL_RECORD 13
+
+struct journalHeader {
+    char magic[8];
+    uint64_t size;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint64_t fingerprint;
+    uint64_t path_len;
+};
+
+struct journal {
+    int fd;
+    char path[4096];
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    char *buf;          // Records the writer hasn't taken yet
+    size_t len, cap;
+    size_t last;        // Offset of the last record in buf, for merging
+    int stop;
+    int failed;         // A write failed; the journal can't be trusted any more
+};
+
+int journalPath(const char *path, char *out, size_t outlen) {
+    char *abs = realpath(path, NULL);
+    char *home = getenv("HOME");
+    char *dir = getenv("REM_SWAP_DIR");
+    char base[4096];
+
+    if (abs == NULL) { return -1; }
+
+    if (dir) {
+        snprintf(base, sizeof(base), "%s", dir);
+    } else if (home) {
+        snprintf(base, sizeof(base), "%s/.rem", home);
+        mkdir(base, 0755);
+        snprintf(base, sizeof(base), "%s/.rem/swap", home);
+    } else {
+        free(abs);
+        return -1;
+    }
+
+    mkdir(base, 0700);
+    snprintf(out, outlen, "%s/%016llx.swp", base, (unsigned long long) lineCacheHash(0xcbf29ce484222325ULL, abs, strlen(abs)));
+    free(abs);
+
+    return 0;
+}
+
+static void *journalWriter(void *arg) {
+    struct journal *j = arg;
+    char *out = NULL;
+    size_t outcap = 0;
+
+    pthread_mutex_lock(&j->lock);
+
+    while (1) {
+        while (j->len == 0 && !j->stop) { pthread_cond_wait(&j->wake, &j->lock); }
+
+        if (j->len == 0 && j->stop) { break; }
+
+        // Let a burst of edits pile up into one write
+        if (!j->stop) {
+            struct timespec ts = {0, JOURNAL_BATCH_MS * 1000000L};
+
+            pthread_mutex_unlock(&j->lock);
+            nanosleep(&ts, NULL);
+            pthread_mutex_lock(&j->lock);
+        }
+
+        // Swap buffers so the editor can keep queueing while this one is written
+        char *tmp = out;
+        size_t tmpcap = outcap;
+        size_t len = j->len;
+
+        out = j->buf;
+        outcap = j->cap;
+        j->buf = tmp;
+        j->cap = tmpcap;
+        j->len = 0;
+        j->last = (size_t) -1;
+
+        pthread_mutex_unlock(&j->lock);
+
+        size_t done = 0;
+
+        while (done < len) {
+            ssize_t n = write(j->fd, out + done, len - done);
+
+            if (n <= 0) {
+                if (n == -1 && errno == EINTR) { continue; }
+                break;
+            }
+
+            done += n;
+        }
+
+        int ok = (done == len && fdatasync(j->fd) == 0);
+
+        pthread_mutex_lock(&j->lock);
+
+        if (!ok) { __atomic_store_n(&j->failed, 1, __ATOMIC_RELAXED); }
+    }
+
+    pthread_mutex_unlock(&j->lock);
+    free(out);
+
+    return NULL;
+}
+
+static int journalStart(struct journal *j, int fd, const char *path) {
+    memset(j, 0, sizeof(*j));
+    j->fd = fd;
+    j->last = (size_t) -1;
+    snprintf(j->path, sizeof(j->path), "%s", path);
+    pthread_mutex_init(&j->lock, NULL);
+    pthread_cond_init(&j->wake, NULL);
+
+    if (pthread_create(&j->thread, NULL, journalWriter, j) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    return 0;
+}
+
+// Starts a fresh journal for edits to the file at path (described by st and fingerprint)
+struct journal *journalCreate(const char *path, const struct stat *st, uint64_t fingerprint) {
+    char jpath[4096];
+    char *abs = realpath(path, NULL);
+
+    if (abs == NULL || journalPath(path, jpath, sizeof(jpath)) == -1) {
+        free(abs);
+        return NULL;
+    }
+
+    int fd = open(jpath, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    struct journalHeader h;
+
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, JOURNAL_MAGIC, sizeof(h.magic));
+    h.size = st->st_size;
+    h.mtime_sec = st->st_mtim.tv_sec;
+    h.mtime_nsec = st->st_mtim.tv_nsec;
+    h.fingerprint = fingerprint;
+    h.path_len = strlen(abs);
+
+    int ok = fd != -1 && write(fd, &h, sizeof(h)) == sizeof(h) &&
+             write(fd, abs, h.path_len) == (ssize_t) h.path_len;
+
+    free(abs);
+
+    if (!ok) {
+        if (fd != -1) { close(fd); }
+        unlink(jpath);
+        return NULL;
+    }
+
+    struct journal *j = malloc(sizeof(struct journal));
+
+    if (journalStart(j, fd, jpath) == -1) {
+        free(j);
+        return NULL;
+    }
+
+    return j;
+}
+
+// Continues an existing journal (after its records have been replayed)
+struct journal *journalReopen(const char *jpath) {
+    int fd = open(jpath, O_WRONLY | O_APPEND);
+
+    if (fd == -1) { return NULL; }
+
+    struct journal *j = malloc(sizeof(struct journal));
+
+    if (journalStart(j, fd, jpath) == -1) {
+        free(j);
+        return NULL;
+    }
+
+    return j;
+}
+
+static void journalPut32(char *p, uint32_t v) {
+    memcpy(p, &v, sizeof(v));
+}
+
+static uint32_t journalGet32(const char *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+/*
+Queues a record. With merge set, data continuing the previous record (same
+op and row, starting at its col + len) is added onto it instead, so typing
+a line costs one record.
+*/
+void journalAppend(struct journal *j, int op, int row, int col, const char *data, int len, int merge) {
+    pthread_mutex_lock(&j->lock);
+
+    if (j->len + JOURNAL_RECORD + len > j->cap) {
+        j->cap = (j->len + JOURNAL_RECORD + len) * 2 + 4096;
+        j->buf = realloc(j->buf, j->cap);
+    }
+
+    char *last = (j->last != (size_t) -1) ? &j->buf[j->last] : NULL;
+
+    if (merge && last && last[0] == op && journalGet32(last + 1) == (uint32_t) row &&
+        journalGet32(last + 5) + journalGet32(last + 9) == (uint32_t) col) {
+        journalPut32(last + 9, journalGet32(last + 9) + len);
+    } else {
+        char *rec = &j->buf[j->len];
+
+        rec[0] = op;
+        journalPut32(rec + 1, row);
+        journalPut32(rec + 5, col);
+        journalPut32(rec + 9, len);
+        j->last = j->len;
+        j->len += JOURNAL_RECORD;
+    }
+
+    memcpy(&j->buf[j->len], data, len);
+    j->len += len;
+
+    pthread_cond_signal(&j->wake);
+    pthread_mutex_unlock(&j->lock);
+}
+
+// Bytes the journal holds on the heap (mostly records the writer hasn't taken yet)
+size_t journalHeap(struct journal *j) {
+    if (j == NULL) { return 0; }
+
+    pthread_mutex_lock(&j->lock);
+    size_t n = sizeof(struct journal) + j->cap;
+    pthread_mutex_unlock(&j->lock);
+
+    return n;
+}
+
+// Flushes what's queued and stops the writer. The journal file is deleted if discard is set.
+void journalClose(struct journal *j, int discard) {
+    if (j == NULL) { return; }
+
+    pthread_mutex_lock(&j->lock);
+    j->stop = 1;
+    pthread_cond_signal(&j->wake);
+    pthread_mutex_unlock(&j->lock);
+    pthread_join(j->thread, NULL);
+
+    close(j->fd);
+
+    if (discard) { unlink(j->path); }
+
+    pthread_mutex_destroy(&j->lock);
+    pthread_cond_destroy(&j->wake);
+    free(j->buf);
+    free(j);
+}
+
+struct journalReader {
+    char *data;
+    size_t len;
+    size_t pos;
+};
+
+/*
+Loads the journal for path. Returns 1 if it describes the file as it is
+now (st, fingerprint), 0 if there is none, and -1 if there is one but the
+file has changed since, so its records don't apply.
+*/
+int journalLoad(struct journalReader *r, const char *path, const struct stat *st, uint64_t fingerprint, char *jpath, size_t jpathlen) {
+    memset(r, 0, sizeof(*r));
+
+    if (journalPath(path, jpath, jpathlen) == -1) { return 0; }
+
+    int fd = open(jpath, O_RDONLY);
+    struct stat jst;
+
+    if (fd == -1) { return 0; }
+
+    if (fstat(fd, &jst) == -1 || (size_t) jst.st_size < sizeof(struct journalHeader)) {
+        close(fd);
+        return -1;
+    }
+
+    r->len = jst.st_size;
+    r->data = malloc(r->len);
+
+    int ok = read(fd, r->data, r->len) == (ssize_t) r->len;
+    close(fd);
+
+    struct journalHeader *h = (struct journalHeader *) r->data;
+    char *abs = realpath(path, NULL);
+
+    ok = ok && abs && !memcmp(h->magic, JOURNAL_MAGIC, sizeof(h->magic)) &&
+         h->size == (uint64_t) st->st_size &&
+         h->mtime_sec == (int64_t) st->st_mtim.tv_sec &&
+         h->mtime_nsec == (int64_t) st->st_mtim.tv_nsec &&
+         h->fingerprint == fingerprint &&
+         h->path_len == strlen(abs) && sizeof(*h) + h->path_len <= r->len &&
+         !memcmp(r->data + sizeof(*h), abs, h->path_len);
+
+    free(abs);
+
+    if (!ok) {
+        free(r->data);
+        r->data = NULL;
+        return -1;
+    }
+
+    r->pos = sizeof(*h) + h->path_len;
+
+    return 1;
+}
+
+// Reads the next record. Returns 0 at the end (a record cut short by a crash counts as the end).
+int journalNext(struct journalReader *r, int *op, int *row, int *col, const char **data, int *len) {
+    if (r->len - r->pos < JOURNAL_RECORD) { return 0; }
+
+    const char *rec = &r->data[r->pos];
+    uint32_t n = journalGet32(rec + 9);
+
+    if (n > r->len - r->pos - JOURNAL_RECORD) { return 0; }
+
+    *op = (unsigned char) rec[0];
+    *row = journalGet32(rec + 1);
+    *col = journalGet32(rec + 5);
+    *len = n;
+    *data = rec + JOURNAL_RECORD;
+    r->pos += JOURNAL_RECORD + n;
+
+    return 1;
+}
+
+void journalFreeReader(struct journalReader *r) {
+    free(r->data);
+    r->data = NULL;
+}
@@ -0,0 +1,514 @@
+/*
+Table-driven syntax lexer
+
+Every editorSyntax is compiled once into a DFA over byte equivalence classes.
+Highlighting a row is then a single table lookup per byte:
+
+    t = trans[state * nclasses + eqclass[byte]]
+
+Each transition packs the next state, the highlight class of the current byte
+and an optional backfill (recolor the previous N bytes). Backfills resolve the
+two places the old highlighter needed lookahead: keywords (only known once the
+following separator arrives) and multi-byte comment delimiters.
+
+Keywords may not contain separator characters, and comment delimiters may not
+contain quote characters (when strings are enabled) or exceed LEX_MAX_DELIM.
+*/
+
+#include <stdint.h>
+
+#define LEX_MAX_DELIM 7
+#define LEX_MAX_STATES 65535
+
+// Builder modes (kept in the top bits of a state key)
+enum lexerMode {
+    LEX_CODE = 0,
+    LEX_STR,
+    LEX_STR_ESC,
+    LEX_LINE_COMMENT,
+    LEX_MULTI_COMMENT
+};
+
+struct lexer {
+    int nstates;
+    int nclasses;
+    unsigned char eqclass[256];
+    uint32_t *trans;
+    unsigned char *incomment; // Per state: inside a multi-line comment
+    int start[2];             // Row start states (0: code, 1: multi-line comment)
+};
+
+#define LEX_NEXT(t) ((t) & 0xffff)
+#define LEX_CLASS(t) (((t) >> 16) & 0xf)
+#define LEX_BACK_CLASS(t) (((t) >> 20) & 0xf)
+#define LEX_BACK(t) ((t) >> 24)
+
+int is_seperator(int c) {
+    return isspace(c) || c == '\0' || strchr(",.()+-/*=~%<>[];", c) != NULL;
+}
+
+// Keyword trie used while building the DFA
+struct lexerTrie {
+    int (*child)[256];
+    unsigned char *accept; // Highlight class, 0 if not a keyword
+    unsigned char *depth;
+    int len;
+    int cap;
+};
+
+static int lexerTrieNode(struct lexerTrie *t, int depth) {
+    if (t->len == t->cap) {
+        t->cap = t->cap ? t->cap * 2 : 64;
+        t->child = realloc(t->child, sizeof(*t->child) * t->cap);
+        t->accept = realloc(t->accept, t->cap);
+        t->depth = realloc(t->depth, t->cap);
+    }
+
+    memset(t->child[t->len], -1, sizeof(t->child[t->len]));
+    t->accept[t->len] = 0;
+    t->depth[t->len] = depth;
+
+    return t->len++;
+}
+
+static void lexerTrieAdd(struct lexerTrie *t, const char *kw, int syntax_hl) {
+    int len = strlen(kw);
+    int node = 0;
+
+    if (len == 0 || len > 255) { return; }
+
+    for (int i = 0; i < len; i++) {
+        if (is_seperator((unsigned char) kw[i])) { return; }
+    }
+
+    for (int i = 0; i < len; i++) {
+        unsigned char c = kw[i];
+
+        if (t->child[node][c] == -1) {
+            int n = lexerTrieNode(t, i + 1);
+            t->child[node][c] = n;
+        }
+
+        node = t->child[node][c];
+    }
+
+    // The first listed keyword wins, like the original highlighter
+    if (!t->accept[node]) {
+        t->accept[node] = syntax_hl;
+    }
+}
+
+/*
+State keys
+
+CODE: sep(1) num(1) word(20) pend_which(1) pend_len(3)
+STR/STR_ESC: quote(8)
+MULTI_COMMENT: progress(3)
+*/
+
+#define LEX_KEY(mode, payload) (((uint64_t) (mode) << 40) | (uint64_t) (payload))
+#define LEX_KEY_MODE(k) ((int) ((k) >> 40))
+
+static uint64_t lexerCodeKey(int sep, int num, int word, int pend_which, int pend_len) {
+    if (sep) { word = 1; }
+    if (pend_len == 0) { pend_which = 0; }
+
+    return LEX_KEY(LEX_CODE, ((uint64_t) sep) | ((uint64_t) num << 1) | ((uint64_t) word << 2) |
+                             ((uint64_t) pend_which << 22) | ((uint64_t) pend_len << 23));
+}
+
+struct lexerBuilder {
+    struct editorSyntax *syntax;
+    struct lexerTrie trie;
+    const char *delim[2]; // Single line and multi-line comment start
+    int delim_len[2];
+    const char *mce;
+    int mce_len;
+    int mce_kmp[LEX_MAX_DELIM + 1][256];
+    uint64_t *keys;
+    int nkeys;
+    int keycap;
+    uint64_t *hkeys;
+    int *hvals;
+    int hcap;
+};
+
+static int lexerIsQuote(struct lexerBuilder *b, int c) {
+    return (b->syntax->flags & HL_STRINGS) && c != '\0' && strchr(b->syntax->quotes ? b->syntax->quotes : "\"'", c) != NULL;
+}
+
+static void lexerHashGrow(struct lexerBuilder *b) {
+    int cap = b->hcap ? b->hcap * 2 : 1024;
+
+    free(b->hkeys);
+    free(b->hvals);
+
+    b->hkeys = malloc(sizeof(uint64_t) * cap);
+    b->hvals = malloc(sizeof(int) * cap);
+    b->hcap = cap;
+
+    for (int i = 0; i < cap; i++) { b->hvals[i] = -1; }
+
+    for (int s = 0; s < b->nkeys; s++) {
+        unsigned int h = (unsigned int) ((b->keys[s] * 0x9E3779B97F4A7C15ULL) >> 32) & (cap - 1);
+
+        while (b->hvals[h] != -1) { h = (h + 1) & (cap - 1); }
+
+        b->hkeys[h] = b->keys[s];
+        b->hvals[h] = s;
+    }
+}
+
+// Returns the state id for a key, creating the state if it is new
+static int lexerState(struct lexerBuilder *b, uint64_t key) {
+    if (b->nkeys * 2 >= b->hcap) { lexerHashGrow(b); }
+
+    unsigned int h = (unsigned int) ((key * 0x9E3779B97F4A7C15ULL) >> 32) & (b->hcap - 1);
+
+    while (b->hvals[h] != -1) {
+        if (b->hkeys[h] == key) { return b->hvals[h]; }
+        h = (h + 1) & (b->hcap - 1);
+    }
+
+    if (b->nkeys == LEX_MAX_STATES) { return -1; }
+
+    if (b->nkeys == b->keycap) {
+        b->keycap = b->keycap ? b->keycap * 2 : 256;
+        b->keys = realloc(b->keys, sizeof(uint64_t) * b->keycap);
+    }
+
+    b->keys[b->nkeys] = key;
+    b->hkeys[h] = key;
+    b->hvals[h] = b->nkeys;
+
+    return b->nkeys++;
+}
+
+static uint32_t lexerPack(int next, int syntax_hl, int back, int back_hl) {
+    return (uint32_t) next | ((uint32_t) syntax_hl << 16) | ((uint32_t) back_hl << 20) | ((uint32_t) back << 24);
+}
+
+// Pending text of a CODE state: a proper prefix of one of the comment starts
+static int lexerPendText(struct lexerBuilder *b, uint64_t key, char *out) {
+    int which = (key >> 22) & 1;
+    int len = (key >> 23) & 7;
+
+    memcpy(out, b->delim[which], len);
+    return len;
+}
+
+static int lexerEndsWith(const char *t, int tlen, const char *d, int dlen) {
+    return dlen && dlen <= tlen && !memcmp(t + tlen - dlen, d, dlen);
+}
+
+// Computes the transition out of one state on byte c
+static uint32_t lexerStep(struct lexerBuilder *b, uint64_t key, int c) {
+    struct editorSyntax *syn = b->syntax;
+    int mode = LEX_KEY_MODE(key);
+
+    switch (mode) {
+        case LEX_LINE_COMMENT:
+            return lexerPack(lexerState(b, key), SYNTAX_HL_COMMENT, 0, 0);
+        case LEX_STR:
+            {
+                int q = key & 0xff;
+
+                if (c == '\\') {
+                    return lexerPack(lexerState(b, LEX_KEY(LEX_STR_ESC, q)), SYNTAX_HL_STR, 0, 0);
+                }
+
+                if (c == q) {
+                    return lexerPack(lexerState(b, lexerCodeKey(1, 0, 1, 0, 0)), SYNTAX_HL_STR, 0, 0);
+                }
+
+                return lexerPack(lexerState(b, key), SYNTAX_HL_STR, 0, 0);
+            }
+        case LEX_STR_ESC:
+            return lexerPack(lexerState(b, LEX_KEY(LEX_STR, key & 0xff)), SYNTAX_HL_STR, 0, 0);
+        case LEX_MULTI_COMMENT:
+            {
+                int progress = b->mce_kmp[key & 7][c];
+
+                if (progress == b->mce_len) {
+                    return lexerPack(lexerState(b, lexerCodeKey(1, 0, 1, 0, 0)), SYNTAX_HL_MULTI_COMMENT, 0, 0);
+                }
+
+                return lexerPack(lexerState(b, LEX_KEY(LEX_MULTI_COMMENT, progress)), SYNTAX_HL_MULTI_COMMENT, 0, 0);
+            }
+    }
+
+    int sep = key & 1;
+    int num = (key >> 1) & 1;
+    int word = (key >> 2) & 0xfffff;
+
+    // What the byte would be without any comment delimiters
+    int syntax_hl = SYNTAX_HL_DEFAULT;
+    int back = 0, back_hl = 0;
+    int nsep = 0, nnum = 0, nword = 0;
+
+    if (lexerIsQuote(b, c)) {
+        syntax_hl = SYNTAX_HL_STR;
+    } else if ((syn->flags & HL_NUMBERS) && ((isdigit(c) && (sep || num)) || (c == '.' && num))) {
+        syntax_hl = SYNTAX_HL_NUM;
+        nnum = 1;
+    } else if (is_seperator(c)) {
+        if (!sep && word && b->trie.accept[word - 1]) {
+            back = b->trie.depth[word - 1];
+            back_hl = b->trie.accept[word - 1];
+        }
+
+        nsep = 1;
+        nword = 1;
+    } else if (sep) {
+        nword = b->trie.child[0][c] + 1;
+    } else if (word) {
+        nword = b->trie.child[word - 1][c] + 1;
+    }
+
+    // Comment delimiters take priority over everything else in code
+    char t[LEX_MAX_DELIM + 1];
+    int tlen = lexerPendText(b, key, t);
+    t[tlen++] = c;
+
+    int scs = lexerEndsWith(t, tlen, b->delim[0], b->delim_len[0]);
+    int mcs = lexerEndsWith(t, tlen, b->delim[1], b->delim_len[1]) && b->mce_len;
+
+    if (scs && mcs) {
+        mcs = b->delim_len[1] > b->delim_len[0];
+        scs = !mcs;
+    }
+
+    if (scs || mcs) {
+        int d_len = b->delim_len[scs ? 0 : 1];
+        int d_hl = scs ? SYNTAX_HL_COMMENT : SYNTAX_HL_MULTI_COMMENT;
+        uint64_t nkey = scs ? LEX_KEY(LEX_LINE_COMMENT, 0) : LEX_KEY(LEX_MULTI_COMMENT, 0);
+
+        if (d_len > 1) {
+            back = d_len - 1;
+            back_hl = d_hl;
+        }
+
+        return lexerPack(lexerState(b, nkey), d_hl, back, back_hl);
+    }
+
+    if (syntax_hl == SYNTAX_HL_STR) {
+        return lexerPack(lexerState(b, LEX_KEY(LEX_STR, c)), SYNTAX_HL_STR, back, back_hl);
+    }
+
+    // Longest suffix that may still become a comment delimiter
+    int pend_which = 0, pend_len = 0;
+
+    for (int start = 0; start < tlen && !pend_len; start++) {
+        for (int d = 0; d < 2; d++) {
+            int len = tlen - start;
+
+            if (len < b->delim_len[d] && !memcmp(t + start, b->delim[d], len)) {
+                pend_which = d;
+                pend_len = len;
+                break;
+            }
+        }
+    }
+
+    return lexerPack(lexerState(b, lexerCodeKey(nsep, nnum, nword, pend_which, pend_len)), syntax_hl, back, back_hl);
+}
+
+static void lexerEquivalence(struct lexerBuilder *b, struct lexer *lx) {
+    int sig[256];
+    int special[256] = {0};
+
+    for (int d = 0; d < 2; d++) {
+        for (int i = 0; i < b->delim_len[d]; i++) { special[(unsigned char) b->delim[d][i]] = 1; }
+    }
+
+    for (int i = 0; i < b->mce_len; i++) { special[(unsigned char) b->mce[i]] = 1; }
+
+    for (int n = 0; n < b->trie.len; n++) {
+        for (int c = 0; c < 256; c++) {
+            if (b->trie.child[n][c] != -1) { special[c] = 1; }
+        }
+    }
+
+    for (int c = 0; c < 256; c++) {
+        if (special[c] || lexerIsQuote(b, c) || c == '\\' || c == '.') {
+            sig[c] = 256 + c;
+        } else if (isdigit(c)) {
+            sig[c] = 1;
+        } else if (is_seperator(c)) {
+            sig[c] = 2;
+        } else {
+            sig[c] = 3;
+        }
+    }
+
+    lx->nclasses = 0;
+
+    for (int c = 0; c < 256; c++) {
+        int p;
+
+        for (p = 0; p < c; p++) {
+            if (sig[p] == sig[c]) { break; }
+        }
+
+        lx->eqclass[c] = (p < c) ? lx->eqclass[p] : lx->nclasses++;
+    }
+}
+
+void lexerFree(struct lexer *lx) {
+    if (lx == NULL) { return; }
+
+    free(lx->trans);
+    free(lx->incomment);
+    free(lx);
+}
+
+// Compiles a syntax definition. Returns NULL if the definition is unusable.
+struct lexer *lexerCompile(struct editorSyntax *syntax) {
+    struct lexerBuilder b;
+    memset(&b, 0, sizeof(b));
+    b.syntax = syntax;
+
+    lexerTrieNode(&b.trie, 0);
+
+    for (int k = 0; syntax->keywords && syntax->keywords[k]; k++) {
+        lexerTrieAdd(&b.trie, syntax->keywords[k], SYNTAX_HL_KEYWORD1);
+    }
+
+    for (int k = 0; syntax->keywords2 && syntax->keywords2[k]; k++) {
+        lexerTrieAdd(&b.trie, syntax->keywords2[k], SYNTAX_HL_KEYWORD2);
+    }
+
+    b.delim[0] = syntax->singleline_comment_s ? syntax->singleline_comment_s : "";
+    b.delim[1] = syntax->multiline_comment_s ? syntax->multiline_comment_s : "";
+    b.mce = syntax->multiline_comment_e ? syntax->multiline_comment_e : "";
+    b.delim_len[0] = strlen(b.delim[0]);
+    b.delim_len[1] = strlen(b.delim[1]);
+    b.mce_len = strlen(b.mce);
+
+    if (b.mce_len == 0) { b.delim_len[1] = 0; }
+    if (b.delim_len[1] == 0) { b.mce_len = 0; }
+
+    int usable = b.delim_len[0] <= LEX_MAX_DELIM && b.delim_len[1] <= LEX_MAX_DELIM && b.mce_len <= LEX_MAX_DELIM;
+
+    for (int d = 0; d < 2 && usable; d++) {
+        for (int i = 0; i < b.delim_len[d]; i++) {
+            if (lexerIsQuote(&b, (unsigned char) b.delim[d][i])) { usable = 0; }
+        }
+    }
+
+    if (!usable) {
+        free(b.trie.child);
+        free(b.trie.accept);
+        free(b.trie.depth);
+        return NULL;
+    }
+
+    // KMP automaton for the multi-line comment end
+    for (int p = 0; p < b.mce_len; p++) {
+        for (int c = 0; c < 256; c++) {
+            int k = p + 1;
+            char buf[LEX_MAX_DELIM + 1];
+
+            memcpy(buf, b.mce, p);
+            buf[p] = c;
+
+            while (k > 0 && memcmp(buf + p + 1 - k, b.mce, k)) { k--; }
+
+            b.mce_kmp[p][c] = k;
+        }
+    }
+
+    struct lexer *lx = calloc(1, sizeof(struct lexer));
+    lexerEquivalence(&b, lx);
+
+    int rep[256];
+
+    for (int c = 255; c >= 0; c--) { rep[lx->eqclass[c]] = c; }
+
+    lx->start[0] = lexerState(&b, lexerCodeKey(1, 0, 1, 0, 0));
+    lx->start[1] = lexerState(&b, LEX_KEY(LEX_MULTI_COMMENT, 0));
+
+    int cap = 0;
+
+    // Breadth-first construction; new states are appended while we walk
+    for (int s = 0; s < b.nkeys; s++) {
+        if (s >= cap) {
+            cap = b.keycap;
+            lx->trans = realloc(lx->trans, sizeof(uint32_t) * cap * lx->nclasses);
+        }
+
+        for (int e = 0; e < lx->nclasses; e++) {
+            uint32_t t = lexerStep(&b, b.keys[s], rep[e]);
+
+            if (LEX_NEXT(t) == 0xffff) {
+                lexerFree(lx);
+                lx = NULL;
+                goto done;
+            }
+
+            lx->trans[s * lx->nclasses + e] = t;
+        }
+    }
+
+    lx->nstates = b.nkeys;
+    lx->incomment = malloc((unsigned int) lx->nstates);
+
+    for (int s = 0; s < lx->nstates; s++) {
+        lx->incomment[s] = LEX_KEY_MODE(b.keys[s]) == LEX_MULTI_COMMENT;
+    }
+
+done:
+    free(b.trie.child);
+    free(b.trie.accept);
+    free(b.trie.depth);
+    free(b.keys);
+    free(b.hkeys);
+    free(b.hvals);
+
+    return lx;
+}
+
+/*
+Highlights len bytes of s into syntax_hl, starting inside a multi-line comment
+if in_comment is set. Returns whether the text ends inside a multi-line comment.
+*/
+int lexerRun(const struct lexer *lx, const char *s, int len, unsigned char *syntax_hl, int in_comment) {
+    const uint32_t *trans = lx->trans;
+    const unsigned char *eq = lx->eqclass;
+    unsigned int nclasses = lx->nclasses;
+    unsigned int state = lx->start[in_comment];
+
+    for (int i = 0; i < len; i++) {
+        uint32_t t = trans[state * nclasses + eq[(unsigned char) s[i]]];
+
+        state = LEX_NEXT(t);
+        syntax_hl[i] = LEX_CLASS(t);
+
+        if (LEX_BACK(t)) {
+            memset(&syntax_hl[i - LEX_BACK(t)], LEX_BACK_CLASS(t), LEX_BACK(t));
+        }
+    }
+
+    // The end of the row acts as a separator (closes a trailing keyword)
+    uint32_t t = trans[state * nclasses + eq[0]];
+
+    if (LEX_BACK(t)) {
+        memset(&syntax_hl[len - LEX_BACK(t)], LEX_BACK_CLASS(t), LEX_BACK(t));
+    }
+
+    return lx->incomment[state];
+}
+
+// Like lexerRun, but only works out the state the row ends in (no highlighting)
+int lexerRunState(const struct lexer *lx, const char *s, int len, int in_comment) {
+    const uint32_t *trans = lx->trans;
+    const unsigned char *eq = lx->eqclass;
+    unsigned int nclasses = lx->nclasses;
+    unsigned int state = lx->start[in_comment];
+
+    for (int i = 0; i < len; i++) {
+        state = LEX_NEXT(trans[state * nclasses + eq[(unsigned char) s[i]]]);
+    }
+
+    return lx->incomment[state];
+}
@@ -0,0 +1,269 @@
+/*
+Line index cache
+
+Big files get a sidecar in ~/.rem/cache (or $REM_CACHE_DIR) so reopening
+them doesn't have to scan for newlines or re-run the lexer from the top.
+A cache file is:
+
+    struct lineCacheHeader
+    path                  path_len bytes
+    rows                  one varint per row: size*2 (+1 if the line ending isn't
+                          a single '\n', followed by a varint of its length)
+    states                one bit per row, the multi-line comment state it ends in
+
+It's only used while the path, size, mtime and a fingerprint of the contents
+all match. States are only used if the syntax signature matches too.
+*/
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define LINECACHE_MAGIC "REMIDX1"
+#define LINECACHE_MIN_SIZE (1 << 20)   // Smaller files are quick enough to scan
+#define LINECACHE_SAMPLES 16
+
+struct lineCacheHeader {
+    char magic[8];
+    uint64_t size;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint64_t fingerprint;
+    uint64_t syntax_sig;   // 0: no states stored
+    uint64_t nrows;
+    uint64_t rows_bytes;
+    uint64_t path_len;
+};
+
+struct lineCache {
+    void *map;
+    size_t maplen;
+    const unsigned char *rows;
+    const unsigned char *rows_end;
+    const unsigned char *states;
+    uint64_t nrows;
+    uint64_t syntax_sig;
+};
+
+static uint64_t lineCacheHash(uint64_t h, const void *p, size_t len) {
+    const unsigned char *s = p;
+
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ s[i]) * 0x100000001b3ULL;
+    }
+
+    return h;
+}
+
+/*
+Hashes a few evenly spaced 4K blocks (always the first and last) instead of
+the whole file, so checking a multi-GB file costs a handful of reads.
+Together with size and mtime that's enough to notice a changed file.
+*/
+uint64_t lineCacheFingerprint(int fd, uint64_t size) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    char block[4096];
+
+    for (int i = 0; i < LINECACHE_SAMPLES; i++) {
+        uint64_t off = (size > sizeof(block)) ? (size - sizeof(block)) / (LINECACHE_SAMPLES - 1) * i : 0;
+        ssize_t n = pread(fd, block, sizeof(block), off);
+
+        if (n > 0) { h = lineCacheHash(h, block, n); }
+    }
+
+    return h;
+}
+
+// Path of a sidecar with extension ext for a file (by a hash of its absolute path)
+int lineCachePathExt(const char *path, const char *ext, char *out, size_t outlen) {
+    char *abs = realpath(path, NULL);
+    char *home = getenv("HOME");
+    char *dir = getenv("REM_CACHE_DIR");
+    char base[4096];
+
+    if (abs == NULL) { return -1; }
+
+    if (dir) {
+        snprintf(base, sizeof(base), "%s", dir);
+    } else if (home) {
+        snprintf(base, sizeof(base), "%s/.rem", home);
+        mkdir(base, 0755);
+        snprintf(base, sizeof(base), "%s/.rem/cache", home);
+    } else {
+        free(abs);
+        return -1;
+    }
+
+    mkdir(base, 0755);
+    snprintf(out, outlen, "%s/%016llx%s", base, (unsigned long long) lineCacheHash(0xcbf29ce484222325ULL, abs, strlen(abs)), ext);
+    free(abs);
+
+    return 0;
+}
+
+int lineCachePath(const char *path, char *out, size_t outlen) {
+    return lineCachePathExt(path, ".idx", out, outlen);
+}
+
+static int lineCacheMatches(const struct lineCacheHeader *h, const char *abs, const struct stat *st, uint64_t fingerprint) {
+    return !memcmp(h->magic, LINECACHE_MAGIC, sizeof(h->magic)) &&
+           h->size == (uint64_t) st->st_size &&
+           h->mtime_sec == (int64_t) st->st_mtim.tv_sec &&
+           h->mtime_nsec == (int64_t) st->st_mtim.tv_nsec &&
+           h->fingerprint == fingerprint &&
+           h->path_len == strlen(abs);
+}
+
+// Maps the cache for path. Returns 0 if it's there and still describes the file.
+int lineCacheOpen(struct lineCache *c, const char *path, const struct stat *st, uint64_t fingerprint) {
+    char cpath[4096];
+    struct stat cst;
+
+    memset(c, 0, sizeof(*c));
+
+    if (lineCachePath(path, cpath, sizeof(cpath)) == -1) { return -1; }
+
+    int fd = open(cpath, O_RDONLY);
+
+    if (fd == -1) { return -1; }
+
+    if (fstat(fd, &cst) == -1 || (size_t) cst.st_size < sizeof(struct lineCacheHeader)) {
+        close(fd);
+        return -1;
+    }
+
+    c->maplen = cst.st_size;
+    c->map = mmap(NULL, c->maplen, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (c->map == MAP_FAILED) {
+        c->map = NULL;
+        return -1;
+    }
+
+    const struct lineCacheHeader *h = c->map;
+    const unsigned char *p = (const unsigned char *) (h + 1);
+    char *abs = realpath(path, NULL);
+    int ok = abs && lineCacheMatches(h, abs, st, fingerprint) &&
+             sizeof(*h) + h->path_len + h->rows_bytes + (h->syntax_sig ? (h->nrows + 7) / 8 : 0) <= c->maplen &&
+             !memcmp(p, abs, h->path_len);
+
+    free(abs);
+
+    if (!ok) {
+        munmap(c->map, c->maplen);
+        c->map = NULL;
+        return -1;
+    }
+
+    c->rows = p + h->path_len;
+    c->rows_end = c->rows + h->rows_bytes;
+    c->states = h->syntax_sig ? c->rows_end : NULL;
+    c->nrows = h->nrows;
+    c->syntax_sig = h->syntax_sig;
+
+    return 0;
+}
+
+void lineCacheClose(struct lineCache *c) {
+    if (c->map) { munmap(c->map, c->maplen); }
+
+    c->map = NULL;
+}
+
+static const unsigned char *lineCacheGetVarint(const unsigned char *p, const unsigned char *end, uint64_t *v) {
+    int shift = 0;
+
+    *v = 0;
+
+    while (p < end && shift < 64) {
+        *v |= (uint64_t) (*p & 0x7f) << shift;
+        shift += 7;
+
+        if (!(*p++ & 0x80)) { return p; }
+    }
+
+    return NULL;
+}
+
+// Decodes the next row. Returns 0 at the end of the rows or on corrupt data.
+int lineCacheNextRow(struct lineCache *c, const unsigned char **p, int *size, int *strip) {
+    uint64_t v, s = 1;
+
+    if (*p == NULL || *p >= c->rows_end) { return 0; }
+
+    *p = lineCacheGetVarint(*p, c->rows_end, &v);
+
+    if (*p && (v & 1)) { *p = lineCacheGetVarint(*p, c->rows_end, &s); }
+
+    if (*p == NULL || (v >> 1) > INT32_MAX || s > INT32_MAX) { return 0; }
+
+    *size = v >> 1;
+    *strip = s;
+
+    return 1;
+}
+
+// Appends one row to a buffer with room for at least 20 more bytes. Returns the bytes used.
+int lineCachePutRow(unsigned char *out, int size, int strip) {
+    uint64_t v = ((uint64_t) size << 1) | (strip != 1);
+    int n = 0;
+
+    for (int pass = 0; pass < 2; pass++) {
+        while (v >= 0x80) {
+            out[n++] = (v & 0x7f) | 0x80;
+            v >>= 7;
+        }
+
+        out[n++] = v;
+
+        if (strip == 1) { break; }
+
+        v = strip;
+    }
+
+    return n;
+}
+
+// Writes the cache for path (via a temporary file, so readers never see half of one)
+int lineCacheSave(const char *path, const struct stat *st, uint64_t fingerprint, uint64_t syntax_sig,
+                  uint64_t nrows, const unsigned char *rows, uint64_t rows_bytes, const unsigned char *states) {
+    char cpath[4096], tmp[4200];
+    char *abs = realpath(path, NULL);
+
+    if (abs == NULL || lineCachePath(path, cpath, sizeof(cpath)) == -1) {
+        free(abs);
+        return -1;
+    }
+
+    struct lineCacheHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, LINECACHE_MAGIC, sizeof(h.magic));
+    h.size = st->st_size;
+    h.mtime_sec = st->st_mtim.tv_sec;
+    h.mtime_nsec = st->st_mtim.tv_nsec;
+    h.fingerprint = fingerprint;
+    h.syntax_sig = states ? syntax_sig : 0;
+    h.nrows = nrows;
+    h.rows_bytes = rows_bytes;
+    h.path_len = strlen(abs);
+
+    snprintf(tmp, sizeof(tmp), "%s.%d", cpath, (int) getpid());
+
+    FILE *fp = fopen(tmp, "w");
+    int ok = fp != NULL;
+
+    if (ok) {
+        ok = fwrite(&h, sizeof(h), 1, fp) == 1 &&
+             fwrite(abs, 1, h.path_len, fp) == h.path_len &&
+             fwrite(rows, 1, rows_bytes, fp) == rows_bytes &&
+             (!h.syntax_sig || fwrite(states, 1, (nrows + 7) / 8, fp) == (nrows + 7) / 8);
+        ok = (fclose(fp) == 0) && ok;
+        ok = ok && rename(tmp, cpath) == 0;
+
+        if (!ok) { unlink(tmp); }
+    }
+
+    free(abs);
+
+    return ok ? 0 : -1;
+}
@@ -0,0 +1,156 @@
+/*
+LZ block codec
+
+A small LZ77 codec in the style of LZ4, used to pack the text of rows far
+from the view. Each sequence is a token (literal count in the high nibble,
+match length - 4 in the low one, 15 meaning more length bytes follow), the
+literals, then a 2-byte offset back into the output. The last sequence is
+literals only. It goes for speed rather than ratio: one hash probe per
+position, and it skips ahead faster through text that doesn't repeat.
+*/
+
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 65535
+#define LZ_HASH_BITS 14
+
+// Room compressing n bytes can take in the worst case
+#define LZ_BOUND(n) ((n) + (n) / 255 + 16)
+
+static uint32_t lzRead32(const unsigned char *p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+
+    return v;
+}
+
+static unsigned char *lzPutLength(unsigned char *op, int len) {
+    while (len >= 255) {
+        *op++ = 255;
+        len -= 255;
+    }
+
+    *op++ = len;
+    return op;
+}
+
+static unsigned char *lzPutLiterals(unsigned char *op, const unsigned char *lit, int n, int match_nibble) {
+    *op++ = ((n < 15 ? n : 15) << 4) | match_nibble;
+
+    if (n >= 15) { op = lzPutLength(op, n - 15); }
+
+    memcpy(op, lit, n);
+    return op + n;
+}
+
+// Compresses n bytes of src into dst, which has room for LZ_BOUND(n). Returns the compressed size.
+int lzCompress(const char *src, int n, char *dst) {
+    const unsigned char *in = (const unsigned char *) src;
+    unsigned char *op = (unsigned char *) dst;
+    int table[1 << LZ_HASH_BITS];
+    int anchor = 0, i = 0, misses = 0;
+
+    memset(table, 0xff, sizeof(table));
+
+    while (i + LZ_MIN_MATCH <= n) {
+        uint32_t v = lzRead32(in + i);
+        uint32_t h = (v * 2654435761U) >> (32 - LZ_HASH_BITS);
+        int ref = table[h];
+
+        table[h] = i;
+
+        if (ref < 0 || i - ref > LZ_MAX_OFFSET || lzRead32(in + ref) != v) {
+            i += 1 + (misses++ >> 6);
+            continue;
+        }
+
+        int len = LZ_MIN_MATCH;
+
+        while (i + len < n && in[ref + len] == in[i + len]) { len++; }
+
+        int extra = len - LZ_MIN_MATCH;
+
+        op = lzPutLiterals(op, in + anchor, i - anchor, extra < 15 ? extra : 15);
+        *op++ = (i - ref) & 0xff;
+        *op++ = (i - ref) >> 8;
+
+        if (extra >= 15) { op = lzPutLength(op, extra - 15); }
+
+        i += len;
+        anchor = i;
+        misses = 0;
+    }
+
+    op = lzPutLiterals(op, in + anchor, n - anchor, 0);
+
+    return op - (unsigned char *) dst;
+}
+
+// Reads the bytes extending a length. Returns -1 if they run past end.
+static int lzGetLength(const unsigned char **ip, const unsigned char *end) {
+    int len = 0;
+    int b;
+
+    do {
+        if (*ip >= end || len > (1 << 30)) { return -1; }
+
+        b = *(*ip)++;
+        len += b;
+    } while (b == 255);
+
+    return len;
+}
+
+// Decompresses n bytes of src into dst (cap bytes). Returns the decompressed size, or -1 if src is corrupt.
+int lzDecompress(const char *src, int n, char *dst, int cap) {
+    const unsigned char *ip = (const unsigned char *) src;
+    const unsigned char *end = ip + n;
+    int out = 0;
+
+    while (ip < end) {
+        int token = *ip++;
+        int lit = token >> 4;
+
+        if (lit == 15) {
+            int more = lzGetLength(&ip, end);
+
+            if (more < 0) { return -1; }
+
+            lit += more;
+        }
+
+        if (lit > end - ip || lit > cap - out) { return -1; }
+
+        memcpy(dst + out, ip, lit);
+        ip += lit;
+        out += lit;
+
+        if (ip == end) { break; }
+        if (end - ip < 2) { return -1; }
+
+        int off = ip[0] | (ip[1] << 8);
+        int len = (token & 15) + LZ_MIN_MATCH;
+
+        ip += 2;
+
+        if ((token & 15) == 15) {
+            int more = lzGetLength(&ip, end);
+
+            if (more < 0) { return -1; }
+
+            len += more;
+        }
+
+        if (off == 0 || off > out || len > cap - out) { return -1; }
+
+        if (off >= len) {
+            memcpy(dst + out, dst + out - off, len);
+        } else {
+            // The match overlaps what it's copying (a repeated run)
+            for (int k = 0; k < len; k++) { dst[out + k] = dst[out - off + k]; }
+        }
+
+        out += len;
+    }
+
+    return out;
+}
@@ -0,0 +1,155 @@
+/*
+Memory accounting
+
+What the editor holds on the heap, by what it's for. rem.c adds up a
+memUse (an array indexed by memKind); these turn it into the one line shown
+in the status bar and the table written to a dump file. The mapped file
+isn't counted: its pages belong to the page cache and can be dropped at any
+time.
+*/
+
+enum memKind {
+    MEM_ROWS,     // The row array
+    MEM_TEXT,     // Row text copied out of the file
+    MEM_PACKED,   // Compressed blocks of cold rows
+    MEM_RENDER,   // Rendered rows and their column tables
+    MEM_HL,       // Highlighting and color spans
+    MEM_UNDO,
+    MEM_CLIP,
+    MEM_WORDS,    // Completion index
+    MEM_INDEXES,  // Line, wrap and bracket indexes, folds
+    MEM_SEARCH,   // Project search results
+    MEM_FRAME,    // Frame buffer and screen hashes
+    MEM_CACHE,    // Unpacked block cache, swap file buffer
+    MEM_KINDS
+};
+
+static const char *memNames[MEM_KINDS] = {
+    "rows", "text", "packed", "render", "hl", "undo", "clip", "words", "indexes", "search", "frame", "caches"
+};
+
+static const char *memInfo[MEM_KINDS] = {
+    "Row array, one entry per line",
+    "Row text copied out of the file (edited, pasted or saved)",
+    "LZ compressed text of rows far from the view",
+    "Rendered rows (tabs expanded) and their column tables",
+    "Syntax highlighting and color spans",
+    "Undo history",
+    "Clipboard",
+    "Word index for completion",
+    "Line, wrap and bracket indexes, folds",
+    "Project search results",
+    "Last frame sent to the terminal, screen line hashes",
+    "Unpacked block cache, swap file buffer"
+};
+
+size_t memTotal(const size_t *use) {
+    size_t n = 0;
+
+    for (int k = 0; k < MEM_KINDS; k++) { n += use[k]; }
+
+    return n;
+}
+
+// Writes n bytes as 512, 12.3K, 4.5M or 1.2G
+int memFormat(char *out, size_t len, size_t n) {
+    static const char units[] = "KMGT";
+
+    if (n < 1024) { return snprintf(out, len, "%zu", n); }
+
+    double v = n / 1024.0;
+    int u = 0;
+
+    while (v >= 1024 && u < 3) {
+        v /= 1024;
+        u++;
+    }
+
+    return snprintf(out, len, (v < 100) ? "%.1f%c" : "%.0f%c", v, units[u]);
+}
+
+// One line for the status bar: the total against the budget, then the largest kinds, as many as fit in len
+void memSummary(char *out, size_t len, const size_t *use, size_t budget) {
+    char total[16], limit[16];
+    int order[MEM_KINDS];
+
+    memFormat(total, sizeof(total), memTotal(use));
+    memFormat(limit, sizeof(limit), budget);
+
+    size_t at = snprintf(out, len, "Memory %s of %s:", total, limit);
+
+    for (int k = 0; k < MEM_KINDS; k++) { order[k] = k; }
+
+    // Largest first (a dozen kinds, so an insertion sort)
+    for (int k = 1; k < MEM_KINDS; k++) {
+        for (int j = k; j > 0 && use[order[j]] > use[order[j - 1]]; j--) {
+            int t = order[j];
+            order[j] = order[j - 1];
+            order[j - 1] = t;
+        }
+    }
+
+    for (int k = 0; k < MEM_KINDS && use[order[k]] && at < len; k++) {
+        char item[32], size[16];
+
+        memFormat(size, sizeof(size), use[order[k]]);
+
+        size_t n = snprintf(item, sizeof(item), " %s %s", memNames[order[k]], size);
+
+        if (at + n + 1 > len) { break; }
+
+        memcpy(out + at, item, n + 1);
+        at += n;
+    }
+}
+
+// Writes the whole breakdown to f
+void memReport(FILE *f, const size_t *use, size_t budget, size_t mapped) {
+    size_t total = memTotal(use);
+
+    fprintf(f, "%-8s %14s %6s  %s\n", "kind", "bytes", "share", "what");
+
+    for (int k = 0; k < MEM_KINDS; k++) {
+        fprintf(f, "%-8s %14zu %5.1f%%  %s\n", memNames[k], use[k], total ? 100.0 * use[k] / total : 0.0, memInfo[k]);
+    }
+
+    fprintf(f, "%-8s %14zu\n", "total", total);
+    fprintf(f, "%-8s %14zu\n", "budget", budget);
+    fprintf(f, "%-8s %14zu         File mapped read-only (page cache, not counted)\n", "mapped", mapped);
+}
+
+// Reads a size like 512 (in MB), 512M, 2G or 65536K. Returns 0 if it isn't one.
+size_t memParseSize(const char *s) {
+    char *end;
+    double v = strtod(s, &end);
+
+    if (end == s || v <= 0) { return 0; }
+
+    switch (toupper((unsigned char) *end)) {
+        case 'K': return v * 1024;
+        case 'G': return v * 1024 * 1024 * 1024;
+        case 'T': return v * 1024 * 1024 * 1024 * 1024;
+        default: return v * 1024 * 1024;
+    }
+}
+
+// Memory limit of the cgroup the process runs in (v2, then v1), or 0 if there's none
+size_t memCgroupLimit() {
+    static const char *paths[] = {"/sys/fs/cgroup/memory.max", "/sys/fs/cgroup/memory/memory.limit_in_bytes"};
+
+    for (int p = 0; p < 2; p++) {
+        FILE *f = fopen(paths[p], "r");
+        unsigned long long limit;
+
+        if (f == NULL) { continue; }
+
+        int ok = (fscanf(f, "%llu", &limit) == 1);
+
+        fclose(f);
+
+        // "max" (v2) or a huge number (v1) means no limit
+        if (ok && limit < (1ULL << 50)) { return limit; }
+    }
+
+    return 0;
+}
@@ -0,0 +1,69 @@
+/*
+Data-parallel loops
+
+parallelFor() splits [0, n) into chunks of grain items and hands them out to
+one thread per CPU ($REM_THREADS overrides the count) until none are left.
+The calling thread works too, and the call returns once every chunk is done.
+Chunks always start at a multiple of grain, so start / grain identifies one.
+*/
+
+#include <pthread.h>
+
+#define PARALLEL_MAX_THREADS 64
+
+struct parallelJob {
+    void (*fn)(void *ctx, int start, int end);
+    void *ctx;
+    int n;
+    int grain;
+    int next;
+};
+
+static void *parallelWorker(void *arg) {
+    struct parallelJob *job = arg;
+
+    while (1) {
+        int start = __atomic_fetch_add(&job->next, job->grain, __ATOMIC_RELAXED);
+
+        if (start >= job->n) { return NULL; }
+
+        int end = (job->n - start > job->grain) ? start + job->grain : job->n;
+        job->fn(job->ctx, start, end);
+    }
+}
+
+int parallelThreads() {
+    static int threads = 0;
+
+    if (threads == 0) {
+        char *env = getenv("REM_THREADS");
+
+        threads = env ? atoi(env) : (int) sysconf(_SC_NPROCESSORS_ONLN);
+
+        if (threads < 1) { threads = 1; }
+        if (threads > PARALLEL_MAX_THREADS) { threads = PARALLEL_MAX_THREADS; }
+    }
+
+    return threads;
+}
+
+void parallelFor(int n, int grain, void (*fn)(void *ctx, int start, int end), void *ctx) {
+    struct parallelJob job = {fn, ctx, n, grain > 0 ? grain : 1, 0};
+    pthread_t tid[PARALLEL_MAX_THREADS];
+    int chunks = (n + job.grain - 1) / job.grain;
+    int threads = parallelThreads();
+    int started = 0;
+
+    if (threads > chunks) { threads = chunks; }
+
+    // Thread creation failing just leaves more work for the others
+    while (started < threads - 1 && pthread_create(&tid[started], NULL, parallelWorker, &job) == 0) {
+        started++;
+    }
+
+    parallelWorker(&job);
+
+    for (int t = 0; t < started; t++) {
+        pthread_join(tid[t], NULL);
+    }
+}
@@ -0,0 +1,135 @@
+/*
+Key scripts
+
+A batch script is the keys to press, as they'd be typed. Text goes in as
+is, and other keys are named in angle brackets: <Enter>, <Esc>, <Tab>,
+<BS>, <Del>, <Up>, <Down>, <Left>, <Right>, <Home>, <End>, <PgUp>, <PgDn>,
+<C-Home>, <C-End>, <C-Up>, <C-Down>, <S-Up> (and the other Shift arrows)
+and <C-x> for Ctrl plus a key. <lt> is a literal '<', as is a '<' that
+doesn't start a key name. Newlines are skipped so a script can be spread
+over lines; keys recorded raw from a terminal (\r, escape sequences) work
+as well.
+*/
+
+struct scriptKey {
+    const char *name;  // NULL: only recognised as a raw sequence
+    const char *seq;   // NULL: a plain byte
+    int key;
+};
+
+static const struct scriptKey scriptKeys[] = {
+    {"Enter", NULL, '\r'},
+    {"Esc", NULL, '\x1b'},
+    {"Tab", NULL, '\t'},
+    {"BS", NULL, BACKSPACE},
+    {"lt", NULL, '<'},
+    {"Up", "\x1b[A", ARROW_UP},
+    {"Down", "\x1b[B", ARROW_DOWN},
+    {"Right", "\x1b[C", ARROW_RIGHT},
+    {"Left", "\x1b[D", ARROW_LEFT},
+    {"Home", "\x1b[H", HOME_KEY},
+    {"End", "\x1b[F", END_KEY},
+    {"Del", "\x1b[3~", DEL_KEY},
+    {"PgUp", "\x1b[5~", PAGE_UP},
+    {"PgDn", "\x1b[6~", PAGE_DOWN},
+    {"C-Home", "\x1b[1;5H", FILE_START},
+    {"C-End", "\x1b[1;5F", FILE_END},
+    {"C-Up", "\x1b[1;5A", ADD_CURSOR_UP},
+    {"C-Down", "\x1b[1;5B", ADD_CURSOR_DOWN},
+    {"S-Up", "\x1b[1;2A", SELECT_UP},
+    {"S-Down", "\x1b[1;2B", SELECT_DOWN},
+    {"S-Right", "\x1b[1;2C", SELECT_RIGHT},
+    {"S-Left", "\x1b[1;2D", SELECT_LEFT},
+    {NULL, "\x1b[1~", HOME_KEY},
+    {NULL, "\x1b[4~", END_KEY},
+    {NULL, "\x1b[7~", HOME_KEY},
+    {NULL, "\x1b[8~", END_KEY},
+    {NULL, "\x1bOH", HOME_KEY},
+    {NULL, "\x1bOF", END_KEY},
+};
+
+#define SCRIPT_NKEYS ((int) (sizeof(scriptKeys) / sizeof(scriptKeys[0])))
+
+// Key named at s (just past a '<'), or -1. *used is set to what it took, including the '>'.
+static int scriptName(const char *s, int len, int *used) {
+    const char *close = memchr(s, '>', len);
+
+    if (close == NULL) { return -1; }
+
+    int n = close - s;
+
+    for (int k = 0; k < SCRIPT_NKEYS; k++) {
+        const char *name = scriptKeys[k].name;
+
+        if (name && (int) strlen(name) == n && !memcmp(s, name, n)) {
+            *used = n + 1;
+            return scriptKeys[k].key;
+        }
+    }
+
+    if (n == 3 && s[0] == 'C' && s[1] == '-') {
+        *used = n + 1;
+        return s[2] & 0x1f;
+    }
+
+    return -1;
+}
+
+// Key a raw escape sequence at s stands for (the longest one that matches), or -1
+static int scriptSequence(const char *s, int len, int *used) {
+    int best = -1, best_len = 0;
+
+    for (int k = 0; k < SCRIPT_NKEYS; k++) {
+        const char *seq = scriptKeys[k].seq;
+        int n = seq ? (int) strlen(seq) : 0;
+
+        if (n > best_len && n <= len && !memcmp(s, seq, n)) {
+            best = scriptKeys[k].key;
+            best_len = n;
+        }
+    }
+
+    *used = best_len;
+    return best;
+}
+
+// Turns the len bytes of a script into keys. Returns how many; *keys is malloc'd.
+int scriptParse(const char *s, int len, int **keys) {
+    int *out = malloc(sizeof(int) * (len ? len : 1));
+    int n = 0;
+
+    for (int i = 0; i < len;) {
+        int used = 1;
+        int key = (unsigned char) s[i];
+
+        if (s[i] == '\n') {
+            i++;
+            continue;
+        }
+
+        if (s[i] == '<') {
+            int named = scriptName(s + i + 1, len - i - 1, &used);
+
+            if (named >= 0) {
+                key = named;
+                used++;
+            } else {
+                used = 1;
+            }
+        } else if (s[i] == '\x1b') {
+            int raw = scriptSequence(s + i, len - i, &used);
+
+            if (raw >= 0) {
+                key = raw;
+            } else {
+                used = 1;
+            }
+        }
+
+        out[n++] = key;
+        i += used;
+    }
+
+    *keys = out;
+    return n;
+}
@@ -0,0 +1,285 @@
+/*
+Server sockets
+
+rem --server keeps the files it opens warm in a long-lived process, and
+rem <file> attaches to it over a Unix socket (~/.rem/server.sock, or
+$REM_SOCKET) as a thin client. A session starts with:
+
+    struct serverHello    the client's terminal size
+    cwd                   cwd_len bytes
+    path                  path_len bytes
+
+The server answers with one byte: SERVER_YES, or SERVER_NO if it's busy
+with another client or can't open the file (the client then runs the editor
+itself). After that the socket only carries terminal bytes: keys to the
+server, frames back. The client sends a resize in band as the xterm size
+report, ESC [ 8 ; rows ; cols t.
+
+The server draws for one client at a time. Connections are accepted on a
+thread of their own (serverDoorRun), so a client that comes while another
+one is attached is turned away at once instead of waiting in the backlog.
+*/
+
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define SERVER_MAGIC "REMSRV1"
+#define SERVER_REPLY_MS 2000   // A client runs the editor itself if the server doesn't answer by then
+#define SERVER_YES 'y'
+#define SERVER_NO 'n'
+
+struct serverHello {
+    char magic[8];
+    int32_t rows;
+    int32_t cols;
+    uint32_t cwd_len;
+    uint32_t path_len;
+};
+
+// Hands accepted connections to the main thread while no client is attached
+struct serverDoor {
+    int listen_fd;
+    int pipe[2];       // Connections for the main thread, an int each
+    int busy;          // A client is attached: set by the door thread, cleared by the main thread
+    pthread_t thread;
+};
+
+int serverSocketPath(char *out, size_t outlen) {
+    char *home = getenv("HOME");
+    char *path = getenv("REM_SOCKET");
+    struct sockaddr_un addr;
+
+    if (path) {
+        snprintf(out, outlen, "%s", path);
+    } else if (home) {
+        snprintf(out, outlen, "%s/.rem", home);
+        mkdir(out, 0755);
+        snprintf(out, outlen, "%s/.rem/server.sock", home);
+    } else {
+        return -1;
+    }
+
+    return strlen(out) < sizeof(addr.sun_path) ? 0 : -1;
+}
+
+static void serverAddr(const char *path, struct sockaddr_un *addr) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    snprintf(addr->sun_path, sizeof(addr->sun_path), "%s", path);
+}
+
+int serverConnect(const char *path) {
+    struct sockaddr_un addr;
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    if (fd == -1) { return -1; }
+
+    serverAddr(path, &addr);
+
+    if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) == -1) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+// Binds fd to path with only this user allowed to connect: clients get to read and write their files
+static int serverBind(int fd, const char *path) {
+    struct sockaddr_un addr;
+
+    serverAddr(path, &addr);
+
+    // Set before the socket exists, so there's no moment anyone else can connect
+    mode_t mask = umask(077);
+    int ret = bind(fd, (struct sockaddr *) &addr, sizeof(addr));
+    int err = errno;
+
+    umask(mask);
+    errno = err;
+
+    return ret;
+}
+
+// Listens on path, replacing a socket no server is behind any more. Fails with EADDRINUSE if one is.
+int serverListen(const char *path) {
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    if (fd == -1) { return -1; }
+
+    if (serverBind(fd, path) == -1) {
+        int probe = (errno == EADDRINUSE) ? serverConnect(path) : -1;
+        int stale = (probe == -1 && errno == ECONNREFUSED);
+        struct stat st;
+
+        // Connecting to any other kind of file is refused too: only a socket is ours to replace
+        if (stale && (lstat(path, &st) == -1 || !S_ISSOCK(st.st_mode))) {
+            stale = 0;
+            errno = EEXIST;
+        }
+
+        if (!stale || unlink(path) == -1 || serverBind(fd, path) == -1) {
+            if (probe != -1) {
+                close(probe);
+                errno = EADDRINUSE;
+            }
+
+            close(fd);
+            return -1;
+        }
+    }
+
+    if (listen(fd, 8) == -1) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+// Reads exactly len bytes, waiting at most timeout ms for each part. Returns 0, or -1 on EOF, error or timeout.
+int serverReadFull(int fd, void *buf, size_t len, int timeout) {
+    char *p = buf;
+
+    while (len > 0) {
+        struct pollfd pfd = {fd, POLLIN, 0};
+
+        if (poll(&pfd, 1, timeout) <= 0) { return -1; }
+
+        ssize_t n = read(fd, p, len);
+
+        if (n <= 0) { return -1; }
+
+        p += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+int serverWriteFull(int fd, const void *buf, size_t len) {
+    const char *p = buf;
+
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+
+        if (n == -1 && errno == EINTR) { continue; }
+        if (n <= 0) { return -1; }
+
+        p += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+static void *serverDoorRun(void *arg) {
+    struct serverDoor *d = arg;
+
+    while (1) {
+        int fd = accept(d->listen_fd, NULL, NULL);
+
+        if (fd == -1) { continue; }
+
+        if (__atomic_load_n(&d->busy, __ATOMIC_ACQUIRE)) {
+            char no = SERVER_NO;
+
+            write(fd, &no, 1);
+            close(fd);
+            continue;
+        }
+
+        __atomic_store_n(&d->busy, 1, __ATOMIC_RELEASE);
+
+        if (serverWriteFull(d->pipe[1], &fd, sizeof(fd)) == -1) { close(fd); }
+    }
+
+    return NULL;
+}
+
+int serverDoorStart(struct serverDoor *d, int listen_fd) {
+    d->listen_fd = listen_fd;
+    d->busy = 0;
+
+    if (pipe(d->pipe) == -1) { return -1; }
+
+    return pthread_create(&d->thread, NULL, serverDoorRun, d) == 0 ? 0 : -1;
+}
+
+// Waits for the next client. Returns its connection.
+int serverDoorNext(struct serverDoor *d) {
+    int fd;
+
+    while (serverReadFull(d->pipe[0], &fd, sizeof(fd), -1) == -1) {}
+
+    return fd;
+}
+
+// The client's gone: the next one can attach
+void serverDoorIdle(struct serverDoor *d) {
+    __atomic_store_n(&d->busy, 0, __ATOMIC_RELEASE);
+}
+
+static volatile sig_atomic_t serverWinched;
+
+static void serverOnWinch(int sig) {
+    (void) sig;
+    serverWinched = 1;
+}
+
+// Tells the server the terminal's size, as an xterm size report
+static int serverSendSize(int fd) {
+    struct winsize w;
+    char buf[32];
+
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &w) == -1 || w.ws_col == 0) { return 0; }
+
+    int n = snprintf(buf, sizeof(buf), "\x1b[8;%d;%dt", w.ws_row, w.ws_col);
+
+    return serverWriteFull(fd, buf, n);
+}
+
+/*
+The client's side of a session: copies keys to the server and what it draws
+to the terminal until the server hangs up. Returns 0 then, or -1 if the
+terminal went away first.
+*/
+int serverRelay(int fd) {
+    char buf[65536];
+    struct sigaction sa;
+
+    // No SA_RESTART, so a resize also wakes poll()
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = serverOnWinch;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGWINCH, &sa, NULL);
+
+    while (1) {
+        struct pollfd fds[2] = {
+            {STDIN_FILENO, POLLIN, 0},
+            {fd, POLLIN, 0}
+        };
+
+        if (serverWinched) {
+            serverWinched = 0;
+            serverSendSize(fd);
+        }
+
+        if (poll(fds, 2, -1) == -1) { continue; }
+
+        if (fds[1].revents) {
+            ssize_t n = read(fd, buf, sizeof(buf));
+
+            if (n <= 0) { return 0; }
+            if (serverWriteFull(STDOUT_FILENO, buf, n) == -1) { return -1; }
+        }
+
+        if (fds[0].revents) {
+            ssize_t n = read(STDIN_FILENO, buf, sizeof(buf));
+
+            // The raw terminal reads 0 bytes when there's nothing after all, only a hangup ends it
+            if ((n == 0 && (fds[0].revents & POLLHUP)) || (n == -1 && errno != EINTR && errno != EAGAIN)) { return -1; }
+            if (n > 0 && serverWriteFull(fd, buf, n) == -1) { return 0; }
+        }
+    }
+}
@@ -0,0 +1,240 @@
+/*
+Vectorized byte kernels
+
+Each kernel has a scalar version plus SSE2/AVX2 versions on x86. simdInit()
+picks the widest one the CPU supports at runtime; until it runs, the scalar
+versions are used.
+*/
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define REM_SIMD_X86 1
+#endif
+
+// Counts occurrences of byte c
+static int remCountByteScalar(const char *s, int len, char c) {
+    int count = 0;
+
+    for (int i = 0; i < len; i++) {
+        count += (s[i] == c);
+    }
+
+    return count;
+}
+
+// Index of the first control byte (0x00-0x1f, 0x7f), or len if there is none
+static int remFindCtrlScalar(const char *s, int len) {
+    for (int i = 0; i < len; i++) {
+        unsigned char c = s[i];
+
+        if (c < 0x20 || c == 0x7f) { return i; }
+    }
+
+    return len;
+}
+
+// Index of the first byte >= 0x80, or len if the text is plain ASCII
+static int remFindNonAsciiScalar(const char *s, int len) {
+    for (int i = 0; i < len; i++) {
+        if ((unsigned char) s[i] >= 0x80) { return i; }
+    }
+
+    return len;
+}
+
+// Index of the first occurrence of needle, or len if there is none
+static int remFindStrScalar(const char *s, int len, const char *needle, int nlen) {
+    const char *hit = memmem(s, len, needle, nlen);
+
+    return hit ? hit - s : len;
+}
+
+#ifdef REM_SIMD_X86
+__attribute__((target("sse2")))
+static int remCountByteSSE2(const char *s, int len, char c) {
+    __m128i needle = _mm_set1_epi8(c);
+    int count = 0;
+    int i = 0;
+
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (s + i));
+        count += __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(v, needle)));
+    }
+
+    return count + remCountByteScalar(s + i, len - i, c);
+}
+
+__attribute__((target("sse2")))
+static int remFindCtrlSSE2(const char *s, int len) {
+    __m128i limit = _mm_set1_epi8(0x1f);
+    __m128i del = _mm_set1_epi8(0x7f);
+    int i = 0;
+
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (s + i));
+        __m128i ctrl = _mm_or_si128(_mm_cmpeq_epi8(_mm_min_epu8(v, limit), v), _mm_cmpeq_epi8(v, del));
+        int mask = _mm_movemask_epi8(ctrl);
+
+        if (mask) { return i + __builtin_ctz(mask); }
+    }
+
+    return i + remFindCtrlScalar(s + i, len - i);
+}
+
+__attribute__((target("sse2")))
+static int remFindNonAsciiSSE2(const char *s, int len) {
+    int i = 0;
+
+    for (; i + 16 <= len; i += 16) {
+        int mask = _mm_movemask_epi8(_mm_loadu_si128((const __m128i *) (s + i)));
+
+        if (mask) { return i + __builtin_ctz(mask); }
+    }
+
+    return i + remFindNonAsciiScalar(s + i, len - i);
+}
+
+// Compares the needle's first and last bytes 16 positions at a time, then checks candidates
+__attribute__((target("sse2")))
+static int remFindStrSSE2(const char *s, int len, const char *needle, int nlen) {
+    if (nlen < 2) { return remFindStrScalar(s, len, needle, nlen); }
+
+    __m128i first = _mm_set1_epi8(needle[0]);
+    __m128i last = _mm_set1_epi8(needle[nlen - 1]);
+    int i = 0;
+
+    for (; i + nlen - 1 + 16 <= len; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *) (s + i));
+        __m128i b = _mm_loadu_si128((const __m128i *) (s + i + nlen - 1));
+        int mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+
+        while (mask) {
+            int at = i + __builtin_ctz(mask);
+
+            if (!memcmp(s + at + 1, needle + 1, nlen - 2)) { return at; }
+
+            mask &= mask - 1;
+        }
+    }
+
+    return i + remFindStrScalar(s + i, len - i, needle, nlen);
+}
+
+__attribute__((target("avx2")))
+static int remCountByteAVX2(const char *s, int len, char c) {
+    __m256i needle = _mm256_set1_epi8(c);
+    int count = 0;
+    int i = 0;
+
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) (s + i));
+        count += __builtin_popcount((unsigned int) _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, needle)));
+    }
+
+    return count + remCountByteSSE2(s + i, len - i, c);
+}
+
+__attribute__((target("avx2")))
+static int remFindCtrlAVX2(const char *s, int len) {
+    __m256i limit = _mm256_set1_epi8(0x1f);
+    __m256i del = _mm256_set1_epi8(0x7f);
+    int i = 0;
+
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) (s + i));
+        __m256i ctrl = _mm256_or_si256(_mm256_cmpeq_epi8(_mm256_min_epu8(v, limit), v), _mm256_cmpeq_epi8(v, del));
+        unsigned int mask = _mm256_movemask_epi8(ctrl);
+
+        if (mask) { return i + __builtin_ctz(mask); }
+    }
+
+    return i + remFindCtrlSSE2(s + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static int remFindNonAsciiAVX2(const char *s, int len) {
+    int i = 0;
+
+    for (; i + 32 <= len; i += 32) {
+        unsigned int mask = _mm256_movemask_epi8(_mm256_loadu_si256((const __m256i *) (s + i)));
+
+        if (mask) { return i + __builtin_ctz(mask); }
+    }
+
+    return i + remFindNonAsciiSSE2(s + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static int remFindStrAVX2(const char *s, int len, const char *needle, int nlen) {
+    if (nlen < 2) { return remFindStrScalar(s, len, needle, nlen); }
+
+    __m256i first = _mm256_set1_epi8(needle[0]);
+    __m256i last = _mm256_set1_epi8(needle[nlen - 1]);
+    int i = 0;
+
+    for (; i + nlen - 1 + 32 <= len; i += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i *) (s + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *) (s + i + nlen - 1));
+        unsigned int mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(a, first), _mm256_cmpeq_epi8(b, last)));
+
+        while (mask) {
+            int at = i + __builtin_ctz(mask);
+
+            if (!memcmp(s + at + 1, needle + 1, nlen - 2)) { return at; }
+
+            mask &= mask - 1;
+        }
+    }
+
+    return i + remFindStrSSE2(s + i, len - i, needle, nlen);
+}
+#endif
+
+int (*remCountByte)(const char *s, int len, char c) = remCountByteScalar;
+int (*remFindCtrl)(const char *s, int len) = remFindCtrlScalar;
+int (*remFindNonAscii)(const char *s, int len) = remFindNonAsciiScalar;
+int (*remFindStr)(const char *s, int len, const char *needle, int nlen) = remFindStrScalar;
+const char *remSimdLevel = "scalar";
+
+// Forces a kernel level ("scalar", "sse2" or "avx2"). Returns 0 if unsupported.
+int simdSelect(const char *level) {
+    if (!strcmp(level, "scalar")) {
+        remCountByte = remCountByteScalar;
+        remFindCtrl = remFindCtrlScalar;
+        remFindNonAscii = remFindNonAsciiScalar;
+        remFindStr = remFindStrScalar;
+        remSimdLevel = "scalar";
+        return 1;
+    }
+
+#ifdef REM_SIMD_X86
+    __builtin_cpu_init();
+
+    if (!strcmp(level, "sse2") && __builtin_cpu_supports("sse2")) {
+        remCountByte = remCountByteSSE2;
+        remFindCtrl = remFindCtrlSSE2;
+        remFindNonAscii = remFindNonAsciiSSE2;
+        remFindStr = remFindStrSSE2;
+        remSimdLevel = "sse2";
+        return 1;
+    }
+
+    if (!strcmp(level, "avx2") && __builtin_cpu_supports("avx2")) {
+        remCountByte = remCountByteAVX2;
+        remFindCtrl = remFindCtrlAVX2;
+        remFindNonAscii = remFindNonAsciiAVX2;
+        remFindStr = remFindStrAVX2;
+        remSimdLevel = "avx2";
+        return 1;
+    }
+#endif
+
+    return 0;
+}
+
+void simdInit() {
+    if (simdSelect("avx2")) { return; }
+    if (simdSelect("sse2")) { return; }
+
+    simdSelect("scalar");
+}
@@ -14,14 +14,19 @@ enum editorSyntaxHl {
 #define HL_NUMBERS (1<<0)
 #define HL_STRINGS (1<<1)
 
+struct lexer;
+
 struct editorSyntax {
     char *filetype;
     char **filematch;
     char **keywords;
+    char **keywords2;
     char *singleline_comment_s;
     char *multiline_comment_s;
     char *multiline_comment_e;
     int flags;
+    char *quotes;         // NULL means both " and '
+    struct lexer *lexer;  // Compiled on first use
 };
 
 // C/C++
@@ -33,16 +38,12 @@ char *syntax_hl_extensions_c[] = {
 };
 
 char *syntax_hl_keywords_c[] = {
+    "define", "sizeof", "int", "switch", "case", "char", "for", "while", "return", "if", "break", "continue", "else", "true", "struct", "union", "typedef", "static", "include", "printf", "enum", "void", "const",
+    NULL
+};
 
-    // Keyword 1
-    "define", "sizeof", "int", "switch", "case", "char", "for", "while", "return", "if", "break", "continue", "else", "else if", "true", "struct", "union", "typedef", "static", "include", "printf", "enum", "void", "const",
-
-    // Keyword 2
-    "false2",
-
-    // Keyword 3
-    // "main3",
-    
+char *syntax_hl_keywords2_c[] = {
+    "false",
     NULL
 };
 
@@ -53,33 +54,39 @@ char *syntax_hl_extensions_py[] = {
 };
 
 char *syntax_hl_keywords_py[] = {
+    "def", "for", "while", "return", "if", "break", "continue", "else", "True", "self", "print", "try", "except", "class", "None", "__init__",
+    NULL
+};
 
-    // Keyword 1
-    "def", "for", "while", "return", "if", "break", "continue", "else", "else if", "True", "self", "print", "try", "except", "class", "None", "__init__",
-
-    // Keyword 2
-    "False2",
-
-    // Keyword 3
-    // "main3",
-    
+char *syntax_hl_keywords2_py[] = {
+    "False",
     NULL
 };
 
+/*
+Built-in definitions
+
+These are used when no definition file for the filetype is found
+(see syntax_load.h). Definition files with the same filetype replace them.
+*/
 struct editorSyntax SyntaxDB[] = {
     {
         "c",
         syntax_hl_extensions_c,
         syntax_hl_keywords_c,
+        syntax_hl_keywords2_c,
         "//", "/*", "*/",
-        HL_NUMBERS | HL_STRINGS
+        HL_NUMBERS | HL_STRINGS,
+        NULL, NULL
     },
     {
         "py",
         syntax_hl_extensions_py,
         syntax_hl_keywords_py,
+        syntax_hl_keywords2_py,
         "#", "/*", "*/", // I know Python uses """, but that breaks everything
-        HL_NUMBERS | HL_STRINGS
+        HL_NUMBERS | HL_STRINGS,
+        NULL, NULL
     },
 };
 
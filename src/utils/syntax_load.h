@@ -0,0 +1,192 @@
+// Syntax definition files
+//
+// Definitions are plain text, one directive per line:
+//
+//     filetype go
+//     extensions .go
+//     comment //
+//     multiline /* */
+//     flags numbers strings
+//     quotes "'`
+//     keywords1 break case chan const continue
+//     keywords2 false nil true
+//
+// Blank lines and lines starting with # are ignored, and keywords1/keywords2
+// may be repeated. Every *.syntax file in the following directories is loaded
+// at startup, later directories replacing earlier definitions by filetype:
+//
+//     SYNTAX_DIR (set at build time), ~/.rem/syntax, $REM_SYNTAX_DIR
+
+#include <dirent.h>
+
+#ifndef SYNTAX_DIR
+#define SYNTAX_DIR "/usr/local/share/rem/syntax"
+#endif
+
+struct editorSyntax **SyntaxTable = NULL;
+int SyntaxTableLen = 0;
+
+static int syntaxIsBuiltin(struct editorSyntax *s) {
+    return s >= &SyntaxDB[0] && s < &SyntaxDB[SYNTAXDB_ENTRIES];
+}
+
+static void syntaxFreeList(char **list) {
+    for (int i = 0; list && list[i]; i++) { free(list[i]); }
+    free(list);
+}
+
+void syntaxFree(struct editorSyntax *s) {
+    if (syntaxIsBuiltin(s)) { return; }
+
+    free(s->filetype);
+    syntaxFreeList(s->filematch);
+    syntaxFreeList(s->keywords);
+    syntaxFreeList(s->keywords2);
+    free(s->singleline_comment_s);
+    free(s->multiline_comment_s);
+    free(s->multiline_comment_e);
+    free(s->quotes);
+    lexerFree(s->lexer);
+    free(s);
+}
+
+// Adds a definition, replacing any existing one with the same filetype
+void syntaxRegister(struct editorSyntax *s) {
+    for (int i = 0; i < SyntaxTableLen; i++) {
+        if (!strcmp(SyntaxTable[i]->filetype, s->filetype)) {
+            syntaxFree(SyntaxTable[i]);
+            SyntaxTable[i] = s;
+            return;
+        }
+    }
+
+    SyntaxTable = realloc(SyntaxTable, sizeof(struct editorSyntax *) * (SyntaxTableLen + 1));
+    SyntaxTable[SyntaxTableLen++] = s;
+}
+
+// Appends whitespace separated words to a NULL terminated list
+static char **syntaxAppendWords(char **list, char *words) {
+    int len = 0;
+
+    while (list && list[len]) { len++; }
+
+    char *save = NULL;
+
+    for (char *w = strtok_r(words, " \t", &save); w; w = strtok_r(NULL, " \t", &save)) {
+        list = realloc(list, sizeof(char *) * (len + 2));
+        list[len++] = strdup(w);
+        list[len] = NULL;
+    }
+
+    return list;
+}
+
+struct editorSyntax *syntaxLoadFile(const char *path) {
+    FILE *fp = fopen(path, "r");
+
+    if (!fp) { return NULL; }
+
+    struct editorSyntax *s = calloc(1, sizeof(struct editorSyntax));
+    char *line = NULL;
+    size_t linecap = 0;
+    ssize_t line_len;
+
+    while ((line_len = getline(&line, &linecap, fp)) != -1) {
+        while (line_len > 0 && isspace((unsigned char) line[line_len - 1])) {
+            line[--line_len] = '\0';
+        }
+
+        char *key = line;
+        while (isspace((unsigned char) *key)) { key++; }
+
+        if (*key == '\0' || *key == '#') { continue; }
+
+        char *val = key;
+        while (*val && !isspace((unsigned char) *val)) { val++; }
+        if (*val) { *val++ = '\0'; }
+        while (isspace((unsigned char) *val)) { val++; }
+
+        if (!strcmp(key, "filetype")) {
+            free(s->filetype);
+            s->filetype = strdup(val);
+        } else if (!strcmp(key, "extensions")) {
+            s->filematch = syntaxAppendWords(s->filematch, val);
+        } else if (!strcmp(key, "comment")) {
+            free(s->singleline_comment_s);
+            s->singleline_comment_s = strdup(val);
+        } else if (!strcmp(key, "multiline")) {
+            char *end = val;
+            while (*end && !isspace((unsigned char) *end)) { end++; }
+            if (*end) { *end++ = '\0'; }
+            while (isspace((unsigned char) *end)) { end++; }
+
+            free(s->multiline_comment_s);
+            free(s->multiline_comment_e);
+            s->multiline_comment_s = strdup(val);
+            s->multiline_comment_e = strdup(end);
+        } else if (!strcmp(key, "flags")) {
+            if (strstr(val, "numbers")) { s->flags |= HL_NUMBERS; }
+            if (strstr(val, "strings")) { s->flags |= HL_STRINGS; }
+        } else if (!strcmp(key, "quotes")) {
+            free(s->quotes);
+            s->quotes = strdup(val);
+        } else if (!strcmp(key, "keywords1")) {
+            s->keywords = syntaxAppendWords(s->keywords, val);
+        } else if (!strcmp(key, "keywords2")) {
+            s->keywords2 = syntaxAppendWords(s->keywords2, val);
+        }
+    }
+
+    free(line);
+    fclose(fp);
+
+    if (s->filetype == NULL || s->filematch == NULL) {
+        syntaxFree(s);
+        return NULL;
+    }
+
+    return s;
+}
+
+void syntaxLoadDir(const char *dir) {
+    DIR *d = opendir(dir);
+
+    if (!d) { return; }
+
+    struct dirent *ent;
+
+    while ((ent = readdir(d)) != NULL) {
+        int len = strlen(ent->d_name);
+
+        if (len <= 7 || strcmp(ent->d_name + len - 7, ".syntax")) { continue; }
+
+        char path[4096];
+        snprintf(path, sizeof(path), "%s/%s", dir, ent->d_name);
+
+        struct editorSyntax *s = syntaxLoadFile(path);
+
+        if (s) { syntaxRegister(s); }
+    }
+
+    closedir(d);
+}
+
+void syntaxLoadAll() {
+    for (unsigned int e = 0; e < SYNTAXDB_ENTRIES; e++) {
+        syntaxRegister(&SyntaxDB[e]);
+    }
+
+    syntaxLoadDir(SYNTAX_DIR);
+
+    char *home = getenv("HOME");
+
+    if (home) {
+        char path[4096];
+        snprintf(path, sizeof(path), "%s/.rem/syntax", home);
+        syntaxLoadDir(path);
+    }
+
+    char *env = getenv("REM_SYNTAX_DIR");
+
+    if (env) { syntaxLoadDir(env); }
+}
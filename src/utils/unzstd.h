@@ -0,0 +1,724 @@
+/*
+zstd decompressor
+
+A decoder for zstd frames (RFC 8878): raw, RLE and compressed blocks,
+Huffman coded literals and FSE coded sequences, and skippable frames in
+between. Frames that need a dictionary aren't supported, and checksums are
+skipped. Like inflate.h it works a block at a time, and everything a block
+can inherit from the one before (repeat offsets and entropy tables) is kept
+in zstdState, a plain struct, so a decode can go on from a copy of it and
+the frame's last window of output.
+*/
+
+#define ZSTD_MAGIC 0xfd2fb528u
+#define ZSTD_BLOCK_MAX (128 << 10)
+#define ZSTD_HUF_BITS 11  // Longest literal code
+
+struct zstdFse {
+    uint8_t symbol;
+    uint8_t nbits;
+    uint16_t base;
+};
+
+enum zstdStage {
+    ZSTD_FRAME,   // At a frame header (or the end of the file)
+    ZSTD_BLOCKS,  // Between two blocks of a frame
+    ZSTD_END
+};
+
+struct zstdState {
+    uint64_t pos;         // Input bytes consumed
+    int stage;
+    int checksum;         // The frame ends in a checksum
+    uint64_t window;      // The frame's window size
+    uint64_t out_total;   // Bytes decompressed so far
+    uint64_t frame_start; // Output offset the frame started at
+    uint32_t rep[3];      // Repeat offsets
+    int huf_bits;         // Literal code length, 0 before the frame's first table
+    uint16_t huf[1 << ZSTD_HUF_BITS];  // symbol << 8 | length, by the next huf_bits bits
+    int fse_log[3];       // Literal lengths, offsets, match lengths: -1 before the first table
+    struct zstdFse fse[3][1 << 9];
+};
+
+struct unzstd {
+    const unsigned char *in;
+    size_t inlen;
+    struct zstdState st;
+    unsigned char lit[ZSTD_BLOCK_MAX];
+};
+
+static const uint32_t zstdLLBase[36] = {
+    0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 18, 20, 22, 24, 28, 32, 40, 48, 64, 128, 256, 512,
+    1024, 2048, 4096, 8192, 16384, 32768, 65536
+};
+
+static const uint8_t zstdLLBits[36] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 3, 3, 4, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16
+};
+
+static const uint32_t zstdMLBase[53] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31, 32,
+    33, 34, 35, 37, 39, 41, 43, 47, 51, 59, 67, 83, 99, 131, 259, 515, 1027, 2051, 4099, 8195, 16387, 32771, 65539
+};
+
+static const uint8_t zstdMLBits[53] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2,
+    3, 3, 4, 4, 5, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16
+};
+
+// Predefined distributions, for literal lengths, offsets and match lengths
+static const int16_t zstdLLDefault[36] = {
+    4, 3, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 1, 1, 1, 2, 2, 2, 2, 2, 2, 2, 2, 2, 3, 2, 1, 1, 1, 1, 1, -1, -1, -1, -1
+};
+
+static const int16_t zstdOFDefault[29] = {
+    1, 1, 1, 1, 1, 1, 2, 2, 2, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, -1, -1, -1, -1, -1
+};
+
+static const int16_t zstdMLDefault[53] = {
+    1, 4, 3, 2, 2, 2, 2, 2, 2, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, -1, -1, -1, -1, -1, -1, -1
+};
+
+static int zstdHighBit(uint32_t v) {
+    return 31 - __builtin_clz(v);
+}
+
+static uint64_t zstdLE(const unsigned char *p, int n) {
+    uint64_t v = 0;
+
+    for (int i = 0; i < n; i++) { v |= (uint64_t) p[i] << (8 * i); }
+
+    return v;
+}
+
+/*
+Bit streams
+
+Huffman and FSE data is read backwards, from the end of a stream whose last
+byte is marked with a 1 bit above the first bits to read. Reads are taken off
+the top; bits before the start of the stream read as zeros, and pos going
+negative is how overruns are noticed.
+*/
+
+struct zstdBits {
+    const unsigned char *s;
+    size_t n;
+    int64_t pos;  // Bits left
+};
+
+static int zstdBitsInit(struct zstdBits *b, const unsigned char *s, size_t n) {
+    if (n == 0 || s[n - 1] == 0) { return -1; }
+
+    b->s = s;
+    b->n = n;
+    b->pos = (int64_t) n * 8 - 8 + zstdHighBit(s[n - 1]);
+
+    return 0;
+}
+
+// The n bits (up to 32) below bit p
+static uint32_t zstdPeekAt(const struct zstdBits *b, int64_t p, int n) {
+    if (n == 0) { return 0; }
+
+    if (p < 0) {
+        if (p + n <= 0) { return 0; }
+
+        return zstdPeekAt(b, 0, p + n) << -p;
+    }
+
+    size_t byte = p >> 3;
+    uint64_t v;
+
+    if (byte + 8 <= b->n) {
+        v = zstdLE(b->s + byte, 8);
+    } else {
+        v = zstdLE(b->s + byte, b->n - byte);
+    }
+
+    return (v >> (p & 7)) & ((1ULL << n) - 1);
+}
+
+static uint32_t zstdRead(struct zstdBits *b, int n) {
+    b->pos -= n;
+    return zstdPeekAt(b, b->pos, n);
+}
+
+/*
+FSE tables
+*/
+
+// The k bits at bitpos in a forward stream
+static uint32_t zstdFwd(const unsigned char *p, size_t n, uint64_t bitpos, int k) {
+    size_t byte = bitpos / 8;
+
+    if (byte >= n) { return 0; }
+
+    return (zstdLE(p + byte, (n - byte < 8) ? n - byte : 8) >> (bitpos & 7)) & ((1u << k) - 1);
+}
+
+// Reads a table description. Returns the bytes it took, or -1.
+static int zstdReadCounts(const unsigned char *p, size_t n, int16_t *norm, int maxsym, int *log) {
+    uint64_t bitpos = 0;
+    int sym = 0;
+    int al = zstdFwd(p, n, bitpos, 4) + 5;
+
+    bitpos += 4;
+
+    int remaining = (1 << al) + 1, threshold = 1 << al, nbits = al + 1;
+
+    *log = al;
+
+    while (remaining > 1 && sym <= maxsym) {
+        int max = (2 * threshold - 1) - remaining;
+        int count = zstdFwd(p, n, bitpos, nbits);
+
+        if ((count & (threshold - 1)) < max) {
+            count &= threshold - 1;
+            bitpos += nbits - 1;
+        } else {
+            if (count >= threshold) { count -= max; }
+
+            bitpos += nbits;
+        }
+
+        count--;
+        remaining -= (count < 0) ? -count : count;
+        norm[sym++] = count;
+
+        if (count == 0) {
+            // A run of zeros follows, in 2 bit counts of up to 3
+            while (1) {
+                int rep = zstdFwd(p, n, bitpos, 2);
+
+                bitpos += 2;
+
+                for (int i = 0; i < rep && sym <= maxsym; i++) { norm[sym++] = 0; }
+
+                if (rep != 3) { break; }
+            }
+        }
+
+        while (remaining < threshold) {
+            nbits--;
+            threshold >>= 1;
+        }
+    }
+
+    if (remaining != 1 || (bitpos + 7) / 8 > n) { return -1; }
+
+    while (sym <= maxsym) { norm[sym++] = 0; }
+
+    return (bitpos + 7) / 8;
+}
+
+static int zstdBuildFse(struct zstdFse *t, const int16_t *norm, int nsym, int log) {
+    int size = 1 << log, high = size - 1;
+    uint16_t next[256];
+
+    for (int s = 0; s < nsym; s++) {
+        if (norm[s] == -1) {
+            t[high--].symbol = s;
+            next[s] = 1;
+        } else {
+            next[s] = norm[s];
+        }
+    }
+
+    int pos = 0, step = (size >> 1) + (size >> 3) + 3;
+
+    for (int s = 0; s < nsym; s++) {
+        for (int i = 0; i < norm[s]; i++) {
+            t[pos].symbol = s;
+
+            do { pos = (pos + step) & (size - 1); } while (pos > high);
+        }
+    }
+
+    if (pos != 0) { return -1; }
+
+    for (int i = 0; i < size; i++) {
+        int x = next[t[i].symbol]++;
+
+        t[i].nbits = log - zstdHighBit(x);
+        t[i].base = (x << t[i].nbits) - size;
+    }
+
+    return 0;
+}
+
+/*
+Literals
+*/
+
+static int zstdReadHuffman(struct unzstd *z, const unsigned char *p, size_t n) {
+    uint8_t weights[256];
+    int nw = 0;
+
+    if (n == 0) { return -1; }
+
+    int hb = p[0];
+    int used;
+
+    if (hb >= 128) {
+        nw = hb - 127;
+        used = 1 + (nw + 1) / 2;
+
+        if ((size_t) used > n) { return -1; }
+
+        for (int i = 0; i < nw; i++) { weights[i] = (i & 1) ? p[1 + i / 2] & 15 : p[1 + i / 2] >> 4; }
+    } else {
+        // FSE coded, by two states taking turns on one stream
+        int16_t norm[256];
+        struct zstdFse t[1 << 6];
+        struct zstdBits b;
+        int log;
+
+        used = 1 + hb;
+
+        if ((size_t) used > n) { return -1; }
+
+        int hdr = zstdReadCounts(p + 1, hb, norm, 255, &log);
+
+        if (hdr == -1 || log > 6 || zstdBuildFse(t, norm, 256, log) == -1) { return -1; }
+        if (zstdBitsInit(&b, p + 1 + hdr, hb - hdr) == -1) { return -1; }
+
+        int s1 = zstdRead(&b, log), s2 = zstdRead(&b, log);
+
+        while (nw < 254) {
+            weights[nw++] = t[s1].symbol;
+            s1 = t[s1].base + zstdRead(&b, t[s1].nbits);
+
+            if (b.pos < 0) {
+                weights[nw++] = t[s2].symbol;
+                break;
+            }
+
+            weights[nw++] = t[s2].symbol;
+            s2 = t[s2].base + zstdRead(&b, t[s2].nbits);
+
+            if (b.pos < 0) {
+                weights[nw++] = t[s1].symbol;
+                break;
+            }
+        }
+    }
+
+    // The last symbol's weight is what makes the total a power of 2
+    uint32_t total = 0;
+
+    for (int i = 0; i < nw; i++) {
+        if (weights[i] > ZSTD_HUF_BITS) { return -1; }
+        if (weights[i]) { total += 1 << (weights[i] - 1); }
+    }
+
+    if (total == 0 || nw >= 256) { return -1; }
+
+    int bits = zstdHighBit(total) + 1;
+    uint32_t rest = (1u << bits) - total;
+
+    if (bits > ZSTD_HUF_BITS || (rest & (rest - 1))) { return -1; }
+
+    weights[nw++] = zstdHighBit(rest) + 1;
+
+    // Codes go to symbols by weight, lightest first, each taking 2^(weight-1) entries
+    int at = 0;
+
+    for (int w = 1; w <= bits; w++) {
+        for (int s = 0; s < nw; s++) {
+            if (weights[s] != w) { continue; }
+
+            int len = bits + 1 - w;
+
+            for (int i = 0; i < (1 << (w - 1)); i++) { z->st.huf[at++] = (s << 8) | len; }
+        }
+    }
+
+    z->st.huf_bits = bits;
+
+    return used;
+}
+
+static int zstdHuffStream(struct unzstd *z, const unsigned char *p, size_t n, unsigned char *dst, size_t count) {
+    struct zstdBits b;
+    int bits = z->st.huf_bits;
+
+    if (zstdBitsInit(&b, p, n) == -1) { return -1; }
+
+    for (size_t i = 0; i < count; i++) {
+        uint16_t e = z->st.huf[zstdPeekAt(&b, b.pos - bits, bits)];
+
+        dst[i] = e >> 8;
+        b.pos -= e & 255;
+    }
+
+    return (b.pos == 0) ? 0 : -1;
+}
+
+// Decodes the literals section into z->lit. Returns the bytes it took, or -1.
+static int zstdLiterals(struct unzstd *z, const unsigned char *p, size_t n, size_t *nlit) {
+    if (n == 0) { return -1; }
+
+    int type = p[0] & 3, format = (p[0] >> 2) & 3;
+    size_t regen, csize, hdr;
+
+    if (type < 2) {
+        hdr = (format == 1) ? 2 : (format == 3) ? 3 : 1;
+
+        if (hdr > n) { return -1; }
+
+        regen = (hdr == 1) ? p[0] >> 3 : zstdLE(p, hdr) >> 4;
+
+        if (regen > ZSTD_BLOCK_MAX) { return -1; }
+
+        *nlit = regen;
+
+        if (type == 1) {
+            if (hdr + 1 > n) { return -1; }
+
+            memset(z->lit, p[hdr], regen);
+            return hdr + 1;
+        }
+
+        if (hdr + regen > n) { return -1; }
+
+        memcpy(z->lit, p + hdr, regen);
+        return hdr + regen;
+    }
+
+    int streams = (format == 0) ? 1 : 4;
+    int sbits = (format < 2) ? 10 : (format == 2) ? 14 : 18;
+
+    hdr = (format < 2) ? 3 : (format == 2) ? 4 : 5;
+
+    if (hdr > n) { return -1; }
+
+    uint64_t v = zstdLE(p, hdr);
+
+    regen = (v >> 4) & ((1u << sbits) - 1);
+    csize = (v >> (4 + sbits)) & ((1u << sbits) - 1);
+
+    if (regen > ZSTD_BLOCK_MAX || hdr + csize > n) { return -1; }
+
+    const unsigned char *s = p + hdr;
+    size_t left = csize;
+
+    if (type == 2) {
+        int used = zstdReadHuffman(z, s, left);
+
+        if (used == -1) { return -1; }
+
+        s += used;
+        left -= used;
+    } else if (z->st.huf_bits == 0) {
+        return -1;
+    }
+
+    *nlit = regen;
+
+    if (streams == 1) {
+        if (zstdHuffStream(z, s, left, z->lit, regen) == -1) { return -1; }
+
+        return hdr + csize;
+    }
+
+    if (left < 6) { return -1; }
+
+    size_t seg = (regen + 3) / 4, sizes[4], off = 6;
+
+    sizes[0] = zstdLE(s, 2);
+    sizes[1] = zstdLE(s + 2, 2);
+    sizes[2] = zstdLE(s + 4, 2);
+
+    if (sizes[0] + sizes[1] + sizes[2] + 6 > left || 3 * seg > regen) { return -1; }
+
+    sizes[3] = left - 6 - sizes[0] - sizes[1] - sizes[2];
+
+    for (int i = 0; i < 4; i++) {
+        size_t count = (i < 3) ? seg : regen - 3 * seg;
+
+        if (zstdHuffStream(z, s + off, sizes[i], z->lit + i * seg, count) == -1) { return -1; }
+
+        off += sizes[i];
+    }
+
+    return hdr + csize;
+}
+
+/*
+Sequences
+*/
+
+// Sets up the table for one kind of code (0: literal lengths, 1: offsets, 2: match lengths)
+static int zstdSeqTable(struct unzstd *z, int kind, int mode, const unsigned char *p, size_t n) {
+    static const int16_t *defaults[3] = {zstdLLDefault, zstdOFDefault, zstdMLDefault};
+    static const int deflog[3] = {6, 5, 6}, maxlog[3] = {9, 8, 9}, maxsym[3] = {35, 31, 52};
+    int16_t norm[64];
+    int log;
+
+    switch (mode) {
+        case 0:
+            {
+                int nsym = (kind == 0) ? 36 : (kind == 1) ? 29 : 53;
+
+                z->st.fse_log[kind] = deflog[kind];
+                return (zstdBuildFse(z->st.fse[kind], defaults[kind], nsym, deflog[kind]) == -1) ? -1 : 0;
+            }
+        case 1:
+            if (n < 1 || p[0] > maxsym[kind]) { return -1; }
+
+            // One symbol, taking no bits
+            z->st.fse_log[kind] = 0;
+            z->st.fse[kind][0].symbol = p[0];
+            z->st.fse[kind][0].nbits = 0;
+            z->st.fse[kind][0].base = 0;
+            return 1;
+        case 2:
+            {
+                int used = zstdReadCounts(p, n, norm, maxsym[kind], &log);
+
+                if (used == -1 || log > maxlog[kind] || zstdBuildFse(z->st.fse[kind], norm, maxsym[kind] + 1, log) == -1) { return -1; }
+
+                z->st.fse_log[kind] = log;
+                return used;
+            }
+        default:
+            // The last block's table, which there has to be
+            return (z->st.fse_log[kind] < 0) ? -1 : 0;
+    }
+}
+
+static int zstdSequences(struct unzstd *z, const unsigned char *p, size_t n, size_t nlit, struct zipOut *out) {
+    const unsigned char *end = p + n;
+    size_t nseq;
+
+    if (n < 1) { return -1; }
+
+    if (p[0] < 128) {
+        nseq = p[0];
+        p += 1;
+    } else if (p[0] < 255) {
+        if (n < 2) { return -1; }
+
+        nseq = ((p[0] - 128) << 8) + p[1];
+        p += 2;
+    } else {
+        if (n < 3) { return -1; }
+
+        nseq = p[1] + (p[2] << 8) + 0x7f00;
+        p += 3;
+    }
+
+    size_t litpos = 0;
+
+    zipOutReserve(out, ZSTD_BLOCK_MAX);
+
+    if (nseq > 0) {
+        if (p >= end) { return -1; }
+
+        int modes = *p++;
+
+        if (modes & 3) { return -1; }
+
+        for (int kind = 0; kind < 3; kind++) {
+            int used = zstdSeqTable(z, kind, (modes >> (6 - 2 * kind)) & 3, p, end - p);
+
+            if (used == -1) { return -1; }
+
+            p += used;
+        }
+
+        struct zstdBits b;
+
+        if (zstdBitsInit(&b, p, end - p) == -1) { return -1; }
+
+        struct zstdFse *ll = z->st.fse[0], *of = z->st.fse[1], *ml = z->st.fse[2];
+        uint32_t sll = zstdRead(&b, z->st.fse_log[0]);
+        uint32_t sof = zstdRead(&b, z->st.fse_log[1]);
+        uint32_t sml = zstdRead(&b, z->st.fse_log[2]);
+        uint32_t *rep = z->st.rep;
+
+        for (size_t i = 0; i < nseq; i++) {
+            int ofc = of[sof].symbol, llc = ll[sll].symbol, mlc = ml[sml].symbol;
+
+            if (ofc > 31 || llc > 35 || mlc > 52) { return -1; }
+
+            uint32_t offval = (1u << ofc) + zstdRead(&b, ofc);
+            uint32_t mlen = zstdMLBase[mlc] + zstdRead(&b, zstdMLBits[mlc]);
+            uint32_t llen = zstdLLBase[llc] + zstdRead(&b, zstdLLBits[llc]);
+            uint32_t offset;
+
+            if (offval > 3) {
+                offset = offval - 3;
+                rep[2] = rep[1];
+                rep[1] = rep[0];
+                rep[0] = offset;
+            } else {
+                int idx = offval - 1 + (llen == 0);
+
+                if (idx == 0) {
+                    offset = rep[0];
+                } else {
+                    offset = (idx == 3) ? rep[0] - 1 : rep[idx];
+
+                    if (idx > 1) { rep[2] = rep[1]; }
+
+                    rep[1] = rep[0];
+                    rep[0] = offset;
+                }
+            }
+
+            if (i + 1 < nseq) {
+                sll = ll[sll].base + zstdRead(&b, ll[sll].nbits);
+                sml = ml[sml].base + zstdRead(&b, ml[sml].nbits);
+                sof = of[sof].base + zstdRead(&b, of[sof].nbits);
+            }
+
+            if (litpos + llen > nlit) { return -1; }
+
+            zipOutReserve(out, llen + mlen);
+            memcpy(out->buf + out->len, z->lit + litpos, llen);
+            out->len += llen;
+            litpos += llen;
+
+            if (offset == 0 || offset > out->len) { return -1; }
+
+            zipOutCopy(out, offset, mlen);
+        }
+
+        if (b.pos != 0) { return -1; }
+    }
+
+    zipOutReserve(out, nlit - litpos);
+    memcpy(out->buf + out->len, z->lit + litpos, nlit - litpos);
+    out->len += nlit - litpos;
+
+    return 0;
+}
+
+// Reads a frame header (skipping skippable frames). Returns 1 if there's a frame, 0 at the end, -1 if it's broken.
+static int zstdFrame(struct unzstd *z) {
+    const unsigned char *in = z->in;
+    size_t p = z->st.pos;
+
+    while (p + 8 <= z->inlen && (zstdLE(in + p, 4) & 0xfffffff0u) == 0x184d2a50u) { p += 8 + zstdLE(in + p + 4, 4); }
+
+    z->st.pos = p;
+
+    // Anything but another frame after the first is padding
+    if (p + 5 > z->inlen || zstdLE(in + p, 4) != ZSTD_MAGIC) { return (p > 0) ? 0 : -1; }
+
+    int desc = in[p + 4];
+    int fcs = desc >> 6, single = (desc >> 5) & 1, dict = desc & 3;
+    static const int dictSize[4] = {0, 1, 2, 4}, fcsSize[4] = {0, 2, 4, 8};
+    int fsize = (fcs == 0 && single) ? 1 : fcsSize[fcs];
+
+    if (desc & 8) { return -1; }
+
+    p += 5;
+
+    size_t need = p + !single + dictSize[dict] + fsize;
+
+    if (need > z->inlen) { return -1; }
+
+    if (!single) {
+        int exp = in[p] >> 3, mant = in[p] & 7;
+        uint64_t base = 1ULL << (10 + exp);
+
+        z->st.window = base + (base / 8) * mant;
+        p++;
+    }
+
+    if (dict && zstdLE(in + p, dictSize[dict]) != 0) { return -1; }
+
+    p += dictSize[dict];
+
+    if (single) { z->st.window = zstdLE(in + p, fsize) + ((fsize == 2) ? 256 : 0); }
+
+    p += fsize;
+
+    z->st.pos = p;
+    z->st.frame_start = z->st.out_total;
+    z->st.checksum = (desc >> 2) & 1;
+    z->st.rep[0] = 1;
+    z->st.rep[1] = 4;
+    z->st.rep[2] = 8;
+    z->st.huf_bits = 0;
+
+    for (int k = 0; k < 3; k++) { z->st.fse_log[k] = -1; }
+
+    return 1;
+}
+
+void unzstdInit(struct unzstd *z, const unsigned char *in, size_t inlen) {
+    memset(&z->st, 0, sizeof(z->st));
+    z->in = in;
+    z->inlen = inlen;
+    z->st.stage = ZSTD_FRAME;
+}
+
+void unzstdResume(struct unzstd *z, const struct zstdState *st) {
+    z->st = *st;
+}
+
+// Decodes the next block (or frame header) onto out. Returns 1 if there's more, 0 at the end and -1 if the data is broken.
+int unzstdStep(struct unzstd *z, struct zipOut *out) {
+    size_t before = out->len;
+    int ret = 1;
+
+    if (z->st.stage == ZSTD_FRAME) {
+        ret = zstdFrame(z);
+
+        if (ret == 1) {
+            z->st.stage = ZSTD_BLOCKS;
+        } else if (ret == 0) {
+            z->st.stage = ZSTD_END;
+        }
+
+        return ret;
+    }
+
+    if (z->st.stage != ZSTD_BLOCKS) { return 0; }
+
+    size_t p = z->st.pos;
+
+    if (p + 3 > z->inlen) { return -1; }
+
+    uint32_t bh = zstdLE(z->in + p, 3);
+    int last = bh & 1, type = (bh >> 1) & 3;
+    size_t size = bh >> 3;
+    size_t csize = (type == 1) ? 1 : size;
+
+    p += 3;
+
+    if (p + csize > z->inlen || size > ZSTD_BLOCK_MAX) { return -1; }
+
+    if (type == 0) {
+        zipOutReserve(out, size);
+        memcpy(out->buf + out->len, z->in + p, size);
+        out->len += size;
+    } else if (type == 1) {
+        zipOutReserve(out, size);
+        memset(out->buf + out->len, z->in[p], size);
+        out->len += size;
+    } else if (type == 2) {
+        size_t nlit;
+        int used = zstdLiterals(z, z->in + p, size, &nlit);
+
+        if (used == -1 || zstdSequences(z, z->in + p + used, size - used, nlit, out) == -1) { ret = -1; }
+    } else {
+        ret = -1;
+    }
+
+    p += csize;
+
+    if (last && ret == 1) {
+        p += z->st.checksum ? 4 : 0;
+        z->st.stage = ZSTD_FRAME;
+    }
+
+    z->st.pos = p;
+    z->st.out_total += out->len - before;
+
+    return ret;
+}
@@ -0,0 +1,149 @@
+/*
+UTF-8 decoding and display widths
+
+Invalid or truncated sequences decode as U+FFFD one byte at a time, so any
+byte string can be walked safely.
+*/
+
+#define UTF8_REPLACEMENT 0xFFFD
+
+// Decodes the code point at s. Returns the number of bytes it uses (>= 1).
+int utf8Decode(const char *s, int len, int *cp) {
+    const unsigned char *u = (const unsigned char *) s;
+    int n;
+
+    if (u[0] < 0x80) {
+        *cp = u[0];
+        return 1;
+    } else if ((u[0] & 0xe0) == 0xc0) {
+        n = 2;
+        *cp = u[0] & 0x1f;
+    } else if ((u[0] & 0xf0) == 0xe0) {
+        n = 3;
+        *cp = u[0] & 0x0f;
+    } else if ((u[0] & 0xf8) == 0xf0) {
+        n = 4;
+        *cp = u[0] & 0x07;
+    } else {
+        *cp = UTF8_REPLACEMENT;
+        return 1;
+    }
+
+    if (n > len) {
+        *cp = UTF8_REPLACEMENT;
+        return 1;
+    }
+
+    for (int i = 1; i < n; i++) {
+        if ((u[i] & 0xc0) != 0x80) {
+            *cp = UTF8_REPLACEMENT;
+            return 1;
+        }
+
+        *cp = (*cp << 6) | (u[i] & 0x3f);
+    }
+
+    return n;
+}
+
+struct utf8Range {
+    int first;
+    int last;
+};
+
+// Zero width: combining marks, joiners and variation selectors
+static const struct utf8Range utf8ZeroWidth[] = {
+    {0x0300, 0x036f}, {0x0483, 0x0489}, {0x0591, 0x05bd}, {0x0610, 0x061a},
+    {0x064b, 0x065f}, {0x0670, 0x0670}, {0x06d6, 0x06dc}, {0x0e31, 0x0e31},
+    {0x0e34, 0x0e3a}, {0x0e47, 0x0e4e}, {0x1ab0, 0x1aff}, {0x1dc0, 0x1dff},
+    {0x200b, 0x200f}, {0x20d0, 0x20ff}, {0xfe00, 0xfe0f}, {0xfe20, 0xfe2f},
+    {0xe0100, 0xe01ef}
+};
+
+// Double width: East Asian wide/fullwidth and emoji
+static const struct utf8Range utf8Wide[] = {
+    {0x1100, 0x115f}, {0x231a, 0x231b}, {0x2329, 0x232a}, {0x23e9, 0x23ec},
+    {0x25fd, 0x25fe}, {0x2614, 0x2615}, {0x2648, 0x2653}, {0x26aa, 0x26ab},
+    {0x26bd, 0x26be}, {0x26c4, 0x26c5}, {0x26f2, 0x26f5}, {0x2705, 0x2705},
+    {0x270a, 0x270b}, {0x2753, 0x2755}, {0x2795, 0x2797}, {0x2e80, 0x303e},
+    {0x3041, 0x33ff}, {0x3400, 0x4dbf}, {0x4e00, 0x9fff}, {0xa000, 0xa4cf},
+    {0xa960, 0xa97f}, {0xac00, 0xd7a3}, {0xf900, 0xfaff}, {0xfe10, 0xfe19},
+    {0xfe30, 0xfe6f}, {0xff00, 0xff60}, {0xffe0, 0xffe6}, {0x16fe0, 0x18aff},
+    {0x1b000, 0x1b2ff}, {0x1f004, 0x1f004}, {0x1f0cf, 0x1f0cf}, {0x1f18e, 0x1f18e},
+    {0x1f191, 0x1f19a}, {0x1f200, 0x1f251}, {0x1f300, 0x1f64f}, {0x1f680, 0x1f6ff},
+    {0x1f7e0, 0x1f7eb}, {0x1f90c, 0x1f9ff}, {0x1fa70, 0x1faff}, {0x20000, 0x2fffd},
+    {0x30000, 0x3fffd}
+};
+
+static int utf8InRanges(int cp, const struct utf8Range *r, int n) {
+    int lo = 0, hi = n - 1;
+
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+
+        if (cp < r[mid].first) {
+            hi = mid - 1;
+        } else if (cp > r[mid].last) {
+            lo = mid + 1;
+        } else {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+// Number of terminal columns a code point takes (0, 1 or 2)
+int utf8Width(int cp) {
+    if (cp < 0x300) { return 1; }
+
+    if (utf8InRanges(cp, utf8ZeroWidth, sizeof(utf8ZeroWidth) / sizeof(utf8ZeroWidth[0]))) { return 0; }
+    if (utf8InRanges(cp, utf8Wide, sizeof(utf8Wide) / sizeof(utf8Wide[0]))) { return 2; }
+
+    return 1;
+}
+
+static int utf8IsCont(char c) {
+    return ((unsigned char) c & 0xc0) == 0x80;
+}
+
+// Start of the character (code point plus trailing zero width marks) after pos
+int utf8Next(const char *s, int len, int pos) {
+    int cp;
+
+    if (pos >= len) { return len; }
+
+    pos += utf8Decode(&s[pos], len - pos, &cp);
+
+    while (pos < len) {
+        int n = utf8Decode(&s[pos], len - pos, &cp);
+
+        if (utf8Width(cp) != 0) { break; }
+
+        pos += n;
+    }
+
+    return pos;
+}
+
+// Start of the character that ends at pos
+int utf8Prev(const char *s, int len, int pos) {
+    while (pos > 0) {
+        int start = pos - 1;
+        int cp;
+
+        while (start > 0 && utf8IsCont(s[start]) && pos - start < 4) { start--; }
+
+        // Stray continuation bytes decode one at a time
+        if (utf8Decode(&s[start], len - start, &cp) != pos - start) {
+            start = pos - 1;
+            cp = UTF8_REPLACEMENT;
+        }
+
+        pos = start;
+
+        if (utf8Width(cp) != 0 || (unsigned char) s[start] < 0x80) { break; }
+    }
+
+    return pos;
+}
@@ -0,0 +1,354 @@
+/*
+Word index
+
+Identifiers outside strings, comments and numbers are counted in a hash
+table, and each row keeps the ids of the words it holds, so an edit takes
+back the row's old words before adding its new ones. Completion looks words
+up by prefix in a table sorted by their text: new words go on an unsorted
+tail first, which is merged in once it grows past WORDS_TAIL (or by
+wordsSettle() when there's time), so a lookup is a binary search and a short
+scan. Words no row holds any more are kept until they outnumber the live
+ones, then their slots are reused.
+*/
+
+#define WORDS_MIN_LEN 3    // Shorter words aren't worth completing
+#define WORDS_MAX_LEN 64
+#define WORDS_TAIL 64      // New words looked through unsorted before they're merged in
+#define WORDS_COLLECT 1024 // Dead words kept regardless
+
+struct wordEntry {
+    char *s;        // NULL: a free slot
+    int len;
+    uint32_t hash;
+    int count;      // Occurrences in indexed rows (0: dead)
+};
+
+struct wordIndex {
+    struct wordEntry *words;
+    int nwords, capwords;
+    int *free_ids;
+    int nfree;
+    int *table;     // Open addressing on hash, ids + 1 (0 is empty)
+    int tsize;      // Power of 2, at most half full
+    int *sorted;    // Ids by text
+    int nsorted;
+    int *tail;      // Ids added since the last merge
+    int ntail, captail;
+    int nlive, ndead;
+    size_t text;    // Bytes of word text
+    size_t lists;   // Bytes of the rows' id lists
+};
+
+// Id list of an indexed row without words
+static uint32_t wordsNone[1] = {0};
+
+int wordsChar(unsigned char c) {
+    return isalnum(c) || c == '_' || c >= 0x80;
+}
+
+static uint32_t wordsHash(const char *s, int len) {
+    uint32_t h = 2166136261u;
+
+    for (int i = 0; i < len; i++) { h = (h ^ (unsigned char) s[i]) * 16777619u; }
+
+    return h;
+}
+
+static int wordsFind(const struct wordIndex *w, const char *s, int len, uint32_t hash) {
+    if (w->tsize == 0) { return -1; }
+
+    for (int slot = hash & (w->tsize - 1);; slot = (slot + 1) & (w->tsize - 1)) {
+        int id = w->table[slot] - 1;
+
+        if (id < 0) { return -1; }
+
+        const struct wordEntry *e = &w->words[id];
+
+        if (e->hash == hash && e->len == len && !memcmp(e->s, s, len)) { return id; }
+    }
+}
+
+static void wordsTableAdd(struct wordIndex *w, int id) {
+    int slot = w->words[id].hash & (w->tsize - 1);
+
+    while (w->table[slot]) { slot = (slot + 1) & (w->tsize - 1); }
+
+    w->table[slot] = id + 1;
+}
+
+// Builds the table again with room for n words
+static void wordsRehash(struct wordIndex *w, int n) {
+    int size = 1024;
+
+    while (size < n * 2) { size *= 2; }
+
+    free(w->table);
+    w->table = calloc(size, sizeof(int));
+    w->tsize = size;
+
+    for (int id = 0; id < w->nwords; id++) {
+        if (w->words[id].s) { wordsTableAdd(w, id); }
+    }
+}
+
+static int wordsIntern(struct wordIndex *w, const char *s, int len) {
+    uint32_t hash = wordsHash(s, len);
+    int id = wordsFind(w, s, len, hash);
+
+    if (id >= 0) {
+        if (w->words[id].count++ == 0) {
+            w->ndead--;
+            w->nlive++;
+        }
+
+        return id;
+    }
+
+    if ((w->nlive + w->ndead + 1) * 2 > w->tsize) { wordsRehash(w, w->nlive + w->ndead + 1); }
+
+    if (w->nfree) {
+        id = w->free_ids[--w->nfree];
+    } else {
+        if (w->nwords == w->capwords) {
+            w->capwords = w->capwords ? w->capwords * 2 : 1024;
+            w->words = realloc(w->words, sizeof(struct wordEntry) * w->capwords);
+            w->free_ids = realloc(w->free_ids, sizeof(int) * w->capwords);
+        }
+
+        id = w->nwords++;
+    }
+
+    struct wordEntry *e = &w->words[id];
+
+    e->s = malloc(len);
+    memcpy(e->s, s, len);
+    e->len = len;
+    e->hash = hash;
+    e->count = 1;
+    w->text += len;
+    w->nlive++;
+    wordsTableAdd(w, id);
+
+    if (w->ntail == w->captail) {
+        w->captail = w->captail ? w->captail * 2 : WORDS_TAIL * 2;
+        w->tail = realloc(w->tail, sizeof(int) * w->captail);
+    }
+
+    w->tail[w->ntail++] = id;
+
+    return id;
+}
+
+/*
+Counts the words of a line (hl, if given, is its highlighting, to skip
+strings, comments and numbers). Returns the ids it holds for
+wordsDropLine(): a count, then the ids.
+*/
+uint32_t *wordsAddLine(struct wordIndex *w, const char *s, const unsigned char *hl, int len) {
+    uint32_t *ids = NULL;
+    int n = 0, cap = 0;
+
+    for (int i = 0; i < len;) {
+        if (!wordsChar(s[i])) {
+            i++;
+            continue;
+        }
+
+        int start = i;
+
+        while (i < len && wordsChar(s[i])) { i++; }
+
+        if (i - start < WORDS_MIN_LEN || i - start > WORDS_MAX_LEN || isdigit((unsigned char) s[start])) { continue; }
+
+        if (hl && (hl[start] == SYNTAX_HL_STR || hl[start] == SYNTAX_HL_COMMENT ||
+                   hl[start] == SYNTAX_HL_MULTI_COMMENT || hl[start] == SYNTAX_HL_NUM)) { continue; }
+
+        if (n + 1 >= cap) {
+            cap = cap ? cap * 2 : 8;
+            ids = realloc(ids, sizeof(uint32_t) * cap);
+        }
+
+        ids[++n] = wordsIntern(w, s + start, i - start);
+    }
+
+    if (n == 0) { return wordsNone; }
+
+    ids = realloc(ids, sizeof(uint32_t) * (n + 1));
+    ids[0] = n;
+    w->lists += sizeof(uint32_t) * (n + 1);
+
+    return ids;
+}
+
+// Takes back the words of a line added by wordsAddLine()
+void wordsDropLine(struct wordIndex *w, uint32_t *ids) {
+    if (ids == NULL || ids == wordsNone) { return; }
+
+    for (uint32_t k = 1; k <= ids[0]; k++) {
+        if (--w->words[ids[k]].count == 0) {
+            w->nlive--;
+            w->ndead++;
+        }
+    }
+
+    w->lists -= sizeof(uint32_t) * (ids[0] + 1);
+    free(ids);
+}
+
+static int wordsCompare(const struct wordEntry *a, const struct wordEntry *b) {
+    int c = memcmp(a->s, b->s, a->len < b->len ? a->len : b->len);
+
+    return c ? c : a->len - b->len;
+}
+
+static const struct wordIndex *wordsSorting;  // For wordsCompareIds, while sorting
+
+static int wordsCompareIds(const void *a, const void *b) {
+    return wordsCompare(&wordsSorting->words[*(const int *) a], &wordsSorting->words[*(const int *) b]);
+}
+
+// Sorts the tail into the sorted table
+static void wordsMerge(struct wordIndex *w) {
+    if (w->ntail == 0) { return; }
+
+    wordsSorting = w;
+    qsort(w->tail, w->ntail, sizeof(int), wordsCompareIds);
+
+    int *out = malloc(sizeof(int) * (w->nsorted + w->ntail));
+    int i = 0, j = 0, n = 0;
+
+    while (i < w->nsorted || j < w->ntail) {
+        if (j == w->ntail || (i < w->nsorted && wordsCompare(&w->words[w->sorted[i]], &w->words[w->tail[j]]) < 0)) {
+            out[n++] = w->sorted[i++];
+        } else {
+            out[n++] = w->tail[j++];
+        }
+    }
+
+    free(w->sorted);
+    w->sorted = out;
+    w->nsorted = n;
+    w->ntail = 0;
+}
+
+// Frees the slots of dead words once there are more of them than live ones
+static void wordsCollect(struct wordIndex *w) {
+    if (w->ndead < WORDS_COLLECT || w->ndead <= w->nlive) { return; }
+
+    for (int id = 0; id < w->nwords; id++) {
+        struct wordEntry *e = &w->words[id];
+
+        if (e->s && e->count == 0) {
+            w->text -= e->len;
+            free(e->s);
+            e->s = NULL;
+            w->free_ids[w->nfree++] = id;
+        }
+    }
+
+    int n = 0;
+
+    for (int k = 0; k < w->nsorted; k++) {
+        if (w->words[w->sorted[k]].s) { w->sorted[n++] = w->sorted[k]; }
+    }
+
+    w->nsorted = n;
+    n = 0;
+
+    for (int k = 0; k < w->ntail; k++) {
+        if (w->words[w->tail[k]].s) { w->tail[n++] = w->tail[k]; }
+    }
+
+    w->ntail = n;
+    w->ndead = 0;
+    wordsRehash(w, w->nlive);
+}
+
+// Tidies up when there's time: collects dead words and merges the tail. Returns 1 if there was anything to do.
+int wordsSettle(struct wordIndex *w) {
+    if (w->ntail == 0 && (w->ndead < WORDS_COLLECT || w->ndead <= w->nlive)) { return 0; }
+
+    wordsCollect(w);
+    wordsMerge(w);
+
+    return 1;
+}
+
+// Keeps the best max candidates in out (most used first, then by text)
+static void wordsConsider(struct wordIndex *w, int id, int *out, int *n, int max) {
+    const struct wordEntry *e = &w->words[id];
+    int at = *n;
+
+    while (at > 0) {
+        const struct wordEntry *o = &w->words[out[at - 1]];
+
+        if (o->count > e->count || (o->count == e->count && wordsCompare(o, e) < 0)) { break; }
+
+        at--;
+    }
+
+    if (at >= max) { return; }
+    if (*n < max) { (*n)++; }
+
+    memmove(&out[at + 1], &out[at], sizeof(int) * (*n - 1 - at));
+    out[at] = id;
+}
+
+// Words that start with prefix (and are longer), most used first. Returns how many (at most max) went in out.
+int wordsComplete(struct wordIndex *w, const char *prefix, int len, int *out, int max) {
+    int n = 0;
+
+    if (w->ntail > WORDS_TAIL) { wordsMerge(w); }
+
+    int lo = 0, hi = w->nsorted;
+
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        const struct wordEntry *e = &w->words[w->sorted[mid]];
+        int c = memcmp(e->s, prefix, e->len < len ? e->len : len);
+
+        if (c < 0 || (c == 0 && e->len < len)) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    for (int k = lo; k < w->nsorted; k++) {
+        const struct wordEntry *e = &w->words[w->sorted[k]];
+
+        if (e->len < len || memcmp(e->s, prefix, len)) { break; }
+        if (e->len > len && e->count > 0) { wordsConsider(w, w->sorted[k], out, &n, max); }
+    }
+
+    for (int k = 0; k < w->ntail; k++) {
+        const struct wordEntry *e = &w->words[w->tail[k]];
+
+        if (e->len > len && e->count > 0 && !memcmp(e->s, prefix, len)) { wordsConsider(w, w->tail[k], out, &n, max); }
+    }
+
+    return n;
+}
+
+const char *wordsText(const struct wordIndex *w, int id, int *len) {
+    *len = w->words[id].len;
+    return w->words[id].s;
+}
+
+// Bytes the index holds, including the rows' id lists
+size_t wordsHeap(const struct wordIndex *w) {
+    return sizeof(struct wordEntry) * w->capwords + sizeof(int) * (w->capwords + w->tsize + w->nsorted + w->captail) +
+        w->text + w->lists;
+}
+
+// Frees the index (the rows' id lists are freed with wordsDropLine() first, or along with the rows)
+void wordsFree(struct wordIndex *w) {
+    for (int id = 0; id < w->nwords; id++) { free(w->words[id].s); }
+
+    free(w->words);
+    free(w->free_ids);
+    free(w->table);
+    free(w->sorted);
+    free(w->tail);
+    memset(w, 0, sizeof(*w));
+}
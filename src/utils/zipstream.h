@@ -0,0 +1,679 @@
+/*
+Compressed files
+
+gzip and zstd files (told apart by their magic bytes, not their names) are
+decompressed on a background thread with inflate.h or unzstd.h. The output
+is handed over in chunks of whole lines, about ZIP_CHUNK bytes at a time and
+already split into lines, so the editor can show the start of the file while
+the rest is still being decompressed. Every ZIP_SPAN bytes of output or so
+(more for zstd frames with big windows) the decoder's state and the window
+of output before it are kept as a checkpoint, so zipStreamRead() can
+decompress any part of the file again from the checkpoint before it.
+
+Once it's done, zipIndexSave() writes the checkpoints and the length of
+every line to ~/.rem/cache, next to the line caches of linecache.h:
+
+    struct zipIndexHeader
+    path                  path_len bytes
+    checkpoints           each a struct zipCheckpointRecord, the decoder's
+                          state and the LZ compressed window
+    rows                  line lengths, as varints like a line cache's
+
+zipIndexLoad() turns that back into chunks without text, so opening the
+file again doesn't decompress anything but what's read. Like line caches,
+an index is only used while the file's size, mtime and fingerprint match.
+*/
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define ZIP_CHUNK (1 << 20)        // Bytes of lines handed over at a time
+#define ZIP_SPAN (4 << 20)         // Output between checkpoints (at least 8 windows' worth)
+#define ZIP_WINDOW_MAX (16 << 20)  // Bigger zstd windows only get checkpoints between frames
+#define ZIP_INDEX_MAGIC "REMZIX1"
+
+enum zipKind {
+    ZIP_NONE,
+    ZIP_GZIP,
+    ZIP_ZSTD
+};
+
+union zipState {
+    struct inflateState gz;
+    struct zstdState zs;
+};
+
+struct zipDecoder {
+    int kind;
+    union {
+        struct inflater gz;
+        struct unzstd zs;
+    } u;
+};
+
+// A line in a chunk, without its line ending
+struct zipLine {
+    int off;
+    int size;
+};
+
+struct zipChunk {
+    char *text;      // NULL in chunks from an index (read with zipStreamRead())
+    int len;
+    uint64_t off;    // Where it starts in the decompressed file
+    struct zipLine *lines;
+    int nlines;
+};
+
+struct zipCheckpoint {
+    uint64_t off;    // Output the decode can go on from
+    union zipState state;
+    int wlen;        // Output before off matches may copy from
+    int zlen;
+    char *window;    // The window, LZ compressed
+};
+
+struct zipStream {
+    unsigned char *in;       // The mapped file, unmapped by zipStreamFree()
+    size_t inlen;
+    int kind;
+    pthread_t thread;
+    int threaded;
+    pthread_mutex_t lock;    // Guards chunks and checkpoints
+    struct zipChunk *chunks; // Not taken yet
+    int nchunks, capchunks;
+    struct zipCheckpoint *cps;
+    int ncps, capcps;
+    unsigned char *rows;     // Line lengths for the index; these three are final once done
+    size_t rows_len, rows_cap;
+    uint64_t nrows, out_len;
+    int indexed;             // Read from an index rather than decompressed
+    size_t in_done;          // The rest are read and written atomically
+    int done;                // 1 once finished, -1 if the data is broken
+    int stop;                // Asks the thread to finish early
+};
+
+struct zipIndexHeader {
+    char magic[8];
+    uint64_t size;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint64_t fingerprint;
+    uint32_t kind;
+    uint32_t state_size;     // Only indexes written by the same build are read
+    uint64_t ncps;
+    uint64_t nrows;
+    uint64_t rows_bytes;
+    uint64_t out_len;
+    uint64_t path_len;
+};
+
+struct zipCheckpointRecord {
+    uint64_t off;
+    int32_t wlen;
+    int32_t zlen;
+};
+
+// What compression data starts with, if any
+int zipDetect(const unsigned char *p, size_t n) {
+    if (n >= 3 && p[0] == 0x1f && p[1] == 0x8b && p[2] == 8) { return ZIP_GZIP; }
+    if (n >= 4 && zstdLE(p, 4) == ZSTD_MAGIC) { return ZIP_ZSTD; }
+
+    return ZIP_NONE;
+}
+
+static size_t zipStateSize(int kind) {
+    return (kind == ZIP_GZIP) ? sizeof(struct inflateState) : sizeof(struct zstdState);
+}
+
+// Starts decoding from the top, or from a checkpoint's state
+static void zipDecoderInit(struct zipDecoder *d, int kind, const unsigned char *in, size_t inlen, const union zipState *st) {
+    d->kind = kind;
+
+    if (kind == ZIP_GZIP) {
+        inflateInit(&d->u.gz, in, inlen);
+
+        if (st) { inflateResume(&d->u.gz, &st->gz); }
+    } else {
+        unzstdInit(&d->u.zs, in, inlen);
+
+        if (st) { unzstdResume(&d->u.zs, &st->zs); }
+    }
+}
+
+static int zipDecoderStep(struct zipDecoder *d, struct zipOut *out) {
+    return (d->kind == ZIP_GZIP) ? inflateStep(&d->u.gz, out) : unzstdStep(&d->u.zs, out);
+}
+
+static void zipDecoderState(const struct zipDecoder *d, union zipState *st) {
+    memset(st, 0, sizeof(*st));
+
+    if (d->kind == ZIP_GZIP) {
+        st->gz = d->u.gz.st;
+    } else {
+        st->zs = d->u.zs.st;
+    }
+}
+
+// Output the next block may copy from
+static size_t zipDecoderWindow(const struct zipDecoder *d) {
+    if (d->kind == ZIP_GZIP) {
+        const struct inflateState *st = &d->u.gz.st;
+        uint64_t since = st->out_total - st->member_start;
+
+        return (st->stage != INFLATE_BLOCKS) ? 0 : (since < INFLATE_WINDOW) ? since : INFLATE_WINDOW;
+    }
+
+    const struct zstdState *st = &d->u.zs.st;
+    uint64_t since = st->out_total - st->frame_start;
+
+    return (st->stage != ZSTD_BLOCKS) ? 0 : (since < st->window) ? since : st->window;
+}
+
+static size_t zipDecoderInPos(const struct zipDecoder *d) {
+    return (d->kind == ZIP_GZIP) ? d->u.gz.st.bitpos / 8 : d->u.zs.st.pos;
+}
+
+/*
+Drops output from the front of out, as far as upto (an offset in the file,
+base being the offset of out->buf[0]) but keeping the last keep bytes. Only
+once that's a good deal, so the rest isn't moved down too often.
+*/
+static void zipOutTrim(struct zipOut *out, uint64_t *base, uint64_t upto, size_t keep) {
+    size_t drop = (upto > *base) ? upto - *base : 0;
+
+    if (drop > out->len) { drop = out->len; }
+    if (out->len - drop < keep) { drop = (out->len > keep) ? out->len - keep : 0; }
+
+    if (drop < ZIP_CHUNK || drop < keep) { return; }
+
+    memmove(out->buf, out->buf + drop, out->len - drop);
+    out->len -= drop;
+    *base += drop;
+}
+
+static void zipAddCheckpoint(struct zipStream *z, const struct zipDecoder *d, const struct zipOut *out, uint64_t off, size_t wlen) {
+    struct zipCheckpoint cp;
+
+    cp.off = off;
+    cp.wlen = wlen;
+    cp.zlen = 0;
+    cp.window = NULL;
+    zipDecoderState(d, &cp.state);
+
+    if (wlen) {
+        cp.window = malloc(LZ_BOUND(wlen));
+        cp.zlen = lzCompress((const char *) out->buf + out->len - wlen, wlen, cp.window);
+        cp.window = realloc(cp.window, cp.zlen);
+    }
+
+    pthread_mutex_lock(&z->lock);
+
+    if (z->ncps == z->capcps) {
+        z->capcps = z->capcps ? z->capcps * 2 : 16;
+        z->cps = realloc(z->cps, sizeof(struct zipCheckpoint) * z->capcps);
+    }
+
+    z->cps[z->ncps++] = cp;
+
+    pthread_mutex_unlock(&z->lock);
+}
+
+static void zipAddChunk(struct zipStream *z, struct zipChunk *c) {
+    pthread_mutex_lock(&z->lock);
+
+    if (z->nchunks == z->capchunks) {
+        z->capchunks = z->capchunks ? z->capchunks * 2 : 16;
+        z->chunks = realloc(z->chunks, sizeof(struct zipChunk) * z->capchunks);
+    }
+
+    z->chunks[z->nchunks++] = *c;
+
+    pthread_mutex_unlock(&z->lock);
+}
+
+// Hands over len bytes of whole lines at off, split into lines (recorded for the index too)
+static void zipEmit(struct zipStream *z, const unsigned char *text, size_t len, uint64_t off) {
+    struct zipChunk c;
+    int cap = 256;
+
+    c.text = malloc(len ? len : 1);
+    c.len = len;
+    c.off = off;
+    c.lines = malloc(sizeof(struct zipLine) * cap);
+    c.nlines = 0;
+    memcpy(c.text, text, len);
+
+    for (size_t start = 0; start < len; ) {
+        const char *nl = memchr(c.text + start, '\n', len - start);
+        size_t end = nl ? (size_t) (nl - c.text) : len;
+        size_t size = end;
+
+        while (size > start && c.text[size - 1] == '\r') { size--; }
+
+        if (c.nlines == cap) {
+            cap *= 2;
+            c.lines = realloc(c.lines, sizeof(struct zipLine) * cap);
+        }
+
+        c.lines[c.nlines].off = start;
+        c.lines[c.nlines++].size = size - start;
+
+        if (z->rows_cap - z->rows_len < 20) {
+            z->rows_cap = z->rows_cap ? z->rows_cap * 2 : 4096;
+            z->rows = realloc(z->rows, z->rows_cap);
+        }
+
+        size_t next = nl ? end + 1 : len;
+
+        z->rows_len += lineCachePutRow(z->rows + z->rows_len, size - start, next - size);
+        start = next;
+    }
+
+    z->nrows += c.nlines;
+    zipAddChunk(z, &c);
+}
+
+static size_t zipSpan(size_t window) {
+    return (window * 8 > ZIP_SPAN) ? window * 8 : ZIP_SPAN;
+}
+
+static void *zipRun(void *arg) {
+    struct zipStream *z = arg;
+    struct zipDecoder *d = malloc(sizeof(struct zipDecoder));
+    struct zipOut out = {NULL, 0, 0};
+    uint64_t base = 0;      // Offset of out.buf[0]
+    uint64_t emitted = 0;   // Output before this has been handed over
+    uint64_t line_end = 0;  // Just after the last line ending so far
+    uint64_t last_cp = 0;
+    int ret = 1;
+
+    zipDecoderInit(d, z->kind, z->in, z->inlen, NULL);
+    zipAddCheckpoint(z, d, &out, 0, 0);
+
+    while (!__atomic_load_n(&z->stop, __ATOMIC_RELAXED) && ret == 1) {
+        size_t before = out.len;
+
+        ret = zipDecoderStep(d, &out);
+
+        if (ret == -1) { break; }
+
+        // Only what's new needs looking at for line endings
+        const unsigned char *nl = (out.len > before) ? memrchr(out.buf + before, '\n', out.len - before) : NULL;
+        uint64_t total = base + out.len;
+        size_t window = zipDecoderWindow(d);
+
+        if (nl) { line_end = base + (nl - out.buf) + 1; }
+
+        if (line_end - emitted >= ZIP_CHUNK || (ret == 0 && total > emitted)) {
+            uint64_t end = (ret == 0) ? total : line_end;
+
+            zipEmit(z, out.buf + (emitted - base), end - emitted, emitted);
+            emitted = end;
+        }
+
+        if (ret == 1 && total - last_cp >= zipSpan(window) && window <= ZIP_WINDOW_MAX) {
+            zipAddCheckpoint(z, d, &out, total, window);
+            last_cp = total;
+        }
+
+        zipOutTrim(&out, &base, emitted, window);
+        __atomic_store_n(&z->in_done, zipDecoderInPos(d), __ATOMIC_RELAXED);
+    }
+
+    z->out_len = base + out.len;
+    free(out.buf);
+    free(d);
+
+    __atomic_store_n(&z->done, (ret == -1) ? -1 : 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+static struct zipStream *zipStreamNew(unsigned char *in, size_t inlen, int kind) {
+    struct zipStream *z = calloc(1, sizeof(struct zipStream));
+
+    z->in = in;
+    z->inlen = inlen;
+    z->kind = kind;
+    pthread_mutex_init(&z->lock, NULL);
+
+    return z;
+}
+
+// Starts decompressing a mapped file of the given kind, taking over the mapping
+struct zipStream *zipStreamStart(unsigned char *in, size_t inlen, int kind) {
+    struct zipStream *z = zipStreamNew(in, inlen, kind);
+
+    // Without a thread it's done before returning
+    z->threaded = (pthread_create(&z->thread, NULL, zipRun, z) == 0);
+
+    if (!z->threaded) { zipRun(z); }
+
+    return z;
+}
+
+// Waits for the thread to finish
+void zipStreamWait(struct zipStream *z) {
+    if (z->threaded) { pthread_join(z->thread, NULL); }
+
+    z->threaded = 0;
+}
+
+// 0 while running, 1 once done, -1 if the data turned out broken
+int zipStreamDone(struct zipStream *z) {
+    return __atomic_load_n(&z->done, __ATOMIC_ACQUIRE);
+}
+
+// How far through the compressed file it is, in percent
+int zipProgress(struct zipStream *z) {
+    size_t in = __atomic_load_n(&z->in_done, __ATOMIC_RELAXED);
+
+    return z->inlen ? (int) ((double) in * 100 / z->inlen) : 100;
+}
+
+// Takes the chunks handed over since the last call. The caller frees their lines and keeps their text.
+int zipTake(struct zipStream *z, struct zipChunk **chunks) {
+    pthread_mutex_lock(&z->lock);
+
+    int n = z->nchunks;
+
+    *chunks = z->chunks;
+    z->chunks = NULL;
+    z->nchunks = z->capchunks = 0;
+
+    pthread_mutex_unlock(&z->lock);
+
+    return n;
+}
+
+/*
+Decompresses len bytes at off in the decompressed file into dst, from the
+last checkpoint before them. Safe to call from any thread, and while the
+stream is still running (for output it already handed over). Returns 0, or
+-1 if the data is broken.
+*/
+int zipStreamRead(struct zipStream *z, uint64_t off, size_t len, char *dst) {
+    struct zipCheckpoint cp;
+
+    pthread_mutex_lock(&z->lock);
+
+    int lo = 0, hi = z->ncps - 1;
+
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+
+        if (z->cps[mid].off <= off) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+
+    cp = z->cps[lo];
+
+    pthread_mutex_unlock(&z->lock);
+
+    struct zipDecoder *d = malloc(sizeof(struct zipDecoder));
+    struct zipOut out = {NULL, 0, 0};
+    uint64_t base = cp.off - cp.wlen;
+    int ret = 1;
+
+    zipOutReserve(&out, cp.wlen);
+
+    if (cp.wlen && lzDecompress(cp.window, cp.zlen, (char *) out.buf, cp.wlen) != cp.wlen) { ret = -1; }
+
+    out.len = cp.wlen;
+    zipDecoderInit(d, z->kind, z->in, z->inlen, &cp.state);
+
+    while (ret == 1 && base + out.len < off + len) {
+        ret = zipDecoderStep(d, &out);
+        zipOutTrim(&out, &base, off, zipDecoderWindow(d));
+    }
+
+    if (ret != -1 && base + out.len >= off + len) {
+        memcpy(dst, out.buf + (off - base), len);
+        ret = 0;
+    } else {
+        ret = -1;
+    }
+
+    free(out.buf);
+    free(d);
+
+    return ret;
+}
+
+// Bytes the stream holds on the heap: checkpoints, line lengths and chunks not taken yet
+size_t zipHeap(struct zipStream *z) {
+    if (z == NULL) { return 0; }
+
+    pthread_mutex_lock(&z->lock);
+
+    size_t n = sizeof(struct zipStream) + sizeof(struct zipCheckpoint) * z->capcps + sizeof(struct zipChunk) * z->capchunks;
+
+    for (int i = 0; i < z->ncps; i++) { n += z->cps[i].zlen; }
+
+    for (int i = 0; i < z->nchunks; i++) { n += z->chunks[i].len + sizeof(struct zipLine) * z->chunks[i].nlines; }
+
+    pthread_mutex_unlock(&z->lock);
+
+    // The line lengths are the thread's until it's done
+    if (zipStreamDone(z)) { n += z->rows_cap; }
+
+    return n;
+}
+
+// Stops the thread if it's still running and frees the stream (and the mapping)
+void zipStreamFree(struct zipStream *z) {
+    if (z == NULL) { return; }
+
+    __atomic_store_n(&z->stop, 1, __ATOMIC_RELAXED);
+
+    if (z->threaded) { pthread_join(z->thread, NULL); }
+
+    for (int i = 0; i < z->nchunks; i++) {
+        free(z->chunks[i].text);
+        free(z->chunks[i].lines);
+    }
+
+    for (int i = 0; i < z->ncps; i++) { free(z->cps[i].window); }
+
+    free(z->chunks);
+    free(z->cps);
+    free(z->rows);
+
+    if (z->in) { munmap(z->in, z->inlen); }
+
+    pthread_mutex_destroy(&z->lock);
+    free(z);
+}
+
+// Writes the seek index for path (once the stream is done)
+int zipIndexSave(struct zipStream *z, const char *path, const struct stat *st, uint64_t fingerprint) {
+    char cpath[4096], tmp[4200];
+    char *abs = realpath(path, NULL);
+
+    if (zipStreamDone(z) != 1 || abs == NULL || lineCachePathExt(path, ".zix", cpath, sizeof(cpath)) == -1) {
+        free(abs);
+        return -1;
+    }
+
+    struct zipIndexHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, ZIP_INDEX_MAGIC, sizeof(h.magic));
+    h.size = st->st_size;
+    h.mtime_sec = st->st_mtim.tv_sec;
+    h.mtime_nsec = st->st_mtim.tv_nsec;
+    h.fingerprint = fingerprint;
+    h.kind = z->kind;
+    h.state_size = zipStateSize(z->kind);
+    h.ncps = z->ncps;
+    h.nrows = z->nrows;
+    h.rows_bytes = z->rows_len;
+    h.out_len = z->out_len;
+    h.path_len = strlen(abs);
+
+    snprintf(tmp, sizeof(tmp), "%s.%d", cpath, (int) getpid());
+
+    FILE *fp = fopen(tmp, "w");
+    int ok = fp != NULL;
+
+    if (ok) {
+        ok = fwrite(&h, sizeof(h), 1, fp) == 1 && fwrite(abs, 1, h.path_len, fp) == h.path_len;
+
+        for (int i = 0; ok && i < z->ncps; i++) {
+            struct zipCheckpointRecord r = {z->cps[i].off, z->cps[i].wlen, z->cps[i].zlen};
+
+            ok = fwrite(&r, sizeof(r), 1, fp) == 1 && fwrite(&z->cps[i].state, h.state_size, 1, fp) == 1 &&
+                 fwrite(z->cps[i].window, 1, r.zlen, fp) == (size_t) r.zlen;
+        }
+
+        ok = ok && fwrite(z->rows, 1, z->rows_len, fp) == z->rows_len;
+        ok = (fclose(fp) == 0) && ok;
+        ok = ok && rename(tmp, cpath) == 0;
+
+        if (!ok) { unlink(tmp); }
+    }
+
+    free(abs);
+
+    return ok ? 0 : -1;
+}
+
+/*
+Reads the seek index for path into a finished stream over the mapped file,
+its lines grouped into chunks without text. Returns NULL if there's no index
+or it no longer describes the file (the mapping is left alone then).
+*/
+struct zipStream *zipIndexLoad(const char *path, const struct stat *st, uint64_t fingerprint, unsigned char *in, size_t inlen, int kind) {
+    char cpath[4096];
+    struct lineCache c;
+    struct stat cst;
+
+    if (lineCachePathExt(path, ".zix", cpath, sizeof(cpath)) == -1) { return NULL; }
+
+    int fd = open(cpath, O_RDONLY);
+
+    if (fd == -1) { return NULL; }
+
+    if (fstat(fd, &cst) == -1 || (size_t) cst.st_size < sizeof(struct zipIndexHeader)) {
+        close(fd);
+        return NULL;
+    }
+
+    size_t maplen = cst.st_size;
+    const unsigned char *map = mmap(NULL, maplen, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    close(fd);
+
+    if (map == MAP_FAILED) { return NULL; }
+
+    const struct zipIndexHeader *h = (const struct zipIndexHeader *) map;
+    const unsigned char *p = map + sizeof(*h), *end = map + maplen;
+    char *abs = realpath(path, NULL);
+    int ok = abs && !memcmp(h->magic, ZIP_INDEX_MAGIC, sizeof(h->magic)) && h->size == (uint64_t) st->st_size &&
+             h->mtime_sec == (int64_t) st->st_mtim.tv_sec && h->mtime_nsec == (int64_t) st->st_mtim.tv_nsec &&
+             h->fingerprint == fingerprint && h->kind == (uint32_t) kind && h->state_size == zipStateSize(kind) &&
+             h->path_len == strlen(abs) && h->path_len <= (size_t) (end - p) && !memcmp(p, abs, h->path_len) &&
+             h->ncps > 0 && h->ncps < INT32_MAX;
+
+    free(abs);
+
+    struct zipStream *z = ok ? zipStreamNew(in, inlen, kind) : NULL;
+
+    if (ok) { p += h->path_len; }
+
+    for (uint64_t i = 0; ok && i < h->ncps; i++) {
+        struct zipCheckpointRecord r;
+
+        ok = (size_t) (end - p) >= sizeof(r) + h->state_size;
+
+        if (!ok) { break; }
+
+        memcpy(&r, p, sizeof(r));
+        p += sizeof(r);
+        ok = r.zlen >= 0 && r.wlen >= 0 && r.off >= (uint64_t) r.wlen && (size_t) (end - p) >= h->state_size + r.zlen;
+
+        if (!ok) { break; }
+
+        struct zipCheckpoint cp;
+        memset(&cp.state, 0, sizeof(cp.state));
+        memcpy(&cp.state, p, h->state_size);
+        p += h->state_size;
+        cp.off = r.off;
+        cp.wlen = r.wlen;
+        cp.zlen = r.zlen;
+        cp.window = r.zlen ? malloc(r.zlen) : NULL;
+
+        if (r.zlen) { memcpy(cp.window, p, r.zlen); }
+
+        p += r.zlen;
+
+        if (z->ncps == z->capcps) {
+            z->capcps = z->capcps ? z->capcps * 2 : 16;
+            z->cps = realloc(z->cps, sizeof(struct zipCheckpoint) * z->capcps);
+        }
+
+        z->cps[z->ncps++] = cp;
+    }
+
+    ok = ok && h->rows_bytes == (uint64_t) (end - p);
+
+    // Lines into chunks of about ZIP_CHUNK bytes, as the thread would have handed them over
+    c.rows_end = end;
+
+    const unsigned char *rp = p;
+    struct zipChunk chunk = {NULL, 0, 0, NULL, 0};
+    uint64_t off = 0, nrows = 0;
+    int size, strip, cap = 0;
+
+    while (ok && lineCacheNextRow(&c, &rp, &size, &strip)) {
+        if (chunk.nlines && (uint64_t) chunk.len + size + strip > ZIP_CHUNK) {
+            zipAddChunk(z, &chunk);
+            chunk.lines = NULL;
+            chunk.nlines = 0;
+            chunk.len = 0;
+            cap = 0;
+        }
+
+        if (chunk.nlines == 0) { chunk.off = off; }
+
+        if (chunk.nlines == cap) {
+            cap = cap ? cap * 2 : 256;
+            chunk.lines = realloc(chunk.lines, sizeof(struct zipLine) * cap);
+        }
+
+        chunk.lines[chunk.nlines].off = chunk.len;
+        chunk.lines[chunk.nlines++].size = size;
+        chunk.len += size + strip;
+        off += size + strip;
+        nrows++;
+    }
+
+    if (chunk.nlines) {
+        zipAddChunk(z, &chunk);
+    } else {
+        free(chunk.lines);
+    }
+
+    ok = ok && rp == end && off == h->out_len && nrows == h->nrows;
+    munmap((void *) map, maplen);
+
+    if (!ok) {
+        // The caller still owns the mapping
+        if (z) {
+            z->in = NULL;
+            zipStreamFree(z);
+        }
+
+        return NULL;
+    }
+
+    z->out_len = off;
+    z->nrows = nrows;
+    z->in_done = inlen;
+    z->indexed = 1;
+    z->done = 1;
+
+    return z;
+}